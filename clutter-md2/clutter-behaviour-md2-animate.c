@@ -29,8 +29,10 @@
 
 #include <clutter/clutter.h>
 #include <math.h>
+#include <string.h>
 
 #include "clutter-md2.h"
+#include "clutter-md2-private.h"
 #include "clutter-behaviour-md2-animate.h"
 
 G_DEFINE_TYPE (ClutterBehaviourMD2Animate,
@@ -41,6 +43,18 @@ struct _ClutterBehaviourMD2AnimatePrivate
 {
   gint frame_start;
   gint frame_end;
+
+  /* Name of the sequence to animate or NULL to use the frame
+     bounds. The sequence is looked up separately for each actor
+     because they may be using different models */
+  gchar *sequence;
+
+  /* The alpha value of the last tick so that actors that were skipped
+     because they weren't visible can catch up when they are painted */
+  gdouble alpha_value;
+
+  /* Number of actors that were updated and skipped on the last tick */
+  guint n_updated, n_skipped;
 };
 
 #define CLUTTER_BEHAVIOUR_MD2_ANIMATE_GET_PRIVATE(obj)                  \
@@ -53,54 +67,42 @@ enum
   PROP_0,
 
   PROP_FRAME_START,
-  PROP_FRAME_END
+  PROP_FRAME_END,
+  PROP_SEQUENCE
 };
 
 struct ForEachData
 {
   int frame_a, frame_b;
   gfloat interval;
-};
 
-static void
-alpha_notify_foreach (ClutterBehaviour *behaviour,
-                      ClutterActor     *actor,
-                      gpointer          user_data)
-{
-  struct ForEachData *data = (struct ForEachData *) user_data;
+  /* Used to look up the frames per actor when animating a sequence */
+  const gchar *sequence;
+  gdouble alpha_value;
 
-  if (CLUTTER_IS_MD2 (actor))
-    clutter_md2_set_sub_frame (CLUTTER_MD2 (actor),
-                               data->frame_a, data->frame_b,
-                               data->interval);
-}
+  /* If set then actors that won't be painted are skipped */
+  gboolean skip_hidden;
+  guint n_updated, n_skipped;
+};
 
 static void
-clutter_behaviour_md2_animate_alpha_notify (ClutterBehaviour *behaviour,
-                                            gdouble           alpha_value)
+clutter_behaviour_md2_animate_get_frames (gint                frame_start,
+                                          gint                frame_end,
+                                          gdouble             alpha_value,
+                                          struct ForEachData *data)
 {
-  ClutterBehaviourMD2Animate        *animate_behaviour;
-  ClutterBehaviourMD2AnimatePrivate *priv;
-  struct ForEachData                 data;
-
-  animate_behaviour = CLUTTER_BEHAVIOUR_MD2_ANIMATE (behaviour);
-  priv = animate_behaviour->priv;
-
-  if (priv->frame_start == priv->frame_end)
+  if (frame_start == frame_end)
     {
-      data.frame_a = priv->frame_start;
-      data.frame_b = priv->frame_end;
-      data.interval = 0.0f;
+      data->frame_a = frame_start;
+      data->frame_b = frame_end;
+      data->interval = 0.0f;
     }
   else
     {
       gfloat frac_frame;
-      gint frame_start, frame_end;
+      gint last_frame = frame_end;
       float int_part;
 
-      frame_start = priv->frame_start;
-      frame_end = priv->frame_end;
-
       if (frame_start > frame_end)
         {
           gint temp = frame_start;
@@ -111,19 +113,179 @@ clutter_behaviour_md2_animate_alpha_notify (ClutterBehaviour *behaviour,
 
       frac_frame = alpha_value * (frame_end - frame_start);
 
-      data.frame_a = frac_frame + frame_start;
+      data->frame_a = frac_frame + frame_start;
 
-      if (data.frame_a == priv->frame_end)
-        data.frame_b = data.frame_a;
+      if (data->frame_a == last_frame)
+        data->frame_b = data->frame_a;
       else
-        data.frame_b = data.frame_a + 1;
+        data->frame_b = data->frame_a + 1;
 
-      data.interval = modff (frac_frame, &int_part);
+      data->interval = modff (frac_frame, &int_part);
     }
+}
+
+static void clutter_behaviour_md2_animate_catch_up (ClutterMD2 *md2,
+                                                    gpointer    user_data);
+
+static void
+alpha_notify_foreach (ClutterBehaviour *behaviour,
+                      ClutterActor     *actor,
+                      gpointer          user_data)
+{
+  struct ForEachData *data = (struct ForEachData *) user_data;
+
+  if (!CLUTTER_IS_MD2 (actor))
+    return;
+
+  /* There is no point in updating actors that won't be painted. The
+     frame only depends on the alpha value so it can be worked out
+     again when the actor becomes visible */
+  if (data->skip_hidden
+      && !_clutter_md2_get_screen_size (CLUTTER_MD2 (actor), NULL))
+    {
+      _clutter_md2_set_catch_up (CLUTTER_MD2 (actor),
+                                 clutter_behaviour_md2_animate_catch_up,
+                                 behaviour);
+      data->n_skipped++;
+      return;
+    }
+
+  if (data->sequence)
+    {
+      ClutterMD2Data *md2_data = clutter_md2_get_data (CLUTTER_MD2 (actor));
+      gint frame_start, frame_end;
+
+      /* Leave actors whose model doesn't have the sequence alone */
+      if (md2_data == NULL
+          || !clutter_md2_data_get_sequence (md2_data, data->sequence,
+                                             &frame_start, &frame_end,
+                                             NULL))
+        return;
+
+      clutter_behaviour_md2_animate_get_frames (frame_start, frame_end,
+                                                data->alpha_value, data);
+    }
+
+  data->n_updated++;
+
+  clutter_md2_set_sub_frame (CLUTTER_MD2 (actor),
+                             data->frame_a, data->frame_b,
+                             data->interval);
+}
+
+static void
+clutter_behaviour_md2_animate_alpha_notify (ClutterBehaviour *behaviour,
+                                            gdouble           alpha_value)
+{
+  ClutterBehaviourMD2Animate        *animate_behaviour;
+  ClutterBehaviourMD2AnimatePrivate *priv;
+  struct ForEachData                 data;
+
+  animate_behaviour = CLUTTER_BEHAVIOUR_MD2_ANIMATE (behaviour);
+  priv = animate_behaviour->priv;
+
+  data.sequence = priv->sequence;
+  data.alpha_value = alpha_value;
+  data.skip_hidden = TRUE;
+  data.n_updated = 0;
+  data.n_skipped = 0;
+
+  priv->alpha_value = alpha_value;
+
+  if (priv->sequence == NULL)
+    clutter_behaviour_md2_animate_get_frames (priv->frame_start,
+                                              priv->frame_end,
+                                              alpha_value,
+                                              &data);
 
   clutter_behaviour_actors_foreach (behaviour,
                                     alpha_notify_foreach,
                                     &data);
+
+  priv->n_updated = data.n_updated;
+  priv->n_skipped = data.n_skipped;
+}
+
+static void
+clutter_behaviour_md2_animate_catch_up (ClutterMD2 *md2,
+                                        gpointer    user_data)
+{
+  ClutterBehaviour *behaviour = CLUTTER_BEHAVIOUR (user_data);
+  ClutterBehaviourMD2AnimatePrivate *priv;
+  struct ForEachData data;
+
+  priv = CLUTTER_BEHAVIOUR_MD2_ANIMATE (behaviour)->priv;
+
+  /* The actor is about to be painted so bring it up to date with the
+     last tick in case it was skipped */
+  data.sequence = priv->sequence;
+  data.alpha_value = priv->alpha_value;
+  data.skip_hidden = FALSE;
+  data.n_updated = 0;
+  data.n_skipped = 0;
+
+  if (priv->sequence == NULL)
+    clutter_behaviour_md2_animate_get_frames (priv->frame_start,
+                                              priv->frame_end,
+                                              priv->alpha_value,
+                                              &data);
+
+  alpha_notify_foreach (behaviour, CLUTTER_ACTOR (md2), &data);
+}
+
+static void
+clutter_behaviour_md2_animate_removed (ClutterBehaviour *behaviour,
+                                       ClutterActor     *actor)
+{
+  if (CLUTTER_IS_MD2 (actor))
+    _clutter_md2_cancel_catch_up (CLUTTER_MD2 (actor), behaviour);
+}
+
+static void
+clutter_behaviour_md2_animate_finalize (GObject *object)
+{
+  ClutterBehaviourMD2Animate *animate = CLUTTER_BEHAVIOUR_MD2_ANIMATE (object);
+
+  g_free (animate->priv->sequence);
+
+  G_OBJECT_CLASS (clutter_behaviour_md2_animate_parent_class)
+    ->finalize (object);
+}
+
+/* Used by both set_bounds and the frame properties so that setting the
+   bounds either way stops animating the sequence */
+static void
+clutter_behaviour_md2_animate_update_bounds
+                                  (ClutterBehaviourMD2Animate *animate,
+                                   gint                        frame_start,
+                                   gint                        frame_end)
+{
+  ClutterBehaviourMD2AnimatePrivate *priv;
+
+  priv = animate->priv;
+
+  g_object_ref (animate);
+  g_object_freeze_notify (G_OBJECT (animate));
+
+  if (priv->frame_start != frame_start)
+    {
+      priv->frame_start = frame_start;
+
+      g_object_notify (G_OBJECT (animate), "frame-start");
+    }
+
+  if (priv->frame_end != frame_end)
+    {
+      priv->frame_end = frame_end;
+
+      g_object_notify (G_OBJECT (animate), "frame-end");
+    }
+
+  /* Explicit bounds replace any sequence */
+  clutter_behaviour_md2_animate_set_sequence (animate, NULL);
+
+  g_object_thaw_notify (G_OBJECT (animate));
+  g_object_unref (animate);
 }
 
 static void
@@ -141,10 +303,18 @@ clutter_behaviour_md2_animate_set_property (GObject      *gobject,
   switch (prop_id)
     {
     case PROP_FRAME_START:
-      priv->frame_start = g_value_get_int (value);
+      clutter_behaviour_md2_animate_update_bounds (animate,
+                                                   g_value_get_int (value),
+                                                   priv->frame_end);
       break;
     case PROP_FRAME_END:
-      priv->frame_end = g_value_get_int (value);
+      clutter_behaviour_md2_animate_update_bounds (animate,
+                                                   priv->frame_start,
+                                                   g_value_get_int (value));
+      break;
+    case PROP_SEQUENCE:
+      clutter_behaviour_md2_animate_set_sequence (animate,
+                                                  g_value_get_string (value));
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (gobject, prop_id, pspec);
@@ -170,6 +340,9 @@ clutter_behaviour_md2_animate_get_property (GObject    *gobject,
     case PROP_FRAME_END:
       g_value_set_int (value, priv->frame_end);
       break;
+    case PROP_SEQUENCE:
+      g_value_set_string (value, priv->sequence);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (gobject, prop_id, pspec);
       break;
@@ -185,8 +358,10 @@ clutter_behaviour_md2_animate_class_init (ClutterBehaviourMD2AnimateClass
 
   gobject_class->set_property = clutter_behaviour_md2_animate_set_property;
   gobject_class->get_property = clutter_behaviour_md2_animate_get_property;
+  gobject_class->finalize = clutter_behaviour_md2_animate_finalize;
 
   behaviour_class->alpha_notify = clutter_behaviour_md2_animate_alpha_notify;
+  behaviour_class->removed = clutter_behaviour_md2_animate_removed;
 
   g_object_class_install_property
     (gobject_class, PROP_FRAME_START,
@@ -208,6 +383,15 @@ clutter_behaviour_md2_animate_class_init (ClutterBehaviourMD2AnimateClass
                        0,
                        G_PARAM_READABLE | G_PARAM_WRITABLE));
 
+  g_object_class_install_property
+    (gobject_class, PROP_SEQUENCE,
+     g_param_spec_string ("sequence",
+                          "Sequence",
+                          "Name of the animation sequence to play instead "
+                          "of the frame bounds",
+                          NULL,
+                          G_PARAM_READABLE | G_PARAM_WRITABLE));
+
   g_type_class_add_private (klass, sizeof (ClutterBehaviourMD2AnimatePrivate));
 }
 
@@ -220,6 +404,10 @@ clutter_behaviour_md2_animate_init (ClutterBehaviourMD2Animate *animate)
 
   priv->frame_start = 0;
   priv->frame_end = 0;
+  priv->sequence = NULL;
+  priv->alpha_value = 0.0;
+  priv->n_updated = 0;
+  priv->n_skipped = 0;
 }
 
 ClutterBehaviour *
@@ -236,6 +424,19 @@ clutter_behaviour_md2_animate_new (ClutterAlpha *alpha,
                        NULL);
 }
 
+ClutterBehaviour *
+clutter_behaviour_md2_animate_new_for_sequence (ClutterAlpha *alpha,
+                                                const gchar  *sequence)
+{
+  g_return_val_if_fail (alpha == NULL || CLUTTER_IS_ALPHA (alpha), NULL);
+  g_return_val_if_fail (sequence != NULL, NULL);
+
+  return g_object_new (CLUTTER_TYPE_BEHAVIOUR_MD2_ANIMATE,
+                       "alpha", alpha,
+                       "sequence", sequence,
+                       NULL);
+}
+
 void
 clutter_behaviour_md2_animate_get_bounds (ClutterBehaviourMD2Animate *animate,
                                           gint                     *frame_start,
@@ -258,6 +459,16 @@ void
 clutter_behaviour_md2_animate_set_bounds (ClutterBehaviourMD2Animate *animate,
                                           gint                      frame_start,
                                           gint                      frame_end)
+{
+  g_return_if_fail (CLUTTER_IS_BEHAVIOUR_MD2_ANIMATE (animate));
+
+  clutter_behaviour_md2_animate_update_bounds (animate, frame_start, frame_end);
+}
+
+void
+clutter_behaviour_md2_animate_set_sequence
+                                  (ClutterBehaviourMD2Animate *animate,
+                                   const gchar                *sequence)
 {
   ClutterBehaviourMD2AnimatePrivate *priv;
 
@@ -265,23 +476,35 @@ clutter_behaviour_md2_animate_set_bounds (ClutterBehaviourMD2Animate *animate,
 
   priv = animate->priv;
 
-  g_object_ref (animate);
-  g_object_freeze_notify (G_OBJECT (animate));
+  if (priv->sequence == sequence
+      || (priv->sequence && sequence && !strcmp (priv->sequence, sequence)))
+    return;
 
-  if (priv->frame_start != frame_start)
-    {
-      priv->frame_start = frame_start;
+  g_free (priv->sequence);
+  priv->sequence = g_strdup (sequence);
 
-      g_object_notify (G_OBJECT (animate), "frame-start");
-    }
+  g_object_notify (G_OBJECT (animate), "sequence");
+}
 
-  if (priv->frame_end != frame_end)
-    {
-      priv->frame_end = frame_end;
+const gchar *
+clutter_behaviour_md2_animate_get_sequence
+                                  (ClutterBehaviourMD2Animate *animate)
+{
+  g_return_val_if_fail (CLUTTER_IS_BEHAVIOUR_MD2_ANIMATE (animate), NULL);
 
-      g_object_notify (G_OBJECT (animate), "frame-end");
-    }
+  return animate->priv->sequence;
+}
 
-  g_object_thaw_notify (G_OBJECT (animate));
-  g_object_unref (animate);
+void
+clutter_behaviour_md2_animate_get_tick_stats
+                                  (ClutterBehaviourMD2Animate *animate,
+                                   guint                      *n_updated,
+                                   guint                      *n_skipped)
+{
+  g_return_if_fail (CLUTTER_IS_BEHAVIOUR_MD2_ANIMATE (animate));
+
+  if (n_updated)
+    *n_updated = animate->priv->n_updated;
+  if (n_skipped)
+    *n_skipped = animate->priv->n_skipped;
 }
@@ -69,6 +69,10 @@ ClutterBehaviour *clutter_behaviour_md2_animate_new (ClutterAlpha *alpha,
                                                      gint          frame_start,
                                                      gint          frame_end);
 
+ClutterBehaviour *clutter_behaviour_md2_animate_new_for_sequence
+(ClutterAlpha *alpha,
+ const gchar  *sequence);
+
 void clutter_behaviour_md2_animate_get_bounds
 (ClutterBehaviourMD2Animate *md2_animate,
  gint                       *frame_start,
@@ -79,6 +83,18 @@ void clutter_behaviour_md2_animate_set_bounds
  gint                        frame_start,
  gint                        frame_end);
 
+void clutter_behaviour_md2_animate_set_sequence
+(ClutterBehaviourMD2Animate *md2_animate,
+ const gchar                *sequence);
+
+const gchar *clutter_behaviour_md2_animate_get_sequence
+(ClutterBehaviourMD2Animate *md2_animate);
+
+void clutter_behaviour_md2_animate_get_tick_stats
+(ClutterBehaviourMD2Animate *md2_animate,
+ guint                      *n_updated,
+ guint                      *n_skipped);
+
 G_END_DECLS
 
 #endif /* __CLUTTER_BEHAVIOUR_MD2_ANIMATE_H__ */
@@ -0,0 +1,636 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib-object.h>
+#include <clutter/clutter.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "clutter-md2-data.h"
+#include "clutter-md2-data-private.h"
+
+/* Instead of storing every frame, the vertex positions of all of the
+   frames are stored as a mean pose plus a weighted sum of a small
+   number of basis poses found by principal component analysis. Each
+   frame then only needs one coefficient per basis pose. Interpolating
+   between frames is done by blending the coefficients so a frame is
+   only rebuilt once per paint no matter how many frames are blended.
+
+   The principal components are the eigenvectors of the covariance of
+   the frames. Only the largest few are needed so they are found with
+   subspace iteration on whichever of the frame-by-frame or the
+   coordinate-by-coordinate product matrix is smaller */
+
+/* Number of extra vectors to iterate beyond the basis size. This
+   speeds up convergence of the last few vectors that are kept */
+#define CLUTTER_MD2_BASIS_OVERSAMPLE  8
+#define CLUTTER_MD2_BASIS_ITERATIONS  16
+/* Maximum number of sweeps for the Jacobi eigenvalue solver */
+#define CLUTTER_MD2_BASIS_MAX_SWEEPS  50
+
+/* Adds weight times row to the positions */
+#ifdef __SSE2__
+
+static void
+clutter_md2_basis_accumulate (float *positions,
+                              const float *row,
+                              float weight,
+                              int n)
+{
+  __m128 w = _mm_set1_ps (weight);
+  int i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    _mm_storeu_ps (positions + i,
+                   _mm_add_ps (_mm_loadu_ps (positions + i),
+                               _mm_mul_ps (_mm_loadu_ps (row + i), w)));
+
+  for (; i < n; i++)
+    positions[i] += row[i] * weight;
+}
+
+#else /* __SSE2__ */
+
+static void
+clutter_md2_basis_accumulate (float *positions,
+                              const float *row,
+                              float weight,
+                              int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    positions[i] += row[i] * weight;
+}
+
+#endif /* __SSE2__ */
+
+/* Makes the columns of the m by n column-major matrix orthonormal
+   with modified Gram-Schmidt. Columns that become degenerate are
+   replaced with zeros */
+static void
+clutter_md2_basis_orthonormalize (double *q, int m, int n)
+{
+  int i, j, k;
+
+  for (j = 0; j < n; j++)
+    {
+      double *col = q + j * m;
+      double norm = 0.0;
+
+      for (k = 0; k < j; k++)
+        {
+          const double *prev = q + k * m;
+          double dot = 0.0;
+
+          for (i = 0; i < m; i++)
+            dot += prev[i] * col[i];
+          for (i = 0; i < m; i++)
+            col[i] -= prev[i] * dot;
+        }
+
+      for (i = 0; i < m; i++)
+        norm += col[i] * col[i];
+
+      norm = sqrt (norm);
+
+      for (i = 0; i < m; i++)
+        col[i] = norm > 1e-12 ? col[i] / norm : 0.0;
+    }
+}
+
+/* Diagonalizes the n by n symmetric matrix a in place with the cyclic
+   Jacobi method. The eigenvectors are accumulated into the columns
+   of v */
+static void
+clutter_md2_basis_jacobi (double *a, double *v, int n)
+{
+  int sweep, p, q, i;
+
+  for (i = 0; i < n * n; i++)
+    v[i] = (i / n == i % n) ? 1.0 : 0.0;
+
+  for (sweep = 0; sweep < CLUTTER_MD2_BASIS_MAX_SWEEPS; sweep++)
+    {
+      double off = 0.0, diag = 0.0;
+
+      for (p = 0; p < n; p++)
+        {
+          diag += a[p * n + p] * a[p * n + p];
+          for (q = p + 1; q < n; q++)
+            off += a[p * n + q] * a[p * n + q];
+        }
+
+      if (off <= diag * 1e-24)
+        break;
+
+      for (p = 0; p < n; p++)
+        for (q = p + 1; q < n; q++)
+          {
+            double apq = a[p * n + q], theta, t, c, s;
+
+            if (apq == 0.0)
+              continue;
+
+            theta = (a[q * n + q] - a[p * n + p]) / (2.0 * apq);
+            t = (theta >= 0.0 ? 1.0 : -1.0)
+              / (fabs (theta) + sqrt (theta * theta + 1.0));
+            c = 1.0 / sqrt (t * t + 1.0);
+            s = t * c;
+
+            for (i = 0; i < n; i++)
+              {
+                double aip = a[i * n + p], aiq = a[i * n + q];
+
+                a[i * n + p] = c * aip - s * aiq;
+                a[i * n + q] = s * aip + c * aiq;
+              }
+            for (i = 0; i < n; i++)
+              {
+                double api = a[p * n + i], aqi = a[q * n + i];
+
+                a[p * n + i] = c * api - s * aqi;
+                a[q * n + i] = s * api + c * aqi;
+              }
+            for (i = 0; i < n; i++)
+              {
+                double vip = v[i * n + p], viq = v[i * n + q];
+
+                v[i * n + p] = c * vip - s * viq;
+                v[i * n + q] = s * vip + c * viq;
+              }
+          }
+    }
+}
+
+/* Finds the n_vectors largest eigenvectors of the m by m symmetric
+   matrix s and returns them as the columns of a column-major
+   matrix */
+static double *
+clutter_md2_basis_get_eigenvectors (const double *s, int m, int n_vectors)
+{
+  int p = MIN (n_vectors + CLUTTER_MD2_BASIS_OVERSAMPLE, m);
+  double *q = g_new (double, m * p);
+  double *z = g_new (double, m * p);
+  double *h = g_new (double, p * p);
+  double *w = g_new (double, p * p);
+  double *result;
+  int *order;
+  GRand *rand;
+  int iteration, i, j, k;
+
+  /* Start from a fixed random subspace so that loading the same model
+     always gives the same result */
+  rand = g_rand_new_with_seed (1);
+  for (i = 0; i < m * p; i++)
+    q[i] = g_rand_double_range (rand, -1.0, 1.0);
+  g_rand_free (rand);
+
+  clutter_md2_basis_orthonormalize (q, m, p);
+
+  for (iteration = 0; iteration < CLUTTER_MD2_BASIS_ITERATIONS; iteration++)
+    {
+      double *tmp;
+
+      for (j = 0; j < p; j++)
+        for (i = 0; i < m; i++)
+          {
+            const double *row = s + i * m;
+            const double *col = q + j * m;
+            double sum = 0.0;
+
+            for (k = 0; k < m; k++)
+              sum += row[k] * col[k];
+
+            z[j * m + i] = sum;
+          }
+
+      clutter_md2_basis_orthonormalize (z, m, p);
+
+      tmp = q;
+      q = z;
+      z = tmp;
+    }
+
+  /* Rotate the subspace so that the vectors are in order of
+     importance by diagonalizing the projection of s onto it */
+  for (j = 0; j < p; j++)
+    for (i = 0; i < m; i++)
+      {
+        const double *row = s + i * m;
+        const double *col = q + j * m;
+        double sum = 0.0;
+
+        for (k = 0; k < m; k++)
+          sum += row[k] * col[k];
+
+        z[j * m + i] = sum;
+      }
+
+  for (i = 0; i < p; i++)
+    for (j = 0; j < p; j++)
+      {
+        double sum = 0.0;
+
+        for (k = 0; k < m; k++)
+          sum += q[i * m + k] * z[j * m + k];
+
+        h[i * p + j] = sum;
+      }
+
+  clutter_md2_basis_jacobi (h, w, p);
+
+  /* Sort the eigenvalues in descending order */
+  order = g_new (int, p);
+  for (i = 0; i < p; i++)
+    order[i] = i;
+  for (i = 1; i < p; i++)
+    for (j = i; j > 0 && (h[order[j] * p + order[j]]
+                          > h[order[j - 1] * p + order[j - 1]]); j--)
+      {
+        int tmp = order[j];
+        order[j] = order[j - 1];
+        order[j - 1] = tmp;
+      }
+
+  result = g_new0 (double, m * n_vectors);
+
+  for (j = 0; j < n_vectors; j++)
+    for (k = 0; k < p; k++)
+      {
+        double weight = w[k * p + order[j]];
+
+        for (i = 0; i < m; i++)
+          result[j * m + i] += q[k * m + i] * weight;
+      }
+
+  g_free (order);
+  g_free (w);
+  g_free (h);
+  g_free (z);
+  g_free (q);
+
+  return result;
+}
+
+/* Returns the largest distance between a vertex in the residual and
+   its original position */
+static float
+clutter_md2_basis_get_max_error (const float *residual, int n)
+{
+  float max_error = 0.0f;
+  int i;
+
+  for (i = 0; i < n; i += 3)
+    {
+      float error = (residual[i] * residual[i]
+                     + residual[i + 1] * residual[i + 1]
+                     + residual[i + 2] * residual[i + 2]);
+
+      if (error > max_error)
+        max_error = error;
+    }
+
+  return sqrt (max_error);
+}
+
+gboolean
+_clutter_md2_data_build_basis (ClutterMD2Data *data)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  int n_frames = priv->num_frames;
+  int n_vertices = priv->num_vertices;
+  int n_coords = n_vertices * 3;
+  int m, max_size, basis_size = 0;
+  gboolean use_gram;
+  gsize raw_size, basis_bytes;
+  double *mean, *s, *eigenvectors;
+  float *x, *basis, *coefficients;
+  float max_error = 0.0f;
+  int f, i, j, k;
+
+  if (priv->basis_tolerance < 0.0f || n_frames < 2 || n_vertices < 1)
+    return FALSE;
+
+  /* Gather the positions of every frame into one row each and
+     subtract the mean pose */
+  x = g_new (float, n_frames * n_coords);
+  mean = g_new0 (double, n_coords);
+
+  for (f = 0; f < n_frames; f++)
+    {
+      const ClutterMD2DataFrame *frame = priv->frames[f];
+      float *row = x + f * n_coords;
+
+      for (i = 0; i < n_vertices; i++)
+        for (j = 0; j < 3; j++)
+          {
+            row[i * 3 + j] = (frame->vertices[i * 4 + j] * frame->scale[j]
+                              + frame->translate[j]);
+            mean[i * 3 + j] += row[i * 3 + j];
+          }
+    }
+
+  for (i = 0; i < n_coords; i++)
+    mean[i] /= n_frames;
+
+  for (f = 0; f < n_frames; f++)
+    for (i = 0; i < n_coords; i++)
+      x[f * n_coords + i] -= mean[i];
+
+  /* With fewer frames than coordinates the eigenvectors of the
+     frame-by-frame product are found instead and mapped back to
+     coordinates afterwards */
+  use_gram = n_frames <= n_coords;
+  m = use_gram ? n_frames : n_coords;
+  max_size = MIN (priv->max_basis_size, m);
+
+  s = g_new0 (double, m * m);
+
+  if (use_gram)
+    {
+      for (i = 0; i < n_frames; i++)
+        for (j = i; j < n_frames; j++)
+          {
+            const float *a = x + i * n_coords, *b = x + j * n_coords;
+            double sum = 0.0;
+
+            for (k = 0; k < n_coords; k++)
+              sum += a[k] * b[k];
+
+            s[i * m + j] = s[j * m + i] = sum;
+          }
+    }
+  else
+    {
+      for (f = 0; f < n_frames; f++)
+        {
+          const float *row = x + f * n_coords;
+
+          for (i = 0; i < n_coords; i++)
+            if (row[i] != 0.0f)
+              for (j = i; j < n_coords; j++)
+                s[i * m + j] += row[i] * row[j];
+        }
+
+      for (i = 0; i < n_coords; i++)
+        for (j = 0; j < i; j++)
+          s[i * m + j] = s[j * m + i];
+    }
+
+  eigenvectors = clutter_md2_basis_get_eigenvectors (s, m, max_size);
+  g_free (s);
+
+  basis = g_new0 (float, max_size * n_coords);
+
+  for (k = 0; k < max_size; k++)
+    {
+      float *row = basis + k * n_coords;
+      const double *vector = eigenvectors + k * m;
+      double norm = 0.0;
+
+      if (use_gram)
+        for (f = 0; f < n_frames; f++)
+          clutter_md2_basis_accumulate (row, x + f * n_coords, vector[f],
+                                        n_coords);
+      else
+        for (i = 0; i < n_coords; i++)
+          row[i] = vector[i];
+
+      for (i = 0; i < n_coords; i++)
+        norm += row[i] * row[i];
+
+      /* The rest of the vectors are only noise once the frames are
+         fully described */
+      if (norm < 1e-12)
+        {
+          max_size = k;
+          break;
+        }
+
+      norm = sqrt (norm);
+      for (i = 0; i < n_coords; i++)
+        row[i] /= norm;
+    }
+
+  g_free (eigenvectors);
+
+  /* Project every frame onto the basis and then pick the smallest
+     number of vectors that brings every vertex within the tolerance
+     by subtracting one vector at a time from the centered frames */
+  coefficients = g_new (float, MAX (n_frames * max_size, 1));
+
+  for (f = 0; f < n_frames; f++)
+    for (k = 0; k < max_size; k++)
+      {
+        const float *row = x + f * n_coords, *vector = basis + k * n_coords;
+        double sum = 0.0;
+
+        for (i = 0; i < n_coords; i++)
+          sum += row[i] * vector[i];
+
+        coefficients[f * max_size + k] = sum;
+      }
+
+  for (k = 0; k < max_size && basis_size == 0; k++)
+    {
+      max_error = 0.0f;
+
+      for (f = 0; f < n_frames; f++)
+        {
+          float *row = x + f * n_coords;
+          float error;
+
+          clutter_md2_basis_accumulate (row, basis + k * n_coords,
+                                        -coefficients[f * max_size + k],
+                                        n_coords);
+
+          error = clutter_md2_basis_get_max_error (row, n_coords);
+          if (error > max_error)
+            max_error = error;
+        }
+
+      if (max_error <= priv->basis_tolerance)
+        basis_size = k + 1;
+    }
+
+  g_free (x);
+
+  raw_size = (gsize) n_frames * n_vertices * 4;
+  basis_bytes = (sizeof (float) * ((gsize) n_coords * (basis_size + 1)
+                                   + (gsize) n_frames * basis_size)
+                 + (gsize) n_frames * n_vertices);
+
+  /* Keep the frames as they are if the tolerance can't be met or the
+     basis wouldn't be any smaller */
+  if (basis_size == 0 || basis_bytes >= raw_size)
+    {
+      g_free (coefficients);
+      g_free (basis);
+      g_free (mean);
+
+      return FALSE;
+    }
+
+  priv->basis_size = basis_size;
+
+  priv->basis_mean = g_new (float, n_coords);
+  for (i = 0; i < n_coords; i++)
+    priv->basis_mean[i] = mean[i];
+  g_free (mean);
+
+  priv->basis = g_realloc (basis, sizeof (float) * n_coords * basis_size);
+
+  priv->basis_coefficients = g_new (float, n_frames * basis_size);
+  for (f = 0; f < n_frames; f++)
+    memcpy (priv->basis_coefficients + f * basis_size,
+            coefficients + f * max_size,
+            sizeof (float) * basis_size);
+  g_free (coefficients);
+
+  priv->basis_positions = g_new (float, n_coords);
+
+  /* The normals are an index into a table so they are kept as they
+     are. The rest of each frame can be freed */
+  priv->basis_normals = g_malloc (n_frames * n_vertices);
+
+  for (f = 0; f < n_frames; f++)
+    {
+      ClutterMD2DataFrame *frame = priv->frames[f];
+      guchar *normals = priv->basis_normals + f * n_vertices;
+
+      for (i = 0; i < n_vertices; i++)
+        normals[i] = frame->vertices[i * 4 + 3];
+
+      /* Only the header is left. It may move, which is safe because
+         the frame name table has its own copies of the names */
+      frame = g_realloc (frame,
+                         G_STRUCT_OFFSET (ClutterMD2DataFrame, vertex_data));
+      frame->vertices = NULL;
+      priv->frames[f] = frame;
+    }
+
+  priv->num_keyframes = 0;
+  priv->frame_bytes_saved = raw_size - basis_bytes;
+  priv->frame_max_error = max_error;
+
+  return TRUE;
+}
+
+void
+_clutter_md2_data_free_basis (ClutterMD2Data *data)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+
+  g_free (priv->basis_mean);
+  g_free (priv->basis);
+  g_free (priv->basis_coefficients);
+  g_free (priv->basis_normals);
+  g_free (priv->basis_positions);
+
+  priv->basis_mean = NULL;
+  priv->basis = NULL;
+  priv->basis_coefficients = NULL;
+  priv->basis_normals = NULL;
+  priv->basis_positions = NULL;
+  priv->basis_size = 0;
+}
+
+void
+_clutter_md2_data_get_basis_positions (ClutterMD2Data *data,
+                                       gint            n_frames,
+                                       const gint     *frame_nums,
+                                       const gfloat   *weights,
+                                       gfloat         *positions)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  int n_coords = priv->num_vertices * 3;
+  float coefficients[CLUTTER_MD2_DATA_MAX_BASIS_SIZE];
+  float total_weight = 0.0f;
+  int i, k;
+
+  /* Blend the coefficients first so that the basis only has to be
+     walked once */
+  memset (coefficients, 0, sizeof (float) * priv->basis_size);
+
+  for (i = 0; i < n_frames; i++)
+    {
+      const float *frame_coefficients
+        = priv->basis_coefficients + frame_nums[i] * priv->basis_size;
+
+      for (k = 0; k < priv->basis_size; k++)
+        coefficients[k] += frame_coefficients[k] * weights[i];
+
+      total_weight += weights[i];
+    }
+
+  memset (positions, 0, sizeof (float) * n_coords);
+  clutter_md2_basis_accumulate (positions, priv->basis_mean, total_weight,
+                                n_coords);
+
+  for (k = 0; k < priv->basis_size; k++)
+    if (coefficients[k] != 0.0f)
+      clutter_md2_basis_accumulate (positions, priv->basis + k * n_coords,
+                                    coefficients[k], n_coords);
+}
+
+void
+_clutter_md2_data_rebuild_basis_frame (ClutterMD2Data *data,
+                                       gint            frame_num,
+                                       guchar         *vertices)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  const ClutterMD2DataFrame *frame = priv->frames[frame_num];
+  const guchar *normals = priv->basis_normals + frame_num * priv->num_vertices;
+  float weight = 1.0f;
+  int i, j;
+
+  _clutter_md2_data_get_basis_positions (data, 1, &frame_num, &weight,
+                                         priv->basis_positions);
+
+  /* Quantize back to the frame's own scale and translation */
+  for (i = 0; i < priv->num_vertices; i++)
+    {
+      for (j = 0; j < 3; j++)
+        {
+          float v = priv->basis_positions[i * 3 + j];
+
+          if (frame->scale[j] == 0.0f)
+            v = 0.0f;
+          else
+            v = floor ((v - frame->translate[j]) / frame->scale[j] + 0.5);
+
+          vertices[i * 4 + j] = CLAMP (v, 0.0f, 255.0f);
+        }
+
+      vertices[i * 4 + 3] = normals[i];
+    }
+}
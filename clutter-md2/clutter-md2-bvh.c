@@ -0,0 +1,519 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib-object.h>
+#include <clutter/clutter.h>
+#include <string.h>
+#include <float.h>
+
+#include "clutter-md2-data.h"
+#include "clutter-md2-data-private.h"
+
+/* Maximum number of triangles in a leaf node */
+#define CLUTTER_MD2_BVH_LEAF_SIZE   4
+/* The tree is built by splitting the triangles in half so it can
+   never be deeper than this for the number of triangles allowed in
+   an MD2 file */
+#define CLUTTER_MD2_BVH_MAX_DEPTH   64
+
+typedef struct _ClutterMD2DataBvhNode ClutterMD2DataBvhNode;
+
+/* The nodes are stored in depth-first order so the left child of an
+   interior node always immediately follows it */
+struct _ClutterMD2DataBvhNode
+{
+  /* For a leaf this is the index of the first triangle in
+     tri_order. For an interior node it is the index of the right
+     child */
+  guint32 offset;
+  /* Number of triangles in a leaf or 0 for an interior node */
+  guint32 count;
+};
+
+/* The topology of the tree is built once from the first frame. The
+   bounding boxes are then refitted for each frame the first time a
+   ray is cast against it. For a sub-frame the boxes of the two
+   frames are interpolated. Because every vertex is interpolated
+   linearly the interpolated boxes are guaranteed to contain the
+   interpolated triangles so no extra refit is needed */
+struct _ClutterMD2DataBvh
+{
+  int num_nodes;
+  ClutterMD2DataBvhNode *nodes;
+  guint32 *tri_order;
+
+  /* Six floats per node (min x,y,z then max x,y,z) for each frame or
+     NULL if the frame hasn't been fitted yet */
+  int num_frames;
+  float **frame_bounds;
+};
+
+typedef struct
+{
+  const float *centroids;
+  int axis;
+} ClutterMD2DataBvhSortData;
+
+static void
+clutter_md2_bvh_get_vertex (const ClutterMD2DataFrame *frame,
+                            const guchar *vertices,
+                            guint32 vertex_num,
+                            float *pos)
+{
+  const guchar *vertex = vertices + vertex_num * 4;
+
+  pos[0] = vertex[0] * frame->scale[0] + frame->translate[0];
+  pos[1] = vertex[1] * frame->scale[1] + frame->translate[1];
+  pos[2] = vertex[2] * frame->scale[2] + frame->translate[2];
+}
+
+static gint
+clutter_md2_bvh_compare_centroids (gconstpointer a,
+                                   gconstpointer b,
+                                   gpointer user_data)
+{
+  const ClutterMD2DataBvhSortData *sort_data = user_data;
+  float ca = sort_data->centroids[*(const guint32 *) a * 3 + sort_data->axis];
+  float cb = sort_data->centroids[*(const guint32 *) b * 3 + sort_data->axis];
+
+  return ca < cb ? -1 : ca > cb ? 1 : 0;
+}
+
+static int
+clutter_md2_bvh_build_node (ClutterMD2DataBvh *bvh,
+                            const float *centroids,
+                            int start, int end)
+{
+  int node_num = bvh->num_nodes++;
+  ClutterMD2DataBvhNode *node = bvh->nodes + node_num;
+
+  if (end - start <= CLUTTER_MD2_BVH_LEAF_SIZE)
+    {
+      node->offset = start;
+      node->count = end - start;
+    }
+  else
+    {
+      ClutterMD2DataBvhSortData sort_data;
+      float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+      float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+      int i, j, mid;
+
+      /* Split along the axis where the centroids are most spread
+         out */
+      for (i = start; i < end; i++)
+        for (j = 0; j < 3; j++)
+          {
+            float c = centroids[bvh->tri_order[i] * 3 + j];
+
+            if (c < min[j])
+              min[j] = c;
+            if (c > max[j])
+              max[j] = c;
+          }
+
+      sort_data.centroids = centroids;
+      sort_data.axis = 0;
+      for (j = 1; j < 3; j++)
+        if (max[j] - min[j] > max[sort_data.axis] - min[sort_data.axis])
+          sort_data.axis = j;
+
+      g_qsort_with_data (bvh->tri_order + start, end - start,
+                         sizeof (guint32),
+                         clutter_md2_bvh_compare_centroids,
+                         &sort_data);
+
+      mid = (start + end) / 2;
+
+      /* The node array is allocated up front so the node pointer
+         stays valid while the children are built */
+      node->count = 0;
+      clutter_md2_bvh_build_node (bvh, centroids, start, mid);
+      node->offset = clutter_md2_bvh_build_node (bvh, centroids, mid, end);
+    }
+
+  return node_num;
+}
+
+static ClutterMD2DataBvh *
+clutter_md2_bvh_new (ClutterMD2Data *data)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  ClutterMD2DataBvh *bvh = g_slice_new (ClutterMD2DataBvh);
+  const guchar *vertices;
+  float *centroids;
+  int i, j;
+
+  /* A binary tree with at least one triangle per leaf can never have
+     more than twice as many nodes as triangles */
+  bvh->num_nodes = 0;
+  bvh->nodes = g_new (ClutterMD2DataBvhNode,
+                      MAX (priv->num_triangles, 1) * 2);
+  bvh->tri_order = g_new (guint32, MAX (priv->num_triangles, 1));
+  bvh->num_frames = priv->num_frames;
+  bvh->frame_bounds = g_new0 (float *, priv->num_frames);
+
+  centroids = g_new (float, MAX (priv->num_triangles, 1) * 3);
+
+  vertices = _clutter_md2_data_get_frame_vertices (data, 0);
+
+  for (i = 0; i < priv->num_triangles; i++)
+    {
+      float pos[3];
+
+      centroids[i * 3 + 0] = 0.0f;
+      centroids[i * 3 + 1] = 0.0f;
+      centroids[i * 3 + 2] = 0.0f;
+
+      for (j = 0; j < 3; j++)
+        {
+          clutter_md2_bvh_get_vertex (priv->frames[0], vertices,
+                                      priv->triangles[i * 3 + j],
+                                      pos);
+          centroids[i * 3 + 0] += pos[0] / 3.0f;
+          centroids[i * 3 + 1] += pos[1] / 3.0f;
+          centroids[i * 3 + 2] += pos[2] / 3.0f;
+        }
+
+      bvh->tri_order[i] = i;
+    }
+
+  clutter_md2_bvh_build_node (bvh, centroids, 0, priv->num_triangles);
+
+  g_free (centroids);
+
+  return bvh;
+}
+
+void
+_clutter_md2_data_free_bvh (ClutterMD2Data *data)
+{
+  ClutterMD2DataBvh *bvh = data->priv->bvh;
+
+  if (bvh)
+    {
+      int i;
+
+      for (i = 0; i < bvh->num_frames; i++)
+        g_free (bvh->frame_bounds[i]);
+
+      g_free (bvh->frame_bounds);
+      g_free (bvh->tri_order);
+      g_free (bvh->nodes);
+
+      g_slice_free (ClutterMD2DataBvh, bvh);
+
+      data->priv->bvh = NULL;
+    }
+}
+
+static const float *
+clutter_md2_bvh_get_frame_bounds (ClutterMD2Data *data, int frame_num)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  ClutterMD2DataBvh *bvh = priv->bvh;
+  const ClutterMD2DataFrame *frame = priv->frames[frame_num];
+  const guchar *vertices;
+  float *bounds;
+  int i, j, k;
+
+  if (bvh->frame_bounds[frame_num])
+    return bvh->frame_bounds[frame_num];
+
+  vertices = _clutter_md2_data_get_frame_vertices (data, frame_num);
+
+  bounds = g_new (float, bvh->num_nodes * 6);
+
+  /* Children are always stored after their parents so walking the
+     nodes backwards fits the leaves before they are needed */
+  for (i = bvh->num_nodes - 1; i >= 0; i--)
+    {
+      const ClutterMD2DataBvhNode *node = bvh->nodes + i;
+      float *box = bounds + i * 6;
+
+      if (node->count)
+        {
+          box[0] = box[1] = box[2] = FLT_MAX;
+          box[3] = box[4] = box[5] = -FLT_MAX;
+
+          for (j = 0; j < node->count; j++)
+            for (k = 0; k < 3; k++)
+              {
+                guint32 tri = bvh->tri_order[node->offset + j];
+                float pos[3];
+                int axis;
+
+                clutter_md2_bvh_get_vertex (frame, vertices,
+                                            priv->triangles[tri * 3 + k],
+                                            pos);
+
+                for (axis = 0; axis < 3; axis++)
+                  {
+                    if (pos[axis] < box[axis])
+                      box[axis] = pos[axis];
+                    if (pos[axis] > box[axis + 3])
+                      box[axis + 3] = pos[axis];
+                  }
+              }
+        }
+      else
+        {
+          const float *left = bounds + (i + 1) * 6;
+          const float *right = bounds + node->offset * 6;
+
+          for (k = 0; k < 3; k++)
+            {
+              box[k] = MIN (left[k], right[k]);
+              box[k + 3] = MAX (left[k + 3], right[k + 3]);
+            }
+        }
+    }
+
+  return bvh->frame_bounds[frame_num] = bounds;
+}
+
+/* Slab test of the ray against a box. The box is interpolated
+   between the two frames if they are different. Returns whether the
+   ray hits the box somewhere before max_t */
+static gboolean
+clutter_md2_bvh_hit_box (const float *box_a,
+                         const float *box_b,
+                         float interval,
+                         const float *origin,
+                         const float *inv_dir,
+                         float max_t)
+{
+  float t_near = 0.0f, t_far = max_t;
+  int axis;
+
+  for (axis = 0; axis < 3; axis++)
+    {
+      float lo = box_a[axis], hi = box_a[axis + 3];
+      float t0, t1;
+
+      if (box_b != box_a)
+        {
+          lo += (box_b[axis] - lo) * interval;
+          hi += (box_b[axis + 3] - hi) * interval;
+        }
+
+      t0 = (lo - origin[axis]) * inv_dir[axis];
+      t1 = (hi - origin[axis]) * inv_dir[axis];
+
+      if (t0 > t1)
+        {
+          float tmp = t0;
+          t0 = t1;
+          t1 = tmp;
+        }
+
+      if (t0 > t_near)
+        t_near = t0;
+      if (t1 < t_far)
+        t_far = t1;
+
+      if (t_near > t_far)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Möller-Trumbore ray/triangle test. Both sides of the triangle are
+   considered because the model is rendered without culling */
+static gboolean
+clutter_md2_bvh_hit_triangle (const float *v0,
+                              const float *v1,
+                              const float *v2,
+                              const ClutterMD2DataRay *ray,
+                              float *t_out)
+{
+  float e1[3], e2[3], p[3], s[3], q[3];
+  float det, inv_det, u, v, t;
+  int i;
+
+  for (i = 0; i < 3; i++)
+    {
+      e1[i] = v1[i] - v0[i];
+      e2[i] = v2[i] - v0[i];
+    }
+
+  p[0] = ray->direction[1] * e2[2] - ray->direction[2] * e2[1];
+  p[1] = ray->direction[2] * e2[0] - ray->direction[0] * e2[2];
+  p[2] = ray->direction[0] * e2[1] - ray->direction[1] * e2[0];
+
+  det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+
+  if (det > -FLT_EPSILON && det < FLT_EPSILON)
+    return FALSE;
+
+  inv_det = 1.0f / det;
+
+  for (i = 0; i < 3; i++)
+    s[i] = ray->origin[i] - v0[i];
+
+  u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv_det;
+  if (u < 0.0f || u > 1.0f)
+    return FALSE;
+
+  q[0] = s[1] * e1[2] - s[2] * e1[1];
+  q[1] = s[2] * e1[0] - s[0] * e1[2];
+  q[2] = s[0] * e1[1] - s[1] * e1[0];
+
+  v = (ray->direction[0] * q[0] + ray->direction[1] * q[1]
+       + ray->direction[2] * q[2]) * inv_det;
+  if (v < 0.0f || u + v > 1.0f)
+    return FALSE;
+
+  t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv_det;
+  if (t < 0.0f)
+    return FALSE;
+
+  *t_out = t;
+
+  return TRUE;
+}
+
+gboolean
+clutter_md2_data_ray_intersect (ClutterMD2Data          *data,
+                                gint                     frame_num_a,
+                                gint                     frame_num_b,
+                                gfloat                   interval,
+                                const ClutterMD2DataRay *ray,
+                                ClutterMD2DataHit       *hit)
+{
+  ClutterMD2DataPrivate *priv;
+  const ClutterMD2DataFrame *frame_a, *frame_b;
+  const guchar *vertices_a, *vertices_b;
+  const float *bounds_a, *bounds_b;
+  int stack[CLUTTER_MD2_BVH_MAX_DEPTH * 2];
+  int stack_size = 0;
+  float inv_dir[3];
+  float best_t = FLT_MAX;
+  int best_tri = -1;
+  int i;
+
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), FALSE);
+  g_return_val_if_fail (ray != NULL, FALSE);
+
+  priv = data->priv;
+
+  g_return_val_if_fail (frame_num_a >= 0 && frame_num_a < priv->num_frames,
+                        FALSE);
+  g_return_val_if_fail (frame_num_b >= 0 && frame_num_b < priv->num_frames,
+                        FALSE);
+
+  if (priv->num_triangles == 0)
+    return FALSE;
+
+  if (priv->bvh == NULL)
+    priv->bvh = clutter_md2_bvh_new (data);
+
+  if (frame_num_a == frame_num_b || interval == 0.0f)
+    frame_num_b = frame_num_a;
+
+  frame_a = priv->frames[frame_num_a];
+  frame_b = priv->frames[frame_num_b];
+  bounds_a = clutter_md2_bvh_get_frame_bounds (data, frame_num_a);
+  bounds_b = clutter_md2_bvh_get_frame_bounds (data, frame_num_b);
+  vertices_a = _clutter_md2_data_get_frame_vertices (data, frame_num_a);
+  vertices_b = _clutter_md2_data_get_frame_vertices (data, frame_num_b);
+
+  for (i = 0; i < 3; i++)
+    inv_dir[i] = ray->direction[i] == 0.0f
+      ? FLT_MAX : 1.0f / ray->direction[i];
+
+  stack[stack_size++] = 0;
+
+  while (stack_size > 0)
+    {
+      int node_num = stack[--stack_size];
+      const ClutterMD2DataBvhNode *node = priv->bvh->nodes + node_num;
+
+      if (!clutter_md2_bvh_hit_box (bounds_a + node_num * 6,
+                                    bounds_b + node_num * 6,
+                                    interval,
+                                    ray->origin, inv_dir,
+                                    best_t))
+        continue;
+
+      if (node->count)
+        {
+          for (i = 0; i < node->count; i++)
+            {
+              guint32 tri = priv->bvh->tri_order[node->offset + i];
+              float verts[3][3], t;
+              int j, k;
+
+              for (j = 0; j < 3; j++)
+                {
+                  guint32 vertex_num = priv->triangles[tri * 3 + j];
+
+                  clutter_md2_bvh_get_vertex (frame_a, vertices_a,
+                                              vertex_num, verts[j]);
+
+                  if (frame_b != frame_a)
+                    {
+                      float pos_b[3];
+
+                      clutter_md2_bvh_get_vertex (frame_b, vertices_b,
+                                                  vertex_num, pos_b);
+
+                      for (k = 0; k < 3; k++)
+                        verts[j][k] += (pos_b[k] - verts[j][k]) * interval;
+                    }
+                }
+
+              if (clutter_md2_bvh_hit_triangle (verts[0], verts[1], verts[2],
+                                                ray, &t)
+                  && t < best_t)
+                {
+                  best_t = t;
+                  best_tri = tri;
+                }
+            }
+        }
+      else
+        {
+          stack[stack_size++] = node->offset;
+          stack[stack_size++] = node_num + 1;
+        }
+    }
+
+  if (best_tri == -1)
+    return FALSE;
+
+  if (hit)
+    {
+      hit->distance = best_t;
+      hit->triangle = best_tri;
+      for (i = 0; i < 3; i++)
+        hit->position[i] = ray->origin[i] + ray->direction[i] * best_t;
+    }
+
+  return TRUE;
+}
@@ -0,0 +1,533 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Authored By Neil Roberts  <neil@o-hand.com>
+ *
+ * Copyright (C) 2008 OpenedHand
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CLUTTER_MD2_DATA_PRIVATE_H__
+#define __CLUTTER_MD2_DATA_PRIVATE_H__
+
+#include <glib-object.h>
+#include <clutter/clutter.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+/* Include cogl to get the right GL header for this platform */
+#include <cogl/cogl.h>
+
+#include "clutter-md2-data.h"
+
+G_BEGIN_DECLS
+
+#define CLUTTER_MD2_DATA_MAX_FRAME_NAME_LEN 15
+#define CLUTTER_MD2_DATA_MAX_SKIN_NAME_LEN  63
+
+typedef struct _ClutterMD2DataFrame ClutterMD2DataFrame;
+typedef struct _ClutterMD2DataSkin ClutterMD2DataSkin;
+typedef struct _ClutterMD2DataSkinEntry ClutterMD2DataSkinEntry;
+typedef struct _ClutterMD2DataSkinImage ClutterMD2DataSkinImage;
+typedef struct _ClutterMD2DataMipmaps ClutterMD2DataMipmaps;
+typedef struct _ClutterMD2DataBvh ClutterMD2DataBvh;
+typedef struct _ClutterMD2DataImpostor ClutterMD2DataImpostor;
+typedef struct _ClutterMD2DataSequence ClutterMD2DataSequence;
+typedef struct _ClutterMD2DataFrameSlot ClutterMD2DataFrameSlot;
+
+/* Number of rebuilt frames that are kept around. Rendering needs up
+   to CLUTTER_MD2_DATA_MAX_POSES at once so this must be at least
+   twice that for the round-robin replacement to be safe */
+#define CLUTTER_MD2_DATA_FRAME_SLOTS (CLUTTER_MD2_DATA_MAX_POSES * 2)
+
+/* Size in bytes of the 256 RGB entries of an indexed skin */
+#define CLUTTER_MD2_DATA_PALETTE_SIZE (256 * 3)
+
+/* Largest number of principal components that can be kept */
+#define CLUTTER_MD2_DATA_MAX_BASIS_SIZE 64
+
+struct _ClutterMD2DataFrameSlot
+{
+  /* -1 if the slot is empty */
+  int frame_num;
+  guchar *vertices;
+};
+
+struct _ClutterMD2DataPrivate
+{
+  guchar *gl_commands;
+
+  /* The GL commands broken down into a plain list of triangles with
+     three vertex numbers each. This is used for ray casting */
+  guint32 *triangles;
+  int num_triangles;
+  int num_vertices;
+
+  int num_frames;
+  ClutterMD2DataFrame **frames;
+
+  /* Frames whose vertices are within this distance of a cubic curve
+     through the neighbouring frames are dropped when the model is
+     loaded. Negative to keep every frame */
+  float frame_tolerance;
+  /* Results of the last compression */
+  int num_keyframes;
+  gsize frame_bytes_saved;
+  float frame_max_error;
+  /* Recently rebuilt frames */
+  ClutterMD2DataFrameSlot frame_slots[CLUTTER_MD2_DATA_FRAME_SLOTS];
+  int next_frame_slot;
+
+  /* If basis_tolerance is not negative then the frames are replaced
+     with a mean pose plus a weighted sum of at most max_basis_size
+     principal components when the model is loaded. basis_size is the
+     number of components in use or 0 if the frames are stored
+     directly. Each array of positions has num_vertices * 3 floats */
+  float basis_tolerance;
+  int max_basis_size;
+  int basis_size;
+  float *basis_mean;
+  /* basis_size arrays of positions */
+  float *basis;
+  /* basis_size coefficients for each frame */
+  float *basis_coefficients;
+  /* The normal index of every vertex in each frame */
+  guchar *basis_normals;
+  /* Buffer for rebuilt positions */
+  float *basis_positions;
+
+  /* If frame_budget is not zero then the file is kept mapped and the
+     vertices of each frame are only copied out of it when needed.
+     The frames that are paged in are queued with the most recently
+     used first. stream_generation is incremented whenever the mapping
+     is closed so that background reads that finish afterwards are
+     ignored */
+  guint frame_budget;
+  GMappedFile *frame_file;
+  GQueue resident_frames;
+  gsize resident_bytes;
+  guint stream_generation;
+  guint n_page_ins, n_prefetched;
+
+  /* Hash tables mapping a frame name to the frame number and a
+     sequence name to the index in the sequences array. Both values
+     are stored plus one. The frame name table owns copies of the
+     names and frees them when it is destroyed. The keys of the
+     sequence name table are owned by the sequences */
+  GHashTable *frame_names;
+  GHashTable *sequence_names;
+  GArray *sequences;
+
+  int skin_width, skin_height;
+  /* The size that the skin textures are padded to. This is the skin
+     size if GL supports textures that aren't a power of two */
+  guint texture_width, texture_height;
+  int num_skins;
+  ClutterMD2DataSkin *skins;
+  int skins_size;
+
+  /* Whether skins are uploaded as GL textures and whether a copy of
+     the pixels is kept in system memory for the software renderer */
+  guint upload_skins : 1;
+  guint keep_skin_pixels : 1;
+  /* Whether paletted skins are kept as indices and a palette */
+  guint indexed_skins : 1;
+  /* Whether uploaded RGB skins get a mipmap chain */
+  guint mipmap_skins : 1;
+  /* Whether skins that aren't in the disk cache are decoded in the
+     background. skin_generation is incremented whenever the skins are
+     freed so that loads that finish afterwards don't notify the wrong
+     skin */
+  guint progressive_skins : 1;
+  guint skin_generation;
+
+  /* Buffer for vertices to pass to OpenGL */
+  GLfloat *vertices;
+  guint vertices_size;
+
+  /* Maximum extents of all frames */
+  ClutterMD2DataExtents extents;
+
+  /* Bounding volume hierarchy for ray casting. This is only created
+     the first time a ray is cast */
+  ClutterMD2DataBvh *bvh;
+
+  /* Size in pixels of each cell of the impostor atlases or 0 if
+     impostors are disabled, and the number of viewing angles */
+  int impostor_size;
+  int impostor_angles;
+  /* One atlas per skin, created on demand */
+  ClutterMD2DataImpostor **impostors;
+  int num_impostors;
+  /* Incremented whenever the atlases are thrown away so that rows
+     that finish rendering in the background afterwards are ignored */
+  guint impostor_generation;
+};
+
+struct _ClutterMD2DataFrame
+{
+  float scale[3];
+  float translate[3];
+  char name[CLUTTER_MD2_DATA_MAX_FRAME_NAME_LEN + 1];
+
+  /* Extents of the model in this frame */
+  ClutterMD2DataExtents extents;
+
+  /* If the frame was dropped when compressing then it is rebuilt
+     from a cubic curve through these four keyframes */
+  int controls[4];
+
+  /* When streaming, the position of the vertices in the file, the
+     link in the queue of resident frames or NULL if the frame isn't
+     paged in and whether a background read is pending */
+  gsize offset;
+  GList *lru_link;
+  gboolean prefetching;
+
+  /* Points to vertex_data, to the vertices of an identical frame or
+     is NULL if the frame was dropped. Use
+     _clutter_md2_data_get_frame_vertices instead of accessing this
+     directly */
+  guchar *vertices;
+  guchar vertex_data[1];
+};
+
+struct _ClutterMD2DataSkin
+{
+  /* Whether the skin is drawn with GL. The texture belongs to the
+     entry and is only uploaded when the skin is first drawn */
+  gboolean use_texture;
+  /* The image padded to the texture size or NULL if the pixels
+     aren't kept */
+  GdkPixbuf *pixbuf;
+  /* For indexed skins the texture and the pixels are indices instead
+     and the colours come from this palette. The palette belongs to
+     the model so that it can be changed without affecting other
+     models that share the indices. The palette texture is 0 until
+     the skin is first drawn */
+  GByteArray *indices;
+  guchar *palette;
+  GLuint palette_texture;
+  /* The shared cache entry that owns the texture */
+  ClutterMD2DataSkinEntry *entry;
+};
+
+/* A skin in the cache that is shared between all of the models */
+struct _ClutterMD2DataSkinEntry
+{
+  /* NULL if the file couldn't be found so the entry isn't shared */
+  gchar *key;
+  guint ref_count;
+  /* Number of the references that use the texture */
+  guint n_texture_users;
+
+  /* The texture is 0 until it is first drawn and again after it is
+     evicted to stay within the texture budget. It is then uploaded
+     from the pixels if they are still here or decoded again from the
+     resolved path. The pixels are dropped after the upload because
+     the skins that keep them have their own references */
+  GLuint texture;
+  gsize texture_bytes;
+  guint texture_width, texture_height;
+  GdkPixbuf *pixbuf;
+  /* The mipmaps are built with the pixels and dropped with them. They
+     are only made for RGB skins if mipmap was requested */
+  gboolean mipmap;
+  ClutterMD2DataMipmaps *mipmaps;
+  gchar *path;
+  /* Set if the image couldn't be decoded again so that it isn't
+     retried on every paint */
+  gboolean reload_failed;
+  /* The link in the list of resident textures, least recently used
+     first */
+  GList *resident_link;
+
+  /* Set if the image was a paletted file that was requested as an
+     indexed skin. The texture and the kept pixels are then indices
+     and the palette is the one from the file */
+  gboolean indexed;
+  GByteArray *indices;
+  guchar palette[CLUTTER_MD2_DATA_PALETTE_SIZE];
+
+  /* Set while the image is being decoded in the background. Until it
+     is ready the skin is drawn with the preview, which is a copy of a
+     small level of the mipmap chain, or with a plain grey texel
+     before that. The models waiting for it are notified when either
+     arrives */
+  gboolean loading;
+  GdkPixbuf *preview;
+  GLuint preview_texture;
+  GSList *waiters;
+};
+
+/* The pixels of a skin for the software rasterizer. Indexed skins
+   have one byte per texel which is looked up in the palette */
+struct _ClutterMD2DataSkinImage
+{
+  const guchar *texels;
+  int width, height;
+  int rowstride, n_channels;
+  const guchar *palette;
+};
+
+/* The levels of a skin's mipmap chain below the base level. They are
+   packed one after another without any padding between the rows and
+   each is half the size of the one above rounded down to at least
+   one texel. The data is either owned or points into a mapped skin
+   cache file */
+struct _ClutterMD2DataMipmaps
+{
+  guint ref_count;
+  int n_levels, n_channels;
+  const guchar *data;
+  gsize size;
+  GMappedFile *file;
+};
+
+void _clutter_md2_data_free_bvh (ClutterMD2Data *data);
+
+/* Gets a reference to the cached skin for an image padded to the
+   given texture size. If upload is TRUE the image is decoded so that
+   it is ready to upload when it is first drawn and the pixels are
+   kept if keep_pixels is TRUE. If indexed is TRUE then paletted
+   images are kept as indices. If mipmap is TRUE then RGB skins are
+   uploaded with a mipmap chain. If progressive is TRUE then an image
+   that isn't in the disk cache is decoded in the background and the
+   entry is loading until it is ready */
+ClutterMD2DataSkinEntry *
+_clutter_md2_data_get_skin_entry (const gchar *filename,
+                                  guint        texture_width,
+                                  guint        texture_height,
+                                  gboolean     upload,
+                                  gboolean     keep_pixels,
+                                  gboolean     indexed,
+                                  gboolean     mipmap,
+                                  gboolean     progressive,
+                                  GError     **error);
+/* Emits "skin-changed" for the skin when the loading entry gets its
+   preview or its full image */
+void _clutter_md2_data_wait_for_skin_entry
+                                    (ClutterMD2DataSkinEntry *entry,
+                                     ClutterMD2Data          *data,
+                                     gint                     skin_num);
+void _clutter_md2_data_emit_skin_changed (ClutterMD2Data *data,
+                                          gint            skin_num);
+void _clutter_md2_data_release_skin_entry
+                                    (ClutterMD2DataSkinEntry *entry,
+                                     gboolean                 used_texture);
+/* Gets the texture of an entry for drawing, uploading it first if it
+   isn't resident. This may evict other textures and leave a different
+   texture bound. Returns 0 if the image couldn't be loaded */
+GLuint _clutter_md2_data_use_skin_entry (ClutterMD2DataSkinEntry *entry);
+
+/* Checks whether indexed skins can be drawn with GL. This compiles
+   the fragment program that looks up the palette so it needs a GL
+   context */
+gboolean _clutter_md2_data_indexed_skins_supported (void);
+/* Creates a texture for the palette of an indexed skin or replaces
+   the contents of an existing one */
+GLuint _clutter_md2_data_upload_palette (const guchar *palette,
+                                         GLuint        texture);
+/* Saves the palette lookup state before a batch and restores it
+   afterwards */
+void _clutter_md2_data_begin_palette (void);
+void _clutter_md2_data_end_palette (void);
+/* Turns the palette lookup on for an indexed skin or off if the skin
+   isn't indexed */
+void _clutter_md2_data_bind_palette (const ClutterMD2DataSkin *skin);
+/* Fills in the pixels of a skin for the software rasterizer. Returns
+   FALSE if the pixels weren't kept */
+gboolean _clutter_md2_data_get_skin_image (const ClutterMD2DataSkin *skin,
+                                           ClutterMD2DataSkinImage  *image);
+
+/* Checks whether the file contents are a PCX image that can be
+   decoded with _clutter_md2_data_decode_pcx */
+gboolean _clutter_md2_data_is_pcx (const guchar *contents,
+                                   gsize         length);
+/* Decodes a PCX image into an RGB pixbuf of the texture size,
+   repeating the edge pixels into any space that the image doesn't
+   cover. If the size is 0 then the pixbuf is the size of the image */
+GdkPixbuf *_clutter_md2_data_decode_pcx (const guchar *contents,
+                                         gsize         length,
+                                         guint         texture_width,
+                                         guint         texture_height,
+                                         const gchar  *display_name,
+                                         GError      **error);
+/* Checks whether the file contents are a paletted PCX image that can
+   be decoded with _clutter_md2_data_decode_pcx_indexed */
+gboolean _clutter_md2_data_is_indexed_pcx (const guchar *contents,
+                                           gsize         length);
+/* Decodes the indices of a paletted PCX image padded to the texture
+   size in the same way as _clutter_md2_data_decode_pcx and copies
+   the CLUTTER_MD2_DATA_PALETTE_SIZE bytes of the palette */
+GByteArray *_clutter_md2_data_decode_pcx_indexed
+                                        (const guchar *contents,
+                                         gsize         length,
+                                         guint         texture_width,
+                                         guint         texture_height,
+                                         guchar       *palette,
+                                         const gchar  *display_name,
+                                         GError      **error);
+
+/* Gets the size of the levels below a base level of the given size
+   and the number of them */
+gsize _clutter_md2_data_get_mipmaps_size (int  width,
+                                          int  height,
+                                          int  n_channels,
+                                          int *n_levels);
+/* Box filters the base level down to a 1x1 level. Large levels are
+   split between threads. Returns NULL if the base is already 1x1 */
+ClutterMD2DataMipmaps *
+_clutter_md2_data_generate_mipmaps (const guchar *pixels,
+                                    int           width,
+                                    int           height,
+                                    int           rowstride,
+                                    int           n_channels);
+/* Wraps levels that are stored in a mapped file. The mipmaps keep a
+   reference on the file */
+ClutterMD2DataMipmaps *
+_clutter_md2_data_mipmaps_new_mapped (GMappedFile  *file,
+                                      const guchar *data,
+                                      int           width,
+                                      int           height,
+                                      int           n_channels);
+ClutterMD2DataMipmaps *
+_clutter_md2_data_mipmaps_ref (ClutterMD2DataMipmaps *mipmaps);
+void _clutter_md2_data_mipmaps_unref (ClutterMD2DataMipmaps *mipmaps);
+/* Gets the texels and size of a level where level 1 is the first one
+   below the base */
+const guchar *
+_clutter_md2_data_get_mipmap_level (const ClutterMD2DataMipmaps *mipmaps,
+                                    int                          level,
+                                    int                          width,
+                                    int                          height,
+                                    int                         *level_width,
+                                    int                         *level_height);
+
+void _clutter_md2_data_build_sequences (ClutterMD2Data *data);
+void _clutter_md2_data_free_sequences (ClutterMD2Data *data);
+/* Gets the range of the sequence containing a frame. Returns FALSE if
+   the frame isn't in a sequence */
+gboolean _clutter_md2_data_get_frame_sequence (ClutterMD2Data *data,
+                                               gint            frame_num,
+                                               gint           *frame_start,
+                                               gint           *frame_end);
+
+/* Drops frames that can be rebuilt from their neighbours according to
+   the frame tolerance */
+void _clutter_md2_data_compress_frames (ClutterMD2Data *data);
+void _clutter_md2_data_free_frame_cache (ClutterMD2Data *data);
+
+/* Returns the four bytes per vertex of a frame. If the frame was
+   dropped then it is rebuilt into a temporary slot which stays valid
+   until CLUTTER_MD2_DATA_MAX_POSES other dropped frames have been
+   fetched. This must only be called from the main thread */
+const guchar *_clutter_md2_data_get_frame_vertices (ClutterMD2Data *data,
+                                                    gint            frame_num);
+
+/* Maps the file so that frame vertices can be paged in on demand */
+gboolean _clutter_md2_data_open_stream (ClutterMD2Data *data,
+                                        const gchar    *filename,
+                                        const gchar    *display_name,
+                                        GError        **error);
+void _clutter_md2_data_close_stream (ClutterMD2Data *data);
+/* Returns the vertices of a frame when streaming, paging them in if
+   necessary */
+const guchar *_clutter_md2_data_stream_frame (ClutterMD2Data *data,
+                                              gint            frame_num);
+
+/* Replaces the frames with a principal component basis according to
+   the basis tolerance. Returns FALSE if the frames are kept */
+gboolean _clutter_md2_data_build_basis (ClutterMD2Data *data);
+void _clutter_md2_data_free_basis (ClutterMD2Data *data);
+
+/* Writes the model-space position of every vertex for a weighted
+   blend of frames as three floats each. This can only be used when
+   basis_size is not zero */
+void _clutter_md2_data_get_basis_positions (ClutterMD2Data *data,
+                                            gint            n_frames,
+                                            const gint     *frame_nums,
+                                            const gfloat   *weights,
+                                            gfloat         *positions);
+void _clutter_md2_data_rebuild_basis_frame (ClutterMD2Data *data,
+                                            gint            frame_num,
+                                            guchar         *vertices);
+
+/* Gets the scale and the center of the model that are used to fit
+   the model into the given geometry. A point in model space is
+   mapped to the actor with (p - center) * scale + (width/2,
+   height/2, 0) */
+void _clutter_md2_data_get_fit_transform (ClutterMD2Data        *data,
+                                          const ClutterGeometry *geom,
+                                          float                 *scale,
+                                          float                 *center);
+
+/* Draws several models with one save and restore of the GL state. If
+   pick_color is not NULL every model is drawn as a silhouette. The
+   models are placed with the extents of fit_data so that a weapon can
+   be drawn with the same transformation as the body holding it. If
+   transform is not NULL it is applied on top of the current
+   modelview matrix before fitting the model into the geometry */
+void _clutter_md2_data_begin_batch (const ClutterColor *pick_color);
+void _clutter_md2_data_draw_batched (ClutterMD2Data        *data,
+                                     gint                   n_frames,
+                                     const gint            *frame_nums,
+                                     const gfloat          *weights,
+                                     gint                   skin_num,
+                                     ClutterMD2Data        *fit_data,
+                                     const CoglMatrix      *transform,
+                                     const ClutterGeometry *geom);
+void _clutter_md2_data_end_batch (void);
+
+/* Writes the interpolated model-space position of every vertex as
+   three floats each */
+void _clutter_md2_data_get_vertex_positions (ClutterMD2Data *data,
+                                             gint            frame_num_a,
+                                             gint            frame_num_b,
+                                             gfloat          interval,
+                                             gfloat         *positions);
+
+/* Software rasterizes the GL commands with vertex positions that are
+   already transformed into buffer space. This does not touch the
+   ClutterMD2Data so it is safe to call from any thread as long as
+   the arguments stay alive */
+void _clutter_md2_data_rasterize (const guchar                  *gl_commands,
+                                  const gfloat                  *vertices,
+                                  const ClutterMD2DataSkinImage *skin,
+                                  ClutterMD2DataBuffer          *buffer);
+/* Gets the number of threads worth using for work that is split up
+   between the CPUs */
+int _clutter_md2_data_get_n_threads (void);
+
+/* Paints the frame from the impostor atlas for the skin at the
+   nearest pre-rendered angle. If that frame hasn't been rendered yet
+   then it is queued and FALSE is returned so that the caller can
+   paint the full model instead. The stage of actor is redrawn when
+   the frame is ready */
+gboolean _clutter_md2_data_paint_impostor (ClutterMD2Data        *data,
+                                           ClutterActor          *actor,
+                                           gint                   frame_num,
+                                           gint                   skin_num,
+                                           gfloat                 angle,
+                                           const ClutterGeometry *geom);
+
+void _clutter_md2_data_free_impostors (ClutterMD2Data *data);
+
+G_END_DECLS
+
+#endif /* __CLUTTER_MD2_DATA_PRIVATE_H__ */
@@ -34,10 +34,14 @@
 #include <clutter/clutter.h>
 #include <errno.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 /* Include cogl to get the right GL header for this platform */
 #include <cogl/cogl.h>
 
 #include "clutter-md2-data.h"
+#include "clutter-md2-data-private.h"
 #include "clutter-md2-norms.h"
 
 #define CLUTTER_MD2_DATA_GET_PRIVATE(obj)                       \
@@ -51,8 +55,11 @@ static void clutter_md2_data_get_property (GObject    *self,
                                            guint       property_id,
                                            GValue     *value,
                                            GParamSpec *pspec);
+static void clutter_md2_data_set_property (GObject      *self,
+                                           guint         property_id,
+                                           const GValue *value,
+                                           GParamSpec   *pspec);
 
-typedef struct _ClutterMD2DataFrame ClutterMD2DataFrame;
 typedef struct _ClutterMD2DataState ClutterMD2DataState;
 
 #define CLUTTER_MD2_DATA_FORMAT_MAGIC       0x32504449 /* IDP2 */
@@ -67,43 +74,8 @@ typedef struct _ClutterMD2DataState ClutterMD2DataState;
    invalid */
 #define CLUTTER_MD2_DATA_MAX_SKIN_SIZE      65536
 
-#define CLUTTER_MD2_DATA_MAX_FRAME_NAME_LEN 15
-#define CLUTTER_MD2_DATA_MAX_SKIN_NAME_LEN  63
-
 #define CLUTTER_MD2_DATA_FLOATS_PER_VERTEX  (3 + 3 + 2)
 
-struct _ClutterMD2DataPrivate
-{
-  guchar *gl_commands;
-
-  int num_frames;
-  ClutterMD2DataFrame **frames;
-
-  int skin_width, skin_height;
-  int num_skins;
-  GLuint *textures;
-  int textures_size;
-
-  /* Buffer for vertices to pass to OpenGL */
-  GLfloat *vertices;
-  guint vertices_size;
-
-  /* Maximum extents of all frames */
-  ClutterMD2DataExtents extents;
-};
-
-struct _ClutterMD2DataFrame
-{
-  float scale[3];
-  float translate[3];
-  char name[CLUTTER_MD2_DATA_MAX_FRAME_NAME_LEN + 1];
-
-  /* Extents of the model in this frame */
-  ClutterMD2DataExtents extents;
-
-  guchar vertices[1];
-};
-
 /* Variables for some of the OpenGL state so that it can be preserved
    across paint calls */
 struct _ClutterMD2DataState
@@ -121,6 +93,21 @@ struct _ClutterMD2DataState
   GLint     tex_env_mode;
 };
 
+/* The state shared between the models drawn in one batch. Painting
+   only happens in the main thread so there is only ever one batch */
+typedef struct _ClutterMD2DataBatch ClutterMD2DataBatch;
+
+struct _ClutterMD2DataBatch
+{
+  gboolean            active;
+  gboolean            pick;
+  GLuint              texture;
+  GLuint              palette_texture;
+  ClutterMD2DataState state;
+};
+
+static ClutterMD2DataBatch clutter_md2_data_batch;
+
 enum
   {
     CLUTTER_MD2_DATA_HEADER_MAGIC,
@@ -146,6 +133,7 @@ enum
 enum
   {
     DATA_CHANGED,
+    SKIN_CHANGED,
     LAST_SIGNAL
   };
 
@@ -157,7 +145,18 @@ enum
 
     PROP_N_SKINS,
     PROP_N_FRAMES,
-    PROP_EXTENTS
+    PROP_EXTENTS,
+    PROP_UPLOAD_SKINS,
+    PROP_KEEP_SKIN_PIXELS,
+    PROP_INDEXED_SKINS,
+    PROP_MIPMAP_SKINS,
+    PROP_PROGRESSIVE_SKINS,
+    PROP_IMPOSTOR_SIZE,
+    PROP_IMPOSTOR_ANGLES,
+    PROP_FRAME_TOLERANCE,
+    PROP_BASIS_TOLERANCE,
+    PROP_MAX_BASIS_SIZE,
+    PROP_FRAME_BUDGET
   };
 
 GQuark
@@ -174,6 +173,7 @@ clutter_md2_data_class_init (ClutterMD2DataClass *klass)
 
   object_class->finalize = clutter_md2_data_finalize;
   object_class->get_property = clutter_md2_data_get_property;
+  object_class->set_property = clutter_md2_data_set_property;
 
   g_type_class_add_private (klass, sizeof (ClutterMD2DataPrivate));
 
@@ -186,6 +186,15 @@ clutter_md2_data_class_init (ClutterMD2DataClass *klass)
                   g_cclosure_marshal_VOID__VOID,
                   G_TYPE_NONE, 0);
 
+  data_signals[SKIN_CHANGED] =
+    g_signal_new ("skin-changed",
+                  G_TYPE_FROM_CLASS (object_class),
+                  G_SIGNAL_RUN_FIRST,
+                  G_STRUCT_OFFSET (ClutterMD2DataClass, skin_changed),
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__INT,
+                  G_TYPE_NONE, 1, G_TYPE_INT);
+
   pspec = g_param_spec_int ("n_skins", "Number of skins loaded",
                             "The current number of skins loaded",
                             0, G_MAXINT, 0, G_PARAM_READABLE);
@@ -202,20 +211,153 @@ clutter_md2_data_class_init (ClutterMD2DataClass *klass)
                               CLUTTER_TYPE_MD2_DATA_EXTENTS,
                               G_PARAM_READABLE);
   g_object_class_install_property (object_class, PROP_EXTENTS, pspec);
+
+  pspec = g_param_spec_boolean ("upload_skins", "Upload skins",
+                                "Whether skins are uploaded as GL "
+                                "textures. Disable this to use the data "
+                                "without a GL context",
+                                TRUE, G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_UPLOAD_SKINS, pspec);
+
+  pspec = g_param_spec_boolean ("keep_skin_pixels", "Keep skin pixels",
+                                "Whether a copy of the skin images is kept "
+                                "in system memory for software rendering",
+                                FALSE, G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_KEEP_SKIN_PIXELS,
+                                   pspec);
+
+  pspec = g_param_spec_boolean ("indexed_skins", "Indexed skins",
+                                "Whether paletted skins are kept as one "
+                                "byte per texel and a palette instead of "
+                                "being expanded to RGB",
+                                FALSE, G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_INDEXED_SKINS, pspec);
+
+  pspec = g_param_spec_boolean ("mipmap_skins", "Mipmap skins",
+                                "Whether uploaded skins have a mipmap "
+                                "chain so they don't shimmer when drawn "
+                                "small",
+                                TRUE, G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_MIPMAP_SKINS, pspec);
+
+  pspec = g_param_spec_boolean ("progressive_skins", "Progressive skins",
+                                "Whether skins are decoded in the "
+                                "background so the model can be drawn "
+                                "before they are ready",
+                                FALSE, G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_PROGRESSIVE_SKINS,
+                                   pspec);
+
+  pspec = g_param_spec_int ("impostor_size", "Impostor size",
+                            "The size in pixels of each image in the "
+                            "impostor atlases or 0 to disable impostors. "
+                            "This should be set before loading the model",
+                            0, 1024, 0, G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_IMPOSTOR_SIZE, pspec);
+
+  pspec = g_param_spec_int ("impostor_angles", "Impostor angles",
+                            "The number of viewing angles around the "
+                            "vertical axis rendered into the impostor "
+                            "atlases",
+                            1, 360, 8, G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_IMPOSTOR_ANGLES,
+                                   pspec);
+
+  pspec = g_param_spec_float ("frame_tolerance", "Frame tolerance",
+                              "The largest distance in model units that "
+                              "a vertex may move when a frame is dropped "
+                              "and rebuilt from the neighbouring "
+                              "keyframes, or a negative value to keep "
+                              "every frame. This should be set before "
+                              "loading the model",
+                              -1.0f, G_MAXFLOAT, -1.0f, G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_FRAME_TOLERANCE,
+                                   pspec);
+
+  pspec = g_param_spec_float ("basis_tolerance", "Basis tolerance",
+                              "The largest distance in model units that "
+                              "a vertex may move when the frames are "
+                              "replaced with a mean pose and a set of "
+                              "principal components, or a negative "
+                              "value to store the frames directly. This "
+                              "should be set before loading the model",
+                              -1.0f, G_MAXFLOAT, -1.0f, G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_BASIS_TOLERANCE,
+                                   pspec);
+
+  pspec = g_param_spec_int ("max_basis_size", "Max basis size",
+                            "The largest number of principal components "
+                            "to use when basis_tolerance is set",
+                            1, CLUTTER_MD2_DATA_MAX_BASIS_SIZE, 32,
+                            G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_MAX_BASIS_SIZE,
+                                   pspec);
+
+  pspec = g_param_spec_uint ("frame_budget", "Frame budget",
+                             "If not zero, the frame vertices are read "
+                             "from the file when they are needed and at "
+                             "most this many bytes of them are kept in "
+                             "memory. This should be set before loading "
+                             "the model",
+                             0, G_MAXUINT, 0, G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_FRAME_BUDGET, pspec);
 }
 
 static void
 clutter_md2_data_init (ClutterMD2Data *self)
 {
   ClutterMD2DataPrivate *priv;
+  int i;
 
   self->priv = priv = CLUTTER_MD2_DATA_GET_PRIVATE (self);
 
   priv->gl_commands = NULL;
+  priv->triangles = NULL;
+  priv->num_triangles = 0;
+  priv->bvh = NULL;
   priv->num_frames = 0;
   priv->frames = NULL;
+  priv->frame_names = NULL;
+  priv->sequence_names = NULL;
+  priv->sequences = NULL;
   priv->num_skins = 0;
-  priv->textures = NULL;
+  priv->skins = NULL;
+  priv->upload_skins = TRUE;
+  priv->keep_skin_pixels = FALSE;
+  priv->indexed_skins = FALSE;
+  priv->mipmap_skins = TRUE;
+  priv->progressive_skins = FALSE;
+  priv->skin_generation = 0;
+  priv->impostor_size = 0;
+  priv->impostor_angles = 8;
+  priv->impostors = NULL;
+  priv->num_impostors = 0;
+  priv->impostor_generation = 0;
+  priv->frame_tolerance = -1.0f;
+  priv->num_keyframes = 0;
+  priv->frame_bytes_saved = 0;
+  priv->frame_max_error = 0.0f;
+  priv->basis_tolerance = -1.0f;
+  priv->max_basis_size = 32;
+  priv->basis_size = 0;
+  priv->basis_mean = NULL;
+  priv->basis = NULL;
+  priv->basis_coefficients = NULL;
+  priv->basis_normals = NULL;
+  priv->basis_positions = NULL;
+  priv->frame_budget = 0;
+  priv->frame_file = NULL;
+  g_queue_init (&priv->resident_frames);
+  priv->resident_bytes = 0;
+  priv->stream_generation = 0;
+  priv->n_page_ins = 0;
+  priv->n_prefetched = 0;
+  for (i = 0; i < CLUTTER_MD2_DATA_FRAME_SLOTS; i++)
+    {
+      priv->frame_slots[i].frame_num = -1;
+      priv->frame_slots[i].vertices = NULL;
+    }
+  priv->next_frame_slot = 0;
   priv->vertices = g_malloc (sizeof (GLfloat)
                              * CLUTTER_MD2_DATA_FLOATS_PER_VERTEX
                              * (priv->vertices_size = 1));
@@ -247,6 +389,114 @@ clutter_md2_data_get_property (GObject    *self,
       }
       break;
 
+    case PROP_UPLOAD_SKINS:
+      g_value_set_boolean (value, clutter_md2_data_get_upload_skins (data));
+      break;
+
+    case PROP_KEEP_SKIN_PIXELS:
+      g_value_set_boolean (value,
+                           clutter_md2_data_get_keep_skin_pixels (data));
+      break;
+
+    case PROP_INDEXED_SKINS:
+      g_value_set_boolean (value, clutter_md2_data_get_indexed_skins (data));
+      break;
+
+    case PROP_MIPMAP_SKINS:
+      g_value_set_boolean (value, clutter_md2_data_get_mipmap_skins (data));
+      break;
+
+    case PROP_PROGRESSIVE_SKINS:
+      g_value_set_boolean (value,
+                           clutter_md2_data_get_progressive_skins (data));
+      break;
+
+    case PROP_IMPOSTOR_SIZE:
+      g_value_set_int (value, clutter_md2_data_get_impostor_size (data));
+      break;
+
+    case PROP_IMPOSTOR_ANGLES:
+      g_value_set_int (value, clutter_md2_data_get_impostor_angles (data));
+      break;
+
+    case PROP_FRAME_TOLERANCE:
+      g_value_set_float (value, clutter_md2_data_get_frame_tolerance (data));
+      break;
+
+    case PROP_BASIS_TOLERANCE:
+      g_value_set_float (value, clutter_md2_data_get_basis_tolerance (data));
+      break;
+
+    case PROP_MAX_BASIS_SIZE:
+      g_value_set_int (value, clutter_md2_data_get_max_basis_size (data));
+      break;
+
+    case PROP_FRAME_BUDGET:
+      g_value_set_uint (value, clutter_md2_data_get_frame_budget (data));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (self, property_id, pspec);
+      break;
+    }
+}
+
+static void
+clutter_md2_data_set_property (GObject      *self,
+                               guint         property_id,
+                               const GValue *value,
+                               GParamSpec   *pspec)
+{
+  ClutterMD2Data *data = CLUTTER_MD2_DATA (self);
+
+  switch (property_id)
+    {
+    case PROP_UPLOAD_SKINS:
+      clutter_md2_data_set_upload_skins (data, g_value_get_boolean (value));
+      break;
+
+    case PROP_KEEP_SKIN_PIXELS:
+      clutter_md2_data_set_keep_skin_pixels (data,
+                                             g_value_get_boolean (value));
+      break;
+
+    case PROP_INDEXED_SKINS:
+      clutter_md2_data_set_indexed_skins (data, g_value_get_boolean (value));
+      break;
+
+    case PROP_MIPMAP_SKINS:
+      clutter_md2_data_set_mipmap_skins (data, g_value_get_boolean (value));
+      break;
+
+    case PROP_PROGRESSIVE_SKINS:
+      clutter_md2_data_set_progressive_skins (data,
+                                              g_value_get_boolean (value));
+      break;
+
+    case PROP_IMPOSTOR_SIZE:
+      clutter_md2_data_set_impostor_size (data, g_value_get_int (value));
+      break;
+
+    case PROP_IMPOSTOR_ANGLES:
+      clutter_md2_data_set_impostor_angles (data, g_value_get_int (value));
+      break;
+
+    case PROP_FRAME_TOLERANCE:
+      clutter_md2_data_set_frame_tolerance (data, g_value_get_float (value));
+      break;
+
+    case PROP_BASIS_TOLERANCE:
+      clutter_md2_data_set_basis_tolerance (data, g_value_get_float (value));
+      break;
+
+    case PROP_MAX_BASIS_SIZE:
+      clutter_md2_data_set_max_basis_size (data, g_value_get_int (value));
+      break;
+
+    case PROP_FRAME_BUDGET:
+      clutter_md2_data_set_frame_budget (data, g_value_get_uint (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (self, property_id, pspec);
       break;
@@ -335,203 +585,822 @@ clutter_md2_data_restore_state (const ClutterMD2DataState *state)
 }
 
 void
-clutter_md2_data_render (ClutterMD2Data        *data,
-                         gint                   frame_num_a,
-                         gint                   frame_num_b,
-                         gfloat                 interval,
-                         gint                   skin_num,
-                         const ClutterGeometry *geom)
+_clutter_md2_data_get_fit_transform (ClutterMD2Data        *data,
+                                     const ClutterGeometry *geom,
+                                     float                 *scale,
+                                     float                 *center)
 {
   ClutterMD2DataPrivate *priv = data->priv;
-  ClutterMD2DataFrame *frame_a, *frame_b;
-  guchar *vertices_a, *vertices_b;
-  guchar *gl_command;
-  float scale;
-  ClutterMD2DataState state;
 
-  if (priv->gl_commands == NULL
-      || priv->frames == NULL
-      || priv->textures == NULL
-      || frame_num_a >= priv->num_frames
-      || frame_num_b >= priv->num_frames
-      || skin_num >= priv->num_skins
-      || geom->width == 0
-      || geom->height == 0
-      || priv->extents.top == priv->extents.bottom)
-    return;
+  /* Scale so that the model fits in either the width or the height of
+     the actor, whichever makes the model bigger */
+  if (((priv->extents.right - priv->extents.left)
+       / (priv->extents.bottom - priv->extents.top))
+      > geom->width / (float) geom->height)
+    /* Fit width */
+    *scale = geom->width / (priv->extents.right - priv->extents.left);
+  else
+    /* Fit height */
+    *scale = geom->height / (priv->extents.bottom - priv->extents.top);
 
-  frame_a = priv->frames[frame_num_a];
-  frame_b = priv->frames[frame_num_b];
-  vertices_a = frame_a->vertices;
-  vertices_b = frame_b->vertices;
-  gl_command = priv->gl_commands;
+  center[0] = (priv->extents.left + priv->extents.right) / 2;
+  center[1] = (priv->extents.top + priv->extents.bottom) / 2;
+  center[2] = (priv->extents.back + priv->extents.front) / 2;
+}
+
+/* Per pose constants for blending the vertices. The scale and
+   translation of each frame are premultiplied by its weight so that
+   the blended position is just the sum of each byte vertex times its
+   scale plus the summed translation */
+typedef struct
+{
+  const guchar *vertices;
+  float weight;
+  float scale[4];
+} ClutterMD2DataPose;
+
+#ifdef __SSE2__
+
+static inline void
+clutter_md2_data_blend_vertex (const ClutterMD2DataPose *poses,
+                               int                       n_poses,
+                               const float              *translate,
+                               int                       vertex_num,
+                               GLfloat                  *vp)
+{
+  __m128 pos = _mm_loadu_ps (translate);
+  __m128 norm = _mm_setzero_ps ();
+  __m128i zero = _mm_setzero_si128 ();
+  int i;
+
+  for (i = 0; i < n_poses; i++)
+    {
+      const guchar *vertex = poses[i].vertices + vertex_num * 4;
+      const float *n = _clutter_md2_norms + vertex[3] * 3;
+      __m128i bytes;
+      guint32 packed;
+
+      /* Widen the four bytes of the vertex to floats. The fourth
+         component is the normal index but the scale for it is zero */
+      memcpy (&packed, vertex, sizeof (packed));
+      bytes = _mm_cvtsi32_si128 (packed);
+      bytes = _mm_unpacklo_epi8 (bytes, zero);
+      bytes = _mm_unpacklo_epi16 (bytes, zero);
+
+      pos = _mm_add_ps (pos, _mm_mul_ps (_mm_cvtepi32_ps (bytes),
+                                         _mm_loadu_ps (poses[i].scale)));
+      norm = _mm_add_ps (norm,
+                         _mm_mul_ps (_mm_set_ps (0.0f, n[2], n[1], n[0]),
+                                     _mm_set1_ps (poses[i].weight)));
+    }
+
+  /* The normal is stored first because its fourth float spills into
+     the position which is written afterwards */
+  _mm_storeu_ps (vp + 2, norm);
+  _mm_storel_pi ((__m64 *) (vp + 5), pos);
+  _mm_store_ss (vp + 7, _mm_movehl_ps (pos, pos));
+}
+
+#else /* __SSE2__ */
+
+static inline void
+clutter_md2_data_blend_vertex (const ClutterMD2DataPose *poses,
+                               int                       n_poses,
+                               const float              *translate,
+                               int                       vertex_num,
+                               GLfloat                  *vp)
+{
+  float pos[3] = { translate[0], translate[1], translate[2] };
+  float norm[3] = { 0.0f, 0.0f, 0.0f };
+  int i, j;
+
+  for (i = 0; i < n_poses; i++)
+    {
+      const guchar *vertex = poses[i].vertices + vertex_num * 4;
+      const float *n = _clutter_md2_norms + vertex[3] * 3;
+
+      for (j = 0; j < 3; j++)
+        {
+          pos[j] += vertex[j] * poses[i].scale[j];
+          norm[j] += n[j] * poses[i].weight;
+        }
+    }
+
+  memcpy (vp + 2, norm, sizeof (norm));
+  memcpy (vp + 5, pos, sizeof (pos));
+}
+
+#endif /* __SSE2__ */
+
+/* When the frames are built from a principal component basis the
+   positions have already been blended so only the normals are needed
+   from the poses. The vertices of each pose are then just the normal
+   indices */
+static inline void
+clutter_md2_data_blend_basis_vertex (const ClutterMD2DataPose *poses,
+                                     int                       n_poses,
+                                     const float              *positions,
+                                     int                       vertex_num,
+                                     GLfloat                  *vp)
+{
+  float norm[3] = { 0.0f, 0.0f, 0.0f };
+  int i, j;
+
+  for (i = 0; i < n_poses; i++)
+    {
+      const float *n = _clutter_md2_norms + poses[i].vertices[vertex_num] * 3;
+
+      for (j = 0; j < 3; j++)
+        norm[j] += n[j] * poses[i].weight;
+    }
+
+  memcpy (vp + 2, norm, sizeof (norm));
+  memcpy (vp + 5, positions + vertex_num * 3, sizeof (float) * 3);
+}
+
+/* Sets up the GL state that is shared by every model drawn until
+   _clutter_md2_data_end_batch. If pick_color is not NULL the models
+   are drawn as a solid silhouette in that color instead of with their
+   skins */
+void
+_clutter_md2_data_begin_batch (const ClutterColor *pick_color)
+{
+  ClutterMD2DataBatch *batch = &clutter_md2_data_batch;
+
+  g_return_if_fail (!batch->active);
+
+  batch->active = TRUE;
+  batch->pick = pick_color != NULL;
+  batch->texture = 0;
+  batch->palette_texture = 0;
 
   cogl_begin_gl ();
 
-  clutter_md2_data_save_state (&state);
+  clutter_md2_data_save_state (&batch->state);
+  _clutter_md2_data_begin_palette ();
 
   glEnable (GL_DEPTH_TEST);
   glDisable (GL_BLEND);
   glDepthFunc (GL_LEQUAL);
-  glBindTexture (GL_TEXTURE_2D, priv->textures[skin_num]);
-  glEnable (GL_TEXTURE_2D);
 #ifdef GL_TEXTURE_RECTANGLE_ARB
   glDisable (GL_TEXTURE_RECTANGLE_ARB);
 #endif
-  glTexEnvi (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-  glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+  if (pick_color)
+    {
+      glDisable (GL_TEXTURE_2D);
+      glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+      glColor4ub (pick_color->red, pick_color->green,
+                  pick_color->blue, pick_color->alpha);
+    }
+  else
+    {
+      glEnable (GL_TEXTURE_2D);
+      glTexEnvi (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+      glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+    }
   glEnableClientState (GL_NORMAL_ARRAY);
   glEnableClientState (GL_VERTEX_ARRAY);
   glDisableClientState (GL_COLOR_ARRAY);
+}
+
+void
+_clutter_md2_data_end_batch (void)
+{
+  ClutterMD2DataBatch *batch = &clutter_md2_data_batch;
+
+  g_return_if_fail (batch->active);
+
+  _clutter_md2_data_end_palette ();
+  clutter_md2_data_restore_state (&batch->state);
+
+  cogl_end_gl ();
+
+  batch->active = FALSE;
+}
+
+/* Draws a weighted blend of up to CLUTTER_MD2_DATA_MAX_POSES frames
+   of a model between _clutter_md2_data_begin_batch and
+   _clutter_md2_data_end_batch. The model is placed in the geometry
+   using the extents of fit_data so that models which are attached to
+   each other line up. The transform is applied first */
+void
+_clutter_md2_data_draw_batched (ClutterMD2Data        *data,
+                                gint                   n_frames,
+                                const gint            *frame_nums,
+                                const gfloat          *weights,
+                                gint                   skin_num,
+                                ClutterMD2Data        *fit_data,
+                                const CoglMatrix      *transform,
+                                const ClutterGeometry *geom)
+{
+  ClutterMD2DataBatch *batch = &clutter_md2_data_batch;
+  ClutterMD2DataPrivate *priv = data->priv;
+  ClutterMD2DataPose poses[CLUTTER_MD2_DATA_MAX_POSES];
+  ClutterMD2DataFrame *static_frame = NULL;
+  const float *basis_positions = NULL;
+  float translate[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  int n_poses = 0;
+  guchar *gl_command;
+  float scale, center[3];
+  int i, j;
+
+  g_return_if_fail (batch->active);
+
+  if (priv->gl_commands == NULL
+      || priv->frames == NULL
+      || (!batch->pick
+          && (skin_num < 0
+              || skin_num >= priv->num_skins
+              || !priv->skins[skin_num].use_texture))
+      || geom->width == 0
+      || geom->height == 0
+      || fit_data->priv->extents.top == fit_data->priv->extents.bottom)
+    return;
+
+  for (i = 0; i < n_frames; i++)
+    {
+      ClutterMD2DataFrame *frame;
+
+      if (frame_nums[i] < 0 || frame_nums[i] >= priv->num_frames)
+        return;
+
+      /* Frames with no weight don't need to be visited at all */
+      if (weights[i] == 0.0f)
+        continue;
+
+      frame = priv->frames[frame_nums[i]];
+
+      if (priv->basis_size > 0)
+        poses[n_poses].vertices = (priv->basis_normals
+                                   + frame_nums[i] * priv->num_vertices);
+      else
+        poses[n_poses].vertices
+          = _clutter_md2_data_get_frame_vertices (data, frame_nums[i]);
+      poses[n_poses].weight = weights[i];
+      for (j = 0; j < 3; j++)
+        {
+          poses[n_poses].scale[j] = frame->scale[j] * weights[i];
+          translate[j] += frame->translate[j] * weights[i];
+        }
+      poses[n_poses].scale[3] = 0.0f;
+
+      /* Remember the frame in case it is the only one */
+      static_frame = frame;
+      n_poses++;
+    }
+
+  if (n_poses == 0)
+    return;
+
+  /* A single frame with full weight can skip the blending */
+  if (n_poses > 1 || poses[0].weight != 1.0f)
+    static_frame = NULL;
+
+  /* With a basis the frames are blended by their coefficients so all
+     of the positions are built once up front */
+  if (priv->basis_size > 0)
+    {
+      _clutter_md2_data_get_basis_positions (data, n_frames,
+                                             frame_nums, weights,
+                                             priv->basis_positions);
+      basis_positions = priv->basis_positions;
+      static_frame = NULL;
+    }
+
+  gl_command = priv->gl_commands;
+
+  /* Consecutive models with the same skin don't need to rebind it */
+  if (!batch->pick)
+    {
+      ClutterMD2DataSkin *skin = priv->skins + skin_num;
+      GLuint texture;
+
+      /* Uploading binds the new texture and evicting may delete the
+         bound one and let GL reuse its name */
+      if (skin->entry->texture == 0)
+        batch->texture = 0;
+
+      if ((texture = _clutter_md2_data_use_skin_entry (skin->entry)) == 0)
+        return;
+
+      if (skin->palette && skin->palette_texture == 0)
+        {
+          skin->palette_texture
+            = _clutter_md2_data_upload_palette (skin->palette, 0);
+          batch->texture = 0;
+        }
+
+      if (texture != batch->texture)
+        {
+          batch->texture = texture;
+          glBindTexture (GL_TEXTURE_2D, batch->texture);
+        }
+
+      if (skin->palette_texture != batch->palette_texture)
+        {
+          batch->palette_texture = skin->palette_texture;
+          _clutter_md2_data_bind_palette (skin);
+        }
+    }
 
   clutter_md2_data_set_vertex_buffer (data);
 
   glPushMatrix ();
 
-  /* Scale so that the model fits in either the width or the height of
-     the actor, whichever makes the model bigger */
-  if (((priv->extents.right - priv->extents.left)
-       / (priv->extents.bottom - priv->extents.top))
-      > geom->width / (float) geom->height)
-    /* Fit width */
-    scale = geom->width / (priv->extents.right - priv->extents.left);
-  else
-    /* Fit height */
-    scale = geom->height / (priv->extents.bottom - priv->extents.top);
+  /* The Cogl matrix stack isn't flushed inside cogl_begin_gl so each
+     instance's transform has to be given to GL directly */
+  if (transform)
+    glMultMatrixf (cogl_matrix_get_array (transform));
+
+  _clutter_md2_data_get_fit_transform (fit_data, geom, &scale, center);
 
   /* Scale about the center of the model and move to the center of the actor */
   glTranslatef (geom->width / 2,
                 geom->height / 2,
                 0);
   glScalef (scale, scale, scale);
-  glTranslatef (-(priv->extents.left + priv->extents.right) / 2,
-                -(priv->extents.top + priv->extents.bottom) / 2,
-                -(priv->extents.back + priv->extents.front) / 2);
+  glTranslatef (-center[0], -center[1], -center[2]);
+
+  while (*(gint32 *) gl_command)
+    {
+      gint32 command_len = *(gint32 *) gl_command;
+      GLfloat *vp;
+      GLenum draw_mode;
+
+      gl_command += sizeof (gint32);
+
+      if (command_len < 0)
+        {
+          draw_mode = GL_TRIANGLE_FAN;
+          command_len = -command_len;
+        }
+      else
+        draw_mode = GL_TRIANGLE_STRIP;
+
+      /* Make sure there's enough space in the vertex buffer */
+      if (command_len > priv->vertices_size)
+        {
+          guint nsize = priv->vertices_size;
+          do
+            nsize *= 2;
+          while (nsize < command_len);
+          priv->vertices = g_realloc (priv->vertices,
+                                      (priv->vertices_size = nsize)
+                                      * CLUTTER_MD2_DATA_FLOATS_PER_VERTEX
+                                      * sizeof (GLfloat));
+
+          clutter_md2_data_set_vertex_buffer (data);
+        }
+
+      vp = priv->vertices;
+
+      /* Fill the vertex buffer */
+      for (i = 0; i < command_len; i++)
+        {
+          float s, t;
+          int vertex_num;
+
+          s = *(float *) gl_command;
+          gl_command += sizeof (float);
+          t = *(float *) gl_command;
+          gl_command += sizeof (float);
+          vertex_num = *(guint32 *) gl_command;
+          gl_command += sizeof (guint32);
+
+          vp[0] = s;
+          vp[1] = t;
+
+          if (static_frame)
+            {
+              const guchar *vertex = poses[0].vertices + vertex_num * 4;
+
+              memcpy (vp + 2, _clutter_md2_norms + vertex[3] * 3,
+                      sizeof (float) * 3);
+
+              vp[5] = (vertex[0] * static_frame->scale[0]
+                       + static_frame->translate[0]);
+              vp[6] = (vertex[1] * static_frame->scale[1]
+                       + static_frame->translate[1]);
+              vp[7] = (vertex[2] * static_frame->scale[2]
+                       + static_frame->translate[2]);
+            }
+          else if (basis_positions)
+            clutter_md2_data_blend_basis_vertex (poses, n_poses,
+                                                 basis_positions,
+                                                 vertex_num, vp);
+          else
+            clutter_md2_data_blend_vertex (poses, n_poses, translate,
+                                           vertex_num, vp);
+
+          vp += CLUTTER_MD2_DATA_FLOATS_PER_VERTEX;
+        }
+
+      glDrawArrays (draw_mode, 0, command_len);
+    }
+
+  glPopMatrix ();
+}
+
+/* Renders a single model in a batch of its own */
+static void
+clutter_md2_data_real_render (ClutterMD2Data        *data,
+                              gint                   n_frames,
+                              const gint            *frame_nums,
+                              const gfloat          *weights,
+                              gint                   skin_num,
+                              const ClutterGeometry *geom)
+{
+  _clutter_md2_data_begin_batch (NULL);
+  _clutter_md2_data_draw_batched (data, n_frames, frame_nums, weights,
+                                  skin_num, data, NULL, geom);
+  _clutter_md2_data_end_batch ();
+}
+
+void
+clutter_md2_data_render (ClutterMD2Data        *data,
+                         gint                   frame_num_a,
+                         gint                   frame_num_b,
+                         gfloat                 interval,
+                         gint                   skin_num,
+                         const ClutterGeometry *geom)
+{
+  _clutter_md2_data_begin_batch (NULL);
+  clutter_md2_data_render_draw (data, frame_num_a, frame_num_b, interval,
+                                skin_num, NULL, geom);
+  _clutter_md2_data_end_batch ();
+}
+
+/* Saves the GL state and sets it up for drawing models with
+   clutter_md2_data_render_draw. This can be used in a paint handler
+   to draw many models for the cost of a single state change. Nothing
+   else should be painted until clutter_md2_data_render_end is
+   called */
+void
+clutter_md2_data_render_begin (void)
+{
+  _clutter_md2_data_begin_batch (NULL);
+}
+
+/* Draws a model between clutter_md2_data_render_begin and
+   clutter_md2_data_render_end. The model is fitted into geom and the
+   transform is multiplied with the modelview matrix if it is not
+   NULL. The skin texture is only bound when it is different from the
+   previous draw so draws should be sorted by data and skin */
+void
+clutter_md2_data_render_draw (ClutterMD2Data        *data,
+                              gint                   frame_num_a,
+                              gint                   frame_num_b,
+                              gfloat                 interval,
+                              gint                   skin_num,
+                              const CoglMatrix      *transform,
+                              const ClutterGeometry *geom)
+{
+  gint frame_nums[2] = { frame_num_a, frame_num_b };
+  gfloat weights[2] = { 1.0f - interval, interval };
+
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+  g_return_if_fail (geom != NULL);
+
+  if (frame_num_a == frame_num_b)
+    weights[0] = 1.0f;
+
+  _clutter_md2_data_draw_batched (data,
+                                  frame_num_a == frame_num_b ? 1 : 2,
+                                  frame_nums, weights,
+                                  skin_num, data, transform, geom);
+}
+
+/* Restores the GL state that was saved by
+   clutter_md2_data_render_begin */
+void
+clutter_md2_data_render_end (void)
+{
+  _clutter_md2_data_end_batch ();
+}
+
+/* Renders a weighted blend of up to CLUTTER_MD2_DATA_MAX_POSES frames
+   in a single pass over the vertices. The weights should normally add
+   up to 1 */
+void
+clutter_md2_data_render_blend (ClutterMD2Data        *data,
+                               gint                   n_frames,
+                               const gint            *frame_nums,
+                               const gfloat          *weights,
+                               gint                   skin_num,
+                               const ClutterGeometry *geom)
+{
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+  g_return_if_fail (n_frames >= 1 && n_frames <= CLUTTER_MD2_DATA_MAX_POSES);
+  g_return_if_fail (frame_nums != NULL && weights != NULL);
+
+  clutter_md2_data_real_render (data, n_frames, frame_nums, weights,
+                                skin_num, geom);
+}
+
+gint
+clutter_md2_data_get_n_skins (ClutterMD2Data *data)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), 0);
+
+  return data->priv->num_skins;
+}
+
+gint
+clutter_md2_data_get_n_frames (ClutterMD2Data *data)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), 0);
+
+  return data->priv->num_frames;
+}
+
+const gchar *
+clutter_md2_data_get_frame_name (ClutterMD2Data *data, gint frame_num)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), NULL);
+  g_return_val_if_fail (frame_num >= 0
+                        && frame_num < data->priv->num_frames,
+                        NULL);
+
+  return data->priv->frames[frame_num]->name;
+}
+
+/* These only affect skins that are added after the property is
+   changed */
+void
+clutter_md2_data_set_upload_skins (ClutterMD2Data *data,
+                                   gboolean        upload_skins)
+{
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+
+  if (data->priv->upload_skins != !!upload_skins)
+    {
+      data->priv->upload_skins = !!upload_skins;
+
+      g_object_notify (G_OBJECT (data), "upload_skins");
+    }
+}
+
+gboolean
+clutter_md2_data_get_upload_skins (ClutterMD2Data *data)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), FALSE);
+
+  return data->priv->upload_skins;
+}
+
+void
+clutter_md2_data_set_keep_skin_pixels (ClutterMD2Data *data,
+                                       gboolean        keep_skin_pixels)
+{
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+
+  if (data->priv->keep_skin_pixels != !!keep_skin_pixels)
+    {
+      data->priv->keep_skin_pixels = !!keep_skin_pixels;
+
+      g_object_notify (G_OBJECT (data), "keep_skin_pixels");
+    }
+}
+
+gboolean
+clutter_md2_data_get_keep_skin_pixels (ClutterMD2Data *data)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), FALSE);
+
+  return data->priv->keep_skin_pixels;
+}
+
+void
+clutter_md2_data_set_indexed_skins (ClutterMD2Data *data,
+                                    gboolean        indexed_skins)
+{
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+
+  if (data->priv->indexed_skins != !!indexed_skins)
+    {
+      data->priv->indexed_skins = !!indexed_skins;
+
+      g_object_notify (G_OBJECT (data), "indexed_skins");
+    }
+}
+
+gboolean
+clutter_md2_data_get_indexed_skins (ClutterMD2Data *data)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), FALSE);
+
+  return data->priv->indexed_skins;
+}
+
+/* Only affects skins that are added afterwards */
+void
+clutter_md2_data_set_mipmap_skins (ClutterMD2Data *data,
+                                   gboolean        mipmap_skins)
+{
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+
+  if (data->priv->mipmap_skins != !!mipmap_skins)
+    {
+      data->priv->mipmap_skins = !!mipmap_skins;
+
+      g_object_notify (G_OBJECT (data), "mipmap_skins");
+    }
+}
+
+gboolean
+clutter_md2_data_get_mipmap_skins (ClutterMD2Data *data)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), FALSE);
+
+  return data->priv->mipmap_skins;
+}
+
+/* Only affects skins that are added afterwards. Skins whose pixels
+   are kept and indexed skins are still decoded straight away. The
+   texture bytes of a skin aren't known until it has loaded */
+void
+clutter_md2_data_set_progressive_skins (ClutterMD2Data *data,
+                                        gboolean        progressive_skins)
+{
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+
+  if (data->priv->progressive_skins != !!progressive_skins)
+    {
+      data->priv->progressive_skins = !!progressive_skins;
+
+      g_object_notify (G_OBJECT (data), "progressive_skins");
+    }
+}
+
+gboolean
+clutter_md2_data_get_progressive_skins (ClutterMD2Data *data)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), FALSE);
+
+  return data->priv->progressive_skins;
+}
+
+/* The impostor atlases need the skin pixels so the size should be set
+   before any skins are loaded. Changing either setting throws away
+   any atlases that were already rendered */
+void
+clutter_md2_data_set_impostor_size (ClutterMD2Data *data,
+                                    gint            impostor_size)
+{
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+  g_return_if_fail (impostor_size >= 0);
+
+  if (data->priv->impostor_size != impostor_size)
+    {
+      _clutter_md2_data_free_impostors (data);
+      data->priv->impostor_size = impostor_size;
+
+      g_object_notify (G_OBJECT (data), "impostor_size");
+    }
+}
+
+gint
+clutter_md2_data_get_impostor_size (ClutterMD2Data *data)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), 0);
+
+  return data->priv->impostor_size;
+}
+
+void
+clutter_md2_data_set_impostor_angles (ClutterMD2Data *data,
+                                      gint            impostor_angles)
+{
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+  g_return_if_fail (impostor_angles >= 1);
 
-  while (*(gint32 *) gl_command)
+  if (data->priv->impostor_angles != impostor_angles)
     {
-      gint32 command_len = *(gint32 *) gl_command;
-      GLfloat *vp;
-      GLenum draw_mode;
-      int i;
+      _clutter_md2_data_free_impostors (data);
+      data->priv->impostor_angles = impostor_angles;
 
-      gl_command += sizeof (gint32);
+      g_object_notify (G_OBJECT (data), "impostor_angles");
+    }
+}
 
-      if (command_len < 0)
-        {
-          draw_mode = GL_TRIANGLE_FAN;
-          command_len = -command_len;
-        }
-      else
-        draw_mode = GL_TRIANGLE_STRIP;
+gint
+clutter_md2_data_get_impostor_angles (ClutterMD2Data *data)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), 0);
 
-      /* Make sure there's enough space in the vertex buffer */
-      if (command_len > priv->vertices_size)
-        {
-          guint nsize = priv->vertices_size;
-          do
-            nsize *= 2;
-          while (nsize < command_len);
-          priv->vertices = g_realloc (priv->vertices,
-                                      (priv->vertices_size = nsize)
-                                      * CLUTTER_MD2_DATA_FLOATS_PER_VERTEX
-                                      * sizeof (GLfloat));
+  return data->priv->impostor_angles;
+}
 
-          clutter_md2_data_set_vertex_buffer (data);
-        }
+/* This only affects models that are loaded afterwards */
+void
+clutter_md2_data_set_frame_tolerance (ClutterMD2Data *data,
+                                      gfloat          tolerance)
+{
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
 
-      vp = priv->vertices;
+  if (tolerance < 0.0f)
+    tolerance = -1.0f;
 
-      /* Fill the vertex buffer */
-      for (i = 0; i < command_len; i++)
-        {
-          float s, t;
-          int vertex_num;
+  if (data->priv->frame_tolerance != tolerance)
+    {
+      data->priv->frame_tolerance = tolerance;
 
-          s = *(float *) gl_command;
-          gl_command += sizeof (float);
-          t = *(float *) gl_command;
-          gl_command += sizeof (float);
-          vertex_num = *(guint32 *) gl_command;
-          gl_command += sizeof (guint32);
+      g_object_notify (G_OBJECT (data), "frame_tolerance");
+    }
+}
 
-          *(vp++) = s;
-          *(vp++) = t;
+gfloat
+clutter_md2_data_get_frame_tolerance (ClutterMD2Data *data)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), -1.0f);
 
-          if (frame_a == frame_b)
-            {
-              guchar *vertex = vertices_a + vertex_num * 4;
+  return data->priv->frame_tolerance;
+}
 
-              memcpy (vp, _clutter_md2_norms + vertex[3] * 3,
-                      sizeof (float) * 3);
-              vp += 3;
+/* This only affects models that are loaded afterwards. If it is set
+   then the frame tolerance is ignored */
+void
+clutter_md2_data_set_basis_tolerance (ClutterMD2Data *data,
+                                      gfloat          tolerance)
+{
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
 
-              *(vp++) = vertex[0] * frame_a->scale[0] + frame_a->translate[0];
-              *(vp++) = vertex[1] * frame_a->scale[1] + frame_a->translate[1];
-              *(vp++) = vertex[2] * frame_a->scale[2] + frame_a->translate[2];
-            }
-          else
-            {
-              guchar *vertex_ap = vertices_a + vertex_num * 4;
-              guchar *vertex_bp = vertices_b + vertex_num * 4;
-              const float *norm_a = _clutter_md2_norms + vertex_ap[3] * 3;
-              const float *norm_b = _clutter_md2_norms + vertex_bp[3] * 3;
-              float vert_a[] = {
-                vertex_ap[0] * frame_a->scale[0] + frame_a->translate[0],
-                vertex_ap[1] * frame_a->scale[1] + frame_a->translate[1],
-                vertex_ap[2] * frame_a->scale[2] + frame_a->translate[2]
-              };
-              float vert_b[] = {
-                vertex_bp[0] * frame_b->scale[0] + frame_b->translate[0],
-                vertex_bp[1] * frame_b->scale[1] + frame_b->translate[1],
-                vertex_bp[2] * frame_b->scale[2] + frame_b->translate[2]
-              };
-
-              *(vp++) = norm_a[0] + (norm_b[0] - norm_a[0]) * interval;
-              *(vp++) = norm_a[1] + (norm_b[1] - norm_a[1]) * interval;
-              *(vp++) = norm_a[2] + (norm_b[2] - norm_a[2]) * interval;
-
-              *(vp++) = vert_a[0] + (vert_b[0] - vert_a[0]) * interval;
-              *(vp++) = vert_a[1] + (vert_b[1] - vert_a[1]) * interval;
-              *(vp++) = vert_a[2] + (vert_b[2] - vert_a[2]) * interval;
-            }
-        }
+  if (tolerance < 0.0f)
+    tolerance = -1.0f;
 
-      glDrawArrays (draw_mode, 0, command_len);
+  if (data->priv->basis_tolerance != tolerance)
+    {
+      data->priv->basis_tolerance = tolerance;
+
+      g_object_notify (G_OBJECT (data), "basis_tolerance");
     }
+}
 
-  glPopMatrix ();
+gfloat
+clutter_md2_data_get_basis_tolerance (ClutterMD2Data *data)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), -1.0f);
 
-  clutter_md2_data_restore_state (&state);
+  return data->priv->basis_tolerance;
+}
 
-  cogl_end_gl ();
+void
+clutter_md2_data_set_max_basis_size (ClutterMD2Data *data,
+                                     gint            max_size)
+{
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+  g_return_if_fail (max_size >= 1
+                    && max_size <= CLUTTER_MD2_DATA_MAX_BASIS_SIZE);
+
+  if (data->priv->max_basis_size != max_size)
+    {
+      data->priv->max_basis_size = max_size;
+
+      g_object_notify (G_OBJECT (data), "max_basis_size");
+    }
 }
 
 gint
-clutter_md2_data_get_n_skins (ClutterMD2Data *data)
+clutter_md2_data_get_max_basis_size (ClutterMD2Data *data)
 {
   g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), 0);
 
-  return data->priv->num_skins;
+  return data->priv->max_basis_size;
 }
 
-gint
-clutter_md2_data_get_n_frames (ClutterMD2Data *data)
+/* This only affects models that are loaded afterwards. Streamed
+   frames can't be compressed so the frame and basis tolerances are
+   ignored while it is set */
+void
+clutter_md2_data_set_frame_budget (ClutterMD2Data *data,
+                                   guint           budget)
+{
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+
+  if (data->priv->frame_budget != budget)
+    {
+      data->priv->frame_budget = budget;
+
+      g_object_notify (G_OBJECT (data), "frame_budget");
+    }
+}
+
+guint
+clutter_md2_data_get_frame_budget (ClutterMD2Data *data)
 {
   g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), 0);
 
-  return data->priv->num_frames;
+  return data->priv->frame_budget;
 }
 
-const gchar *
-clutter_md2_data_get_frame_name (ClutterMD2Data *data, gint frame_num)
+/* Returns the number of principal components that the frames of the
+   loaded model are built from or 0 if they are stored directly */
+gint
+clutter_md2_data_get_basis_size (ClutterMD2Data *data)
 {
-  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), NULL);
-  g_return_val_if_fail (frame_num >= 0
-                        && frame_num < data->priv->num_frames,
-                        NULL);
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), 0);
 
-  return data->priv->frames[frame_num]->name;
+  return data->priv->basis_size;
 }
 
 void
@@ -641,6 +1510,88 @@ clutter_md2_data_next_p2 (gint a)
   return rval;
 }
 
+/* Breaks the strips and fans of the validated GL commands down into a
+   plain triangle list */
+static gboolean
+clutter_md2_data_build_triangles (ClutterMD2Data *data,
+                                  const gchar *display_name,
+                                  GError **error)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  guchar *p;
+  guint32 *tri;
+  int num_triangles = 0;
+
+  for (p = priv->gl_commands; *(gint32 *) p; )
+    {
+      gint32 command_len = ABS (*(gint32 *) p);
+
+      /* Commands with fewer than three vertices are valid but don't
+         make any triangles */
+      num_triangles += MAX (command_len - 2, 0);
+      p += sizeof (gint32) + command_len * (sizeof (float) * 2
+                                            + sizeof (guint32));
+    }
+
+  if (priv->triangles)
+    g_free (priv->triangles);
+
+  priv->num_triangles = 0;
+
+  if ((priv->triangles = clutter_md2_data_check_malloc
+       (display_name, sizeof (guint32) * 3 * num_triangles,
+        error)) == NULL)
+    return FALSE;
+
+  tri = priv->triangles;
+
+  for (p = priv->gl_commands; *(gint32 *) p; )
+    {
+      gint32 command_len = *(gint32 *) p;
+      gboolean is_fan = command_len < 0;
+      guint32 *command_vertices;
+      int i;
+
+      command_len = ABS (command_len);
+      p += sizeof (gint32);
+
+      if (command_len < 3)
+        {
+          p += command_len * (sizeof (float) * 2 + sizeof (guint32));
+          continue;
+        }
+
+      /* The vertex number is the third word of each vertex */
+      command_vertices = (guint32 *) p + 2;
+
+      for (i = 0; i + 2 < command_len; i++)
+        {
+          if (is_fan)
+            {
+              tri[0] = command_vertices[0];
+              tri[1] = command_vertices[(i + 1) * 3];
+            }
+          else
+            {
+              tri[0] = command_vertices[i * 3];
+              tri[1] = command_vertices[(i + 1) * 3];
+            }
+          tri[2] = command_vertices[(i + 2) * 3];
+
+          /* Skip degenerate triangles */
+          if (tri[0] != tri[1] && tri[1] != tri[2] && tri[2] != tri[0])
+            {
+              tri += 3;
+              priv->num_triangles++;
+            }
+        }
+
+      p += command_len * (sizeof (float) * 2 + sizeof (guint32));
+    }
+
+  return TRUE;
+}
+
 static gboolean
 clutter_md2_data_load_gl_commands (ClutterMD2Data *data, FILE *file,
                                    const gchar *display_name,
@@ -652,12 +1603,25 @@ clutter_md2_data_load_gl_commands (ClutterMD2Data *data, FILE *file,
   ClutterMD2DataPrivate *priv = data->priv;
   guchar *p;
   int byte_len = num_commands * sizeof (guint32);
-  guint32 texture_width, texture_height;
+  gboolean scale_tex_coords;
+
+  /* If GL can't use textures of any size then the skins are padded
+     to a power of two so we may need to scale the texture
+     coordinates */
+  if (priv->upload_skins
+      && cogl_features_available (COGL_FEATURE_TEXTURE_NPOT))
+    {
+      priv->texture_width = MAX (priv->skin_width, 1);
+      priv->texture_height = MAX (priv->skin_height, 1);
+    }
+  else
+    {
+      priv->texture_width = clutter_md2_data_next_p2 (priv->skin_width);
+      priv->texture_height = clutter_md2_data_next_p2 (priv->skin_height);
+    }
 
-  /* The textures are always power of two sized so we may need to
-     scale the texture coordinates */
-  texture_width = clutter_md2_data_next_p2 (priv->skin_width);
-  texture_height = clutter_md2_data_next_p2 (priv->skin_height);
+  scale_tex_coords = (priv->texture_width != priv->skin_width
+                      || priv->texture_height != priv->skin_height);
 
   if (!clutter_md2_data_seek (file, file_offset, display_name, error))
     return FALSE;
@@ -704,10 +1668,14 @@ clutter_md2_data_load_gl_commands (ClutterMD2Data *data, FILE *file,
           guint32 vertex_num;
 
           /* Scale the texture coordinates */
-          *(float *) p *= priv->skin_width / (float) texture_width;
-          p += sizeof (float);
-          *(float *) p *= priv->skin_height / (float) texture_height;
-          p += sizeof (float);
+          if (scale_tex_coords)
+            {
+              ((float *) p)[0] *= (priv->skin_width
+                                   / (float) priv->texture_width);
+              ((float *) p)[1] *= (priv->skin_height
+                                   / (float) priv->texture_height);
+            }
+          p += sizeof (float) * 2;
 
           *(guint32 *) p = vertex_num = GUINT32_FROM_LE (*(guint32 *) p);
           p += sizeof (guint32);
@@ -741,11 +1709,14 @@ clutter_md2_data_load_gl_commands (ClutterMD2Data *data, FILE *file,
       return FALSE;
     }
 
-  return TRUE;
+  priv->num_vertices = num_vertices;
+
+  return clutter_md2_data_build_triangles (data, display_name, error);
 }
 
 static gboolean
 clutter_md2_data_load_frames (ClutterMD2Data *data, FILE *file,
+                              const gchar *filename,
                               const gchar *display_name,
                               guint32 num_frames,
                               guint32 num_vertices,
@@ -753,8 +1724,18 @@ clutter_md2_data_load_frames (ClutterMD2Data *data, FILE *file,
                               GError **error)
 {
   ClutterMD2DataPrivate *priv = data->priv;
+  gsize frame_header_size;
   int i;
 
+  /* The name tables and caches refer to the old frames */
+  _clutter_md2_data_free_sequences (data);
+  _clutter_md2_data_free_frame_cache (data);
+  _clutter_md2_data_free_basis (data);
+  _clutter_md2_data_close_stream (data);
+
+  priv->n_page_ins = 0;
+  priv->n_prefetched = 0;
+
   if (priv->frames)
     {
       for (i = 0; i < priv->num_frames; i++)
@@ -781,21 +1762,31 @@ clutter_md2_data_load_frames (ClutterMD2Data *data, FILE *file,
 
   for (i = 0; i < num_frames; i++)
     {
-      guchar data[sizeof (float) * 6 + CLUTTER_MD2_DATA_MAX_FRAME_NAME_LEN + 1];
-      guchar *p = data;
+      guchar header[sizeof (float) * 6
+                    + CLUTTER_MD2_DATA_MAX_FRAME_NAME_LEN + 1];
+      guchar *p = header;
       ClutterMD2DataFrame *frame;
 
-      if (!clutter_md2_data_read (data, sizeof (data), file,
-                             display_name, error))
+      if (!clutter_md2_data_read (header, sizeof (header), file,
+                                  display_name, error))
         return FALSE;
 
+      frame_header_size = sizeof (header);
+
       priv->frames[i] = clutter_md2_data_check_malloc
-        (display_name, sizeof (ClutterMD2DataFrame) + num_vertices * 4, error);
+        (display_name,
+         G_STRUCT_OFFSET (ClutterMD2DataFrame, vertex_data)
+         + num_vertices * 4, error);
 
       if (priv->frames[i] == NULL)
         return FALSE;
 
       frame = priv->frames[i];
+      frame->vertices = frame->vertex_data;
+      frame->offset = (file_offset + frame_header_size
+                       + i * (frame_header_size + num_vertices * 4));
+      frame->lru_link = NULL;
+      frame->prefetching = FALSE;
 
       memcpy (frame->scale, p, sizeof (float) * 3);
       p += sizeof (float) * 3;
@@ -864,8 +1855,27 @@ clutter_md2_data_load_frames (ClutterMD2Data *data, FILE *file,
         priv->extents.back = frame->extents.back;
       if (frame->extents.front > priv->extents.front)
         priv->extents.front = frame->extents.front;
+
+      /* When streaming, only the header is kept */
+      if (priv->frame_budget > 0)
+        {
+          frame = g_realloc (frame, G_STRUCT_OFFSET (ClutterMD2DataFrame,
+                                                     vertex_data));
+          frame->vertices = NULL;
+          priv->frames[i] = frame;
+        }
     }
 
+  if (priv->frame_budget > 0
+      && !_clutter_md2_data_open_stream (data, filename, display_name, error))
+    return FALSE;
+
+  _clutter_md2_data_build_sequences (data);
+
+  /* Sequences are needed first so that frames aren't reconstructed
+     across the boundary between two animations */
+  _clutter_md2_data_compress_frames (data);
+
   return TRUE;
 }
 
@@ -875,10 +1885,9 @@ clutter_md2_data_real_add_skin (ClutterMD2Data *data,
                                 GError **error)
 {
   ClutterMD2DataPrivate *priv;
-  GdkPixbuf *pixbuf;
-  int bpp, rowstride, alignment = 1;
-  guint texture_width, texture_height;
-  int image_width, image_height;
+  ClutterMD2DataSkinEntry *entry;
+  gboolean keep_pixels, indexed, progressive;
+  ClutterMD2DataSkin *skin;
 
   g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
@@ -886,114 +1895,63 @@ clutter_md2_data_real_add_skin (ClutterMD2Data *data,
 
   priv = data->priv;
 
-  /* The textures should always be a power of two */
-  texture_width = clutter_md2_data_next_p2 (priv->skin_width);
-  texture_height = clutter_md2_data_next_p2 (priv->skin_height);
-
-  pixbuf = gdk_pixbuf_new_from_file (filename, error);
-
-  if (pixbuf == NULL)
+  /* Keep the padded image around for the software renderer and the
+     impostor atlases */
+  keep_pixels = priv->keep_skin_pixels || priv->impostor_size > 0;
+
+  /* Indexed skins are stored as RGB if GL can't look up the palette */
+  indexed = (priv->indexed_skins
+             && (!priv->upload_skins
+                 || _clutter_md2_data_indexed_skins_supported ()));
+
+  /* The palette and the kept pixels are needed straight away so only
+     skins that are just uploaded can be decoded in the background */
+  progressive = (priv->progressive_skins && priv->upload_skins
+                 && !keep_pixels && !indexed);
+
+  entry = _clutter_md2_data_get_skin_entry (filename,
+                                            priv->texture_width,
+                                            priv->texture_height,
+                                            priv->upload_skins, keep_pixels,
+                                            indexed,
+                                            priv->upload_skins
+                                            && priv->mipmap_skins,
+                                            progressive,
+                                            error);
+  if (entry == NULL)
     return FALSE;
 
-  image_width = gdk_pixbuf_get_width (pixbuf);
-  image_height = gdk_pixbuf_get_height (pixbuf);
-  bpp = gdk_pixbuf_get_has_alpha (pixbuf) ? 4 : 3;
-  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-
-  /* If the pixmap isn't the same size as the texture then create a
-     new pixbuf and set a subregion of it */
-  if (image_width != texture_width || image_height != texture_height)
-    {
-      GdkPixbuf *pixbuf_tmp;
-
-      pixbuf_tmp = gdk_pixbuf_new (GDK_COLORSPACE_RGB,
-                                   gdk_pixbuf_get_has_alpha (pixbuf),
-                                   gdk_pixbuf_get_bits_per_sample (pixbuf),
-                                   texture_width, texture_height);
-
-      gdk_pixbuf_copy_area (pixbuf, 0, 0,
-                            MIN (texture_width, image_width),
-                            MIN (texture_height, image_height),
-                            pixbuf_tmp, 0, 0);
-
-      g_object_unref (pixbuf);
-      pixbuf = pixbuf_tmp;
-      rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-
-      /* If the new pixbuf is bigger than the old one then copy in the
-         pixels at the edges so there won't be artifacts if the
-         texture is linear filtered */
-      if (image_height < texture_height)
-        {
-          int row;
-          guchar *dst = gdk_pixbuf_get_pixels (pixbuf)
-            + rowstride * image_height;
-          const guchar *src = dst - rowstride;
-
-          for (row = image_height; row < texture_height; row++)
-            {
-              memcpy (dst, src, image_width * bpp);
-              dst += rowstride;
-            }
-        }
-      if (image_width < texture_width)
-        {
-          int row, col;
-          guchar *dst = gdk_pixbuf_get_pixels (pixbuf) + bpp * image_width;
-          const guchar *src = dst - bpp;
-
-          for (row = 0; row < texture_height; row++)
-            {
-              for (col = texture_width - image_width; col > 0; col--)
-                {
-                  memcpy (dst, src, bpp);
-                  dst += bpp;
-                }
-              dst += rowstride - (texture_width - image_width) * bpp;
-              src += rowstride;
-            }
-        }
-    }
-
-  while ((rowstride & 1) == 0 && alignment < 8)
-    {
-      rowstride >>= 1;
-      alignment <<= 1;
-    }
-
-  if (priv->num_skins >= priv->textures_size)
+  if (priv->num_skins >= priv->skins_size)
     {
-      if (priv->textures_size == 0)
-        priv->textures = g_malloc (++priv->textures_size * sizeof (GLuint));
+      if (priv->skins_size == 0)
+        priv->skins = g_malloc (++priv->skins_size
+                                * sizeof (ClutterMD2DataSkin));
       else
-        priv->textures = g_realloc (priv->textures,
-                                    (priv->textures_size *= 2)
-                                    * sizeof (GLuint));
+        priv->skins = g_realloc (priv->skins,
+                                 (priv->skins_size *= 2)
+                                 * sizeof (ClutterMD2DataSkin));
     }
 
-  glGenTextures (1, priv->textures + priv->num_skins);
-  glBindTexture (GL_TEXTURE_2D, priv->textures[priv->num_skins++]);
-#ifdef GL_UNPACK_ROW_LENGTH
-  glPixelStorei (GL_UNPACK_ROW_LENGTH,
-                 gdk_pixbuf_get_rowstride (pixbuf) / bpp);
-#endif
-  glPixelStorei (GL_UNPACK_ALIGNMENT, alignment);
+  skin = priv->skins + priv->num_skins++;
+  skin->entry = entry;
+  skin->use_texture = priv->upload_skins;
+  skin->pixbuf = NULL;
+  skin->indices = NULL;
+  skin->palette = NULL;
+  skin->palette_texture = 0;
 
-  glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  if (entry->indexed)
+    {
+      skin->palette = g_memdup (entry->palette, CLUTTER_MD2_DATA_PALETTE_SIZE);
 
-  glTexImage2D (GL_TEXTURE_2D, 0,
-                gdk_pixbuf_get_has_alpha (pixbuf) ? GL_RGBA : GL_RGB,
-                gdk_pixbuf_get_width (pixbuf),
-                gdk_pixbuf_get_height (pixbuf),
-                0,
-                gdk_pixbuf_get_has_alpha (pixbuf) ? GL_RGBA : GL_RGB,
-                GL_UNSIGNED_BYTE,
-                gdk_pixbuf_get_pixels (pixbuf));
+      if (keep_pixels)
+        skin->indices = g_byte_array_ref (entry->indices);
+    }
+  else if (keep_pixels)
+    skin->pixbuf = g_object_ref (entry->pixbuf);
 
-  g_object_unref (pixbuf);
+  if (entry->loading)
+    _clutter_md2_data_wait_for_skin_entry (entry, data, priv->num_skins - 1);
 
   return TRUE;
 }
@@ -1013,6 +1971,126 @@ clutter_md2_data_add_skin (ClutterMD2Data *data,
   return FALSE;
 }
 
+/* Returns the 256 RGB entries of the palette of an indexed skin or
+   NULL if the skin isn't indexed */
+const guchar *
+clutter_md2_data_get_skin_palette (ClutterMD2Data *data,
+                                   gint            skin_num)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), NULL);
+  g_return_val_if_fail (skin_num >= 0 && skin_num < data->priv->num_skins,
+                        NULL);
+
+  return data->priv->skins[skin_num].palette;
+}
+
+/* Only the palette is uploaded again so this is a cheap way to
+   recolour a model, for example for team colours. Other models that
+   share the skin image keep their own palette */
+void
+clutter_md2_data_set_skin_palette (ClutterMD2Data *data,
+                                   gint            skin_num,
+                                   const guchar   *palette)
+{
+  ClutterMD2DataPrivate *priv;
+  ClutterMD2DataSkin *skin;
+
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+  g_return_if_fail (skin_num >= 0 && skin_num < data->priv->num_skins);
+  g_return_if_fail (palette != NULL);
+
+  priv = data->priv;
+  skin = priv->skins + skin_num;
+
+  g_return_if_fail (skin->palette != NULL);
+
+  memcpy (skin->palette, palette, CLUTTER_MD2_DATA_PALETTE_SIZE);
+
+  if (skin->palette_texture)
+    _clutter_md2_data_upload_palette (skin->palette, skin->palette_texture);
+
+  /* The atlases were rendered with the old colours */
+  if (skin->indices)
+    _clutter_md2_data_free_impostors (data);
+
+  g_signal_emit (data, data_signals[SKIN_CHANGED], 0, skin_num);
+}
+
+/* Returns TRUE while a progressive skin is still being decoded in the
+   background. "skin-changed" is emitted when it is ready */
+gboolean
+clutter_md2_data_is_skin_loading (ClutterMD2Data *data,
+                                  gint            skin_num)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), FALSE);
+  g_return_val_if_fail (skin_num >= 0 && skin_num < data->priv->num_skins,
+                        FALSE);
+
+  return data->priv->skins[skin_num].entry->loading;
+}
+
+void
+_clutter_md2_data_emit_skin_changed (ClutterMD2Data *data,
+                                     gint            skin_num)
+{
+  g_signal_emit (data, data_signals[SKIN_CHANGED], 0, skin_num);
+}
+
+/* Textures that are shared with other models are included and so are
+   skins that aren't resident because they haven't been drawn yet or
+   were evicted */
+gsize
+clutter_md2_data_get_skin_texture_bytes (ClutterMD2Data *data)
+{
+  ClutterMD2DataPrivate *priv;
+  gsize bytes = 0;
+  int i;
+
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), 0);
+
+  priv = data->priv;
+
+  for (i = 0; i < priv->num_skins; i++)
+    {
+      const ClutterMD2DataSkin *skin = priv->skins + i;
+
+      if (skin->use_texture)
+        {
+          bytes += skin->entry->texture_bytes;
+          if (skin->palette)
+            bytes += CLUTTER_MD2_DATA_PALETTE_SIZE;
+        }
+    }
+
+  return bytes;
+}
+
+static void
+clutter_md2_data_free_skins (ClutterMD2Data *data)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  int i;
+
+  for (i = 0; i < priv->num_skins; i++)
+    {
+      ClutterMD2DataSkin *skin = priv->skins + i;
+
+      if (skin->pixbuf)
+        g_object_unref (skin->pixbuf);
+      if (skin->indices)
+        g_byte_array_unref (skin->indices);
+      if (skin->palette_texture)
+        glDeleteTextures (1, &skin->palette_texture);
+      g_free (skin->palette);
+      _clutter_md2_data_release_skin_entry (skin->entry, skin->use_texture);
+    }
+
+  priv->num_skins = 0;
+  /* Skins that finish loading in the background no longer belong to
+     this model */
+  priv->skin_generation++;
+}
+
 static gboolean
 clutter_md2_data_load_skins (ClutterMD2Data *data, FILE *file,
                              const gchar *file_name,
@@ -1021,13 +2099,9 @@ clutter_md2_data_load_skins (ClutterMD2Data *data, FILE *file,
                              guint32 file_offset,
                              GError **error)
 {
-  ClutterMD2DataPrivate *priv = data->priv;
   int i;
 
-  if (priv->textures)
-      glDeleteTextures (priv->num_skins, priv->textures);
-
-  priv->num_skins = 0;
+  clutter_md2_data_free_skins (data);
 
   if (!clutter_md2_data_seek (file, file_offset, display_name, error))
     return FALSE;
@@ -1071,6 +2145,20 @@ clutter_md2_data_free_data (ClutterMD2Data *data)
       priv->gl_commands = NULL;
     }
 
+  if (priv->triangles)
+    {
+      g_free (priv->triangles);
+      priv->triangles = NULL;
+    }
+
+  priv->num_triangles = 0;
+
+  _clutter_md2_data_free_bvh (data);
+  _clutter_md2_data_free_sequences (data);
+  _clutter_md2_data_free_frame_cache (data);
+  _clutter_md2_data_free_basis (data);
+  _clutter_md2_data_close_stream (data);
+
   if (priv->frames)
     {
       int i;
@@ -1086,17 +2174,17 @@ clutter_md2_data_free_data (ClutterMD2Data *data)
 
   priv->num_frames = 0;
 
-  if (priv->textures)
-    {
-      glDeleteTextures (priv->num_skins, priv->textures);
+  _clutter_md2_data_free_impostors (data);
 
-      g_free (priv->textures);
+  clutter_md2_data_free_skins (data);
 
-      priv->textures = NULL;
-      priv->textures_size = 0;
-    }
+  if (priv->skins)
+    {
+      g_free (priv->skins);
 
-  priv->num_skins = 0;
+      priv->skins = NULL;
+      priv->skins_size = 0;
+    }
 }
 
 gboolean
@@ -1115,6 +2203,11 @@ clutter_md2_data_load (ClutterMD2Data *data,
 
   priv = data->priv;
 
+  /* The ray casting data and the impostors depend on the frames so
+     they will need to be rebuilt */
+  _clutter_md2_data_free_bvh (data);
+  _clutter_md2_data_free_impostors (data);
+
   display_name = g_filename_display_name (filename);
 
   if ((file = g_fopen (filename, "rb")) == NULL)
@@ -1188,7 +2281,7 @@ clutter_md2_data_load (ClutterMD2Data *data,
                     error))
             ret = FALSE;
           else if (!clutter_md2_data_load_frames
-                   (data, file, display_name,
+                   (data, file, filename, display_name,
                     header[CLUTTER_MD2_DATA_HEADER_NUM_FRAMES],
                     header[CLUTTER_MD2_DATA_HEADER_NUM_VERTICES],
                     header[CLUTTER_MD2_DATA_HEADER_OFFSET_FRAMES],
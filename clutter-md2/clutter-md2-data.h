@@ -27,6 +27,7 @@
 #define __CLUTTER_MD2_DATA_H__
 
 #include <glib-object.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
 
 G_BEGIN_DECLS
 
@@ -47,6 +48,9 @@ G_BEGIN_DECLS
   (G_TYPE_INSTANCE_GET_CLASS ((obj), CLUTTER_TYPE_MD2_DATA,     \
                               ClutterMD2DataClass))
 
+/* Maximum number of frames that can be blended in one render */
+#define CLUTTER_MD2_DATA_MAX_POSES 4
+
 typedef enum {
   CLUTTER_MD2_DATA_ERROR_INVALID_FILE,
   CLUTTER_MD2_DATA_ERROR_BAD_VERSION
@@ -59,6 +63,9 @@ typedef struct _ClutterMD2Data ClutterMD2Data;
 typedef struct _ClutterMD2DataPrivate ClutterMD2DataPrivate;
 typedef struct _ClutterMD2DataClass ClutterMD2DataClass;
 typedef struct _ClutterMD2DataExtents ClutterMD2DataExtents;
+typedef struct _ClutterMD2DataRay ClutterMD2DataRay;
+typedef struct _ClutterMD2DataHit ClutterMD2DataHit;
+typedef struct _ClutterMD2DataBuffer ClutterMD2DataBuffer;
 
 struct _ClutterMD2Data
 {
@@ -73,6 +80,8 @@ struct _ClutterMD2DataClass
 
   /* signals */
   void (* data_changed) (ClutterMD2Data *data);
+  void (* skin_changed) (ClutterMD2Data *data,
+                         gint            skin_num);
 };
 
 struct _ClutterMD2DataExtents
@@ -82,6 +91,37 @@ struct _ClutterMD2DataExtents
   float back, front;
 };
 
+/* A ray in the same coordinate space as the extents. The direction
+   does not need to be normalized */
+struct _ClutterMD2DataRay
+{
+  float origin[3];
+  float direction[3];
+};
+
+struct _ClutterMD2DataHit
+{
+  /* Distance along the ray in multiples of the ray direction */
+  float distance;
+  /* Index of the triangle that was hit */
+  gint triangle;
+  /* Point of intersection */
+  float position[3];
+};
+
+/* A buffer in system memory for the software renderer. The pixels
+   are stored as RGBA with four bytes per pixel. The depth buffer has
+   one float per pixel where larger values are closer to the
+   viewer. It can be NULL in which case a temporary cleared buffer
+   is used */
+struct _ClutterMD2DataBuffer
+{
+  gint width, height;
+  gint rowstride;
+  guchar *pixels;
+  gfloat *depth;
+};
+
 GType clutter_md2_data_get_type (void) G_GNUC_CONST;
 GType clutter_md2_data_extents_get_type (void) G_GNUC_CONST;
 
@@ -97,11 +137,34 @@ gboolean clutter_md2_data_add_skin (ClutterMD2Data  *md2,
 
 gint clutter_md2_data_get_n_skins (ClutterMD2Data *md2);
 
+const guchar *clutter_md2_data_get_skin_palette (ClutterMD2Data *data,
+                                                 gint            skin_num);
+void clutter_md2_data_set_skin_palette (ClutterMD2Data *data,
+                                        gint            skin_num,
+                                        const guchar   *palette);
+gboolean clutter_md2_data_is_skin_loading (ClutterMD2Data *data,
+                                           gint            skin_num);
+gsize clutter_md2_data_get_skin_texture_bytes (ClutterMD2Data *data);
+
 gint clutter_md2_data_get_n_frames (ClutterMD2Data *md2);
 
 const gchar *clutter_md2_data_get_frame_name (ClutterMD2Data *md2,
                                               gint            frame_num);
 
+gint clutter_md2_data_get_frame_by_name (ClutterMD2Data *data,
+                                         const gchar    *frame_name);
+
+gint clutter_md2_data_get_n_sequences (ClutterMD2Data *data);
+
+const gchar *clutter_md2_data_get_sequence_name (ClutterMD2Data *data,
+                                                 gint            sequence_num);
+
+gboolean clutter_md2_data_get_sequence (ClutterMD2Data *data,
+                                        const gchar    *sequence_name,
+                                        gint           *frame_start,
+                                        gint           *frame_end,
+                                        gfloat         *fps);
+
 void clutter_md2_data_render (ClutterMD2Data        *data,
                               gint                   frame_num_a,
                               gint                   frame_num_b,
@@ -109,6 +172,101 @@ void clutter_md2_data_render (ClutterMD2Data        *data,
                               gint                   skin_num,
                               const ClutterGeometry *geom);
 
+void clutter_md2_data_render_blend (ClutterMD2Data        *data,
+                                    gint                   n_frames,
+                                    const gint            *frame_nums,
+                                    const gfloat          *weights,
+                                    gint                   skin_num,
+                                    const ClutterGeometry *geom);
+
+void clutter_md2_data_render_begin (void);
+void clutter_md2_data_render_draw (ClutterMD2Data        *data,
+                                   gint                   frame_num_a,
+                                   gint                   frame_num_b,
+                                   gfloat                 interval,
+                                   gint                   skin_num,
+                                   const CoglMatrix      *transform,
+                                   const ClutterGeometry *geom);
+void clutter_md2_data_render_end (void);
+
+gboolean clutter_md2_data_render_software (ClutterMD2Data        *data,
+                                           gint                   frame_num_a,
+                                           gint                   frame_num_b,
+                                           gfloat                 interval,
+                                           gint                   skin_num,
+                                           const ClutterGeometry *geom,
+                                           ClutterMD2DataBuffer  *buffer);
+
+void clutter_md2_data_get_skin_cache_stats (guint *n_textures,
+                                            guint *n_hits,
+                                            gsize *bytes_saved);
+void clutter_md2_data_set_skin_texture_budget (gsize bytes);
+gsize clutter_md2_data_get_skin_texture_budget (void);
+void clutter_md2_data_get_skin_residency_stats (gsize *resident_bytes,
+                                                guint *n_uploads,
+                                                guint *n_evictions);
+void clutter_md2_data_set_skin_cache_dir (const gchar *dir);
+const gchar *clutter_md2_data_get_skin_cache_dir (void);
+
+GdkPixbuf *clutter_md2_data_load_pcx (const gchar *filename,
+                                      GError     **error);
+
+void clutter_md2_data_set_upload_skins (ClutterMD2Data *data,
+                                        gboolean        upload_skins);
+gboolean clutter_md2_data_get_upload_skins (ClutterMD2Data *data);
+
+void clutter_md2_data_set_keep_skin_pixels (ClutterMD2Data *data,
+                                            gboolean        keep_skin_pixels);
+gboolean clutter_md2_data_get_keep_skin_pixels (ClutterMD2Data *data);
+
+void clutter_md2_data_set_indexed_skins (ClutterMD2Data *data,
+                                         gboolean        indexed_skins);
+gboolean clutter_md2_data_get_indexed_skins (ClutterMD2Data *data);
+
+void clutter_md2_data_set_mipmap_skins (ClutterMD2Data *data,
+                                        gboolean        mipmap_skins);
+gboolean clutter_md2_data_get_mipmap_skins (ClutterMD2Data *data);
+
+void clutter_md2_data_set_progressive_skins (ClutterMD2Data *data,
+                                             gboolean        progressive_skins);
+gboolean clutter_md2_data_get_progressive_skins (ClutterMD2Data *data);
+
+void clutter_md2_data_set_impostor_size (ClutterMD2Data *data,
+                                         gint            impostor_size);
+gint clutter_md2_data_get_impostor_size (ClutterMD2Data *data);
+
+void clutter_md2_data_set_impostor_angles (ClutterMD2Data *data,
+                                           gint            impostor_angles);
+gint clutter_md2_data_get_impostor_angles (ClutterMD2Data *data);
+
+void clutter_md2_data_set_frame_tolerance (ClutterMD2Data *data,
+                                           gfloat          tolerance);
+gfloat clutter_md2_data_get_frame_tolerance (ClutterMD2Data *data);
+
+void clutter_md2_data_set_basis_tolerance (ClutterMD2Data *data,
+                                           gfloat          tolerance);
+gfloat clutter_md2_data_get_basis_tolerance (ClutterMD2Data *data);
+
+void clutter_md2_data_set_max_basis_size (ClutterMD2Data *data,
+                                          gint            max_size);
+gint clutter_md2_data_get_max_basis_size (ClutterMD2Data *data);
+
+gint clutter_md2_data_get_basis_size (ClutterMD2Data *data);
+
+void clutter_md2_data_set_frame_budget (ClutterMD2Data *data,
+                                        guint           budget);
+guint clutter_md2_data_get_frame_budget (ClutterMD2Data *data);
+
+void clutter_md2_data_get_stream_stats (ClutterMD2Data *data,
+                                        gsize          *resident_bytes,
+                                        guint          *n_page_ins,
+                                        guint          *n_prefetched);
+
+void clutter_md2_data_get_frame_stats (ClutterMD2Data *data,
+                                       gint           *n_keyframes,
+                                       gsize          *bytes_saved,
+                                       gfloat         *max_error);
+
 void clutter_md2_data_get_extents (ClutterMD2Data        *data,
                                    ClutterMD2DataExtents *extents);
 
@@ -116,6 +274,13 @@ void clutter_md2_data_get_frame_extents (ClutterMD2Data        *data,
                                          gint                   frame_num,
                                          ClutterMD2DataExtents *extents);
 
+gboolean clutter_md2_data_ray_intersect (ClutterMD2Data          *data,
+                                         gint                     frame_num_a,
+                                         gint                     frame_num_b,
+                                         gfloat                   interval,
+                                         const ClutterMD2DataRay *ray,
+                                         ClutterMD2DataHit       *hit);
+
 G_END_DECLS
 
 #endif /* __CLUTTER_MD2_DATA_H__ */
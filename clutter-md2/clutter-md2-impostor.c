@@ -0,0 +1,557 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib-object.h>
+#include <clutter/clutter.h>
+#include <string.h>
+#include <math.h>
+/* Include cogl to get the right GL header for this platform */
+#include <cogl/cogl.h>
+
+#include "clutter-md2-data.h"
+#include "clutter-md2-data-private.h"
+
+/* An impostor atlas holds a pre-rendered image of the model for every
+   combination of a frame and a viewing angle around the vertical
+   axis. Each frame occupies one row of cells with one cell per
+   angle. If the cells for all of the angles don't fit in the width of
+   a texture then the row wraps onto several lines of cells. The rows
+   are only rendered the first time a frame is needed so that frames
+   for animations that are never played don't take up any space. The
+   rendering is done with the software rasterizer in a background
+   thread and the finished row is then copied into a page texture from
+   an idle handler */
+
+/* Maximum height of a page texture in pixels */
+#define CLUTTER_MD2_IMPOSTOR_PAGE_HEIGHT 1024
+
+/* Maximum size in bytes of the pixels for one row */
+#define CLUTTER_MD2_IMPOSTOR_MAX_ROW_SIZE (4 * 1024 * 1024)
+
+/* Special values for the frame_rows array */
+#define CLUTTER_MD2_IMPOSTOR_ROW_NONE     -1
+#define CLUTTER_MD2_IMPOSTOR_ROW_PENDING  -2
+
+typedef struct _ClutterMD2ImpostorJob ClutterMD2ImpostorJob;
+
+struct _ClutterMD2DataImpostor
+{
+  int cell_size, n_angles;
+  /* Number of cells across each line and number of lines in a row.
+     n_columns is zero if the row is too big for a texture */
+  int n_columns, n_lines;
+  int rows_per_page;
+
+  /* Array of CoglHandles for the textures */
+  GPtrArray *pages;
+  int n_rows;
+
+  /* The row that each frame was rendered into or one of the special
+     values above */
+  int num_frames;
+  int *frame_rows;
+};
+
+/* Everything needed to render a row is copied into the job so that
+   the thread doesn't need to touch the ClutterMD2Data */
+struct _ClutterMD2ImpostorJob
+{
+  ClutterMD2Data *data;
+  guint generation;
+  int skin_num, frame_num;
+  int cell_size, n_angles;
+  int n_columns, n_lines;
+
+  /* Stage to redraw when the row is ready */
+  ClutterActor *stage;
+
+  guchar *gl_commands;
+  gfloat *positions;
+  int num_vertices;
+
+  /* The skin image points into these. The palette is copied because
+     it can be changed while the row is being rendered */
+  ClutterMD2DataSkinImage skin;
+  GdkPixbuf *pixbuf;
+  GByteArray *indices;
+  guchar *palette;
+
+  /* The model-space square that each cell covers is centered here */
+  float center[3];
+  float side;
+
+  /* The rendered row */
+  guchar *pixels;
+};
+
+static GThreadPool *clutter_md2_impostor_pool = NULL;
+
+/* Gets the length of the side of the square in model space that each
+   cell covers. This is big enough to contain the model rotated to
+   any angle around the vertical axis */
+static float
+clutter_md2_impostor_get_side (const ClutterMD2DataExtents *extents,
+                               int cell_size)
+{
+  float half_width = (extents->right - extents->left) / 2.0f;
+  float half_depth = (extents->front - extents->back) / 2.0f;
+  float radius = sqrt (half_width * half_width + half_depth * half_depth);
+  float side = MAX (radius * 2.0f, extents->bottom - extents->top);
+
+  /* Leave a one pixel border around each cell so that filtering
+     doesn't pull in pixels from the neighbouring cells */
+  return side * cell_size / MAX (1, cell_size - 2);
+}
+
+static int
+clutter_md2_impostor_get_max_texture_size (void)
+{
+  static GLint max_size = 0;
+
+  if (max_size == 0)
+    {
+      glGetIntegerv (GL_MAX_TEXTURE_SIZE, &max_size);
+
+      /* GL guarantees at least this much */
+      max_size = MAX (max_size, 64);
+    }
+
+  return max_size;
+}
+
+static void
+clutter_md2_impostor_render_row (ClutterMD2ImpostorJob *job)
+{
+  int row_width = job->cell_size * job->n_columns;
+  int row_height = job->cell_size * job->n_lines;
+  float scale = job->cell_size / job->side;
+  float half_cell = job->cell_size / 2.0f;
+  gfloat *vertices = g_new (gfloat, job->num_vertices * 3);
+  guchar *p;
+  int angle, i;
+
+  job->pixels = g_malloc0 (row_width * row_height * 4);
+
+  for (angle = 0; angle < job->n_angles; angle++)
+    {
+      /* Rotate about the y axis in the same direction as cogl_rotate */
+      double theta = angle * 2.0 * G_PI / job->n_angles;
+      float c = cos (theta), s = sin (theta);
+      const gfloat *src = job->positions;
+      gfloat *dst = vertices;
+      ClutterMD2DataBuffer buffer;
+
+      for (i = 0; i < job->num_vertices; i++)
+        {
+          float dx = src[0] - job->center[0];
+          float dy = src[1] - job->center[1];
+          float dz = src[2] - job->center[2];
+
+          dst[0] = (dx * c + dz * s) * scale + half_cell;
+          dst[1] = dy * scale + half_cell;
+          dst[2] = (dz * c - dx * s) * scale;
+
+          src += 3;
+          dst += 3;
+        }
+
+      buffer.width = job->cell_size;
+      buffer.height = job->cell_size;
+      buffer.rowstride = row_width * 4;
+      buffer.pixels = (job->pixels
+                       + ((angle / job->n_columns) * job->cell_size
+                          * row_width
+                          + (angle % job->n_columns) * job->cell_size) * 4);
+      buffer.depth = NULL;
+
+      _clutter_md2_data_rasterize (job->gl_commands, vertices,
+                                   &job->skin, &buffer);
+    }
+
+  g_free (vertices);
+
+  /* The atlas is drawn with Cogl's default blending which expects
+     premultiplied colors */
+  for (i = row_width * row_height, p = job->pixels; i > 0; i--, p += 4)
+    if (p[3] != 255)
+      {
+        p[0] = p[0] * p[3] / 255;
+        p[1] = p[1] * p[3] / 255;
+        p[2] = p[2] * p[3] / 255;
+      }
+}
+
+static void
+clutter_md2_impostor_free_job (ClutterMD2ImpostorJob *job)
+{
+  if (job->stage)
+    g_object_remove_weak_pointer (G_OBJECT (job->stage),
+                                  (gpointer *) &job->stage);
+  g_object_unref (job->data);
+  if (job->pixbuf)
+    g_object_unref (job->pixbuf);
+  if (job->indices)
+    g_byte_array_unref (job->indices);
+  g_free (job->palette);
+  g_free (job->gl_commands);
+  g_free (job->positions);
+  g_free (job->pixels);
+  g_slice_free (ClutterMD2ImpostorJob, job);
+}
+
+static gboolean
+clutter_md2_impostor_upload_row (ClutterMD2ImpostorJob *job)
+{
+  ClutterMD2DataPrivate *priv = job->data->priv;
+  ClutterMD2DataImpostor *impostor;
+  int row, page_num, row_width, row_height;
+  CoglHandle page;
+
+  /* The atlas may have been thrown away while the row was rendering
+     if the model was reloaded or the settings changed */
+  if (job->generation != priv->impostor_generation
+      || job->skin_num >= priv->num_impostors
+      || (impostor = priv->impostors[job->skin_num]) == NULL)
+    return FALSE;
+
+  row = impostor->n_rows++;
+  page_num = row / impostor->rows_per_page;
+  row_width = impostor->cell_size * impostor->n_columns;
+  row_height = impostor->cell_size * impostor->n_lines;
+
+  if (page_num >= impostor->pages->len)
+    {
+      int page_height = row_height * impostor->rows_per_page;
+      guchar *blank = g_malloc0 (row_width * page_height * 4);
+
+      page = cogl_texture_new_from_data (row_width, page_height,
+                                         COGL_TEXTURE_NO_AUTO_MIPMAP,
+                                         COGL_PIXEL_FORMAT_RGBA_8888_PRE,
+                                         COGL_PIXEL_FORMAT_RGBA_8888_PRE,
+                                         row_width * 4,
+                                         blank);
+      g_free (blank);
+
+      g_ptr_array_add (impostor->pages, page);
+    }
+  else
+    page = g_ptr_array_index (impostor->pages, page_num);
+
+  cogl_texture_set_region (page,
+                           0, 0,
+                           0,
+                           (row % impostor->rows_per_page) * row_height,
+                           row_width,
+                           row_height,
+                           row_width,
+                           row_height,
+                           COGL_PIXEL_FORMAT_RGBA_8888_PRE,
+                           row_width * 4,
+                           job->pixels);
+
+  impostor->frame_rows[job->frame_num] = row;
+
+  return TRUE;
+}
+
+static gboolean
+clutter_md2_impostor_upload_idle_cb (gpointer user_data)
+{
+  ClutterMD2ImpostorJob *job = user_data;
+
+  /* Actors showing the frame painted the full model while the row
+     was rendering so they need to be painted again */
+  if (clutter_md2_impostor_upload_row (job) && job->stage)
+    clutter_actor_queue_redraw (job->stage);
+
+  clutter_md2_impostor_free_job (job);
+
+  return FALSE;
+}
+
+static void
+clutter_md2_impostor_thread_cb (gpointer job_data, gpointer user_data)
+{
+  ClutterMD2ImpostorJob *job = job_data;
+
+  clutter_md2_impostor_render_row (job);
+
+  /* Textures can only be created with the Clutter lock held */
+  clutter_threads_add_idle (clutter_md2_impostor_upload_idle_cb, job);
+}
+
+static ClutterMD2ImpostorJob *
+clutter_md2_impostor_create_job (ClutterMD2Data *data,
+                                 ClutterMD2DataImpostor *impostor,
+                                 gint frame_num,
+                                 gint skin_num)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  ClutterMD2ImpostorJob *job = g_slice_new (ClutterMD2ImpostorJob);
+  ClutterMD2DataSkin *skin = priv->skins + skin_num;
+  const guchar *gl_command = priv->gl_commands;
+  gsize gl_commands_size;
+
+  /* Work out how much of the GL commands to copy */
+  while (*(const gint32 *) gl_command)
+    {
+      gint32 command_len = *(const gint32 *) gl_command;
+      gl_command += sizeof (gint32) + ABS (command_len) * 12;
+    }
+  gl_commands_size = gl_command + sizeof (gint32) - priv->gl_commands;
+
+  job->data = g_object_ref (data);
+  job->generation = priv->impostor_generation;
+  job->skin_num = skin_num;
+  job->frame_num = frame_num;
+  job->cell_size = impostor->cell_size;
+  job->n_angles = impostor->n_angles;
+  job->n_columns = impostor->n_columns;
+  job->n_lines = impostor->n_lines;
+  job->stage = NULL;
+  job->gl_commands = g_malloc (gl_commands_size);
+  memcpy (job->gl_commands, priv->gl_commands, gl_commands_size);
+  job->num_vertices = priv->num_vertices;
+  job->positions = g_new (gfloat, priv->num_vertices * 3);
+  _clutter_md2_data_get_vertex_positions (data, frame_num, frame_num, 0.0f,
+                                          job->positions);
+  _clutter_md2_data_get_skin_image (skin, &job->skin);
+  job->pixbuf = skin->pixbuf ? g_object_ref (skin->pixbuf) : NULL;
+  job->indices = skin->indices ? g_byte_array_ref (skin->indices) : NULL;
+  job->palette = NULL;
+  if (skin->palette)
+    job->skin.palette = job->palette
+      = g_memdup (skin->palette, CLUTTER_MD2_DATA_PALETTE_SIZE);
+  job->center[0] = (priv->extents.left + priv->extents.right) / 2;
+  job->center[1] = (priv->extents.top + priv->extents.bottom) / 2;
+  job->center[2] = (priv->extents.back + priv->extents.front) / 2;
+  job->side = clutter_md2_impostor_get_side (&priv->extents,
+                                             priv->impostor_size);
+  job->pixels = NULL;
+
+  return job;
+}
+
+static ClutterMD2DataImpostor *
+clutter_md2_impostor_get_atlas (ClutterMD2Data *data, gint skin_num)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  ClutterMD2DataImpostor *impostor;
+  int i, max_size, row_width, row_height;
+
+  if (skin_num >= priv->num_impostors)
+    {
+      priv->impostors = g_realloc (priv->impostors,
+                                   priv->num_skins
+                                   * sizeof (ClutterMD2DataImpostor *));
+      memset (priv->impostors + priv->num_impostors, 0,
+              (priv->num_skins - priv->num_impostors)
+              * sizeof (ClutterMD2DataImpostor *));
+      priv->num_impostors = priv->num_skins;
+    }
+
+  if ((impostor = priv->impostors[skin_num]) == NULL)
+    {
+      impostor = g_slice_new (ClutterMD2DataImpostor);
+      impostor->cell_size = priv->impostor_size;
+      impostor->n_angles = priv->impostor_angles;
+
+      /* Wrap the angles onto more lines if a row would be wider than
+         a texture */
+      max_size = clutter_md2_impostor_get_max_texture_size ();
+      impostor->n_columns = MIN (impostor->n_angles,
+                                 max_size / impostor->cell_size);
+      if (impostor->n_columns > 0)
+        {
+          impostor->n_lines = ((impostor->n_angles + impostor->n_columns - 1)
+                               / impostor->n_columns);
+          row_width = impostor->cell_size * impostor->n_columns;
+          row_height = impostor->cell_size * impostor->n_lines;
+
+          if (row_height > max_size
+              || (gsize) row_width * row_height * 4
+              > CLUTTER_MD2_IMPOSTOR_MAX_ROW_SIZE)
+            impostor->n_columns = 0;
+        }
+
+      if (impostor->n_columns > 0)
+        impostor->rows_per_page
+          = MAX (1, (MIN (CLUTTER_MD2_IMPOSTOR_PAGE_HEIGHT, max_size)
+                     / row_height));
+      else
+        {
+          g_warning ("The impostor size and angles are too big to fit "
+                     "in a texture. The full model will be drawn instead");
+          impostor->n_lines = 0;
+          impostor->rows_per_page = 1;
+        }
+
+      impostor->pages = g_ptr_array_new ();
+      impostor->n_rows = 0;
+      impostor->num_frames = priv->num_frames;
+      impostor->frame_rows = g_new (int, priv->num_frames);
+      for (i = 0; i < priv->num_frames; i++)
+        impostor->frame_rows[i] = CLUTTER_MD2_IMPOSTOR_ROW_NONE;
+
+      priv->impostors[skin_num] = impostor;
+    }
+
+  return impostor;
+}
+
+gboolean
+_clutter_md2_data_paint_impostor (ClutterMD2Data        *data,
+                                  ClutterActor          *actor,
+                                  gint                   frame_num,
+                                  gint                   skin_num,
+                                  gfloat                 angle,
+                                  const ClutterGeometry *geom)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  ClutterMD2DataImpostor *impostor;
+  int row, cell, row_height, page_width, page_height;
+  float scale, center[3], half_side;
+  float tx, ty, tw, th;
+
+  if (priv->impostor_size <= 0
+      || priv->gl_commands == NULL
+      || priv->frames == NULL
+      || skin_num >= priv->num_skins
+      || (priv->skins[skin_num].pixbuf == NULL
+          && priv->skins[skin_num].indices == NULL)
+      || frame_num >= priv->num_frames
+      || geom->width == 0
+      || geom->height == 0
+      || priv->extents.top == priv->extents.bottom)
+    return FALSE;
+
+  impostor = clutter_md2_impostor_get_atlas (data, skin_num);
+
+  if (impostor->n_columns == 0)
+    return FALSE;
+
+  if (impostor->frame_rows[frame_num] == CLUTTER_MD2_IMPOSTOR_ROW_NONE)
+    {
+      ClutterMD2ImpostorJob *job
+        = clutter_md2_impostor_create_job (data, impostor,
+                                           frame_num, skin_num);
+
+      /* Without threads the row is rendered immediately. It only
+         needs to happen once per frame so the stall is acceptable */
+      if (!g_thread_supported ())
+        {
+          clutter_md2_impostor_render_row (job);
+          clutter_md2_impostor_upload_row (job);
+          clutter_md2_impostor_free_job (job);
+        }
+      else
+        {
+          if (clutter_md2_impostor_pool == NULL)
+            clutter_md2_impostor_pool
+              = g_thread_pool_new (clutter_md2_impostor_thread_cb, NULL,
+                                   1, FALSE, NULL);
+
+          if ((job->stage = clutter_actor_get_stage (actor)))
+            g_object_add_weak_pointer (G_OBJECT (job->stage),
+                                       (gpointer *) &job->stage);
+
+          impostor->frame_rows[frame_num] = CLUTTER_MD2_IMPOSTOR_ROW_PENDING;
+          g_thread_pool_push (clutter_md2_impostor_pool, job, NULL);
+        }
+    }
+
+  if ((row = impostor->frame_rows[frame_num]) < 0)
+    return FALSE;
+
+  /* Pick the cell rendered at the angle nearest to the actor's
+     rotation */
+  cell = (int) floor (angle * impostor->n_angles / 360.0f + 0.5f);
+  cell %= impostor->n_angles;
+  if (cell < 0)
+    cell += impostor->n_angles;
+
+  row_height = impostor->cell_size * impostor->n_lines;
+  page_width = impostor->cell_size * impostor->n_columns;
+  page_height = row_height * impostor->rows_per_page;
+  tx = ((cell % impostor->n_columns) * impostor->cell_size
+        / (float) page_width);
+  ty = (((row % impostor->rows_per_page) * row_height
+         + (cell / impostor->n_columns) * impostor->cell_size)
+        / (float) page_height);
+  tw = impostor->cell_size / (float) page_width;
+  th = impostor->cell_size / (float) page_height;
+
+  _clutter_md2_data_get_fit_transform (data, geom, &scale, center);
+  half_side = (clutter_md2_impostor_get_side (&priv->extents,
+                                              impostor->cell_size)
+               * scale / 2.0f);
+
+  /* The cell already shows the model rotated by the angle so undo the
+     actor's rotation about the center of the model to make the quad
+     face the viewer */
+  cogl_push_matrix ();
+  cogl_translate (geom->width / 2, geom->height / 2, 0);
+  cogl_rotate (-angle, 0, 1, 0);
+
+  cogl_set_source_texture (g_ptr_array_index (impostor->pages,
+                                              row / impostor->rows_per_page));
+  cogl_rectangle_with_texture_coords (-half_side, -half_side,
+                                      half_side, half_side,
+                                      tx, ty, tx + tw, ty + th);
+
+  cogl_pop_matrix ();
+
+  return TRUE;
+}
+
+void
+_clutter_md2_data_free_impostors (ClutterMD2Data *data)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  int i, j;
+
+  for (i = 0; i < priv->num_impostors; i++)
+    {
+      ClutterMD2DataImpostor *impostor = priv->impostors[i];
+
+      if (impostor == NULL)
+        continue;
+
+      for (j = 0; j < impostor->pages->len; j++)
+        cogl_handle_unref (g_ptr_array_index (impostor->pages, j));
+      g_ptr_array_free (impostor->pages, TRUE);
+      g_free (impostor->frame_rows);
+      g_slice_free (ClutterMD2DataImpostor, impostor);
+    }
+
+  g_free (priv->impostors);
+  priv->impostors = NULL;
+  priv->num_impostors = 0;
+
+  /* Any rows that are still being rendered will be discarded */
+  priv->impostor_generation++;
+}
@@ -0,0 +1,455 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib-object.h>
+#include <clutter/clutter.h>
+#include <string.h>
+#include <math.h>
+
+#include "clutter-md2-data.h"
+#include "clutter-md2-data-private.h"
+
+/* Frames are dropped one at a time within each animation sequence as
+   long as every dropped frame can still be rebuilt from a
+   Catmull-Rom spline through the remaining keyframes without any
+   vertex moving further than the frame tolerance. The first and last
+   frame of each sequence are always kept so that the spline never
+   has to reach across into a different animation. Once that is done
+   any keyframes with exactly the same vertex bytes share a single
+   copy */
+
+static void
+clutter_md2_keyframes_get_position (const ClutterMD2DataFrame *frame,
+                                    const guchar *vertex,
+                                    float *pos)
+{
+  int i;
+
+  for (i = 0; i < 3; i++)
+    pos[i] = vertex[i] * frame->scale[i] + frame->translate[i];
+}
+
+/* Rebuilds the vertices of a dropped frame from its four control
+   keyframes, quantized to the frame's own scale and translation */
+static void
+clutter_md2_keyframes_rebuild (ClutterMD2DataPrivate *priv,
+                               int frame_num,
+                               const int *controls,
+                               guchar *vertices)
+{
+  const ClutterMD2DataFrame *frame = priv->frames[frame_num];
+  const ClutterMD2DataFrame *keys[4];
+  float t, t2, t3, h00, h10, h01, h11, m1_scale, m2_scale;
+  int i, j;
+
+  for (i = 0; i < 4; i++)
+    keys[i] = priv->frames[controls[i]];
+
+  t = (frame_num - controls[1]) / (float) (controls[2] - controls[1]);
+  t2 = t * t;
+  t3 = t2 * t;
+  h00 = 2.0f * t3 - 3.0f * t2 + 1.0f;
+  h10 = t3 - 2.0f * t2 + t;
+  h01 = -2.0f * t3 + 3.0f * t2;
+  h11 = t3 - t2;
+
+  /* The keyframes aren't evenly spaced so the tangents are scaled by
+     the length of the span compared to the neighbouring spans. Where
+     a control is repeated at the end of a sequence this reduces to a
+     one-sided difference */
+  m1_scale = (controls[2] - controls[1])
+    / (float) (controls[2] - controls[0]);
+  m2_scale = (controls[2] - controls[1])
+    / (float) (controls[3] - controls[1]);
+
+  for (i = 0; i < priv->num_vertices; i++)
+    {
+      float p[4][3];
+      guchar *out = vertices + i * 4;
+
+      for (j = 0; j < 4; j++)
+        clutter_md2_keyframes_get_position (keys[j], keys[j]->vertices + i * 4,
+                                            p[j]);
+
+      for (j = 0; j < 3; j++)
+        {
+          float m1 = (p[2][j] - p[0][j]) * m1_scale;
+          float m2 = (p[3][j] - p[1][j]) * m2_scale;
+          float v = h00 * p[1][j] + h10 * m1 + h01 * p[2][j] + h11 * m2;
+
+          if (frame->scale[j] == 0.0f)
+            v = 0.0f;
+          else
+            v = floor ((v - frame->translate[j]) / frame->scale[j] + 0.5);
+
+          out[j] = CLAMP (v, 0.0f, 255.0f);
+        }
+
+      /* Normals are stored as an index into a table so they can't be
+         interpolated. Use the normal from the nearest keyframe */
+      out[3] = keys[t < 0.5f ? 1 : 2]->vertices[i * 4 + 3];
+    }
+}
+
+static float
+clutter_md2_keyframes_get_error (ClutterMD2DataPrivate *priv,
+                                 int frame_num,
+                                 const int *controls,
+                                 guchar *buf)
+{
+  const ClutterMD2DataFrame *frame = priv->frames[frame_num];
+  float max_error = 0.0f;
+  int i;
+
+  clutter_md2_keyframes_rebuild (priv, frame_num, controls, buf);
+
+  for (i = 0; i < priv->num_vertices; i++)
+    {
+      float a[3], b[3], dx, dy, dz, error;
+
+      clutter_md2_keyframes_get_position (frame, frame->vertices + i * 4, a);
+      clutter_md2_keyframes_get_position (frame, buf + i * 4, b);
+
+      dx = a[0] - b[0];
+      dy = a[1] - b[1];
+      dz = a[2] - b[2];
+      error = dx * dx + dy * dy + dz * dz;
+
+      if (error > max_error)
+        max_error = error;
+    }
+
+  return sqrt (max_error);
+}
+
+static int
+clutter_md2_keyframes_prev_key (const gboolean *is_key,
+                                int frame_start,
+                                int frame_num)
+{
+  while (frame_num > frame_start && !is_key[frame_num - 1])
+    frame_num--;
+
+  return frame_num > frame_start ? frame_num - 1 : frame_start;
+}
+
+static int
+clutter_md2_keyframes_next_key (const gboolean *is_key,
+                                int frame_end,
+                                int frame_num)
+{
+  while (frame_num < frame_end && !is_key[frame_num + 1])
+    frame_num++;
+
+  return frame_num < frame_end ? frame_num + 1 : frame_end;
+}
+
+/* Works out the controls and the error of every dropped frame between
+   the keyframes first_key and last_key and returns the largest
+   error */
+static float
+clutter_md2_keyframes_update_span (ClutterMD2DataPrivate *priv,
+                                   const gboolean *is_key,
+                                   int frame_start,
+                                   int frame_end,
+                                   int first_key,
+                                   int last_key,
+                                   int *controls,
+                                   float *errors,
+                                   guchar *buf)
+{
+  float max_error = 0.0f;
+  int key_a = first_key;
+
+  while (key_a < last_key)
+    {
+      int key_b = clutter_md2_keyframes_next_key (is_key, frame_end, key_a);
+      int before = clutter_md2_keyframes_prev_key (is_key, frame_start, key_a);
+      int after = clutter_md2_keyframes_next_key (is_key, frame_end, key_b);
+      int frame_num;
+
+      for (frame_num = key_a + 1; frame_num < key_b; frame_num++)
+        {
+          int *frame_controls = controls + frame_num * 4;
+          float error;
+
+          frame_controls[0] = before;
+          frame_controls[1] = key_a;
+          frame_controls[2] = key_b;
+          frame_controls[3] = after;
+
+          error = clutter_md2_keyframes_get_error (priv, frame_num,
+                                                   frame_controls, buf);
+          errors[frame_num] = error;
+
+          if (error > max_error)
+            max_error = error;
+        }
+
+      key_a = key_b;
+    }
+
+  return max_error;
+}
+
+static void
+clutter_md2_keyframes_decimate (ClutterMD2Data *data,
+                                int frame_start,
+                                int frame_end,
+                                gboolean *is_key,
+                                float *errors,
+                                int *controls,
+                                guchar *buf)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  int frame_num;
+
+  for (frame_num = frame_start + 1; frame_num < frame_end; frame_num++)
+    {
+      int key_a, key_b, first_key, last_key;
+      float error;
+
+      key_a = clutter_md2_keyframes_prev_key (is_key, frame_start, frame_num);
+      key_b = clutter_md2_keyframes_next_key (is_key, frame_end, frame_num);
+
+      /* Dropping the frame changes the spline over the span it merges
+         and the spans either side because the outer controls move */
+      first_key = clutter_md2_keyframes_prev_key (is_key, frame_start, key_a);
+      last_key = clutter_md2_keyframes_next_key (is_key, frame_end, key_b);
+
+      is_key[frame_num] = FALSE;
+
+      error = clutter_md2_keyframes_update_span (priv, is_key,
+                                                 frame_start, frame_end,
+                                                 first_key, last_key,
+                                                 controls, errors, buf);
+
+      if (error > priv->frame_tolerance)
+        {
+          /* Put the frame back. The controls of the other frames in
+             the spans are restored by recalculating them */
+          is_key[frame_num] = TRUE;
+
+          clutter_md2_keyframes_update_span (priv, is_key,
+                                             frame_start, frame_end,
+                                             first_key, last_key,
+                                             controls, errors, buf);
+        }
+    }
+}
+
+static guint
+clutter_md2_keyframes_hash (const guchar *vertices, int n_bytes)
+{
+  guint hash = 5381;
+  int i;
+
+  for (i = 0; i < n_bytes; i++)
+    hash = hash * 33 + vertices[i];
+
+  return hash;
+}
+
+void
+_clutter_md2_data_compress_frames (ClutterMD2Data *data)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  gsize vertices_size = priv->num_vertices * 4;
+  gsize header_size = G_STRUCT_OFFSET (ClutterMD2DataFrame, vertex_data);
+  gboolean *is_key;
+  float *errors;
+  int *controls;
+  guint *hashes;
+  guchar *buf;
+  int i, j, n_sequences;
+
+  priv->num_keyframes = priv->num_frames;
+  priv->frame_bytes_saved = 0;
+  priv->frame_max_error = 0.0f;
+
+  /* Streamed frames aren't kept in memory to compare against */
+  if (priv->frame_file)
+    return;
+
+  /* A principal component basis replaces all of the frames so there
+     is nothing left to drop */
+  if (_clutter_md2_data_build_basis (data))
+    return;
+
+  if (priv->frame_tolerance < 0.0f || priv->num_frames < 2)
+    return;
+
+  is_key = g_new (gboolean, priv->num_frames);
+  errors = g_new0 (float, priv->num_frames);
+  controls = g_new (int, priv->num_frames * 4);
+  hashes = g_new (guint, priv->num_frames);
+  buf = g_malloc (vertices_size);
+
+  for (i = 0; i < priv->num_frames; i++)
+    is_key[i] = TRUE;
+
+  n_sequences = clutter_md2_data_get_n_sequences (data);
+
+  for (i = 0; i < n_sequences; i++)
+    {
+      const gchar *name = clutter_md2_data_get_sequence_name (data, i);
+      gint frame_start, frame_end;
+
+      clutter_md2_data_get_sequence (data, name,
+                                     &frame_start, &frame_end, NULL);
+      clutter_md2_keyframes_decimate (data, frame_start, frame_end,
+                                      is_key, errors, controls, buf);
+    }
+
+  /* Share the vertices of identical keyframes. Only the bytes need to
+     match because each frame keeps its own scale and translation */
+  for (i = 0; i < priv->num_frames; i++)
+    {
+      ClutterMD2DataFrame *frame = priv->frames[i];
+
+      if (!is_key[i])
+        continue;
+
+      hashes[i] = clutter_md2_keyframes_hash (frame->vertices, vertices_size);
+
+      for (j = 0; j < i; j++)
+        if (is_key[j]
+            && hashes[j] == hashes[i]
+            && priv->frames[j]->vertices == priv->frames[j]->vertex_data
+            && !memcmp (priv->frames[j]->vertices, frame->vertices,
+                        vertices_size))
+          {
+            /* The header may move but nothing points into it */
+            priv->frames[i] = frame = g_realloc (frame, header_size);
+            frame->vertices = priv->frames[j]->vertices;
+            priv->num_keyframes--;
+            priv->frame_bytes_saved += vertices_size;
+            break;
+          }
+    }
+
+  /* The dropped frames can only be freed now that nothing needs to
+     measure the error against them */
+  for (i = 0; i < priv->num_frames; i++)
+    if (!is_key[i])
+      {
+        ClutterMD2DataFrame *frame = g_realloc (priv->frames[i], header_size);
+
+        memcpy (frame->controls, controls + i * 4, sizeof (frame->controls));
+        frame->vertices = NULL;
+        priv->frames[i] = frame;
+
+        priv->num_keyframes--;
+        priv->frame_bytes_saved += vertices_size;
+
+        if (errors[i] > priv->frame_max_error)
+          priv->frame_max_error = errors[i];
+      }
+
+  g_free (buf);
+  g_free (hashes);
+  g_free (controls);
+  g_free (errors);
+  g_free (is_key);
+}
+
+const guchar *
+_clutter_md2_data_get_frame_vertices (ClutterMD2Data *data,
+                                      gint            frame_num)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  const ClutterMD2DataFrame *frame = priv->frames[frame_num];
+  ClutterMD2DataFrameSlot *slot;
+  int i;
+
+  if (priv->frame_file)
+    return _clutter_md2_data_stream_frame (data, frame_num);
+
+  if (frame->vertices)
+    return frame->vertices;
+
+  for (i = 0; i < CLUTTER_MD2_DATA_FRAME_SLOTS; i++)
+    if (priv->frame_slots[i].frame_num == frame_num)
+      return priv->frame_slots[i].vertices;
+
+  slot = priv->frame_slots + priv->next_frame_slot;
+  priv->next_frame_slot = ((priv->next_frame_slot + 1)
+                           % CLUTTER_MD2_DATA_FRAME_SLOTS);
+
+  if (slot->vertices == NULL)
+    slot->vertices = g_malloc (priv->num_vertices * 4);
+
+  if (priv->basis_size > 0)
+    _clutter_md2_data_rebuild_basis_frame (data, frame_num, slot->vertices);
+  else
+    clutter_md2_keyframes_rebuild (priv, frame_num, frame->controls,
+                                   slot->vertices);
+  slot->frame_num = frame_num;
+
+  return slot->vertices;
+}
+
+void
+_clutter_md2_data_free_frame_cache (ClutterMD2Data *data)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  int i;
+
+  for (i = 0; i < CLUTTER_MD2_DATA_FRAME_SLOTS; i++)
+    {
+      g_free (priv->frame_slots[i].vertices);
+      priv->frame_slots[i].vertices = NULL;
+      priv->frame_slots[i].frame_num = -1;
+    }
+
+  priv->next_frame_slot = 0;
+}
+
+/* Gets the results of compressing the frames when the model was
+   loaded with a frame or basis tolerance of zero or more. When a
+   principal component basis is used no frames are stored directly so
+   n_keyframes is zero and max_error is the largest distance that a
+   rendered vertex can move. Any of the return pointers can be NULL */
+void
+clutter_md2_data_get_frame_stats (ClutterMD2Data *data,
+                                  gint           *n_keyframes,
+                                  gsize          *bytes_saved,
+                                  gfloat         *max_error)
+{
+  ClutterMD2DataPrivate *priv;
+
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+
+  priv = data->priv;
+
+  if (n_keyframes)
+    *n_keyframes = priv->num_keyframes;
+  if (bytes_saved)
+    *bytes_saved = priv->frame_bytes_saved;
+  if (max_error)
+    *max_error = priv->frame_max_error;
+}
@@ -0,0 +1,316 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib-object.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <clutter/clutter.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "clutter-md2-data.h"
+#include "clutter-md2-data-private.h"
+
+/* Each level is made from the one above with a 2x2 box filter. The
+   two source rows are first summed into 16-bit totals, which is done
+   with SSE2 where available because it doesn't depend on the number
+   of channels, and then neighbouring texels in the totals are added
+   and averaged. Levels with an odd size drop the last row or column
+   like most GL drivers do. Large levels are split into bands of rows
+   that are filtered on separate threads */
+
+/* Rows in each band given to a thread */
+#define CLUTTER_MD2_MIPMAP_BAND_ROWS  32
+/* Levels with fewer texels than this aren't worth splitting */
+#define CLUTTER_MD2_MIPMAP_MIN_THREADED_TEXELS  (128 * 128)
+
+typedef struct _ClutterMD2MipmapLevel ClutterMD2MipmapLevel;
+
+struct _ClutterMD2MipmapLevel
+{
+  const guchar *src;
+  int src_width, src_height, src_rowstride;
+  guchar *dst;
+  int dst_width, dst_height;
+  int n_channels;
+};
+
+static void
+clutter_md2_mipmap_sum_rows (const guchar *row0,
+                             const guchar *row1,
+                             guint16      *sums,
+                             int           n_bytes)
+{
+  int i = 0;
+
+#ifdef __SSE2__
+  __m128i zero = _mm_setzero_si128 ();
+
+  for (; i + 16 <= n_bytes; i += 16)
+    {
+      __m128i a = _mm_loadu_si128 ((const __m128i *) (row0 + i));
+      __m128i b = _mm_loadu_si128 ((const __m128i *) (row1 + i));
+
+      _mm_storeu_si128 ((__m128i *) (sums + i),
+                        _mm_add_epi16 (_mm_unpacklo_epi8 (a, zero),
+                                       _mm_unpacklo_epi8 (b, zero)));
+      _mm_storeu_si128 ((__m128i *) (sums + i + 8),
+                        _mm_add_epi16 (_mm_unpackhi_epi8 (a, zero),
+                                       _mm_unpackhi_epi8 (b, zero)));
+    }
+#endif /* __SSE2__ */
+
+  for (; i < n_bytes; i++)
+    sums[i] = row0[i] + row1[i];
+}
+
+static void
+clutter_md2_mipmap_filter_rows (const ClutterMD2MipmapLevel *level,
+                                int                          first_row,
+                                int                          last_row)
+{
+  int n_channels = level->n_channels;
+  /* A level that is one texel wide averages each texel with itself */
+  int step = level->src_width > 1 ? n_channels : 0;
+  guint16 *sums = g_new (guint16, level->src_width * n_channels);
+  int y, x, i;
+
+  for (y = first_row; y < last_row; y++)
+    {
+      const guchar *row0 = level->src + y * 2 * level->src_rowstride;
+      const guchar *row1 = (level->src_height > 1
+                            ? row0 + level->src_rowstride : row0);
+      guchar *dst = level->dst + y * level->dst_width * n_channels;
+      const guint16 *p = sums;
+
+      clutter_md2_mipmap_sum_rows (row0, row1, sums,
+                                   MIN (level->dst_width * 2,
+                                        level->src_width) * n_channels);
+
+      for (x = 0; x < level->dst_width; x++)
+        {
+          for (i = 0; i < n_channels; i++)
+            *(dst++) = (p[i] + p[i + step] + 2) >> 2;
+
+          p += n_channels * 2;
+        }
+    }
+
+  g_free (sums);
+}
+
+static void
+clutter_md2_mipmap_band_cb (gpointer band_data, gpointer user_data)
+{
+  const ClutterMD2MipmapLevel *level = user_data;
+  int band = GPOINTER_TO_INT (band_data) - 1;
+  int first_row = band * CLUTTER_MD2_MIPMAP_BAND_ROWS;
+
+  clutter_md2_mipmap_filter_rows (level, first_row,
+                                  MIN (first_row
+                                       + CLUTTER_MD2_MIPMAP_BAND_ROWS,
+                                       level->dst_height));
+}
+
+static void
+clutter_md2_mipmap_filter_level (const ClutterMD2MipmapLevel *level)
+{
+  int n_bands = ((level->dst_height + CLUTTER_MD2_MIPMAP_BAND_ROWS - 1)
+                 / CLUTTER_MD2_MIPMAP_BAND_ROWS);
+  int n_threads = _clutter_md2_data_get_n_threads ();
+  GThreadPool *pool;
+  int i;
+
+  /* The thread pool can only be used if the application has
+     initialised threads */
+  if (n_threads < 2
+      || n_bands < 2
+      || (level->dst_width * level->dst_height
+          < CLUTTER_MD2_MIPMAP_MIN_THREADED_TEXELS)
+      || !g_thread_supported ())
+    {
+      clutter_md2_mipmap_filter_rows (level, 0, level->dst_height);
+      return;
+    }
+
+  pool = g_thread_pool_new (clutter_md2_mipmap_band_cb, (gpointer) level,
+                            MIN (n_threads, n_bands), FALSE, NULL);
+
+  for (i = 0; i < n_bands; i++)
+    g_thread_pool_push (pool, GINT_TO_POINTER (i + 1), NULL);
+
+  /* Wait for all of the bands to finish */
+  g_thread_pool_free (pool, FALSE, TRUE);
+}
+
+gsize
+_clutter_md2_data_get_mipmaps_size (int  width,
+                                    int  height,
+                                    int  n_channels,
+                                    int *n_levels)
+{
+  gsize size = 0;
+  int levels = 0;
+
+  while (width > 1 || height > 1)
+    {
+      width = MAX (width / 2, 1);
+      height = MAX (height / 2, 1);
+      size += width * height * n_channels;
+      levels++;
+    }
+
+  if (n_levels)
+    *n_levels = levels;
+
+  return size;
+}
+
+ClutterMD2DataMipmaps *
+_clutter_md2_data_generate_mipmaps (const guchar *pixels,
+                                    int           width,
+                                    int           height,
+                                    int           rowstride,
+                                    int           n_channels)
+{
+  ClutterMD2DataMipmaps *mipmaps;
+  ClutterMD2MipmapLevel level;
+  guchar *data;
+  gsize size;
+  int n_levels, i;
+
+  size = _clutter_md2_data_get_mipmaps_size (width, height, n_channels,
+                                             &n_levels);
+
+  if (n_levels == 0)
+    return NULL;
+
+  data = g_malloc (size);
+
+  level.src = pixels;
+  level.src_width = width;
+  level.src_height = height;
+  level.src_rowstride = rowstride;
+  level.dst = data;
+  level.n_channels = n_channels;
+
+  for (i = 0; i < n_levels; i++)
+    {
+      level.dst_width = MAX (level.src_width / 2, 1);
+      level.dst_height = MAX (level.src_height / 2, 1);
+
+      clutter_md2_mipmap_filter_level (&level);
+
+      /* The next level is made from this one */
+      level.src = level.dst;
+      level.src_width = level.dst_width;
+      level.src_height = level.dst_height;
+      level.src_rowstride = level.dst_width * n_channels;
+      level.dst += level.dst_width * level.dst_height * n_channels;
+    }
+
+  mipmaps = g_slice_new0 (ClutterMD2DataMipmaps);
+  mipmaps->ref_count = 1;
+  mipmaps->n_levels = n_levels;
+  mipmaps->n_channels = n_channels;
+  mipmaps->data = data;
+  mipmaps->size = size;
+
+  return mipmaps;
+}
+
+ClutterMD2DataMipmaps *
+_clutter_md2_data_mipmaps_new_mapped (GMappedFile  *file,
+                                      const guchar *data,
+                                      int           width,
+                                      int           height,
+                                      int           n_channels)
+{
+  ClutterMD2DataMipmaps *mipmaps = g_slice_new0 (ClutterMD2DataMipmaps);
+
+  mipmaps->ref_count = 1;
+  mipmaps->n_channels = n_channels;
+  mipmaps->size = _clutter_md2_data_get_mipmaps_size (width, height,
+                                                      n_channels,
+                                                      &mipmaps->n_levels);
+  mipmaps->data = data;
+  mipmaps->file = g_mapped_file_ref (file);
+
+  return mipmaps;
+}
+
+ClutterMD2DataMipmaps *
+_clutter_md2_data_mipmaps_ref (ClutterMD2DataMipmaps *mipmaps)
+{
+  mipmaps->ref_count++;
+
+  return mipmaps;
+}
+
+void
+_clutter_md2_data_mipmaps_unref (ClutterMD2DataMipmaps *mipmaps)
+{
+  if (--mipmaps->ref_count > 0)
+    return;
+
+  if (mipmaps->file)
+    g_mapped_file_unref (mipmaps->file);
+  else
+    g_free ((guchar *) mipmaps->data);
+
+  g_slice_free (ClutterMD2DataMipmaps, mipmaps);
+}
+
+const guchar *
+_clutter_md2_data_get_mipmap_level (const ClutterMD2DataMipmaps *mipmaps,
+                                    int                          level,
+                                    int                          width,
+                                    int                          height,
+                                    int                         *level_width,
+                                    int                         *level_height)
+{
+  const guchar *data = mipmaps->data;
+  int i;
+
+  g_return_val_if_fail (level >= 1 && level <= mipmaps->n_levels, NULL);
+
+  width = MAX (width / 2, 1);
+  height = MAX (height / 2, 1);
+
+  for (i = 1; i < level; i++)
+    {
+      data += width * height * mipmaps->n_channels;
+      width = MAX (width / 2, 1);
+      height = MAX (height / 2, 1);
+    }
+
+  *level_width = width;
+  *level_height = height;
+
+  return data;
+}
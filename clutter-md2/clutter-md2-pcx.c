@@ -0,0 +1,437 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib-object.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <clutter/clutter.h>
+#include <string.h>
+
+#include "clutter-md2-data.h"
+#include "clutter-md2-data-private.h"
+
+/* Most MD2 skins are 8-bit paletted PCX files. These are decoded
+   here directly into the padded texture layout instead of going
+   through a gdk-pixbuf loader module and then copying the image into
+   a bigger pixbuf. 24-bit PCX files with three planes are handled as
+   well. Paletted files can also be decoded to just the indices for
+   indexed skins */
+
+#define CLUTTER_MD2_PCX_HEADER_SIZE  128
+/* A marker byte followed by 256 RGB entries at the end of the file */
+#define CLUTTER_MD2_PCX_PALETTE_SIZE (1 + 256 * 3)
+#define CLUTTER_MD2_PCX_PALETTE_MARK 0x0c
+
+enum
+  {
+    CLUTTER_MD2_PCX_MANUFACTURER   = 0,
+    CLUTTER_MD2_PCX_ENCODING       = 2,
+    CLUTTER_MD2_PCX_BITS_PER_PIXEL = 3,
+    CLUTTER_MD2_PCX_XMIN           = 4,
+    CLUTTER_MD2_PCX_YMIN           = 6,
+    CLUTTER_MD2_PCX_XMAX           = 8,
+    CLUTTER_MD2_PCX_YMAX           = 10,
+    CLUTTER_MD2_PCX_N_PLANES       = 65,
+    CLUTTER_MD2_PCX_BYTES_PER_LINE = 66
+  };
+
+static guint
+clutter_md2_pcx_read_16 (const guchar *contents, int offset)
+{
+  return contents[offset] | (contents[offset + 1] << 8);
+}
+
+gboolean
+_clutter_md2_data_is_pcx (const guchar *contents,
+                          gsize         length)
+{
+  return (length >= CLUTTER_MD2_PCX_HEADER_SIZE
+          && contents[CLUTTER_MD2_PCX_MANUFACTURER] == 0x0a
+          /* Run length encoded */
+          && contents[CLUTTER_MD2_PCX_ENCODING] == 1
+          && contents[CLUTTER_MD2_PCX_BITS_PER_PIXEL] == 8
+          && (contents[CLUTTER_MD2_PCX_N_PLANES] == 1
+              || contents[CLUTTER_MD2_PCX_N_PLANES] == 3));
+}
+
+static gboolean
+clutter_md2_pcx_decode_line (const guchar **src_p,
+                             const guchar  *end,
+                             guchar        *line,
+                             guint          line_length,
+                             guint         *run_length,
+                             guchar        *run_value)
+{
+  const guchar *src = *src_p;
+  guint i = 0;
+
+  while (i < line_length)
+    {
+      guchar c;
+
+      /* Some encoders let runs continue onto the next line so the
+         remainder of a run is carried over */
+      if (*run_length)
+        {
+          guint n = MIN (*run_length, line_length - i);
+
+          memset (line + i, *run_value, n);
+          i += n;
+          *run_length -= n;
+          continue;
+        }
+
+      if (src >= end)
+        return FALSE;
+
+      c = *(src++);
+
+      if ((c & 0xc0) == 0xc0)
+        {
+          if (src >= end)
+            return FALSE;
+
+          *run_length = c & 0x3f;
+          *run_value = *(src++);
+        }
+      else
+        line[i++] = c;
+    }
+
+  *src_p = src;
+
+  return TRUE;
+}
+
+/* Writes width pixels of a line of palette indices as RGB */
+static void
+clutter_md2_pcx_expand_palette (const guchar  *line,
+                                const guchar (*palette)[4],
+                                guchar        *dst,
+                                guint          width)
+{
+  guint x;
+
+  /* Each pixel is stored as four bytes so that the compiler can use a
+     single word store. The fourth byte is overwritten by the next
+     pixel so the last pixel is copied separately */
+  for (x = 0; x + 1 < width; x++)
+    {
+      memcpy (dst, palette[line[x]], 4);
+      dst += 3;
+    }
+
+  memcpy (dst, palette[line[x]], 3);
+}
+
+/* Writes width pixels of the red, green and blue planes of a line as
+   RGB */
+static void
+clutter_md2_pcx_interleave_planes (const guchar *line,
+                                   guint         bytes_per_line,
+                                   guchar       *dst,
+                                   guint         width)
+{
+  const guchar *r = line;
+  const guchar *g = line + bytes_per_line;
+  const guchar *b = line + bytes_per_line * 2;
+  guint x;
+
+  for (x = 0; x < width; x++)
+    {
+      dst[0] = r[x];
+      dst[1] = g[x];
+      dst[2] = b[x];
+      dst += 3;
+    }
+}
+
+typedef struct _ClutterMD2PcxImage ClutterMD2PcxImage;
+
+struct _ClutterMD2PcxImage
+{
+  guint width, height;
+  guint n_planes, bytes_per_line;
+  /* The run length encoded lines */
+  const guchar *src, *end;
+  /* The 256 RGB entries for single plane images */
+  const guchar *palette;
+};
+
+static gboolean
+clutter_md2_pcx_read_header (const guchar       *contents,
+                             gsize               length,
+                             ClutterMD2PcxImage *image,
+                             const gchar        *display_name,
+                             GError            **error)
+{
+  image->width = (clutter_md2_pcx_read_16 (contents, CLUTTER_MD2_PCX_XMAX)
+                  - clutter_md2_pcx_read_16 (contents,
+                                             CLUTTER_MD2_PCX_XMIN) + 1);
+  image->height = (clutter_md2_pcx_read_16 (contents, CLUTTER_MD2_PCX_YMAX)
+                   - clutter_md2_pcx_read_16 (contents,
+                                              CLUTTER_MD2_PCX_YMIN) + 1);
+  image->n_planes = contents[CLUTTER_MD2_PCX_N_PLANES];
+  image->bytes_per_line
+    = clutter_md2_pcx_read_16 (contents, CLUTTER_MD2_PCX_BYTES_PER_LINE);
+
+  image->src = contents + CLUTTER_MD2_PCX_HEADER_SIZE;
+  image->end = contents + length;
+  image->palette = NULL;
+
+  if (image->width < 1 || image->width > 0xffff
+      || image->height < 1 || image->height > 0xffff
+      || image->bytes_per_line < image->width
+      || (image->n_planes == 1
+          && (length < (CLUTTER_MD2_PCX_HEADER_SIZE
+                        + CLUTTER_MD2_PCX_PALETTE_SIZE)
+              || (contents[length - CLUTTER_MD2_PCX_PALETTE_SIZE]
+                  != CLUTTER_MD2_PCX_PALETTE_MARK))))
+    {
+      g_set_error (error, CLUTTER_MD2_DATA_ERROR,
+                   CLUTTER_MD2_DATA_ERROR_INVALID_FILE,
+                   "'%s' is not a valid PCX file", display_name);
+      return FALSE;
+    }
+
+  if (image->n_planes == 1)
+    {
+      image->palette = image->end - CLUTTER_MD2_PCX_PALETTE_SIZE + 1;
+      /* The image data stops at the palette */
+      image->end -= CLUTTER_MD2_PCX_PALETTE_SIZE;
+    }
+
+  return TRUE;
+}
+
+GdkPixbuf *
+_clutter_md2_data_decode_pcx (const guchar *contents,
+                              gsize         length,
+                              guint         texture_width,
+                              guint         texture_height,
+                              const gchar  *display_name,
+                              GError      **error)
+{
+  ClutterMD2PcxImage image;
+  guchar palette[256][4];
+  guint copy_width, copy_height;
+  guint run_length = 0;
+  guchar run_value = 0;
+  GdkPixbuf *pixbuf;
+  guchar *pixels, *line;
+  int rowstride;
+  guint x, y;
+
+  g_return_val_if_fail (_clutter_md2_data_is_pcx (contents, length), NULL);
+
+  if (!clutter_md2_pcx_read_header (contents, length, &image,
+                                    display_name, error))
+    return NULL;
+
+  if (image.palette)
+    for (x = 0; x < 256; x++)
+      {
+        memcpy (palette[x], image.palette + x * 3, 3);
+        palette[x][3] = 0;
+      }
+
+  /* A size of zero means the size of the image */
+  if (texture_width == 0 || texture_height == 0)
+    {
+      texture_width = image.width;
+      texture_height = image.height;
+    }
+
+  copy_width = MIN (image.width, texture_width);
+  copy_height = MIN (image.height, texture_height);
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
+                           texture_width, texture_height);
+
+  if (pixbuf == NULL)
+    {
+      g_set_error (error, CLUTTER_MD2_DATA_ERROR,
+                   CLUTTER_MD2_DATA_ERROR_INVALID_FILE,
+                   "'%s' is too big", display_name);
+      return NULL;
+    }
+
+  pixels = gdk_pixbuf_get_pixels (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  line = g_malloc (image.bytes_per_line * image.n_planes);
+
+  for (y = 0; y < copy_height; y++)
+    {
+      guchar *dst = pixels + y * rowstride;
+
+      if (!clutter_md2_pcx_decode_line (&image.src, image.end, line,
+                                        image.bytes_per_line
+                                        * image.n_planes,
+                                        &run_length, &run_value))
+        {
+          g_set_error (error, CLUTTER_MD2_DATA_ERROR,
+                       CLUTTER_MD2_DATA_ERROR_INVALID_FILE,
+                       "'%s' is truncated", display_name);
+          g_free (line);
+          g_object_unref (pixbuf);
+          return NULL;
+        }
+
+      if (image.n_planes == 1)
+        clutter_md2_pcx_expand_palette (line,
+                                        (const guchar (*)[4]) palette,
+                                        dst, copy_width);
+      else
+        clutter_md2_pcx_interleave_planes (line, image.bytes_per_line,
+                                           dst, copy_width);
+
+      /* Repeat the last pixel to the right edge of the texture so
+         there won't be artifacts if it is linear filtered */
+      for (x = copy_width; x < texture_width; x++)
+        memcpy (dst + x * 3, dst + (copy_width - 1) * 3, 3);
+    }
+
+  g_free (line);
+
+  /* Repeat the last row to the bottom of the texture */
+  for (y = copy_height; y < texture_height; y++)
+    memcpy (pixels + y * rowstride,
+            pixels + (copy_height - 1) * rowstride,
+            texture_width * 3);
+
+  return pixbuf;
+}
+
+gboolean
+_clutter_md2_data_is_indexed_pcx (const guchar *contents,
+                                  gsize         length)
+{
+  return (_clutter_md2_data_is_pcx (contents, length)
+          && contents[CLUTTER_MD2_PCX_N_PLANES] == 1);
+}
+
+GByteArray *
+_clutter_md2_data_decode_pcx_indexed (const guchar *contents,
+                                      gsize         length,
+                                      guint         texture_width,
+                                      guint         texture_height,
+                                      guchar       *palette,
+                                      const gchar  *display_name,
+                                      GError      **error)
+{
+  ClutterMD2PcxImage image;
+  guint copy_width, copy_height;
+  guint run_length = 0;
+  guchar run_value = 0;
+  GByteArray *indices;
+  guchar *line;
+  guint y;
+
+  g_return_val_if_fail (_clutter_md2_data_is_indexed_pcx (contents, length),
+                        NULL);
+  g_return_val_if_fail (texture_width > 0 && texture_height > 0, NULL);
+
+  if (!clutter_md2_pcx_read_header (contents, length, &image,
+                                    display_name, error))
+    return NULL;
+
+  memcpy (palette, image.palette, CLUTTER_MD2_DATA_PALETTE_SIZE);
+
+  copy_width = MIN (image.width, texture_width);
+  copy_height = MIN (image.height, texture_height);
+
+  indices = g_byte_array_sized_new (texture_width * texture_height);
+  g_byte_array_set_size (indices, texture_width * texture_height);
+
+  /* The line buffer may be longer than the texture so the lines are
+     decoded separately and then copied */
+  line = g_malloc (image.bytes_per_line);
+
+  for (y = 0; y < copy_height; y++)
+    {
+      guchar *dst = indices->data + y * texture_width;
+
+      if (!clutter_md2_pcx_decode_line (&image.src, image.end, line,
+                                        image.bytes_per_line,
+                                        &run_length, &run_value))
+        {
+          g_set_error (error, CLUTTER_MD2_DATA_ERROR,
+                       CLUTTER_MD2_DATA_ERROR_INVALID_FILE,
+                       "'%s' is truncated", display_name);
+          g_free (line);
+          g_byte_array_unref (indices);
+          return NULL;
+        }
+
+      memcpy (dst, line, copy_width);
+      /* Repeat the edges in the same way as the RGB images */
+      memset (dst + copy_width, line[copy_width - 1],
+              texture_width - copy_width);
+    }
+
+  g_free (line);
+
+  for (y = copy_height; y < texture_height; y++)
+    memcpy (indices->data + y * texture_width,
+            indices->data + (copy_height - 1) * texture_width,
+            texture_width);
+
+  return indices;
+}
+
+/* Loads an 8-bit paletted or 24-bit PCX image with the same decoder
+   that is used for skins. Returns NULL and sets error if the file
+   couldn't be loaded */
+GdkPixbuf *
+clutter_md2_data_load_pcx (const gchar *filename,
+                           GError     **error)
+{
+  GMappedFile *file;
+  GdkPixbuf *pixbuf = NULL;
+  const guchar *contents;
+  gsize length;
+
+  g_return_val_if_fail (filename != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  if ((file = g_mapped_file_new (filename, FALSE, error)) == NULL)
+    return NULL;
+
+  contents = (const guchar *) g_mapped_file_get_contents (file);
+  length = g_mapped_file_get_length (file);
+
+  if (_clutter_md2_data_is_pcx (contents, length))
+    pixbuf = _clutter_md2_data_decode_pcx (contents, length, 0, 0,
+                                           filename, error);
+  else
+    g_set_error (error, CLUTTER_MD2_DATA_ERROR,
+                 CLUTTER_MD2_DATA_ERROR_INVALID_FILE,
+                 "'%s' is not a supported PCX file", filename);
+
+  g_mapped_file_unref (file);
+
+  return pixbuf;
+}
@@ -0,0 +1,55 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CLUTTER_MD2_PRIVATE_H__
+#define __CLUTTER_MD2_PRIVATE_H__
+
+#include "clutter-md2.h"
+
+G_BEGIN_DECLS
+
+/* Returns FALSE if the actor won't be painted because it is unmapped,
+   fully transparent or entirely outside of the stage. Otherwise the
+   larger of the width and height of its on-screen bounding box is
+   stored in size */
+gboolean _clutter_md2_get_screen_size (ClutterMD2 *md2,
+                                       gfloat     *size);
+
+/* An animation driver that skips an actor because it won't be painted
+   registers a function to bring its frame up to date. The function is
+   called and forgotten when the actor is next painted or picked, and
+   forgotten when the frame is set in any other way */
+typedef void (* ClutterMD2CatchUpFunc) (ClutterMD2 *md2,
+                                        gpointer    user_data);
+
+void _clutter_md2_set_catch_up (ClutterMD2            *md2,
+                                ClutterMD2CatchUpFunc  func,
+                                gpointer               user_data);
+
+/* Forgets the catch up function if it was registered with user_data */
+void _clutter_md2_cancel_catch_up (ClutterMD2 *md2,
+                                   gpointer    user_data);
+
+G_END_DECLS
+
+#endif /* __CLUTTER_MD2_PRIVATE_H__ */
@@ -0,0 +1,749 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib-object.h>
+#include <clutter/clutter.h>
+#include <string.h>
+#include <float.h>
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "clutter-md2-data.h"
+#include "clutter-md2-data-private.h"
+
+/* The buffer is split into square tiles of this size. Each tile is
+   rasterized independently so that they can be spread across
+   threads without any locking */
+#define CLUTTER_MD2_RASTER_TILE_SIZE 64
+
+typedef struct _ClutterMD2RasterCorner   ClutterMD2RasterCorner;
+typedef struct _ClutterMD2RasterTriangle ClutterMD2RasterTriangle;
+typedef struct _ClutterMD2RasterState    ClutterMD2RasterState;
+typedef struct _ClutterMD2RasterTask     ClutterMD2RasterTask;
+
+/* A vertex of a GL command after transforming to buffer space */
+struct _ClutterMD2RasterCorner
+{
+  float x, y, z;
+  float s, t;
+};
+
+/* A triangle after setup. Each edge function is E = a * x + b * y +
+   c and the pixel is inside if all three are >= the bias. The z and
+   texture coordinates are stored as planes in the same form */
+struct _ClutterMD2RasterTriangle
+{
+  float edge_a[3], edge_b[3], edge_c[3];
+  float bias[3];
+  float z[3], s[3], t[3];
+
+  /* Bounding box of the pixels to test clamped to the buffer */
+  int min_x, min_y, max_x, max_y;
+};
+
+struct _ClutterMD2RasterState
+{
+  ClutterMD2DataBuffer *buffer;
+  gfloat *depth;
+
+  ClutterMD2RasterTriangle *triangles;
+
+  /* The indices of the triangles touching each tile are stored
+     consecutively in bins in the order they should be drawn. The
+     triangles for tile n start at bin_offsets[n] and end at
+     bin_offsets[n + 1] */
+  int tiles_x, tiles_y;
+  int *bin_offsets;
+  int *bins;
+
+  /* The skin padded to the texture size */
+  const ClutterMD2DataSkinImage *skin;
+
+  /* Number of tiles that the thread pool hasn't finished yet. The
+     last one to finish signals done_cond */
+  int pending_tiles;
+  GMutex *done_mutex;
+  GCond *done_cond;
+};
+
+/* The thread pool is shared by every render so each tile carries the
+   state that it belongs to */
+struct _ClutterMD2RasterTask
+{
+  ClutterMD2RasterState *state;
+  int tile;
+};
+
+static gboolean
+clutter_md2_raster_setup_triangle (ClutterMD2RasterTriangle *tri,
+                                   const ClutterMD2RasterCorner *v0,
+                                   const ClutterMD2RasterCorner *v1,
+                                   const ClutterMD2RasterCorner *v2,
+                                   int width, int height)
+{
+  const ClutterMD2RasterCorner *v[3] = { v0, v1, v2 };
+  float area, min_x, min_y, max_x, max_y;
+  int i;
+
+  /* Edge i is opposite vertex i */
+  for (i = 0; i < 3; i++)
+    {
+      const ClutterMD2RasterCorner *j = v[(i + 1) % 3];
+      const ClutterMD2RasterCorner *k = v[(i + 2) % 3];
+
+      tri->edge_a[i] = j->y - k->y;
+      tri->edge_b[i] = k->x - j->x;
+      tri->edge_c[i] = -(tri->edge_a[i] * j->x + tri->edge_b[i] * j->y);
+    }
+
+  area = tri->edge_a[0] * v0->x + tri->edge_b[0] * v0->y + tri->edge_c[0];
+
+  if (area == 0.0f)
+    return FALSE;
+
+  /* GL doesn't have culling enabled so both windings are drawn. Flip
+     the edges of back-facing triangles so that the inside is always
+     positive */
+  if (area < 0.0f)
+    {
+      for (i = 0; i < 3; i++)
+        {
+          tri->edge_a[i] = -tri->edge_a[i];
+          tri->edge_b[i] = -tri->edge_b[i];
+          tri->edge_c[i] = -tri->edge_c[i];
+        }
+      area = -area;
+    }
+
+  /* Use a top-left fill rule so that pixels exactly on an edge shared
+     by two triangles are only drawn once. An edge shared with a
+     neighbour always has the opposite direction so only one of them
+     will pass this test */
+  for (i = 0; i < 3; i++)
+    tri->bias[i] = (tri->edge_a[i] > 0.0f
+                    || (tri->edge_a[i] == 0.0f && tri->edge_b[i] > 0.0f))
+      ? 0.0f : FLT_MIN;
+
+#define SETUP_PLANE(plane, member)                                      \
+  G_STMT_START {                                                        \
+    (plane)[0] = (v0->member * tri->edge_a[0]                           \
+                  + v1->member * tri->edge_a[1]                         \
+                  + v2->member * tri->edge_a[2]) / area;                \
+    (plane)[1] = (v0->member * tri->edge_b[0]                           \
+                  + v1->member * tri->edge_b[1]                         \
+                  + v2->member * tri->edge_b[2]) / area;                \
+    (plane)[2] = (v0->member * tri->edge_c[0]                           \
+                  + v1->member * tri->edge_c[1]                         \
+                  + v2->member * tri->edge_c[2]) / area;                \
+  } G_STMT_END
+
+  SETUP_PLANE (tri->z, z);
+  SETUP_PLANE (tri->s, s);
+  SETUP_PLANE (tri->t, t);
+
+#undef SETUP_PLANE
+
+  min_x = MIN (v0->x, MIN (v1->x, v2->x));
+  min_y = MIN (v0->y, MIN (v1->y, v2->y));
+  max_x = MAX (v0->x, MAX (v1->x, v2->x));
+  max_y = MAX (v0->y, MAX (v1->y, v2->y));
+
+  /* Only pixels whose centers are within the box need to be
+     tested. The box is rounded outwards and the edge functions decide
+     the pixels on the border */
+  if (max_x < 0.5f || max_y < 0.5f
+      || min_x > width - 0.5f || min_y > height - 0.5f)
+    return FALSE;
+
+  tri->min_x = MAX (0, (int) (min_x - 0.5f));
+  tri->min_y = MAX (0, (int) (min_y - 0.5f));
+  tri->max_x = MIN (width - 1, (int) (max_x + 0.5f));
+  tri->max_y = MIN (height - 1, (int) (max_y + 0.5f));
+
+  return tri->min_x <= tri->max_x && tri->min_y <= tri->max_y;
+}
+
+/* Wraps a texel coordinate like GL_REPEAT. The skin is only a power
+   of two if GL can't use other sizes and then masking is enough */
+static inline int
+clutter_md2_raster_wrap (int i, int size)
+{
+  if ((size & (size - 1)) == 0)
+    return i & (size - 1);
+
+  i %= size;
+
+  return i < 0 ? i + size : i;
+}
+
+/* Samples the skin with bilinear filtering and GL_REPEAT wrapping to
+   match the GL renderer */
+static void
+clutter_md2_raster_sample (const ClutterMD2RasterState *state,
+                           float s, float t,
+                           guchar *dst)
+{
+  const ClutterMD2DataSkinImage *skin = state->skin;
+  float u = s * skin->width - 0.5f;
+  float v = t * skin->height - 0.5f;
+  int iu = (int) u, iv = (int) v;
+  int fu, fv, x0, x1;
+  const guchar *row0, *row1;
+  const guchar *t00, *t01, *t10, *t11;
+  int channels = skin->n_channels;
+  int i;
+
+  /* Round towards negative infinity */
+  if (u < iu)
+    iu--;
+  if (v < iv)
+    iv--;
+
+  fu = (int) ((u - iu) * 256.0f);
+  fv = (int) ((v - iv) * 256.0f);
+
+  x0 = clutter_md2_raster_wrap (iu, skin->width) * channels;
+  x1 = clutter_md2_raster_wrap (iu + 1, skin->width) * channels;
+  row0 = (skin->texels
+          + clutter_md2_raster_wrap (iv, skin->height) * skin->rowstride);
+  row1 = (skin->texels
+          + clutter_md2_raster_wrap (iv + 1, skin->height) * skin->rowstride);
+
+  t00 = row0 + x0;
+  t01 = row0 + x1;
+  t10 = row1 + x0;
+  t11 = row1 + x1;
+
+  /* Indexed skins are filtered after looking up the colours so that
+     the result matches the GL fragment program */
+  if (skin->palette)
+    {
+      t00 = skin->palette + *t00 * 3;
+      t01 = skin->palette + *t01 * 3;
+      t10 = skin->palette + *t10 * 3;
+      t11 = skin->palette + *t11 * 3;
+      channels = 3;
+    }
+
+  for (i = 0; i < channels; i++)
+    {
+      int top = t00[i] * (256 - fu) + t01[i] * fu;
+      int bottom = t10[i] * (256 - fu) + t11[i] * fu;
+
+      dst[i] = (top * (256 - fv) + bottom * fv) >> 16;
+    }
+
+  if (channels == 3)
+    dst[3] = 255;
+}
+
+static void
+clutter_md2_raster_shade (const ClutterMD2RasterState *state,
+                          const ClutterMD2RasterTriangle *tri,
+                          int x, int y, float z)
+{
+  float px = x + 0.5f, py = y + 0.5f;
+  float s = tri->s[0] * px + tri->s[1] * py + tri->s[2];
+  float t = tri->t[0] * px + tri->t[1] * py + tri->t[2];
+
+  state->depth[y * state->buffer->width + x] = z;
+
+  clutter_md2_raster_sample (state, s, t,
+                             state->buffer->pixels
+                             + y * state->buffer->rowstride + x * 4);
+}
+
+static void
+clutter_md2_raster_span (const ClutterMD2RasterState *state,
+                         const ClutterMD2RasterTriangle *tri,
+                         int y, int min_x, int max_x)
+{
+  gfloat *depth_row = state->depth + y * state->buffer->width;
+  float px = min_x + 0.5f, py = y + 0.5f;
+  int x;
+#ifdef __SSE2__
+  __m128 lanes = _mm_set_ps (3.0f, 2.0f, 1.0f, 0.0f);
+  __m128 e[3], e_step[3], bias[3], z, z_step;
+  int i;
+
+  /* Evaluate the edge functions and the depth for four pixels at a
+     time and then only shade the pixels that pass */
+  for (i = 0; i < 3; i++)
+    {
+      e[i] = _mm_add_ps (_mm_set1_ps (tri->edge_a[i] * px
+                                      + tri->edge_b[i] * py
+                                      + tri->edge_c[i]),
+                         _mm_mul_ps (_mm_set1_ps (tri->edge_a[i]), lanes));
+      e_step[i] = _mm_set1_ps (tri->edge_a[i] * 4.0f);
+      bias[i] = _mm_set1_ps (tri->bias[i]);
+    }
+
+  z = _mm_add_ps (_mm_set1_ps (tri->z[0] * px + tri->z[1] * py + tri->z[2]),
+                  _mm_mul_ps (_mm_set1_ps (tri->z[0]), lanes));
+  z_step = _mm_set1_ps (tri->z[0] * 4.0f);
+
+  for (x = min_x; x <= max_x; x += 4)
+    {
+      int n_pixels = MIN (4, max_x - x + 1);
+      __m128 mask, old_depth;
+      int bits;
+
+      mask = _mm_and_ps (_mm_and_ps (_mm_cmpge_ps (e[0], bias[0]),
+                                     _mm_cmpge_ps (e[1], bias[1])),
+                         _mm_cmpge_ps (e[2], bias[2]));
+
+      if (_mm_movemask_ps (mask))
+        {
+          /* Avoid reading past the end of the depth buffer */
+          if (n_pixels == 4)
+            old_depth = _mm_loadu_ps (depth_row + x);
+          else
+            {
+              float tmp[4] = { FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX };
+              memcpy (tmp, depth_row + x, n_pixels * sizeof (float));
+              old_depth = _mm_loadu_ps (tmp);
+            }
+
+          /* Equivalent to GL_LEQUAL with the depth range flipped */
+          mask = _mm_and_ps (mask, _mm_cmpge_ps (z, old_depth));
+          bits = _mm_movemask_ps (mask) & ((1 << n_pixels) - 1);
+
+          if (bits)
+            {
+              float z_values[4];
+
+              _mm_storeu_ps (z_values, z);
+
+              for (i = 0; i < n_pixels; i++)
+                if ((bits & (1 << i)))
+                  clutter_md2_raster_shade (state, tri, x + i, y,
+                                            z_values[i]);
+            }
+        }
+
+      for (i = 0; i < 3; i++)
+        e[i] = _mm_add_ps (e[i], e_step[i]);
+      z = _mm_add_ps (z, z_step);
+    }
+#else /* __SSE2__ */
+  float e0 = tri->edge_a[0] * px + tri->edge_b[0] * py + tri->edge_c[0];
+  float e1 = tri->edge_a[1] * px + tri->edge_b[1] * py + tri->edge_c[1];
+  float e2 = tri->edge_a[2] * px + tri->edge_b[2] * py + tri->edge_c[2];
+  float z = tri->z[0] * px + tri->z[1] * py + tri->z[2];
+
+  for (x = min_x; x <= max_x; x++)
+    {
+      if (e0 >= tri->bias[0] && e1 >= tri->bias[1] && e2 >= tri->bias[2]
+          && z >= depth_row[x])
+        clutter_md2_raster_shade (state, tri, x, y, z);
+
+      e0 += tri->edge_a[0];
+      e1 += tri->edge_a[1];
+      e2 += tri->edge_a[2];
+      z += tri->z[0];
+    }
+#endif /* __SSE2__ */
+}
+
+static void
+clutter_md2_raster_tile (const ClutterMD2RasterState *state, int tile_num)
+{
+  int tile_x = (tile_num % state->tiles_x) * CLUTTER_MD2_RASTER_TILE_SIZE;
+  int tile_y = (tile_num / state->tiles_x) * CLUTTER_MD2_RASTER_TILE_SIZE;
+  int tile_max_x = MIN (tile_x + CLUTTER_MD2_RASTER_TILE_SIZE,
+                        state->buffer->width) - 1;
+  int tile_max_y = MIN (tile_y + CLUTTER_MD2_RASTER_TILE_SIZE,
+                        state->buffer->height) - 1;
+  int bin;
+
+  for (bin = state->bin_offsets[tile_num];
+       bin < state->bin_offsets[tile_num + 1];
+       bin++)
+    {
+      const ClutterMD2RasterTriangle *tri
+        = state->triangles + state->bins[bin];
+      int min_x = MAX (tri->min_x, tile_x);
+      int max_x = MIN (tri->max_x, tile_max_x);
+      int max_y = MIN (tri->max_y, tile_max_y);
+      int y;
+
+      for (y = MAX (tri->min_y, tile_y); y <= max_y; y++)
+        clutter_md2_raster_span (state, tri, y, min_x, max_x);
+    }
+}
+
+static void
+clutter_md2_raster_tile_cb (gpointer task_data, gpointer user_data)
+{
+  ClutterMD2RasterTask *task = task_data;
+  ClutterMD2RasterState *state = task->state;
+
+  clutter_md2_raster_tile (state, task->tile);
+
+  g_mutex_lock (state->done_mutex);
+  if (--state->pending_tiles == 0)
+    g_cond_signal (state->done_cond);
+  g_mutex_unlock (state->done_mutex);
+}
+
+static gpointer
+clutter_md2_raster_create_pool (gpointer user_data)
+{
+  return g_thread_pool_new (clutter_md2_raster_tile_cb, NULL,
+                            GPOINTER_TO_INT (user_data), FALSE, NULL);
+}
+
+int
+_clutter_md2_data_get_n_threads (void)
+{
+#if defined (G_OS_UNIX) && defined (_SC_NPROCESSORS_ONLN)
+  long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+  if (n_cpus > 1)
+    return n_cpus;
+#endif
+
+  return 1;
+}
+
+static void
+clutter_md2_raster_bin_triangles (ClutterMD2RasterState *state,
+                                  int n_triangles)
+{
+  int n_tiles = state->tiles_x * state->tiles_y;
+  int *pos;
+  int i, tx, ty;
+
+  state->bin_offsets = g_new0 (int, n_tiles + 1);
+
+  /* Count the triangles in each tile first so that all of the bins
+     can be stored in a single allocation */
+  for (i = 0; i < n_triangles; i++)
+    {
+      const ClutterMD2RasterTriangle *tri = state->triangles + i;
+
+      for (ty = tri->min_y / CLUTTER_MD2_RASTER_TILE_SIZE;
+           ty <= tri->max_y / CLUTTER_MD2_RASTER_TILE_SIZE;
+           ty++)
+        for (tx = tri->min_x / CLUTTER_MD2_RASTER_TILE_SIZE;
+             tx <= tri->max_x / CLUTTER_MD2_RASTER_TILE_SIZE;
+             tx++)
+          state->bin_offsets[ty * state->tiles_x + tx + 1]++;
+    }
+
+  for (i = 0; i < n_tiles; i++)
+    state->bin_offsets[i + 1] += state->bin_offsets[i];
+
+  state->bins = g_new (int, state->bin_offsets[n_tiles]);
+  pos = g_new (int, n_tiles);
+  memcpy (pos, state->bin_offsets, n_tiles * sizeof (int));
+
+  for (i = 0; i < n_triangles; i++)
+    {
+      const ClutterMD2RasterTriangle *tri = state->triangles + i;
+
+      for (ty = tri->min_y / CLUTTER_MD2_RASTER_TILE_SIZE;
+           ty <= tri->max_y / CLUTTER_MD2_RASTER_TILE_SIZE;
+           ty++)
+        for (tx = tri->min_x / CLUTTER_MD2_RASTER_TILE_SIZE;
+             tx <= tri->max_x / CLUTTER_MD2_RASTER_TILE_SIZE;
+             tx++)
+          state->bins[pos[ty * state->tiles_x + tx]++] = i;
+    }
+
+  g_free (pos);
+}
+
+void
+_clutter_md2_data_get_vertex_positions (ClutterMD2Data *data,
+                                        gint            frame_num_a,
+                                        gint            frame_num_b,
+                                        gfloat          interval,
+                                        gfloat         *positions)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  ClutterMD2DataFrame *frame_a = priv->frames[frame_num_a];
+  ClutterMD2DataFrame *frame_b = priv->frames[frame_num_b];
+  const guchar *vertices_a, *vertices_b;
+  int i, j;
+
+  if (priv->basis_size > 0)
+    {
+      gint frame_nums[2] = { frame_num_a, frame_num_b };
+      gfloat weights[2] = { 1.0f - interval, interval };
+
+      _clutter_md2_data_get_basis_positions (data, 2, frame_nums, weights,
+                                             positions);
+      return;
+    }
+
+  vertices_a = _clutter_md2_data_get_frame_vertices (data, frame_num_a);
+  vertices_b = _clutter_md2_data_get_frame_vertices (data, frame_num_b);
+
+  for (i = 0; i < priv->num_vertices; i++)
+    {
+      const guchar *vertex_a = vertices_a + i * 4;
+      const guchar *vertex_b = vertices_b + i * 4;
+
+      for (j = 0; j < 3; j++)
+        {
+          float pos = vertex_a[j] * frame_a->scale[j] + frame_a->translate[j];
+
+          if (frame_a != frame_b)
+            {
+              float pos_b = (vertex_b[j] * frame_b->scale[j]
+                             + frame_b->translate[j]);
+              pos += (pos_b - pos) * interval;
+            }
+
+          *(positions++) = pos;
+        }
+    }
+}
+
+static GArray *
+clutter_md2_raster_setup_triangles (const guchar *gl_command,
+                                    const float *vertices,
+                                    int width, int height)
+{
+  GArray *triangles, *corners;
+
+  triangles = g_array_new (FALSE, FALSE, sizeof (ClutterMD2RasterTriangle));
+  corners = g_array_new (FALSE, FALSE, sizeof (ClutterMD2RasterCorner));
+
+  while (*(const gint32 *) gl_command)
+    {
+      gint32 command_len = *(const gint32 *) gl_command;
+      gboolean is_fan;
+      ClutterMD2RasterCorner *c;
+      ClutterMD2RasterTriangle tri;
+      int i;
+
+      gl_command += sizeof (gint32);
+
+      if ((is_fan = command_len < 0))
+        command_len = -command_len;
+
+      g_array_set_size (corners, command_len);
+      c = (ClutterMD2RasterCorner *) corners->data;
+
+      for (i = 0; i < command_len; i++)
+        {
+          guint32 vertex_num;
+
+          c[i].s = *(const float *) gl_command;
+          gl_command += sizeof (float);
+          c[i].t = *(const float *) gl_command;
+          gl_command += sizeof (float);
+          vertex_num = *(const guint32 *) gl_command;
+          gl_command += sizeof (guint32);
+
+          c[i].x = vertices[vertex_num * 3];
+          c[i].y = vertices[vertex_num * 3 + 1];
+          c[i].z = vertices[vertex_num * 3 + 2];
+        }
+
+      for (i = 2; i < command_len; i++)
+        {
+          const ClutterMD2RasterCorner *v0, *v1, *v2 = c + i;
+
+          if (is_fan)
+            {
+              v0 = c;
+              v1 = c + i - 1;
+            }
+          else
+            {
+              v0 = c + i - 2;
+              v1 = c + i - 1;
+            }
+
+          if (clutter_md2_raster_setup_triangle (&tri, v0, v1, v2,
+                                                 width, height))
+            g_array_append_val (triangles, tri);
+        }
+    }
+
+  g_array_free (corners, TRUE);
+
+  return triangles;
+}
+
+void
+_clutter_md2_data_rasterize (const guchar                  *gl_commands,
+                             const gfloat                  *vertices,
+                             const ClutterMD2DataSkinImage *skin,
+                             ClutterMD2DataBuffer          *buffer)
+{
+  ClutterMD2RasterState state;
+  GArray *triangles;
+  gfloat *depth = NULL;
+  GThreadPool *pool = NULL;
+  ClutterMD2RasterTask *tasks;
+  int n_tiles, n_threads, i;
+
+  if (buffer->depth == NULL)
+    {
+      depth = g_new (gfloat, buffer->width * buffer->height);
+      for (i = buffer->width * buffer->height - 1; i >= 0; i--)
+        depth[i] = -G_MAXFLOAT;
+    }
+
+  state.buffer = buffer;
+  state.depth = buffer->depth ? buffer->depth : depth;
+  state.skin = skin;
+
+  triangles = clutter_md2_raster_setup_triangles (gl_commands, vertices,
+                                                  buffer->width,
+                                                  buffer->height);
+
+  state.triangles = (ClutterMD2RasterTriangle *) triangles->data;
+  state.tiles_x = ((buffer->width + CLUTTER_MD2_RASTER_TILE_SIZE - 1)
+                   / CLUTTER_MD2_RASTER_TILE_SIZE);
+  state.tiles_y = ((buffer->height + CLUTTER_MD2_RASTER_TILE_SIZE - 1)
+                   / CLUTTER_MD2_RASTER_TILE_SIZE);
+  n_tiles = state.tiles_x * state.tiles_y;
+
+  clutter_md2_raster_bin_triangles (&state, triangles->len);
+
+  /* The thread pool can only be used if the application has
+     initialised threads. Otherwise the tiles are just drawn in
+     order. The pool is created once and kept because the impostors
+     render a row for every frame */
+  n_threads = _clutter_md2_data_get_n_threads ();
+
+  if (n_threads > 1 && n_tiles > 1 && g_thread_supported ())
+    {
+      static GOnce pool_once = G_ONCE_INIT;
+
+      pool = g_once (&pool_once, clutter_md2_raster_create_pool,
+                     GINT_TO_POINTER (n_threads));
+    }
+
+  if (pool)
+    {
+      tasks = g_new (ClutterMD2RasterTask, n_tiles);
+
+      state.pending_tiles = 0;
+      for (i = 0; i < n_tiles; i++)
+        if (state.bin_offsets[i] < state.bin_offsets[i + 1])
+          state.pending_tiles++;
+
+      state.done_mutex = g_mutex_new ();
+      state.done_cond = g_cond_new ();
+
+      g_mutex_lock (state.done_mutex);
+
+      for (i = 0; i < n_tiles; i++)
+        if (state.bin_offsets[i] < state.bin_offsets[i + 1])
+          {
+            tasks[i].state = &state;
+            tasks[i].tile = i;
+            g_thread_pool_push (pool, tasks + i, NULL);
+          }
+
+      /* Wait for all of the tiles to finish */
+      while (state.pending_tiles > 0)
+        g_cond_wait (state.done_cond, state.done_mutex);
+
+      g_mutex_unlock (state.done_mutex);
+
+      g_mutex_free (state.done_mutex);
+      g_cond_free (state.done_cond);
+      g_free (tasks);
+    }
+  else
+    for (i = 0; i < n_tiles; i++)
+      if (state.bin_offsets[i] < state.bin_offsets[i + 1])
+        clutter_md2_raster_tile (&state, i);
+
+  g_free (state.bins);
+  g_free (state.bin_offsets);
+  g_array_free (triangles, TRUE);
+  g_free (depth);
+}
+
+gboolean
+clutter_md2_data_render_software (ClutterMD2Data        *data,
+                                  gint                   frame_num_a,
+                                  gint                   frame_num_b,
+                                  gfloat                 interval,
+                                  gint                   skin_num,
+                                  const ClutterGeometry *geom,
+                                  ClutterMD2DataBuffer  *buffer)
+{
+  ClutterMD2DataPrivate *priv;
+  ClutterMD2DataSkinImage skin;
+  gfloat *vertices, *v, scale, center[3];
+  int i;
+
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), FALSE);
+  g_return_val_if_fail (geom != NULL, FALSE);
+  g_return_val_if_fail (buffer != NULL && buffer->pixels != NULL, FALSE);
+
+  priv = data->priv;
+
+  /* The skin pixels are only available if they were kept when the
+     skin was added */
+  if (priv->gl_commands == NULL
+      || priv->frames == NULL
+      || skin_num < 0
+      || skin_num >= priv->num_skins
+      || !_clutter_md2_data_get_skin_image (priv->skins + skin_num, &skin)
+      || frame_num_a < 0 || frame_num_a >= priv->num_frames
+      || frame_num_b < 0 || frame_num_b >= priv->num_frames
+      || geom->width == 0
+      || geom->height == 0
+      || buffer->width <= 0
+      || buffer->height <= 0
+      || priv->extents.top == priv->extents.bottom)
+    return FALSE;
+
+  vertices = g_new (gfloat, priv->num_vertices * 3);
+  _clutter_md2_data_get_vertex_positions (data, frame_num_a, frame_num_b,
+                                          interval, vertices);
+
+  /* Apply the same transformation as the GL renderer */
+  _clutter_md2_data_get_fit_transform (data, geom, &scale, center);
+
+  for (i = 0, v = vertices; i < priv->num_vertices; i++, v += 3)
+    {
+      v[0] = (v[0] - center[0]) * scale + geom->x + geom->width / 2.0f;
+      v[1] = (v[1] - center[1]) * scale + geom->y + geom->height / 2.0f;
+      v[2] = (v[2] - center[2]) * scale;
+    }
+
+  _clutter_md2_data_rasterize (priv->gl_commands, vertices, &skin, buffer);
+
+  g_free (vertices);
+
+  return TRUE;
+}
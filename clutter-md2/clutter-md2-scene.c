@@ -0,0 +1,577 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib-object.h>
+#include <clutter/clutter.h>
+#include <string.h>
+
+#include "clutter-md2-data.h"
+#include "clutter-md2-data-private.h"
+#include "clutter-md2-scene.h"
+
+/* The scene draws any number of models from a single actor. The
+   instances are plain structs in one array so that there is no
+   GObject, allocation or paint traversal per model. They are drawn in
+   one batch sorted by model and skin so that each texture is only
+   bound once, and instances whose frames are outside the view are
+   skipped */
+
+#define CLUTTER_MD2_SCENE_GET_PRIVATE(obj)                              \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), CLUTTER_TYPE_MD2_SCENE,          \
+                                ClutterMD2ScenePrivate))
+
+G_DEFINE_TYPE (ClutterMD2Scene, clutter_md2_scene, CLUTTER_TYPE_ACTOR);
+
+struct _ClutterMD2ScenePrivate
+{
+  /* Array of ClutterMD2Data. The index is used as the model number */
+  GPtrArray *models;
+
+  guint n_instances, instances_size;
+  ClutterMD2SceneInstance *instances;
+
+  /* The instance numbers sorted by model and skin. This is only
+     sorted again when the model or skin of an instance changes */
+  guint *order;
+  gboolean order_valid;
+
+  /* Counts from the last paint */
+  guint n_drawn, n_culled;
+};
+
+enum
+  {
+    PROP_0,
+
+    PROP_N_INSTANCES,
+
+    PROP_LAST
+  };
+
+static GParamSpec *clutter_md2_scene_properties[PROP_LAST];
+
+static void
+clutter_md2_scene_get_property (GObject    *self,
+                                guint       property_id,
+                                GValue     *value,
+                                GParamSpec *pspec)
+{
+  ClutterMD2Scene *scene = CLUTTER_MD2_SCENE (self);
+
+  switch (property_id)
+    {
+    case PROP_N_INSTANCES:
+      g_value_set_uint (value, clutter_md2_scene_get_n_instances (scene));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (self, property_id, pspec);
+      break;
+    }
+}
+
+static void
+clutter_md2_scene_set_property (GObject      *self,
+                                guint         property_id,
+                                const GValue *value,
+                                GParamSpec   *pspec)
+{
+  ClutterMD2Scene *scene = CLUTTER_MD2_SCENE (self);
+
+  switch (property_id)
+    {
+    case PROP_N_INSTANCES:
+      clutter_md2_scene_set_n_instances (scene, g_value_get_uint (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (self, property_id, pspec);
+      break;
+    }
+}
+
+static void
+clutter_md2_scene_on_model_changed (ClutterMD2Scene *scene)
+{
+  clutter_actor_queue_redraw (CLUTTER_ACTOR (scene));
+}
+
+static void
+clutter_md2_scene_dispose (GObject *self)
+{
+  ClutterMD2ScenePrivate *priv = CLUTTER_MD2_SCENE (self)->priv;
+  guint i;
+
+  if (priv->models)
+    {
+      for (i = 0; i < priv->models->len; i++)
+        {
+          ClutterMD2Data *data = g_ptr_array_index (priv->models, i);
+
+          g_signal_handlers_disconnect_by_func
+            (data, clutter_md2_scene_on_model_changed, self);
+          g_object_unref (data);
+        }
+
+      g_ptr_array_free (priv->models, TRUE);
+      priv->models = NULL;
+    }
+
+  G_OBJECT_CLASS (clutter_md2_scene_parent_class)->dispose (self);
+}
+
+static void
+clutter_md2_scene_finalize (GObject *self)
+{
+  ClutterMD2ScenePrivate *priv = CLUTTER_MD2_SCENE (self)->priv;
+
+  g_free (priv->instances);
+  g_free (priv->order);
+
+  G_OBJECT_CLASS (clutter_md2_scene_parent_class)->finalize (self);
+}
+
+static gint
+clutter_md2_scene_compare_instances (gconstpointer a,
+                                     gconstpointer b,
+                                     gpointer      user_data)
+{
+  const ClutterMD2SceneInstance *instances = user_data;
+  const ClutterMD2SceneInstance *instance_a = instances + *(guint *) a;
+  const ClutterMD2SceneInstance *instance_b = instances + *(guint *) b;
+
+  if (instance_a->model != instance_b->model)
+    return instance_a->model < instance_b->model ? -1 : 1;
+  if (instance_a->skin_num != instance_b->skin_num)
+    return instance_a->skin_num < instance_b->skin_num ? -1 : 1;
+
+  /* Keep the order stable so that overlapping instances at the same
+     depth don't swap between paints */
+  return *(guint *) a < *(guint *) b ? -1 : *(guint *) a > *(guint *) b;
+}
+
+static void
+clutter_md2_scene_sort (ClutterMD2Scene *scene)
+{
+  ClutterMD2ScenePrivate *priv = scene->priv;
+  guint i;
+
+  for (i = 0; i < priv->n_instances; i++)
+    priv->order[i] = i;
+
+  g_qsort_with_data (priv->order, priv->n_instances, sizeof (guint),
+                     clutter_md2_scene_compare_instances,
+                     priv->instances);
+
+  priv->order_valid = TRUE;
+}
+
+/* Builds the matrix that places an instance in the scene. The model
+   is fitted into a unit cube which is then scaled by the instance
+   size so that the size doesn't have to be a whole number of
+   pixels */
+static void
+clutter_md2_scene_get_transform (const ClutterMD2SceneInstance *instance,
+                                 CoglMatrix                    *transform)
+{
+  float half_size = instance->size / 2.0f;
+
+  cogl_matrix_init_identity (transform);
+  cogl_matrix_translate (transform,
+                         instance->x + half_size, instance->y, instance->z);
+  cogl_matrix_rotate (transform, instance->angle, 0.0f, 1.0f, 0.0f);
+  cogl_matrix_translate (transform, -half_size, 0.0f, 0.0f);
+  cogl_matrix_scale (transform,
+                     instance->size, instance->size, instance->size);
+}
+
+/* Returns TRUE if the union of the extents of the two frames is
+   completely outside one of the planes of the view */
+static gboolean
+clutter_md2_scene_is_culled (ClutterMD2Data                *data,
+                             const ClutterMD2SceneInstance *instance,
+                             const CoglMatrix              *view,
+                             const CoglMatrix              *transform,
+                             const ClutterGeometry         *geom)
+{
+  ClutterMD2DataExtents a, b;
+  CoglMatrix fit, matrix;
+  float scale, center[3];
+  float corner[3][2];
+  guint outside = 0x3f;
+  int i;
+
+  clutter_md2_data_get_frame_extents (data, instance->frame_num_a, &a);
+  clutter_md2_data_get_frame_extents (data, instance->frame_num_b, &b);
+
+  corner[0][0] = MIN (a.left, b.left);
+  corner[0][1] = MAX (a.right, b.right);
+  corner[1][0] = MIN (a.top, b.top);
+  corner[1][1] = MAX (a.bottom, b.bottom);
+  corner[2][0] = MIN (a.back, b.back);
+  corner[2][1] = MAX (a.front, b.front);
+
+  /* Use the same fit as _clutter_md2_data_draw_batched */
+  _clutter_md2_data_get_fit_transform (data, geom, &scale, center);
+
+  fit = *transform;
+  cogl_matrix_translate (&fit, geom->width / 2.0f, geom->height / 2.0f, 0);
+  cogl_matrix_scale (&fit, scale, scale, scale);
+  cogl_matrix_translate (&fit, -center[0], -center[1], -center[2]);
+  cogl_matrix_multiply (&matrix, view, &fit);
+
+  for (i = 0; i < 8; i++)
+    {
+      float x = corner[0][i & 1];
+      float y = corner[1][(i >> 1) & 1];
+      float z = corner[2][(i >> 2) & 1];
+      float w = 1.0f;
+      guint code = 0;
+
+      cogl_matrix_transform_point (&matrix, &x, &y, &z, &w);
+
+      /* One bit for each clip plane that the corner is outside of */
+      if (x < -w)
+        code |= 0x01;
+      if (x > w)
+        code |= 0x02;
+      if (y < -w)
+        code |= 0x04;
+      if (y > w)
+        code |= 0x08;
+      if (z < -w)
+        code |= 0x10;
+      if (z > w)
+        code |= 0x20;
+
+      /* If any corner is inside a plane then the box isn't
+         completely outside that plane */
+      outside &= code;
+
+      if (outside == 0)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+clutter_md2_scene_render (ClutterMD2Scene    *scene,
+                          const ClutterColor *pick_color)
+{
+  ClutterMD2ScenePrivate *priv = scene->priv;
+  static const ClutterGeometry unit_geom = { 0, 0, 1, 1 };
+  CoglMatrix modelview, projection, view;
+  guint n_drawn = 0, n_culled = 0;
+  guint i;
+
+  if (priv->n_instances == 0)
+    return;
+
+  if (!priv->order_valid)
+    clutter_md2_scene_sort (scene);
+
+  cogl_get_modelview_matrix (&modelview);
+  cogl_get_projection_matrix (&projection);
+  cogl_matrix_multiply (&view, &projection, &modelview);
+
+  _clutter_md2_data_begin_batch (pick_color);
+
+  for (i = 0; i < priv->n_instances; i++)
+    {
+      const ClutterMD2SceneInstance *instance
+        = priv->instances + priv->order[i];
+      CoglMatrix transform;
+      ClutterMD2Data *data;
+      gint n_frames;
+      gint frame_nums[2];
+      gfloat weights[2];
+
+      if (instance->model < 0
+          || (guint) instance->model >= priv->models->len
+          || instance->skin_num < 0
+          || instance->size <= 0.0f)
+        continue;
+
+      data = g_ptr_array_index (priv->models, instance->model);
+      n_frames = clutter_md2_data_get_n_frames (data);
+
+      if (instance->frame_num_a < 0 || instance->frame_num_a >= n_frames
+          || instance->frame_num_b < 0 || instance->frame_num_b >= n_frames)
+        continue;
+
+      clutter_md2_scene_get_transform (instance, &transform);
+
+      if (clutter_md2_scene_is_culled (data, instance, &view,
+                                       &transform, &unit_geom))
+        {
+          n_culled++;
+          continue;
+        }
+
+      frame_nums[0] = instance->frame_num_a;
+      frame_nums[1] = instance->frame_num_b;
+      weights[0] = 1.0f - instance->interval;
+      weights[1] = instance->interval;
+
+      if (frame_nums[0] == frame_nums[1])
+        weights[0] = 1.0f;
+
+      _clutter_md2_data_draw_batched (data,
+                                      frame_nums[0] == frame_nums[1] ? 1 : 2,
+                                      frame_nums, weights,
+                                      instance->skin_num, data,
+                                      &transform, &unit_geom);
+
+      n_drawn++;
+    }
+
+  _clutter_md2_data_end_batch ();
+
+  /* Picking draws the same instances so only the paint is counted */
+  if (pick_color == NULL)
+    {
+      priv->n_drawn = n_drawn;
+      priv->n_culled = n_culled;
+    }
+}
+
+static void
+clutter_md2_scene_paint (ClutterActor *self)
+{
+  clutter_md2_scene_render (CLUTTER_MD2_SCENE (self), NULL);
+}
+
+static void
+clutter_md2_scene_pick (ClutterActor       *self,
+                        const ClutterColor *color)
+{
+  if (!clutter_actor_should_pick_paint (self))
+    return;
+
+  /* Only the pixels covered by the models are reactive */
+  clutter_md2_scene_render (CLUTTER_MD2_SCENE (self), color);
+}
+
+static void
+clutter_md2_scene_class_init (ClutterMD2SceneClass *klass)
+{
+  ClutterActorClass *actor_class = CLUTTER_ACTOR_CLASS (klass);
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GParamSpec *pspec;
+
+  actor_class->paint = clutter_md2_scene_paint;
+  actor_class->pick = clutter_md2_scene_pick;
+
+  object_class->dispose = clutter_md2_scene_dispose;
+  object_class->finalize = clutter_md2_scene_finalize;
+  object_class->set_property = clutter_md2_scene_set_property;
+  object_class->get_property = clutter_md2_scene_get_property;
+
+  g_type_class_add_private (klass, sizeof (ClutterMD2ScenePrivate));
+
+  pspec = g_param_spec_uint ("n_instances", "Number of instances",
+                             "The number of model instances in the scene",
+                             0, G_MAXUINT, 0, G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_N_INSTANCES, pspec);
+  clutter_md2_scene_properties[PROP_N_INSTANCES] = pspec;
+}
+
+static void
+clutter_md2_scene_init (ClutterMD2Scene *self)
+{
+  ClutterMD2ScenePrivate *priv;
+
+  self->priv = priv = CLUTTER_MD2_SCENE_GET_PRIVATE (self);
+
+  priv->models = g_ptr_array_new ();
+  priv->n_instances = 0;
+  priv->instances_size = 0;
+  priv->instances = NULL;
+  priv->order = NULL;
+  priv->order_valid = FALSE;
+  priv->n_drawn = 0;
+  priv->n_culled = 0;
+}
+
+ClutterActor *
+clutter_md2_scene_new (void)
+{
+  return g_object_new (CLUTTER_TYPE_MD2_SCENE, NULL);
+}
+
+/* Returns the number that instances use to refer to the model */
+gint
+clutter_md2_scene_add_model (ClutterMD2Scene *scene,
+                             ClutterMD2Data  *data)
+{
+  ClutterMD2ScenePrivate *priv;
+
+  g_return_val_if_fail (CLUTTER_IS_MD2_SCENE (scene), -1);
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), -1);
+
+  priv = scene->priv;
+
+  g_object_ref_sink (data);
+  g_signal_connect_swapped (data, "data-changed",
+                            G_CALLBACK (clutter_md2_scene_on_model_changed),
+                            scene);
+  g_signal_connect_swapped (data, "skin-changed",
+                            G_CALLBACK (clutter_md2_scene_on_model_changed),
+                            scene);
+
+  g_ptr_array_add (priv->models, data);
+
+  return priv->models->len - 1;
+}
+
+gint
+clutter_md2_scene_get_n_models (ClutterMD2Scene *scene)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_SCENE (scene), 0);
+
+  return scene->priv->models->len;
+}
+
+ClutterMD2Data *
+clutter_md2_scene_get_model (ClutterMD2Scene *scene,
+                             gint             model)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_SCENE (scene), NULL);
+  g_return_val_if_fail (model >= 0
+                        && (guint) model < scene->priv->models->len, NULL);
+
+  return g_ptr_array_index (scene->priv->models, model);
+}
+
+/* New instances are hidden until they are set */
+void
+clutter_md2_scene_set_n_instances (ClutterMD2Scene *scene,
+                                   guint            n_instances)
+{
+  ClutterMD2ScenePrivate *priv;
+  guint i;
+
+  g_return_if_fail (CLUTTER_IS_MD2_SCENE (scene));
+
+  priv = scene->priv;
+
+  if (priv->n_instances == n_instances)
+    return;
+
+  if (n_instances > priv->instances_size)
+    {
+      priv->instances_size = MAX (priv->instances_size * 2, n_instances);
+      priv->instances = g_renew (ClutterMD2SceneInstance, priv->instances,
+                                 priv->instances_size);
+      priv->order = g_renew (guint, priv->order, priv->instances_size);
+    }
+
+  for (i = priv->n_instances; i < n_instances; i++)
+    {
+      memset (priv->instances + i, 0, sizeof (ClutterMD2SceneInstance));
+      priv->instances[i].model = -1;
+    }
+
+  priv->n_instances = n_instances;
+  priv->order_valid = FALSE;
+
+  clutter_actor_queue_redraw (CLUTTER_ACTOR (scene));
+
+  g_object_notify_by_pspec (G_OBJECT (scene),
+                            clutter_md2_scene_properties[PROP_N_INSTANCES]);
+}
+
+guint
+clutter_md2_scene_get_n_instances (ClutterMD2Scene *scene)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_SCENE (scene), 0);
+
+  return scene->priv->n_instances;
+}
+
+/* Copies a range of instances into the scene. The whole scene can be
+   updated for every frame of an animation with one call */
+void
+clutter_md2_scene_set_instances (ClutterMD2Scene               *scene,
+                                 guint                          first,
+                                 guint                          n_instances,
+                                 const ClutterMD2SceneInstance *instances)
+{
+  ClutterMD2ScenePrivate *priv;
+  guint i;
+
+  g_return_if_fail (CLUTTER_IS_MD2_SCENE (scene));
+  g_return_if_fail (instances != NULL || n_instances == 0);
+
+  priv = scene->priv;
+
+  g_return_if_fail (first <= priv->n_instances
+                    && n_instances <= priv->n_instances - first);
+
+  for (i = 0; i < n_instances; i++)
+    g_return_if_fail (instances[i].skin_num >= 0);
+
+  /* The order only needs sorting again if an instance moved to a
+     different model or skin */
+  if (priv->order_valid)
+    for (i = 0; i < n_instances; i++)
+      if (priv->instances[first + i].model != instances[i].model
+          || priv->instances[first + i].skin_num != instances[i].skin_num)
+        {
+          priv->order_valid = FALSE;
+          break;
+        }
+
+  memcpy (priv->instances + first, instances,
+          n_instances * sizeof (ClutterMD2SceneInstance));
+
+  clutter_actor_queue_redraw (CLUTTER_ACTOR (scene));
+}
+
+/* The returned array has clutter_md2_scene_get_n_instances entries
+   and is only valid until the number of instances changes */
+const ClutterMD2SceneInstance *
+clutter_md2_scene_get_instances (ClutterMD2Scene *scene)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_SCENE (scene), NULL);
+
+  return scene->priv->instances;
+}
+
+void
+clutter_md2_scene_get_paint_stats (ClutterMD2Scene *scene,
+                                   guint           *n_drawn,
+                                   guint           *n_culled)
+{
+  g_return_if_fail (CLUTTER_IS_MD2_SCENE (scene));
+
+  if (n_drawn)
+    *n_drawn = scene->priv->n_drawn;
+  if (n_culled)
+    *n_culled = scene->priv->n_culled;
+}
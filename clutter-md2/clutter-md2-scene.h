@@ -0,0 +1,113 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CLUTTER_MD2_SCENE_H__
+#define __CLUTTER_MD2_SCENE_H__
+
+#include <glib-object.h>
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2-data.h>
+
+G_BEGIN_DECLS
+
+#define CLUTTER_TYPE_MD2_SCENE (clutter_md2_scene_get_type ())
+
+#define CLUTTER_MD2_SCENE(obj)                                          \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), CLUTTER_TYPE_MD2_SCENE,           \
+                               ClutterMD2Scene))
+#define CLUTTER_MD2_SCENE_CLASS(klass)                                  \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), CLUTTER_TYPE_MD2_SCENE,            \
+                            ClutterMD2SceneClass))
+#define CLUTTER_IS_MD2_SCENE(obj)                                       \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), CLUTTER_TYPE_MD2_SCENE))
+#define CLUTTER_IS_MD2_SCENE_CLASS(klass)                               \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), CLUTTER_TYPE_MD2_SCENE))
+#define CLUTTER_MD2_SCENE_GET_CLASS(obj)                                \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), CLUTTER_TYPE_MD2_SCENE,            \
+                              ClutterMD2SceneClass))
+
+typedef struct _ClutterMD2Scene ClutterMD2Scene;
+typedef struct _ClutterMD2ScenePrivate ClutterMD2ScenePrivate;
+typedef struct _ClutterMD2SceneClass ClutterMD2SceneClass;
+typedef struct _ClutterMD2SceneInstance ClutterMD2SceneInstance;
+
+struct _ClutterMD2Scene
+{
+  ClutterActor parent_instance;
+
+  ClutterMD2ScenePrivate *priv;
+};
+
+struct _ClutterMD2SceneClass
+{
+  ClutterActorClass parent_class;
+};
+
+/* One model drawn by the scene. The model is fitted into a cube of
+   size pixels whose top left corner is at x and y and whose middle is
+   at depth z. It is then rotated by angle degrees about the vertical
+   axis through the middle of the cube */
+struct _ClutterMD2SceneInstance
+{
+  /* The index returned by clutter_md2_scene_add_model or -1 to hide
+     the instance */
+  gint model;
+  gint skin_num;
+
+  gint frame_num_a, frame_num_b;
+  gfloat interval;
+
+  gfloat x, y, z;
+  gfloat size;
+  gfloat angle;
+};
+
+GType clutter_md2_scene_get_type (void) G_GNUC_CONST;
+
+ClutterActor *clutter_md2_scene_new (void);
+
+gint clutter_md2_scene_add_model (ClutterMD2Scene *scene,
+                                  ClutterMD2Data  *data);
+gint clutter_md2_scene_get_n_models (ClutterMD2Scene *scene);
+ClutterMD2Data *clutter_md2_scene_get_model (ClutterMD2Scene *scene,
+                                             gint             model);
+
+void clutter_md2_scene_set_n_instances (ClutterMD2Scene *scene,
+                                        guint            n_instances);
+guint clutter_md2_scene_get_n_instances (ClutterMD2Scene *scene);
+
+void clutter_md2_scene_set_instances
+                              (ClutterMD2Scene               *scene,
+                               guint                          first,
+                               guint                          n_instances,
+                               const ClutterMD2SceneInstance *instances);
+const ClutterMD2SceneInstance *
+clutter_md2_scene_get_instances (ClutterMD2Scene *scene);
+
+void clutter_md2_scene_get_paint_stats (ClutterMD2Scene *scene,
+                                        guint           *n_drawn,
+                                        guint           *n_culled);
+
+G_END_DECLS
+
+#endif /* __CLUTTER_MD2_SCENE_H__ */
@@ -0,0 +1,617 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib-object.h>
+#include <clutter/clutter.h>
+#include <math.h>
+
+#include "clutter-md2.h"
+#include "clutter-md2-private.h"
+#include "clutter-md2-scheduler.h"
+
+/* The scheduler animates any number of ClutterMD2 actors from a
+   single timeline. Instead of a behaviour, alpha and timeline per
+   actor each animated actor only has a record in a set of parallel
+   arrays so that advancing all of them is a tight loop */
+
+#define CLUTTER_MD2_SCHEDULER_GET_PRIVATE(obj)                          \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((obj), CLUTTER_TYPE_MD2_SCHEDULER,      \
+                                ClutterMD2SchedulerPrivate))
+
+/* Key used to attach the scheduler to the stage */
+#define CLUTTER_MD2_SCHEDULER_STAGE_KEY "clutter-md2-scheduler"
+
+G_DEFINE_TYPE (ClutterMD2Scheduler, clutter_md2_scheduler, G_TYPE_OBJECT);
+
+struct _ClutterMD2SchedulerPrivate
+{
+  /* The timeline only provides the ticks from the master clock. It
+     loops forever while there are any records */
+  ClutterTimeline *timeline;
+  guint new_frame_handler;
+
+  /* The records. Each array has records_size entries of which the
+     first n_records are used */
+  guint n_records, records_size;
+  ClutterMD2 **actors;
+  gint *frame_starts;
+  /* Number of frames in the sequence */
+  gint *n_frames;
+  gfloat *fps;
+  /* Position in frames from the start of the sequence */
+  gfloat *positions;
+  guint8 *loops;
+
+  /* Maps an actor to its record index plus one */
+  GHashTable *actor_records;
+
+  /* Number of actors that were updated and skipped on the last tick */
+  guint n_updated, n_skipped;
+};
+
+static void clutter_md2_scheduler_remove_record (ClutterMD2Scheduler *scheduler,
+                                                 guint                index);
+
+static void
+clutter_md2_scheduler_actor_finalized (gpointer  user_data,
+                                       GObject  *where_the_object_was)
+{
+  ClutterMD2Scheduler *scheduler = CLUTTER_MD2_SCHEDULER (user_data);
+  guint index;
+
+  index = GPOINTER_TO_UINT (g_hash_table_lookup
+                            (scheduler->priv->actor_records,
+                             where_the_object_was));
+
+  if (index)
+    {
+      /* The weak reference has already gone so make sure the record
+         removal doesn't try to drop it again */
+      g_hash_table_remove (scheduler->priv->actor_records,
+                           where_the_object_was);
+      scheduler->priv->actors[index - 1] = NULL;
+      clutter_md2_scheduler_remove_record (scheduler, index - 1);
+    }
+}
+
+static void
+clutter_md2_scheduler_get_frames (gint                     n_frames,
+                                  gfloat                   position,
+                                  ClutterMD2SchedulerLoop  loop,
+                                  gint                    *frame_a,
+                                  gint                    *frame_b,
+                                  gfloat                  *interval)
+{
+  gint last = n_frames - 1;
+
+  if (last <= 0)
+    {
+      *frame_a = *frame_b = 0;
+      *interval = 0.0f;
+      return;
+    }
+
+  switch (loop)
+    {
+    case CLUTTER_MD2_SCHEDULER_LOOP:
+      /* The position has already been wrapped to [0,n_frames). The
+         last frame blends back into the first */
+      *frame_a = (gint) position;
+      *frame_b = *frame_a >= last ? 0 : *frame_a + 1;
+      break;
+
+    case CLUTTER_MD2_SCHEDULER_PING_PONG:
+      /* The position has been wrapped to [0,last*2) */
+      if (position > last)
+        position = last * 2 - position;
+      *frame_a = (gint) position;
+      *frame_b = MIN (*frame_a + 1, last);
+      break;
+
+    default:
+      if (position > last)
+        position = last;
+      *frame_a = (gint) position;
+      *frame_b = MIN (*frame_a + 1, last);
+      break;
+    }
+
+  *interval = position - *frame_a;
+}
+
+/* Writes the frame for the record's current position into its actor.
+   Returns FALSE if the actor no longer has the frames */
+static gboolean
+clutter_md2_scheduler_apply_record (ClutterMD2SchedulerPrivate *priv,
+                                    guint                       index)
+{
+  ClutterMD2 *md2 = priv->actors[index];
+  gint frame_a, frame_b;
+  gfloat interval;
+
+  /* Skip actors whose data has gone or no longer has the frames */
+  if (priv->frame_starts[index] + priv->n_frames[index]
+      > clutter_md2_get_n_frames (md2))
+    return FALSE;
+
+  clutter_md2_scheduler_get_frames (priv->n_frames[index],
+                                    priv->positions[index],
+                                    priv->loops[index],
+                                    &frame_a, &frame_b, &interval);
+
+  clutter_md2_set_sub_frame (md2,
+                             priv->frame_starts[index] + frame_a,
+                             priv->frame_starts[index] + frame_b,
+                             interval);
+
+  return TRUE;
+}
+
+static void
+clutter_md2_scheduler_catch_up (ClutterMD2 *md2,
+                                gpointer    user_data)
+{
+  ClutterMD2Scheduler *scheduler = CLUTTER_MD2_SCHEDULER (user_data);
+  guint index;
+
+  index = GPOINTER_TO_UINT (g_hash_table_lookup
+                            (scheduler->priv->actor_records, md2));
+
+  if (index)
+    clutter_md2_scheduler_apply_record (scheduler->priv, index - 1);
+}
+
+static void
+clutter_md2_scheduler_on_new_frame (ClutterMD2Scheduler *scheduler)
+{
+  ClutterMD2SchedulerPrivate *priv = scheduler->priv;
+  gfloat seconds;
+  guint i;
+
+  priv->n_updated = 0;
+  priv->n_skipped = 0;
+
+  seconds = clutter_timeline_get_delta (priv->timeline) / 1000.0f;
+
+  /* First advance all of the records. This only touches the arrays */
+  for (i = 0; i < priv->n_records; i++)
+    {
+      gfloat position = priv->positions[i] + priv->fps[i] * seconds;
+
+      /* Keep the position wrapped so that it doesn't lose precision
+         on long running animations */
+      switch (priv->loops[i])
+        {
+        case CLUTTER_MD2_SCHEDULER_LOOP:
+          if (position >= priv->n_frames[i])
+            position = fmod (position, priv->n_frames[i]);
+          break;
+
+        case CLUTTER_MD2_SCHEDULER_PING_PONG:
+          if (priv->n_frames[i] > 1
+              && position >= (priv->n_frames[i] - 1) * 2)
+            position = fmod (position, (priv->n_frames[i] - 1) * 2);
+          break;
+
+        default:
+          if (position > priv->n_frames[i] - 1)
+            position = priv->n_frames[i] - 1;
+          break;
+        }
+
+      priv->positions[i] = position;
+    }
+
+  /* Then write the frames into the actors. Setting the frame emits
+     notifications so a handler could remove records while this is
+     running. Walking backwards means that a removal can only move an
+     already visited record into an earlier slot. Visiting a record
+     twice is harmless because setting the same frame does nothing */
+  for (i = priv->n_records; i-- > 0;)
+    {
+      ClutterMD2 *md2;
+      gboolean finished;
+
+      if (i >= priv->n_records)
+        continue;
+
+      md2 = priv->actors[i];
+
+      /* A record that only plays once is finished when it reaches the
+         last frame. The last frame is always written so that there is
+         nothing left to catch up after the record is removed */
+      finished = (priv->loops[i] == CLUTTER_MD2_SCHEDULER_ONCE
+                  && priv->positions[i] >= priv->n_frames[i] - 1);
+
+      /* Actors that won't be painted only keep their position. The
+         frame is worked out from the position if they are painted
+         again */
+      if (!finished && !_clutter_md2_get_screen_size (md2, NULL))
+        {
+          _clutter_md2_set_catch_up (md2,
+                                     clutter_md2_scheduler_catch_up,
+                                     scheduler);
+          priv->n_skipped++;
+          continue;
+        }
+
+      if (clutter_md2_scheduler_apply_record (priv, i))
+        priv->n_updated++;
+
+      /* The notifications may have already removed or moved the
+         record */
+      if (finished && i < priv->n_records && priv->actors[i] == md2)
+        clutter_md2_scheduler_remove_record (scheduler, i);
+    }
+}
+
+static void
+clutter_md2_scheduler_remove_record (ClutterMD2Scheduler *scheduler,
+                                     guint                index)
+{
+  ClutterMD2SchedulerPrivate *priv = scheduler->priv;
+  guint last = priv->n_records - 1;
+
+  if (priv->actors[index])
+    {
+      _clutter_md2_cancel_catch_up (priv->actors[index], scheduler);
+      g_object_weak_unref (G_OBJECT (priv->actors[index]),
+                           clutter_md2_scheduler_actor_finalized,
+                           scheduler);
+      g_hash_table_remove (priv->actor_records, priv->actors[index]);
+    }
+
+  /* Move the last record into the hole to keep the arrays packed */
+  if (index != last)
+    {
+      priv->actors[index] = priv->actors[last];
+      priv->frame_starts[index] = priv->frame_starts[last];
+      priv->n_frames[index] = priv->n_frames[last];
+      priv->fps[index] = priv->fps[last];
+      priv->positions[index] = priv->positions[last];
+      priv->loops[index] = priv->loops[last];
+
+      g_hash_table_insert (priv->actor_records, priv->actors[index],
+                           GUINT_TO_POINTER (index + 1));
+    }
+
+  priv->n_records--;
+
+  if (priv->n_records == 0)
+    clutter_timeline_stop (priv->timeline);
+}
+
+static guint
+clutter_md2_scheduler_get_record (ClutterMD2Scheduler *scheduler,
+                                  ClutterMD2          *md2)
+{
+  ClutterMD2SchedulerPrivate *priv = scheduler->priv;
+  guint index;
+
+  index = GPOINTER_TO_UINT (g_hash_table_lookup (priv->actor_records, md2));
+
+  if (index)
+    return index - 1;
+
+  if (priv->n_records >= priv->records_size)
+    {
+      priv->records_size = MAX (priv->records_size * 2, 16);
+
+      priv->actors = g_renew (ClutterMD2 *, priv->actors,
+                              priv->records_size);
+      priv->frame_starts = g_renew (gint, priv->frame_starts,
+                                    priv->records_size);
+      priv->n_frames = g_renew (gint, priv->n_frames, priv->records_size);
+      priv->fps = g_renew (gfloat, priv->fps, priv->records_size);
+      priv->positions = g_renew (gfloat, priv->positions,
+                                 priv->records_size);
+      priv->loops = g_renew (guint8, priv->loops, priv->records_size);
+    }
+
+  index = priv->n_records++;
+
+  priv->actors[index] = md2;
+  g_object_weak_ref (G_OBJECT (md2),
+                     clutter_md2_scheduler_actor_finalized,
+                     scheduler);
+  g_hash_table_insert (priv->actor_records, md2,
+                       GUINT_TO_POINTER (index + 1));
+
+  if (!clutter_timeline_is_playing (priv->timeline))
+    clutter_timeline_start (priv->timeline);
+
+  return index;
+}
+
+static void
+clutter_md2_scheduler_dispose (GObject *self)
+{
+  ClutterMD2Scheduler *scheduler = CLUTTER_MD2_SCHEDULER (self);
+  ClutterMD2SchedulerPrivate *priv = scheduler->priv;
+
+  while (priv->n_records > 0)
+    clutter_md2_scheduler_remove_record (scheduler, priv->n_records - 1);
+
+  if (priv->timeline)
+    {
+      g_signal_handler_disconnect (priv->timeline, priv->new_frame_handler);
+      g_object_unref (priv->timeline);
+      priv->timeline = NULL;
+    }
+
+  G_OBJECT_CLASS (clutter_md2_scheduler_parent_class)->dispose (self);
+}
+
+static void
+clutter_md2_scheduler_finalize (GObject *self)
+{
+  ClutterMD2SchedulerPrivate *priv = CLUTTER_MD2_SCHEDULER (self)->priv;
+
+  g_free (priv->actors);
+  g_free (priv->frame_starts);
+  g_free (priv->n_frames);
+  g_free (priv->fps);
+  g_free (priv->positions);
+  g_free (priv->loops);
+
+  g_hash_table_destroy (priv->actor_records);
+
+  G_OBJECT_CLASS (clutter_md2_scheduler_parent_class)->finalize (self);
+}
+
+static void
+clutter_md2_scheduler_class_init (ClutterMD2SchedulerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = clutter_md2_scheduler_dispose;
+  object_class->finalize = clutter_md2_scheduler_finalize;
+
+  g_type_class_add_private (klass, sizeof (ClutterMD2SchedulerPrivate));
+}
+
+static void
+clutter_md2_scheduler_init (ClutterMD2Scheduler *self)
+{
+  ClutterMD2SchedulerPrivate *priv;
+
+  self->priv = priv = CLUTTER_MD2_SCHEDULER_GET_PRIVATE (self);
+
+  priv->timeline = clutter_timeline_new (1000);
+  clutter_timeline_set_loop (priv->timeline, TRUE);
+  priv->new_frame_handler
+    = g_signal_connect_swapped (priv->timeline, "new-frame",
+                                G_CALLBACK (clutter_md2_scheduler_on_new_frame),
+                                self);
+
+  priv->n_records = 0;
+  priv->records_size = 0;
+  priv->actors = NULL;
+  priv->frame_starts = NULL;
+  priv->n_frames = NULL;
+  priv->fps = NULL;
+  priv->positions = NULL;
+  priv->loops = NULL;
+
+  priv->actor_records = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  priv->n_updated = 0;
+  priv->n_skipped = 0;
+}
+
+GType
+clutter_md2_scheduler_loop_get_type (void)
+{
+  static GType our_type = 0;
+
+  if (G_UNLIKELY (our_type == 0))
+    {
+      static const GEnumValue values[] =
+        {
+          { CLUTTER_MD2_SCHEDULER_ONCE,
+            "CLUTTER_MD2_SCHEDULER_ONCE", "once" },
+          { CLUTTER_MD2_SCHEDULER_LOOP,
+            "CLUTTER_MD2_SCHEDULER_LOOP", "loop" },
+          { CLUTTER_MD2_SCHEDULER_PING_PONG,
+            "CLUTTER_MD2_SCHEDULER_PING_PONG", "ping-pong" },
+          { 0, NULL, NULL }
+        };
+
+      our_type = g_enum_register_static
+        (g_intern_static_string ("ClutterMD2SchedulerLoop"), values);
+    }
+
+  return our_type;
+}
+
+ClutterMD2Scheduler *
+clutter_md2_scheduler_get_for_stage (ClutterStage *stage)
+{
+  ClutterMD2Scheduler *scheduler;
+
+  g_return_val_if_fail (CLUTTER_IS_STAGE (stage), NULL);
+
+  scheduler = g_object_get_data (G_OBJECT (stage),
+                                 CLUTTER_MD2_SCHEDULER_STAGE_KEY);
+
+  if (scheduler == NULL)
+    {
+      scheduler = g_object_new (CLUTTER_TYPE_MD2_SCHEDULER, NULL);
+
+      /* The stage owns the scheduler */
+      g_object_set_data_full (G_OBJECT (stage),
+                              CLUTTER_MD2_SCHEDULER_STAGE_KEY,
+                              scheduler,
+                              g_object_unref);
+    }
+
+  return scheduler;
+}
+
+gboolean
+clutter_md2_scheduler_play (ClutterMD2Scheduler     *scheduler,
+                            ClutterMD2              *md2,
+                            const gchar             *sequence,
+                            ClutterMD2SchedulerLoop  loop)
+{
+  ClutterMD2Data *data;
+  gint frame_start, frame_end;
+  gfloat fps;
+
+  g_return_val_if_fail (CLUTTER_IS_MD2_SCHEDULER (scheduler), FALSE);
+  g_return_val_if_fail (CLUTTER_IS_MD2 (md2), FALSE);
+  g_return_val_if_fail (sequence != NULL, FALSE);
+
+  if ((data = clutter_md2_get_data (md2)) == NULL
+      || !clutter_md2_data_get_sequence (data, sequence,
+                                         &frame_start, &frame_end, &fps))
+    return FALSE;
+
+  clutter_md2_scheduler_play_frames (scheduler, md2,
+                                     frame_start, frame_end,
+                                     fps, loop);
+
+  return TRUE;
+}
+
+void
+clutter_md2_scheduler_play_frames (ClutterMD2Scheduler     *scheduler,
+                                   ClutterMD2              *md2,
+                                   gint                     frame_start,
+                                   gint                     frame_end,
+                                   gfloat                   fps,
+                                   ClutterMD2SchedulerLoop  loop)
+{
+  ClutterMD2SchedulerPrivate *priv;
+  guint index;
+
+  g_return_if_fail (CLUTTER_IS_MD2_SCHEDULER (scheduler));
+  g_return_if_fail (CLUTTER_IS_MD2 (md2));
+  g_return_if_fail (frame_start >= 0 && frame_start <= frame_end);
+  g_return_if_fail (fps >= 0.0f);
+
+  priv = scheduler->priv;
+
+  index = clutter_md2_scheduler_get_record (scheduler, md2);
+
+  priv->frame_starts[index] = frame_start;
+  priv->n_frames[index] = frame_end - frame_start + 1;
+  priv->fps[index] = fps;
+  priv->positions[index] = 0.0f;
+  priv->loops[index] = loop;
+
+  /* Show the first frame straight away rather than waiting for the
+     next tick */
+  if (frame_end < clutter_md2_get_n_frames (md2))
+    clutter_md2_set_current_frame (md2, frame_start);
+}
+
+void
+clutter_md2_scheduler_stop (ClutterMD2Scheduler *scheduler,
+                            ClutterMD2          *md2)
+{
+  guint index;
+
+  g_return_if_fail (CLUTTER_IS_MD2_SCHEDULER (scheduler));
+  g_return_if_fail (CLUTTER_IS_MD2 (md2));
+
+  index = GPOINTER_TO_UINT (g_hash_table_lookup
+                            (scheduler->priv->actor_records, md2));
+
+  if (index)
+    clutter_md2_scheduler_remove_record (scheduler, index - 1);
+}
+
+gboolean
+clutter_md2_scheduler_is_playing (ClutterMD2Scheduler *scheduler,
+                                  ClutterMD2          *md2)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_SCHEDULER (scheduler), FALSE);
+  g_return_val_if_fail (CLUTTER_IS_MD2 (md2), FALSE);
+
+  return g_hash_table_lookup (scheduler->priv->actor_records, md2) != NULL;
+}
+
+void
+clutter_md2_scheduler_set_fps (ClutterMD2Scheduler *scheduler,
+                               ClutterMD2          *md2,
+                               gfloat               fps)
+{
+  guint index;
+
+  g_return_if_fail (CLUTTER_IS_MD2_SCHEDULER (scheduler));
+  g_return_if_fail (CLUTTER_IS_MD2 (md2));
+  g_return_if_fail (fps >= 0.0f);
+
+  index = GPOINTER_TO_UINT (g_hash_table_lookup
+                            (scheduler->priv->actor_records, md2));
+
+  if (index)
+    scheduler->priv->fps[index - 1] = fps;
+}
+
+void
+clutter_md2_scheduler_set_phase (ClutterMD2Scheduler *scheduler,
+                                 ClutterMD2          *md2,
+                                 gfloat               phase)
+{
+  ClutterMD2SchedulerPrivate *priv;
+  guint index;
+
+  g_return_if_fail (CLUTTER_IS_MD2_SCHEDULER (scheduler));
+  g_return_if_fail (CLUTTER_IS_MD2 (md2));
+  g_return_if_fail (phase >= 0.0f);
+
+  priv = scheduler->priv;
+
+  index = GPOINTER_TO_UINT (g_hash_table_lookup (priv->actor_records, md2));
+
+  /* The position is wrapped or clamped on the next tick */
+  if (index)
+    priv->positions[index - 1] = phase;
+}
+
+guint
+clutter_md2_scheduler_get_n_records (ClutterMD2Scheduler *scheduler)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_SCHEDULER (scheduler), 0);
+
+  return scheduler->priv->n_records;
+}
+
+void
+clutter_md2_scheduler_get_tick_stats (ClutterMD2Scheduler *scheduler,
+                                      guint               *n_updated,
+                                      guint               *n_skipped)
+{
+  g_return_if_fail (CLUTTER_IS_MD2_SCHEDULER (scheduler));
+
+  if (n_updated)
+    *n_updated = scheduler->priv->n_updated;
+  if (n_skipped)
+    *n_skipped = scheduler->priv->n_skipped;
+}
@@ -0,0 +1,113 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CLUTTER_MD2_SCHEDULER_H__
+#define __CLUTTER_MD2_SCHEDULER_H__
+
+#include <glib-object.h>
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+
+G_BEGIN_DECLS
+
+#define CLUTTER_TYPE_MD2_SCHEDULER (clutter_md2_scheduler_get_type ())
+
+#define CLUTTER_MD2_SCHEDULER(obj)                                      \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), CLUTTER_TYPE_MD2_SCHEDULER,       \
+                               ClutterMD2Scheduler))
+#define CLUTTER_MD2_SCHEDULER_CLASS(klass)                              \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), CLUTTER_TYPE_MD2_SCHEDULER,        \
+                            ClutterMD2SchedulerClass))
+#define CLUTTER_IS_MD2_SCHEDULER(obj)                                   \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), CLUTTER_TYPE_MD2_SCHEDULER))
+#define CLUTTER_IS_MD2_SCHEDULER_CLASS(klass)                           \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), CLUTTER_TYPE_MD2_SCHEDULER))
+#define CLUTTER_MD2_SCHEDULER_GET_CLASS(obj)                            \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), CLUTTER_TYPE_MD2_SCHEDULER,        \
+                              ClutterMD2SchedulerClass))
+
+#define CLUTTER_TYPE_MD2_SCHEDULER_LOOP \
+  (clutter_md2_scheduler_loop_get_type ())
+
+typedef enum {
+  CLUTTER_MD2_SCHEDULER_ONCE,
+  CLUTTER_MD2_SCHEDULER_LOOP,
+  CLUTTER_MD2_SCHEDULER_PING_PONG
+} ClutterMD2SchedulerLoop;
+
+typedef struct _ClutterMD2Scheduler ClutterMD2Scheduler;
+typedef struct _ClutterMD2SchedulerPrivate ClutterMD2SchedulerPrivate;
+typedef struct _ClutterMD2SchedulerClass ClutterMD2SchedulerClass;
+
+struct _ClutterMD2Scheduler
+{
+  GObject parent_instance;
+
+  ClutterMD2SchedulerPrivate *priv;
+};
+
+struct _ClutterMD2SchedulerClass
+{
+  GObjectClass parent_class;
+};
+
+GType clutter_md2_scheduler_get_type (void) G_GNUC_CONST;
+GType clutter_md2_scheduler_loop_get_type (void) G_GNUC_CONST;
+
+ClutterMD2Scheduler *clutter_md2_scheduler_get_for_stage (ClutterStage *stage);
+
+gboolean clutter_md2_scheduler_play (ClutterMD2Scheduler     *scheduler,
+                                     ClutterMD2              *md2,
+                                     const gchar             *sequence,
+                                     ClutterMD2SchedulerLoop  loop);
+
+void clutter_md2_scheduler_play_frames (ClutterMD2Scheduler     *scheduler,
+                                        ClutterMD2              *md2,
+                                        gint                     frame_start,
+                                        gint                     frame_end,
+                                        gfloat                   fps,
+                                        ClutterMD2SchedulerLoop  loop);
+
+void clutter_md2_scheduler_stop (ClutterMD2Scheduler *scheduler,
+                                 ClutterMD2          *md2);
+
+gboolean clutter_md2_scheduler_is_playing (ClutterMD2Scheduler *scheduler,
+                                           ClutterMD2          *md2);
+
+void clutter_md2_scheduler_set_fps (ClutterMD2Scheduler *scheduler,
+                                    ClutterMD2          *md2,
+                                    gfloat               fps);
+
+void clutter_md2_scheduler_set_phase (ClutterMD2Scheduler *scheduler,
+                                      ClutterMD2          *md2,
+                                      gfloat               phase);
+
+guint clutter_md2_scheduler_get_n_records (ClutterMD2Scheduler *scheduler);
+
+void clutter_md2_scheduler_get_tick_stats (ClutterMD2Scheduler *scheduler,
+                                           guint               *n_updated,
+                                           guint               *n_skipped);
+
+G_END_DECLS
+
+#endif /* __CLUTTER_MD2_SCHEDULER_H__ */
@@ -0,0 +1,350 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib-object.h>
+#include <clutter/clutter.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "clutter-md2-data.h"
+#include "clutter-md2-data-private.h"
+
+/* Frames in Quake style models are named after the animation they
+   belong to followed by a number, eg 'run1' to 'run6' or 'pain101' to
+   'pain104'. Consecutive frames with the same name and consecutive
+   numbers are grouped into a sequence */
+
+/* Speed to suggest for sequences that aren't in the table below */
+#define CLUTTER_MD2_SEQUENCE_DEFAULT_FPS 10.0f
+
+struct _ClutterMD2DataSequence
+{
+  gchar *name;
+  gint frame_start, frame_end;
+  gfloat fps;
+};
+
+/* Playback speeds of the standard Quake II player animations */
+static const struct
+{
+  const gchar *name;
+  gfloat fps;
+}
+clutter_md2_sequence_speeds[] =
+  {
+    { "stand", 9.0f },
+    { "run", 10.0f },
+    { "attack", 10.0f },
+    { "pain1", 7.0f },
+    { "pain2", 7.0f },
+    { "pain3", 7.0f },
+    { "jump", 7.0f },
+    { "flip", 7.0f },
+    { "salute", 7.0f },
+    { "taunt", 10.0f },
+    { "wave", 7.0f },
+    { "point", 6.0f },
+    { "crstnd", 10.0f },
+    { "crwalk", 7.0f },
+    { "crattak", 10.0f },
+    { "crpain", 7.0f },
+    { "crdeath", 5.0f },
+    { "death1", 7.0f },
+    { "death2", 7.0f },
+    { "death3", 7.0f },
+    { "boom", 5.0f }
+  };
+
+/* Splits a frame name into the length of the part before the
+   trailing digits and the number that the digits represent. Returns
+   the number of digits */
+static int
+clutter_md2_sequence_split_name (const gchar *name,
+                                 int *base_len,
+                                 long *number)
+{
+  int len = strlen (name), digits = 0;
+
+  while (len > 0 && g_ascii_isdigit (name[len - 1]))
+    {
+      len--;
+      digits++;
+    }
+
+  *base_len = len;
+  *number = digits ? strtol (name + len, NULL, 10) : -1;
+
+  return digits;
+}
+
+static gfloat
+clutter_md2_sequence_get_fps (const gchar *name)
+{
+  int i;
+
+  for (i = 0; i < G_N_ELEMENTS (clutter_md2_sequence_speeds); i++)
+    if (!strcmp (clutter_md2_sequence_speeds[i].name, name))
+      return clutter_md2_sequence_speeds[i].fps;
+
+  return CLUTTER_MD2_SEQUENCE_DEFAULT_FPS;
+}
+
+static void
+clutter_md2_sequence_add (ClutterMD2Data *data,
+                          int frame_start, int frame_end)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  const gchar *first_name = priv->frames[frame_start]->name;
+  ClutterMD2DataSequence sequence;
+  int base_len, digits;
+  long number;
+
+  digits = clutter_md2_sequence_split_name (first_name, &base_len, &number);
+
+  /* Frames with three digit numbers such as 'death301' use the first
+     digit to distinguish between variants of the animation so it is
+     kept as part of the sequence name */
+  if (digits > 2)
+    base_len += digits - 2;
+
+  sequence.name = g_strndup (first_name, base_len);
+
+  /* If the name is already taken then fall back to the name of the
+     first frame which is unique within the sequence */
+  if (sequence.name[0] == '\0'
+      || g_hash_table_lookup (priv->sequence_names, sequence.name))
+    {
+      g_free (sequence.name);
+      sequence.name = g_strdup (first_name);
+
+      if (g_hash_table_lookup (priv->sequence_names, sequence.name))
+        {
+          g_free (sequence.name);
+          return;
+        }
+    }
+
+  sequence.frame_start = frame_start;
+  sequence.frame_end = frame_end;
+  sequence.fps = clutter_md2_sequence_get_fps (sequence.name);
+
+  g_array_append_val (priv->sequences, sequence);
+
+  /* The indices are stored off by one so that NULL means the name is
+     not in the table */
+  g_hash_table_insert (priv->sequence_names,
+                       sequence.name,
+                       GINT_TO_POINTER (priv->sequences->len));
+}
+
+void
+_clutter_md2_data_build_sequences (ClutterMD2Data *data)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  int i, frame_start = 0;
+
+  /* The names are copied because the keyframe and basis compression
+     reallocate the frame headers after this */
+  priv->frame_names = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, NULL);
+  priv->sequence_names = g_hash_table_new (g_str_hash, g_str_equal);
+  priv->sequences = g_array_new (FALSE, FALSE,
+                                 sizeof (ClutterMD2DataSequence));
+
+  for (i = 0; i < priv->num_frames; i++)
+    {
+      const gchar *name = priv->frames[i]->name;
+
+      /* If there are duplicate frame names then the first one wins */
+      if (g_hash_table_lookup (priv->frame_names, name) == NULL)
+        g_hash_table_insert (priv->frame_names, g_strdup (name),
+                             GINT_TO_POINTER (i + 1));
+
+      /* Start a new sequence if the base name changes or the number
+         doesn't follow on from the previous frame */
+      if (i > frame_start)
+        {
+          const gchar *prev_name = priv->frames[i - 1]->name;
+          int base_len, prev_base_len;
+          long number, prev_number;
+
+          clutter_md2_sequence_split_name (name, &base_len, &number);
+          clutter_md2_sequence_split_name (prev_name,
+                                           &prev_base_len, &prev_number);
+
+          if (base_len != prev_base_len
+              || strncmp (name, prev_name, base_len)
+              || number < 0
+              || number != prev_number + 1)
+            {
+              clutter_md2_sequence_add (data, frame_start, i - 1);
+              frame_start = i;
+            }
+        }
+    }
+
+  if (priv->num_frames > 0)
+    clutter_md2_sequence_add (data, frame_start, priv->num_frames - 1);
+}
+
+void
+_clutter_md2_data_free_sequences (ClutterMD2Data *data)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  int i;
+
+  if (priv->frame_names)
+    {
+      g_hash_table_destroy (priv->frame_names);
+      priv->frame_names = NULL;
+    }
+
+  if (priv->sequence_names)
+    {
+      g_hash_table_destroy (priv->sequence_names);
+      priv->sequence_names = NULL;
+    }
+
+  if (priv->sequences)
+    {
+      for (i = 0; i < priv->sequences->len; i++)
+        g_free (g_array_index (priv->sequences,
+                               ClutterMD2DataSequence, i).name);
+      g_array_free (priv->sequences, TRUE);
+      priv->sequences = NULL;
+    }
+}
+
+gboolean
+_clutter_md2_data_get_frame_sequence (ClutterMD2Data *data,
+                                      gint            frame_num,
+                                      gint           *frame_start,
+                                      gint           *frame_end)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  int min = 0, max;
+
+  if (priv->sequences == NULL)
+    return FALSE;
+
+  /* The sequences are added in order of their frames */
+  max = priv->sequences->len;
+
+  while (min < max)
+    {
+      int mid = (min + max) / 2;
+      const ClutterMD2DataSequence *sequence
+        = &g_array_index (priv->sequences, ClutterMD2DataSequence, mid);
+
+      if (frame_num < sequence->frame_start)
+        max = mid;
+      else if (frame_num > sequence->frame_end)
+        min = mid + 1;
+      else
+        {
+          *frame_start = sequence->frame_start;
+          *frame_end = sequence->frame_end;
+
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+gint
+clutter_md2_data_get_frame_by_name (ClutterMD2Data *data,
+                                    const gchar    *frame_name)
+{
+  ClutterMD2DataPrivate *priv;
+
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), -1);
+  g_return_val_if_fail (frame_name != NULL, -1);
+
+  priv = data->priv;
+
+  if (priv->frame_names == NULL)
+    return -1;
+
+  return GPOINTER_TO_INT (g_hash_table_lookup (priv->frame_names,
+                                               frame_name)) - 1;
+}
+
+gint
+clutter_md2_data_get_n_sequences (ClutterMD2Data *data)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), 0);
+
+  return data->priv->sequences ? data->priv->sequences->len : 0;
+}
+
+const gchar *
+clutter_md2_data_get_sequence_name (ClutterMD2Data *data,
+                                    gint            sequence_num)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), NULL);
+  g_return_val_if_fail (sequence_num >= 0
+                        && sequence_num
+                        < clutter_md2_data_get_n_sequences (data), NULL);
+
+  return g_array_index (data->priv->sequences,
+                        ClutterMD2DataSequence, sequence_num).name;
+}
+
+gboolean
+clutter_md2_data_get_sequence (ClutterMD2Data *data,
+                               const gchar    *sequence_name,
+                               gint           *frame_start,
+                               gint           *frame_end,
+                               gfloat         *fps)
+{
+  ClutterMD2DataPrivate *priv;
+  const ClutterMD2DataSequence *sequence;
+  int sequence_num;
+
+  g_return_val_if_fail (CLUTTER_IS_MD2_DATA (data), FALSE);
+  g_return_val_if_fail (sequence_name != NULL, FALSE);
+
+  priv = data->priv;
+
+  if (priv->sequence_names == NULL
+      || (sequence_num = GPOINTER_TO_INT
+          (g_hash_table_lookup (priv->sequence_names, sequence_name))) == 0)
+    return FALSE;
+
+  sequence = &g_array_index (priv->sequences, ClutterMD2DataSequence,
+                             sequence_num - 1);
+
+  if (frame_start)
+    *frame_start = sequence->frame_start;
+  if (frame_end)
+    *frame_end = sequence->frame_end;
+  if (fps)
+    *fps = sequence->fps;
+
+  return TRUE;
+}
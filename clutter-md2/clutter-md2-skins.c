@@ -0,0 +1,1739 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib-object.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <clutter/clutter.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <cogl/cogl.h>
+
+#include "clutter-md2-data.h"
+#include "clutter-md2-data-private.h"
+
+/* Skins are shared between every ClutterMD2Data through a cache keyed
+   by the resolved path of the image, its modification time and the
+   size of the texture that it is padded to. Several models that use
+   the same image, or the same model loaded twice, then only decode
+   and upload it once. Each entry is reference counted by the skins
+   that use it and the texture is deleted when the last one goes */
+
+static GHashTable *clutter_md2_skin_cache = NULL;
+
+/* Number of times an existing entry was reused */
+static guint clutter_md2_skin_cache_hits = 0;
+
+/* If a directory is set then the padded skins are also written there
+   after decoding. A later run then maps the file and passes the texels
+   straight to GL instead of decoding the image again. The files are
+   named after a checksum of the path and the texture size and are
+   rewritten when the modification time or size of the image
+   changes */
+static gchar *clutter_md2_skin_cache_dir = NULL;
+
+/* The textures are only uploaded when a skin is first drawn. If a
+   budget is set then the least recently drawn textures are deleted
+   to keep the resident bytes under it and they are uploaded again
+   the next time they are drawn. The queue holds the entries with a
+   resident texture, least recently used first */
+static gsize clutter_md2_skin_texture_budget = 0;
+static GQueue clutter_md2_skin_resident = G_QUEUE_INIT;
+static gsize clutter_md2_skin_resident_bytes = 0;
+static guint clutter_md2_skin_n_uploads = 0;
+static guint clutter_md2_skin_n_evictions = 0;
+
+/* Models with progressive skins don't wait for images that aren't in
+   the disk cache. They are decoded by a pool of threads while the
+   skin is drawn with a plain grey texel. As soon as the mipmaps are
+   made the largest level that fits in the preview size is handed
+   back, and then the full image once it has been written to the disk
+   cache. The models are told about both with "skin-changed" */
+#define CLUTTER_MD2_SKIN_PREVIEW_SIZE 64
+
+typedef struct _ClutterMD2SkinLoadJob ClutterMD2SkinLoadJob;
+typedef struct _ClutterMD2SkinPreview ClutterMD2SkinPreview;
+typedef struct _ClutterMD2SkinWaiter ClutterMD2SkinWaiter;
+
+/* The thread only uses its own copies so it never touches the entry
+   or the cache directory */
+struct _ClutterMD2SkinLoadJob
+{
+  ClutterMD2DataSkinEntry *entry;
+  gchar *path, *cache_path;
+  struct stat buf;
+  guint texture_width, texture_height;
+  gboolean mipmap;
+
+  GdkPixbuf *pixbuf;
+  ClutterMD2DataMipmaps *mipmaps;
+  GError *error;
+};
+
+/* The job's reference keeps the entry alive because the preview is
+   always handled before the job that it came from */
+struct _ClutterMD2SkinPreview
+{
+  ClutterMD2DataSkinEntry *entry;
+  GdkPixbuf *pixbuf;
+};
+
+struct _ClutterMD2SkinWaiter
+{
+  ClutterMD2Data *data;
+  guint generation;
+  gint skin_num;
+};
+
+static GThreadPool *clutter_md2_skin_pool = NULL;
+static GLuint clutter_md2_skin_placeholder = 0;
+
+/* Indexed skins are stored as a texture of palette indices and a
+   256x1 texture for the palette. A fragment program looks up the four
+   nearest indices, converts them to colours and then filters them
+   like GL_LINEAR would. Each model has its own copy of the palette so
+   recolouring a skin only has to upload 768 bytes. The program is
+   created the first time an indexed skin is added */
+
+#ifndef GL_FRAGMENT_PROGRAM_ARB
+#define GL_FRAGMENT_PROGRAM_ARB      0x8804
+#endif
+#ifndef GL_PROGRAM_FORMAT_ASCII_ARB
+#define GL_PROGRAM_FORMAT_ASCII_ARB  0x8875
+#endif
+#ifndef GL_PROGRAM_BINDING_ARB
+#define GL_PROGRAM_BINDING_ARB       0x8677
+#endif
+#ifndef GL_TEXTURE0
+#define GL_TEXTURE0                  0x84C0
+#define GL_TEXTURE1                  0x84C1
+#endif
+
+typedef void (* ClutterMD2GenProgramsFunc) (GLsizei n, GLuint *programs);
+typedef void (* ClutterMD2BindProgramFunc) (GLenum target, GLuint program);
+typedef void (* ClutterMD2ProgramStringFunc) (GLenum target, GLenum format,
+                                              GLsizei len,
+                                              const void *string);
+typedef void (* ClutterMD2ProgramLocalParameterFunc) (GLenum target,
+                                                      GLuint index,
+                                                      GLfloat x, GLfloat y,
+                                                      GLfloat z, GLfloat w);
+typedef void (* ClutterMD2GetProgramivFunc) (GLenum target, GLenum pname,
+                                             GLint *params);
+typedef void (* ClutterMD2ActiveTextureFunc) (GLenum texture);
+
+typedef struct _ClutterMD2SkinPaletteProgram ClutterMD2SkinPaletteProgram;
+
+struct _ClutterMD2SkinPaletteProgram
+{
+  /* Whether the extension has been checked for yet. The program is 0
+     if it isn't supported */
+  gboolean initialized;
+  GLuint program;
+
+  ClutterMD2GenProgramsFunc gen_programs;
+  ClutterMD2BindProgramFunc bind_program;
+  ClutterMD2ProgramStringFunc program_string;
+  ClutterMD2ProgramLocalParameterFunc program_local_parameter_4f;
+  ClutterMD2GetProgramivFunc get_program_iv;
+  ClutterMD2ActiveTextureFunc active_texture;
+
+  /* The state from before a batch and whether the program is
+     currently enabled within it */
+  gboolean saved;
+  gboolean saved_enabled;
+  GLint saved_program;
+  GLint saved_texture;
+  gboolean enabled;
+};
+
+static ClutterMD2SkinPaletteProgram clutter_md2_skin_palette_program;
+
+/* program.local[0] is the size of the index texture followed by its
+   reciprocal. The indices are mapped from [0,1] to the centers of
+   the palette texels */
+static const char
+clutter_md2_skin_palette_source[] =
+  "!!ARBfp1.0\n"
+  "PARAM size = program.local[0];\n"
+  "PARAM half = { 0.5, 0.5, 0.5, 0.5 };\n"
+  "PARAM lookup = { 0.99609375, 0.001953125, 0.5, 0.0 };\n"
+  "TEMP coord, frac, t0, t1, t2, t3, top, bottom;\n"
+  "MAD coord, fragment.texcoord[0], size, -half;\n"
+  "FRC frac, coord;\n"
+  "SUB coord, coord, frac;\n"
+  "ADD coord, coord, half;\n"
+  "MUL t0, coord, size.zwzw;\n"
+  "MOV t1, t0;\n"
+  "ADD t1.x, t0.x, size.z;\n"
+  "MOV t2, t0;\n"
+  "ADD t2.y, t0.y, size.w;\n"
+  "ADD t3, t0, size.zwzw;\n"
+  "TEX t0, t0, texture[0], 2D;\n"
+  "TEX t1, t1, texture[0], 2D;\n"
+  "TEX t2, t2, texture[0], 2D;\n"
+  "TEX t3, t3, texture[0], 2D;\n"
+  "MAD t0.x, t0.x, lookup.x, lookup.y;\n"
+  "MAD t1.x, t1.x, lookup.x, lookup.y;\n"
+  "MAD t2.x, t2.x, lookup.x, lookup.y;\n"
+  "MAD t3.x, t3.x, lookup.x, lookup.y;\n"
+  "MOV t0.y, lookup.z;\n"
+  "MOV t1.y, lookup.z;\n"
+  "MOV t2.y, lookup.z;\n"
+  "MOV t3.y, lookup.z;\n"
+  "TEX t0, t0, texture[1], 2D;\n"
+  "TEX t1, t1, texture[1], 2D;\n"
+  "TEX t2, t2, texture[1], 2D;\n"
+  "TEX t3, t3, texture[1], 2D;\n"
+  "LRP top, frac.x, t1, t0;\n"
+  "LRP bottom, frac.x, t3, t2;\n"
+  "LRP result.color, frac.y, bottom, top;\n"
+  "END\n";
+
+#define CLUTTER_MD2_SKIN_FILE_MAGIC   0x4b53444d /* MDSK */
+#define CLUTTER_MD2_SKIN_FILE_VERSION 1
+
+typedef struct _ClutterMD2SkinFileHeader ClutterMD2SkinFileHeader;
+
+/* The header is followed by the rows of texels without any padding */
+struct _ClutterMD2SkinFileHeader
+{
+  guint32 magic;
+  guint32 version;
+  guint32 width, height;
+  guint32 has_alpha;
+  guint32 n_levels;
+  /* The image that the texels were decoded from */
+  guint64 source_mtime;
+  guint64 source_size;
+};
+
+static gchar *
+clutter_md2_skin_resolve_path (const gchar *filename)
+{
+  gchar *cwd, *path;
+
+#ifdef G_OS_UNIX
+  char *resolved;
+
+  /* Follow symlinks and remove any '..' so that different ways of
+     naming the same file share an entry */
+  if ((resolved = realpath (filename, NULL)))
+    {
+      path = g_strdup (resolved);
+      free (resolved);
+
+      return path;
+    }
+#endif
+
+  if (g_path_is_absolute (filename))
+    return g_strdup (filename);
+
+  cwd = g_get_current_dir ();
+  path = g_build_filename (cwd, filename, NULL);
+  g_free (cwd);
+
+  return path;
+}
+
+static gchar *
+clutter_md2_skin_get_key (const gchar       *path,
+                          const struct stat *buf,
+                          guint              texture_width,
+                          guint              texture_height,
+                          gboolean           indexed,
+                          gboolean           mipmap)
+{
+  return g_strdup_printf ("%s:%lu:%ux%u%s%s", path,
+                          (unsigned long) buf->st_mtime,
+                          texture_width, texture_height,
+                          indexed ? ":indexed" : "",
+                          mipmap ? ":mipmap" : "");
+}
+
+static gchar *
+clutter_md2_skin_get_file_name (const gchar *path,
+                                guint        texture_width,
+                                guint        texture_height,
+                                gboolean     mipmap)
+{
+  gchar *name, *checksum, *file_name;
+
+  /* The modification time isn't part of the name so that a changed
+     image replaces its old file instead of leaving it behind. Models
+     that do and don't use mipmaps get separate files so that they
+     don't keep overwriting each other's */
+  name = g_strdup_printf ("%s:%ux%u%s", path, texture_width, texture_height,
+                          mipmap ? ":mipmap" : "");
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, name, -1);
+  file_name = g_strconcat (checksum, ".skin", NULL);
+
+  g_free (name);
+  g_free (checksum);
+
+  return file_name;
+}
+
+/* Returns NULL if there is no disk cache */
+static gchar *
+clutter_md2_skin_get_cache_path (const gchar *path,
+                                 guint        texture_width,
+                                 guint        texture_height,
+                                 gboolean     mipmap)
+{
+  gchar *file_name, *cache_path;
+
+  if (clutter_md2_skin_cache_dir == NULL)
+    return NULL;
+
+  file_name = clutter_md2_skin_get_file_name (path, texture_width,
+                                              texture_height, mipmap);
+  cache_path = g_build_filename (clutter_md2_skin_cache_dir,
+                                 file_name, NULL);
+  g_free (file_name);
+
+  return cache_path;
+}
+
+static void
+clutter_md2_skin_unmap (guchar *pixels, gpointer data)
+{
+  g_mapped_file_unref (data);
+}
+
+/* Returns a pixbuf whose pixels point into the mapped cache file or
+   NULL if there is no valid file for the image. If mipmap is TRUE
+   then the file must also have the mipmaps, which are returned in
+   mipmaps */
+static GdkPixbuf *
+clutter_md2_skin_read_file (const gchar            *cache_path,
+                            const struct stat      *buf,
+                            guint                   texture_width,
+                            guint                   texture_height,
+                            gboolean                mipmap,
+                            ClutterMD2DataMipmaps **mipmaps)
+{
+  const ClutterMD2SkinFileHeader *header;
+  GMappedFile *file;
+  gsize base_size, mipmaps_size, length;
+  int bpp, n_mipmap_levels;
+
+  if ((file = g_mapped_file_new (cache_path, FALSE, NULL)) == NULL)
+    return NULL;
+
+  if (g_mapped_file_get_length (file) < sizeof (ClutterMD2SkinFileHeader))
+    {
+      g_mapped_file_unref (file);
+      return NULL;
+    }
+
+  header = (const ClutterMD2SkinFileHeader *) g_mapped_file_get_contents (file);
+  bpp = header->has_alpha ? 4 : 3;
+
+  base_size = texture_width * texture_height * bpp;
+  mipmaps_size = _clutter_md2_data_get_mipmaps_size (texture_width,
+                                                     texture_height,
+                                                     bpp,
+                                                     &n_mipmap_levels);
+  length = g_mapped_file_get_length (file) - sizeof (ClutterMD2SkinFileHeader);
+
+  /* A file without mipmaps can still be used if they aren't needed */
+  if (header->magic != CLUTTER_MD2_SKIN_FILE_MAGIC
+      || header->version != CLUTTER_MD2_SKIN_FILE_VERSION
+      || header->width != texture_width
+      || header->height != texture_height
+      || header->source_mtime != (guint64) buf->st_mtime
+      || header->source_size != (guint64) buf->st_size
+      || !((header->n_levels == 1 + n_mipmap_levels
+            && length == base_size + mipmaps_size)
+           || (header->n_levels == 1
+               && length == base_size
+               && !mipmap)))
+    {
+      g_mapped_file_unref (file);
+      return NULL;
+    }
+
+  if (mipmap && n_mipmap_levels > 0)
+    *mipmaps = _clutter_md2_data_mipmaps_new_mapped
+      (file, (const guchar *) (header + 1) + base_size,
+       texture_width, texture_height, bpp);
+
+  /* The pixbuf keeps the file mapped until it is destroyed */
+  return gdk_pixbuf_new_from_data ((const guchar *) (header + 1),
+                                   GDK_COLORSPACE_RGB,
+                                   header->has_alpha,
+                                   8,
+                                   texture_width, texture_height,
+                                   texture_width * bpp,
+                                   clutter_md2_skin_unmap,
+                                   file);
+}
+
+/* Writing the cache is only an optimization so any errors are
+   ignored */
+static void
+clutter_md2_skin_write_file (const gchar                 *cache_path,
+                             const struct stat           *buf,
+                             GdkPixbuf                   *pixbuf,
+                             const ClutterMD2DataMipmaps *mipmaps)
+{
+  ClutterMD2SkinFileHeader *header;
+  int width = gdk_pixbuf_get_width (pixbuf);
+  int height = gdk_pixbuf_get_height (pixbuf);
+  gboolean has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+  int bpp = has_alpha ? 4 : 3;
+  int rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  const guchar *src = gdk_pixbuf_get_pixels (pixbuf);
+  gsize size = sizeof (ClutterMD2SkinFileHeader) + width * height * bpp;
+  guchar *contents, *dst;
+  gchar *dir;
+  int row;
+
+  if (mipmaps)
+    size += mipmaps->size;
+
+  contents = g_malloc (size);
+
+  header = (ClutterMD2SkinFileHeader *) contents;
+  header->magic = CLUTTER_MD2_SKIN_FILE_MAGIC;
+  header->version = CLUTTER_MD2_SKIN_FILE_VERSION;
+  header->width = width;
+  header->height = height;
+  header->has_alpha = has_alpha;
+  header->n_levels = 1 + (mipmaps ? mipmaps->n_levels : 0);
+  header->source_mtime = buf->st_mtime;
+  header->source_size = buf->st_size;
+
+  dst = (guchar *) (header + 1);
+
+  for (row = 0; row < height; row++)
+    {
+      memcpy (dst, src, width * bpp);
+      dst += width * bpp;
+      src += rowstride;
+    }
+
+  if (mipmaps)
+    memcpy (dst, mipmaps->data, mipmaps->size);
+
+  /* The contents are written to a temporary file and renamed so
+     another process will never map a partial file */
+  dir = g_path_get_dirname (cache_path);
+  if (g_mkdir_with_parents (dir, 0755) == 0)
+    g_file_set_contents (cache_path, (const gchar *) contents, size, NULL);
+  g_free (dir);
+
+  g_free (contents);
+}
+
+/* Decodes the image. If pad is TRUE then it is also padded to the
+   texture size, otherwise the upload pads the texture instead */
+static GdkPixbuf *
+clutter_md2_skin_decode (const gchar *filename,
+                         guint        texture_width,
+                         guint        texture_height,
+                         gboolean     pad,
+                         GError     **error)
+{
+  GdkPixbuf *pixbuf;
+  GMappedFile *file;
+  int image_width, image_height;
+  int bpp, rowstride;
+
+  /* PCX files are decoded straight into the padded layout */
+  if ((file = g_mapped_file_new (filename, FALSE, NULL)))
+    {
+      const guchar *contents
+        = (const guchar *) g_mapped_file_get_contents (file);
+      gsize length = g_mapped_file_get_length (file);
+
+      if (_clutter_md2_data_is_pcx (contents, length))
+        {
+          pixbuf = _clutter_md2_data_decode_pcx (contents, length,
+                                                 pad ? texture_width : 0,
+                                                 pad ? texture_height : 0,
+                                                 filename, error);
+          g_mapped_file_unref (file);
+
+          return pixbuf;
+        }
+
+      g_mapped_file_unref (file);
+    }
+
+  pixbuf = gdk_pixbuf_new_from_file (filename, error);
+
+  if (pixbuf == NULL || !pad)
+    return pixbuf;
+
+  image_width = gdk_pixbuf_get_width (pixbuf);
+  image_height = gdk_pixbuf_get_height (pixbuf);
+  bpp = gdk_pixbuf_get_has_alpha (pixbuf) ? 4 : 3;
+
+  /* If the pixmap isn't the same size as the texture then create a
+     new pixbuf and set a subregion of it */
+  if (image_width != texture_width || image_height != texture_height)
+    {
+      GdkPixbuf *pixbuf_tmp;
+
+      pixbuf_tmp = gdk_pixbuf_new (GDK_COLORSPACE_RGB,
+                                   gdk_pixbuf_get_has_alpha (pixbuf),
+                                   gdk_pixbuf_get_bits_per_sample (pixbuf),
+                                   texture_width, texture_height);
+
+      gdk_pixbuf_copy_area (pixbuf, 0, 0,
+                            MIN (texture_width, image_width),
+                            MIN (texture_height, image_height),
+                            pixbuf_tmp, 0, 0);
+
+      g_object_unref (pixbuf);
+      pixbuf = pixbuf_tmp;
+      rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+
+      /* If the new pixbuf is bigger than the old one then copy in the
+         pixels at the edges so there won't be artifacts if the
+         texture is linear filtered */
+      if (image_height < texture_height)
+        {
+          int row;
+          guchar *dst = gdk_pixbuf_get_pixels (pixbuf)
+            + rowstride * image_height;
+          const guchar *src = dst - rowstride;
+
+          for (row = image_height; row < texture_height; row++)
+            {
+              memcpy (dst, src, image_width * bpp);
+              dst += rowstride;
+            }
+        }
+      if (image_width < texture_width)
+        {
+          int row, col;
+          guchar *dst = gdk_pixbuf_get_pixels (pixbuf) + bpp * image_width;
+          const guchar *src = dst - bpp;
+
+          for (row = 0; row < texture_height; row++)
+            {
+              for (col = texture_width - image_width; col > 0; col--)
+                {
+                  memcpy (dst, src, bpp);
+                  dst += bpp;
+                }
+              dst += rowstride - (texture_width - image_width) * bpp;
+              src += rowstride;
+            }
+        }
+    }
+
+  return pixbuf;
+}
+
+/* Decodes a paletted image to indices padded to the texture size.
+   Returns NULL without setting the error if the image isn't paletted
+   so that it can be decoded as RGB instead. Indexed skins aren't
+   stored in the disk cache because decoding the indices is little
+   more work than reading them back */
+static GByteArray *
+clutter_md2_skin_decode_indexed (const gchar *filename,
+                                 guint        texture_width,
+                                 guint        texture_height,
+                                 guchar      *palette,
+                                 GError     **error)
+{
+  GByteArray *indices = NULL;
+  GMappedFile *file;
+  const guchar *contents;
+  gsize length;
+
+  if ((file = g_mapped_file_new (filename, FALSE, NULL)) == NULL)
+    return NULL;
+
+  contents = (const guchar *) g_mapped_file_get_contents (file);
+  length = g_mapped_file_get_length (file);
+
+  if (_clutter_md2_data_is_indexed_pcx (contents, length))
+    indices = _clutter_md2_data_decode_pcx_indexed (contents, length,
+                                                    texture_width,
+                                                    texture_height,
+                                                    palette,
+                                                    filename, error);
+
+  g_mapped_file_unref (file);
+
+  return indices;
+}
+
+/* Generates the mipmaps from the whole padded texture */
+static ClutterMD2DataMipmaps *
+clutter_md2_skin_generate_mipmaps (GdkPixbuf *pixbuf)
+{
+  return _clutter_md2_data_generate_mipmaps (gdk_pixbuf_get_pixels (pixbuf),
+                                             gdk_pixbuf_get_width (pixbuf),
+                                             gdk_pixbuf_get_height (pixbuf),
+                                             gdk_pixbuf_get_rowstride (pixbuf),
+                                             gdk_pixbuf_get_n_channels
+                                             (pixbuf));
+}
+
+/* Gets the padded image from the disk cache if possible or decodes it
+   otherwise. buf is NULL if the image couldn't be found. The image is
+   only padded if the pixels are kept, it is written to the disk cache
+   or mipmaps are made from it. If mipmap is TRUE then the mipmaps are
+   returned in mipmaps */
+static GdkPixbuf *
+clutter_md2_skin_load (const gchar            *filename,
+                       const gchar            *path,
+                       const struct stat      *buf,
+                       guint                   texture_width,
+                       guint                   texture_height,
+                       gboolean                keep_pixels,
+                       gboolean                mipmap,
+                       ClutterMD2DataMipmaps **mipmaps,
+                       GError                **error)
+{
+  GdkPixbuf *pixbuf;
+  gchar *cache_path;
+
+  if (buf == NULL
+      || (cache_path = clutter_md2_skin_get_cache_path (path, texture_width,
+                                                        texture_height,
+                                                        mipmap)) == NULL)
+    {
+      pixbuf = clutter_md2_skin_decode (filename,
+                                        texture_width, texture_height,
+                                        keep_pixels || mipmap, error);
+
+      if (pixbuf && mipmap)
+        *mipmaps = clutter_md2_skin_generate_mipmaps (pixbuf);
+
+      return pixbuf;
+    }
+
+  pixbuf = clutter_md2_skin_read_file (cache_path, buf,
+                                       texture_width, texture_height,
+                                       mipmap, mipmaps);
+
+  if (pixbuf == NULL)
+    {
+      pixbuf = clutter_md2_skin_decode (filename,
+                                        texture_width, texture_height,
+                                        TRUE, error);
+
+      if (pixbuf)
+        {
+          if (mipmap)
+            *mipmaps = clutter_md2_skin_generate_mipmaps (pixbuf);
+
+          clutter_md2_skin_write_file (cache_path, buf, pixbuf, *mipmaps);
+        }
+    }
+
+  g_free (cache_path);
+
+  return pixbuf;
+}
+
+/* Copies the last column and the last row of the image into the
+   texel after it and into the last texel of the texture so that
+   linear filtering and GL_REPEAT don't blend with undefined texels.
+   Nothing else outside the image is ever sampled */
+static void
+clutter_md2_skin_upload_edges (GdkPixbuf *pixbuf,
+                               GLenum     format,
+                               guint      texture_width,
+                               guint      texture_height)
+{
+  int bpp = gdk_pixbuf_get_has_alpha (pixbuf) ? 4 : 3;
+  int rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  guint width = MIN (gdk_pixbuf_get_width (pixbuf), texture_width);
+  guint height = MIN (gdk_pixbuf_get_height (pixbuf), texture_height);
+  const guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+  guchar *strip, *dst;
+  guint i;
+
+  /* The strip holds either a column or a row plus the corner */
+  strip = g_malloc ((MAX (width, height) + 1) * bpp);
+
+#ifdef GL_UNPACK_ROW_LENGTH
+  glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
+#endif
+  glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+
+  if (width < texture_width)
+    {
+      for (i = 0, dst = strip; i < height; i++, dst += bpp)
+        memcpy (dst, pixels + i * rowstride + (width - 1) * bpp, bpp);
+
+      glTexSubImage2D (GL_TEXTURE_2D, 0, width, 0, 1, height,
+                       format, GL_UNSIGNED_BYTE, strip);
+      if (texture_width - 1 > width)
+        glTexSubImage2D (GL_TEXTURE_2D, 0, texture_width - 1, 0, 1, height,
+                         format, GL_UNSIGNED_BYTE, strip);
+    }
+
+  if (height < texture_height)
+    {
+      guint row_width = width;
+
+      memcpy (strip, pixels + (height - 1) * rowstride, width * bpp);
+
+      /* The corner texel repeats the last pixel */
+      if (width < texture_width)
+        memcpy (strip + row_width++ * bpp, strip + (width - 1) * bpp, bpp);
+
+      for (i = height; i < texture_height; i = MAX (i + 1, texture_height - 1))
+        {
+          glTexSubImage2D (GL_TEXTURE_2D, 0, 0, i, row_width, 1,
+                           format, GL_UNSIGNED_BYTE, strip);
+          if (texture_width - 1 > width)
+            glTexSubImage2D (GL_TEXTURE_2D, 0, texture_width - 1, i, 1, 1,
+                             format, GL_UNSIGNED_BYTE, strip + width * bpp);
+        }
+    }
+
+  g_free (strip);
+}
+
+/* Uploads the pixbuf into a texture of the given size. If the sizes
+   don't match then the texture is allocated empty and the image and
+   its edges are uploaded into it instead of padding a copy. The
+   mipmaps may be NULL */
+static GLuint
+clutter_md2_skin_upload (GdkPixbuf                   *pixbuf,
+                         guint                        texture_width,
+                         guint                        texture_height,
+                         const ClutterMD2DataMipmaps *mipmaps)
+{
+  int bpp = gdk_pixbuf_get_has_alpha (pixbuf) ? 4 : 3;
+  int rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  guint width = gdk_pixbuf_get_width (pixbuf);
+  guint height = gdk_pixbuf_get_height (pixbuf);
+  GLenum format = gdk_pixbuf_get_has_alpha (pixbuf) ? GL_RGBA : GL_RGB;
+  int alignment = 1;
+  GLuint texture;
+
+  while ((rowstride & 1) == 0 && alignment < 8)
+    {
+      rowstride >>= 1;
+      alignment <<= 1;
+    }
+
+  glGenTextures (1, &texture);
+  glBindTexture (GL_TEXTURE_2D, texture);
+#ifdef GL_UNPACK_ROW_LENGTH
+  glPixelStorei (GL_UNPACK_ROW_LENGTH,
+                 gdk_pixbuf_get_rowstride (pixbuf) / bpp);
+#endif
+  glPixelStorei (GL_UNPACK_ALIGNMENT, alignment);
+
+  glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                   mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+  if (width == texture_width && height == texture_height)
+    glTexImage2D (GL_TEXTURE_2D, 0, format, width, height, 0,
+                  format, GL_UNSIGNED_BYTE, gdk_pixbuf_get_pixels (pixbuf));
+  else
+    {
+      glTexImage2D (GL_TEXTURE_2D, 0, format,
+                    texture_width, texture_height, 0,
+                    format, GL_UNSIGNED_BYTE, NULL);
+      glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0,
+                       MIN (width, texture_width),
+                       MIN (height, texture_height),
+                       format, GL_UNSIGNED_BYTE,
+                       gdk_pixbuf_get_pixels (pixbuf));
+
+      clutter_md2_skin_upload_edges (pixbuf, format,
+                                     texture_width, texture_height);
+    }
+
+  if (mipmaps)
+    {
+      int level;
+
+#ifdef GL_UNPACK_ROW_LENGTH
+      glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
+#endif
+      glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+
+      for (level = 1; level <= mipmaps->n_levels; level++)
+        {
+          const guchar *texels;
+          int level_width, level_height;
+
+          texels = _clutter_md2_data_get_mipmap_level (mipmaps, level,
+                                                       texture_width,
+                                                       texture_height,
+                                                       &level_width,
+                                                       &level_height);
+
+          glTexImage2D (GL_TEXTURE_2D, level, format,
+                        level_width, level_height, 0,
+                        format, GL_UNSIGNED_BYTE, texels);
+        }
+    }
+
+  return texture;
+}
+
+static GLuint
+clutter_md2_skin_upload_indices (GByteArray *indices,
+                                 guint       texture_width,
+                                 guint       texture_height)
+{
+  GLuint texture;
+
+  glGenTextures (1, &texture);
+  glBindTexture (GL_TEXTURE_2D, texture);
+#ifdef GL_UNPACK_ROW_LENGTH
+  glPixelStorei (GL_UNPACK_ROW_LENGTH, texture_width);
+#endif
+  glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+
+  /* Indices can't be blended so the fragment program does the
+     filtering */
+  glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+  glTexImage2D (GL_TEXTURE_2D, 0, GL_LUMINANCE8,
+                texture_width, texture_height,
+                0, GL_LUMINANCE, GL_UNSIGNED_BYTE,
+                indices->data);
+
+  return texture;
+}
+
+/* Replaces the pixels of an entry, taking ownership of the new
+   ones */
+static void
+clutter_md2_skin_set_pixels (ClutterMD2DataSkinEntry *entry,
+                             GdkPixbuf               *pixbuf,
+                             GByteArray              *indices,
+                             ClutterMD2DataMipmaps   *mipmaps)
+{
+  gsize n_texels = entry->texture_width * entry->texture_height;
+
+  if (entry->pixbuf)
+    g_object_unref (entry->pixbuf);
+  if (entry->indices)
+    g_byte_array_unref (entry->indices);
+  if (entry->mipmaps)
+    _clutter_md2_data_mipmaps_unref (entry->mipmaps);
+
+  entry->pixbuf = pixbuf;
+  entry->indices = indices;
+  entry->mipmaps = mipmaps;
+  entry->indexed = indices != NULL;
+
+  if (indices)
+    entry->texture_bytes = n_texels;
+  else
+    entry->texture_bytes = (n_texels
+                            * (gdk_pixbuf_get_has_alpha (pixbuf) ? 4 : 3));
+  if (mipmaps)
+    entry->texture_bytes += mipmaps->size;
+}
+
+/* Decodes the image for an entry and replaces any pixels that it
+   already has. The image is padded to the texture size if pad is
+   TRUE */
+static gboolean
+clutter_md2_skin_decode_entry (ClutterMD2DataSkinEntry *entry,
+                               const gchar             *filename,
+                               const struct stat       *buf,
+                               gboolean                 indexed,
+                               gboolean                 pad,
+                               GError                 **error)
+{
+  GdkPixbuf *pixbuf = NULL;
+  GByteArray *indices = NULL;
+  ClutterMD2DataMipmaps *mipmaps = NULL;
+  GError *decode_error = NULL;
+
+  if (indexed)
+    indices = clutter_md2_skin_decode_indexed (filename,
+                                               entry->texture_width,
+                                               entry->texture_height,
+                                               entry->palette,
+                                               &decode_error);
+
+  /* Indices can't be averaged so indexed skins don't have mipmaps */
+  if (indices == NULL && decode_error == NULL)
+    pixbuf = clutter_md2_skin_load (filename, entry->path, buf,
+                                    entry->texture_width,
+                                    entry->texture_height,
+                                    pad, entry->mipmap, &mipmaps,
+                                    &decode_error);
+
+  if (decode_error)
+    {
+      g_propagate_error (error, decode_error);
+      return FALSE;
+    }
+
+  clutter_md2_skin_set_pixels (entry, pixbuf, indices, mipmaps);
+
+  return TRUE;
+}
+
+/* Indices are always padded but RGB pixels that were only decoded for
+   the upload may not be */
+static gboolean
+clutter_md2_skin_has_padded_pixels (ClutterMD2DataSkinEntry *entry)
+{
+  return (entry->indices
+          || (entry->pixbuf
+              && gdk_pixbuf_get_width (entry->pixbuf) == entry->texture_width
+              && (gdk_pixbuf_get_height (entry->pixbuf)
+                  == entry->texture_height)));
+}
+
+static void
+clutter_md2_skin_notify_waiters (ClutterMD2DataSkinEntry *entry)
+{
+  GSList *l;
+
+  for (l = entry->waiters; l; l = l->next)
+    {
+      ClutterMD2SkinWaiter *waiter = l->data;
+
+      /* The model may have been reloaded since it added the skin */
+      if (waiter->generation == waiter->data->priv->skin_generation)
+        _clutter_md2_data_emit_skin_changed (waiter->data, waiter->skin_num);
+    }
+}
+
+static gboolean
+clutter_md2_skin_preview_idle_cb (gpointer user_data)
+{
+  ClutterMD2SkinPreview *preview = user_data;
+  ClutterMD2DataSkinEntry *entry = preview->entry;
+
+  if (entry->preview == NULL)
+    {
+      entry->preview = preview->pixbuf;
+      clutter_md2_skin_notify_waiters (entry);
+    }
+  else
+    g_object_unref (preview->pixbuf);
+
+  g_slice_free (ClutterMD2SkinPreview, preview);
+
+  return FALSE;
+}
+
+static gboolean
+clutter_md2_skin_load_idle_cb (gpointer user_data)
+{
+  ClutterMD2SkinLoadJob *job = user_data;
+  ClutterMD2DataSkinEntry *entry = job->entry;
+  GSList *l;
+
+  entry->loading = FALSE;
+
+  /* A model that wasn't progressive may have decoded the image itself
+     in the meantime */
+  if (entry->texture == 0 && entry->pixbuf == NULL && entry->indices == NULL)
+    {
+      if (job->error)
+        {
+          g_warning ("Failed to load the skin '%s': %s", entry->path,
+                     job->error->message);
+          entry->reload_failed = TRUE;
+        }
+      else
+        {
+          clutter_md2_skin_set_pixels (entry, job->pixbuf, NULL,
+                                       job->mipmaps);
+          job->pixbuf = NULL;
+          job->mipmaps = NULL;
+        }
+    }
+
+  if (entry->preview_texture)
+    {
+      glDeleteTextures (1, &entry->preview_texture);
+      entry->preview_texture = 0;
+    }
+  if (entry->preview)
+    {
+      g_object_unref (entry->preview);
+      entry->preview = NULL;
+    }
+
+  clutter_md2_skin_notify_waiters (entry);
+
+  for (l = entry->waiters; l; l = l->next)
+    {
+      ClutterMD2SkinWaiter *waiter = l->data;
+
+      g_object_unref (waiter->data);
+      g_slice_free (ClutterMD2SkinWaiter, waiter);
+    }
+  g_slist_free (entry->waiters);
+  entry->waiters = NULL;
+
+  _clutter_md2_data_release_skin_entry (entry, FALSE);
+
+  if (job->pixbuf)
+    g_object_unref (job->pixbuf);
+  if (job->mipmaps)
+    _clutter_md2_data_mipmaps_unref (job->mipmaps);
+  if (job->error)
+    g_error_free (job->error);
+  g_free (job->path);
+  g_free (job->cache_path);
+  g_slice_free (ClutterMD2SkinLoadJob, job);
+
+  return FALSE;
+}
+
+/* Copies the largest mipmap level that fits in the preview size into
+   its own pixbuf. Returns NULL if the texture is already that small */
+static GdkPixbuf *
+clutter_md2_skin_make_preview (const ClutterMD2DataMipmaps *mipmaps,
+                               guint                        texture_width,
+                               guint                        texture_height)
+{
+  int level;
+
+  if (texture_width <= CLUTTER_MD2_SKIN_PREVIEW_SIZE
+      && texture_height <= CLUTTER_MD2_SKIN_PREVIEW_SIZE)
+    return NULL;
+
+  for (level = 1; level <= mipmaps->n_levels; level++)
+    {
+      const guchar *texels;
+      int width, height;
+
+      texels = _clutter_md2_data_get_mipmap_level (mipmaps, level,
+                                                   texture_width,
+                                                   texture_height,
+                                                   &width, &height);
+
+      if (width <= CLUTTER_MD2_SKIN_PREVIEW_SIZE
+          && height <= CLUTTER_MD2_SKIN_PREVIEW_SIZE)
+        return gdk_pixbuf_new_from_data (g_memdup (texels,
+                                                   width * height
+                                                   * mipmaps->n_channels),
+                                         GDK_COLORSPACE_RGB,
+                                         mipmaps->n_channels == 4,
+                                         8,
+                                         width, height,
+                                         width * mipmaps->n_channels,
+                                         (GdkPixbufDestroyNotify) g_free,
+                                         NULL);
+    }
+
+  return NULL;
+}
+
+static void
+clutter_md2_skin_load_thread_cb (gpointer job_data, gpointer user_data)
+{
+  ClutterMD2SkinLoadJob *job = job_data;
+  ClutterMD2DataMipmaps *mipmaps;
+
+  /* The image is always padded because the preview comes from the
+     mipmaps of the padded texture */
+  job->pixbuf = clutter_md2_skin_decode (job->path,
+                                         job->texture_width,
+                                         job->texture_height,
+                                         TRUE, &job->error);
+
+  if (job->pixbuf)
+    {
+      if ((mipmaps = clutter_md2_skin_generate_mipmaps (job->pixbuf)))
+        {
+          GdkPixbuf *pixbuf
+            = clutter_md2_skin_make_preview (mipmaps,
+                                             job->texture_width,
+                                             job->texture_height);
+
+          if (pixbuf)
+            {
+              ClutterMD2SkinPreview *preview
+                = g_slice_new (ClutterMD2SkinPreview);
+
+              preview->entry = job->entry;
+              preview->pixbuf = pixbuf;
+
+              clutter_threads_add_idle (clutter_md2_skin_preview_idle_cb,
+                                        preview);
+            }
+        }
+
+      if (job->cache_path)
+        clutter_md2_skin_write_file (job->cache_path, &job->buf, job->pixbuf,
+                                     job->mipmap ? mipmaps : NULL);
+
+      if (job->mipmap)
+        job->mipmaps = mipmaps;
+      else if (mipmaps)
+        _clutter_md2_data_mipmaps_unref (mipmaps);
+    }
+
+  clutter_threads_add_idle (clutter_md2_skin_load_idle_cb, job);
+}
+
+/* Starts decoding the image of an entry in the background. An image
+   that is already in the disk cache is just mapped instead. Returns
+   FALSE if it has to be decoded straight away because there aren't
+   any threads */
+static gboolean
+clutter_md2_skin_start_loading (ClutterMD2DataSkinEntry *entry,
+                                const struct stat       *buf)
+{
+  ClutterMD2SkinLoadJob *job;
+  ClutterMD2DataMipmaps *mipmaps = NULL;
+  GdkPixbuf *pixbuf;
+  gchar *cache_path;
+
+  cache_path = clutter_md2_skin_get_cache_path (entry->path,
+                                                entry->texture_width,
+                                                entry->texture_height,
+                                                entry->mipmap);
+
+  if (cache_path
+      && (pixbuf = clutter_md2_skin_read_file (cache_path, buf,
+                                               entry->texture_width,
+                                               entry->texture_height,
+                                               entry->mipmap, &mipmaps)))
+    {
+      clutter_md2_skin_set_pixels (entry, pixbuf, NULL, mipmaps);
+      g_free (cache_path);
+
+      return TRUE;
+    }
+
+  if (!g_thread_supported ())
+    {
+      g_free (cache_path);
+
+      return FALSE;
+    }
+
+  job = g_slice_new (ClutterMD2SkinLoadJob);
+  job->entry = entry;
+  job->path = g_strdup (entry->path);
+  job->cache_path = cache_path;
+  job->buf = *buf;
+  job->texture_width = entry->texture_width;
+  job->texture_height = entry->texture_height;
+  job->mipmap = entry->mipmap;
+  job->pixbuf = NULL;
+  job->mipmaps = NULL;
+  job->error = NULL;
+
+  /* The job keeps the entry alive until it is finished */
+  entry->ref_count++;
+  entry->loading = TRUE;
+
+  if (clutter_md2_skin_pool == NULL)
+    clutter_md2_skin_pool
+      = g_thread_pool_new (clutter_md2_skin_load_thread_cb, NULL,
+                           _clutter_md2_data_get_n_threads (), FALSE, NULL);
+
+  g_thread_pool_push (clutter_md2_skin_pool, job, NULL);
+
+  return TRUE;
+}
+
+ClutterMD2DataSkinEntry *
+_clutter_md2_data_get_skin_entry (const gchar *filename,
+                                  guint        texture_width,
+                                  guint        texture_height,
+                                  gboolean     upload,
+                                  gboolean     keep_pixels,
+                                  gboolean     indexed,
+                                  gboolean     mipmap,
+                                  gboolean     progressive,
+                                  GError     **error)
+{
+  ClutterMD2DataSkinEntry *entry = NULL;
+  struct stat buf;
+  gboolean found;
+  gchar *path, *key = NULL;
+
+  if (clutter_md2_skin_cache == NULL)
+    clutter_md2_skin_cache = g_hash_table_new (g_str_hash, g_str_equal);
+
+  path = clutter_md2_skin_resolve_path (filename);
+
+  /* If the file can't be found then the skin isn't cached and the
+     decoder will report the error */
+  if ((found = g_stat (path, &buf) == 0))
+    key = clutter_md2_skin_get_key (path, &buf,
+                                    texture_width, texture_height,
+                                    indexed, mipmap);
+
+  if (key && (entry = g_hash_table_lookup (clutter_md2_skin_cache, key)))
+    {
+      clutter_md2_skin_cache_hits++;
+      entry->ref_count++;
+      g_free (key);
+      g_free (path);
+    }
+  else
+    {
+      entry = g_slice_new0 (ClutterMD2DataSkinEntry);
+      entry->key = key;
+      entry->ref_count = 1;
+      entry->texture_width = texture_width;
+      entry->texture_height = texture_height;
+      entry->mipmap = mipmap;
+      entry->path = path;
+
+      if (key)
+        g_hash_table_insert (clutter_md2_skin_cache, key, entry);
+    }
+
+  /* The entry may have been created by a model that didn't need the
+     texture or the pixels so it might need decoding again. The image
+     is decoded now even though the upload waits until it is drawn so
+     that errors are reported here, unless it is progressive in which
+     case they are only reported with a warning */
+  if ((upload && entry->texture == 0
+       && entry->pixbuf == NULL && entry->indices == NULL)
+      || (keep_pixels && !clutter_md2_skin_has_padded_pixels (entry)))
+    {
+      gboolean background
+        = (progressive
+           && (entry->loading
+               || (found && clutter_md2_skin_start_loading (entry, &buf))));
+
+      if (!background
+          && !clutter_md2_skin_decode_entry (entry, filename,
+                                             found ? &buf : NULL,
+                                             indexed, keep_pixels, error))
+        {
+          _clutter_md2_data_release_skin_entry (entry, FALSE);
+          return NULL;
+        }
+    }
+
+  if (upload)
+    entry->n_texture_users++;
+
+  return entry;
+}
+
+void
+_clutter_md2_data_wait_for_skin_entry (ClutterMD2DataSkinEntry *entry,
+                                       ClutterMD2Data          *data,
+                                       gint                     skin_num)
+{
+  ClutterMD2SkinWaiter *waiter;
+
+  g_return_if_fail (entry->loading);
+
+  waiter = g_slice_new (ClutterMD2SkinWaiter);
+  waiter->data = g_object_ref (data);
+  waiter->generation = data->priv->skin_generation;
+  waiter->skin_num = skin_num;
+
+  entry->waiters = g_slist_prepend (entry->waiters, waiter);
+}
+
+static void
+clutter_md2_skin_evict (ClutterMD2DataSkinEntry *entry)
+{
+  g_queue_delete_link (&clutter_md2_skin_resident, entry->resident_link);
+  entry->resident_link = NULL;
+
+  clutter_md2_skin_resident_bytes -= entry->texture_bytes;
+
+  glDeleteTextures (1, &entry->texture);
+  entry->texture = 0;
+}
+
+/* Evicts the least recently used textures until no more than limit
+   bytes are resident */
+static void
+clutter_md2_skin_evict_to (gsize limit)
+{
+  while (clutter_md2_skin_resident_bytes > limit
+         && clutter_md2_skin_resident.head)
+    {
+      clutter_md2_skin_evict (clutter_md2_skin_resident.head->data);
+      clutter_md2_skin_n_evictions++;
+    }
+}
+
+/* The preview and the placeholder are small so they aren't counted
+   against the budget */
+static GLuint
+clutter_md2_skin_use_preview (ClutterMD2DataSkinEntry *entry)
+{
+  if (entry->preview)
+    {
+      if (entry->preview_texture == 0)
+        entry->preview_texture
+          = clutter_md2_skin_upload (entry->preview,
+                                     gdk_pixbuf_get_width (entry->preview),
+                                     gdk_pixbuf_get_height (entry->preview),
+                                     NULL);
+
+      return entry->preview_texture;
+    }
+
+  if (clutter_md2_skin_placeholder == 0)
+    {
+      GdkPixbuf *pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, 1, 1);
+
+      gdk_pixbuf_fill (pixbuf, 0x808080ff);
+      clutter_md2_skin_placeholder = clutter_md2_skin_upload (pixbuf, 1, 1,
+                                                              NULL);
+      g_object_unref (pixbuf);
+    }
+
+  return clutter_md2_skin_placeholder;
+}
+
+GLuint
+_clutter_md2_data_use_skin_entry (ClutterMD2DataSkinEntry *entry)
+{
+  gsize budget = clutter_md2_skin_texture_budget;
+
+  if (entry->texture)
+    {
+      /* Move it to the most recently used end */
+      g_queue_unlink (&clutter_md2_skin_resident, entry->resident_link);
+      g_queue_push_tail_link (&clutter_md2_skin_resident,
+                              entry->resident_link);
+
+      return entry->texture;
+    }
+
+  if (entry->reload_failed)
+    return 0;
+
+  if (entry->loading && entry->pixbuf == NULL && entry->indices == NULL)
+    return clutter_md2_skin_use_preview (entry);
+
+  if (entry->pixbuf == NULL && entry->indices == NULL)
+    {
+      gboolean was_indexed = entry->indexed;
+      GError *error = NULL;
+      struct stat buf;
+
+      /* The models have already set up a palette if the skin was
+         indexed so the image has to decode the same way again */
+      if (!clutter_md2_skin_decode_entry (entry, entry->path,
+                                          g_stat (entry->path, &buf) == 0
+                                          ? &buf : NULL,
+                                          was_indexed, FALSE, &error)
+          || entry->indexed != was_indexed)
+        {
+          g_warning ("Failed to reload the skin '%s': %s", entry->path,
+                     error ? error->message : "the image format changed");
+          if (error)
+            g_error_free (error);
+          entry->reload_failed = TRUE;
+
+          return 0;
+        }
+    }
+
+  /* The texture that is about to be drawn is always uploaded even if
+     it is bigger than the budget on its own */
+  if (budget > 0)
+    clutter_md2_skin_evict_to (budget > entry->texture_bytes
+                               ? budget - entry->texture_bytes : 0);
+
+  if (entry->indices)
+    entry->texture = clutter_md2_skin_upload_indices (entry->indices,
+                                                      entry->texture_width,
+                                                      entry->texture_height);
+  else
+    entry->texture = clutter_md2_skin_upload (entry->pixbuf,
+                                              entry->texture_width,
+                                              entry->texture_height,
+                                              entry->mipmaps);
+
+  g_queue_push_tail (&clutter_md2_skin_resident, entry);
+  entry->resident_link = clutter_md2_skin_resident.tail;
+  clutter_md2_skin_resident_bytes += entry->texture_bytes;
+  clutter_md2_skin_n_uploads++;
+
+  /* The skins that keep the pixels have their own references */
+  if (entry->pixbuf)
+    {
+      g_object_unref (entry->pixbuf);
+      entry->pixbuf = NULL;
+    }
+  if (entry->indices)
+    {
+      g_byte_array_unref (entry->indices);
+      entry->indices = NULL;
+    }
+  if (entry->mipmaps)
+    {
+      _clutter_md2_data_mipmaps_unref (entry->mipmaps);
+      entry->mipmaps = NULL;
+    }
+
+  return entry->texture;
+}
+
+void
+_clutter_md2_data_release_skin_entry (ClutterMD2DataSkinEntry *entry,
+                                      gboolean                 used_texture)
+{
+  if (used_texture)
+    entry->n_texture_users--;
+
+  if (--entry->ref_count > 0)
+    return;
+
+  if (entry->key)
+    {
+      g_hash_table_remove (clutter_md2_skin_cache, entry->key);
+      g_free (entry->key);
+    }
+
+  if (entry->texture)
+    clutter_md2_skin_evict (entry);
+  if (entry->pixbuf)
+    g_object_unref (entry->pixbuf);
+  if (entry->indices)
+    g_byte_array_unref (entry->indices);
+  if (entry->mipmaps)
+    _clutter_md2_data_mipmaps_unref (entry->mipmaps);
+  g_free (entry->path);
+
+  g_slice_free (ClutterMD2DataSkinEntry, entry);
+}
+
+gboolean
+_clutter_md2_data_get_skin_image (const ClutterMD2DataSkin *skin,
+                                  ClutterMD2DataSkinImage  *image)
+{
+  if (skin->indices)
+    {
+      image->texels = skin->indices->data;
+      image->width = skin->entry->texture_width;
+      image->height = skin->entry->texture_height;
+      image->rowstride = image->width;
+      image->n_channels = 1;
+      image->palette = skin->palette;
+    }
+  else if (skin->pixbuf)
+    {
+      image->texels = gdk_pixbuf_get_pixels (skin->pixbuf);
+      image->width = gdk_pixbuf_get_width (skin->pixbuf);
+      image->height = gdk_pixbuf_get_height (skin->pixbuf);
+      image->rowstride = gdk_pixbuf_get_rowstride (skin->pixbuf);
+      image->n_channels = gdk_pixbuf_get_n_channels (skin->pixbuf);
+      image->palette = NULL;
+    }
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+gboolean
+_clutter_md2_data_indexed_skins_supported (void)
+{
+  ClutterMD2SkinPaletteProgram *prog = &clutter_md2_skin_palette_program;
+  const gchar *extensions;
+  GLint old_program;
+
+  if (prog->initialized)
+    return prog->program != 0;
+
+  prog->initialized = TRUE;
+
+  extensions = (const gchar *) glGetString (GL_EXTENSIONS);
+
+  if (extensions == NULL
+      || !cogl_check_extension ("GL_ARB_fragment_program", extensions))
+    return FALSE;
+
+  prog->gen_programs = (ClutterMD2GenProgramsFunc)
+    cogl_get_proc_address ("glGenProgramsARB");
+  prog->bind_program = (ClutterMD2BindProgramFunc)
+    cogl_get_proc_address ("glBindProgramARB");
+  prog->program_string = (ClutterMD2ProgramStringFunc)
+    cogl_get_proc_address ("glProgramStringARB");
+  prog->program_local_parameter_4f = (ClutterMD2ProgramLocalParameterFunc)
+    cogl_get_proc_address ("glProgramLocalParameter4fARB");
+  prog->get_program_iv = (ClutterMD2GetProgramivFunc)
+    cogl_get_proc_address ("glGetProgramivARB");
+  if ((prog->active_texture = (ClutterMD2ActiveTextureFunc)
+       cogl_get_proc_address ("glActiveTexture")) == NULL)
+    prog->active_texture = (ClutterMD2ActiveTextureFunc)
+      cogl_get_proc_address ("glActiveTextureARB");
+
+  if (prog->gen_programs == NULL
+      || prog->bind_program == NULL
+      || prog->program_string == NULL
+      || prog->program_local_parameter_4f == NULL
+      || prog->get_program_iv == NULL
+      || prog->active_texture == NULL)
+    return FALSE;
+
+  prog->get_program_iv (GL_FRAGMENT_PROGRAM_ARB, GL_PROGRAM_BINDING_ARB,
+                        &old_program);
+
+  /* Clear any earlier errors so that a failure to compile the program
+     can be noticed */
+  while (glGetError () != GL_NO_ERROR);
+
+  prog->gen_programs (1, &prog->program);
+  prog->bind_program (GL_FRAGMENT_PROGRAM_ARB, prog->program);
+  prog->program_string (GL_FRAGMENT_PROGRAM_ARB, GL_PROGRAM_FORMAT_ASCII_ARB,
+                        sizeof (clutter_md2_skin_palette_source) - 1,
+                        clutter_md2_skin_palette_source);
+
+  if (glGetError () != GL_NO_ERROR)
+    {
+      g_warning ("The palette lookup program for indexed skins failed "
+                 "to compile");
+      prog->program = 0;
+    }
+
+  prog->bind_program (GL_FRAGMENT_PROGRAM_ARB, old_program);
+
+  return prog->program != 0;
+}
+
+GLuint
+_clutter_md2_data_upload_palette (const guchar *palette,
+                                  GLuint        texture)
+{
+#ifdef GL_UNPACK_ROW_LENGTH
+  glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
+#endif
+  glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+
+  if (texture)
+    {
+      glBindTexture (GL_TEXTURE_2D, texture);
+      glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, 256, 1,
+                       GL_RGB, GL_UNSIGNED_BYTE, palette);
+    }
+  else
+    {
+      glGenTextures (1, &texture);
+      glBindTexture (GL_TEXTURE_2D, texture);
+
+      glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameterf (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+      glTexImage2D (GL_TEXTURE_2D, 0, GL_RGB, 256, 1, 0,
+                    GL_RGB, GL_UNSIGNED_BYTE, palette);
+    }
+
+  return texture;
+}
+
+void
+_clutter_md2_data_begin_palette (void)
+{
+  ClutterMD2SkinPaletteProgram *prog = &clutter_md2_skin_palette_program;
+
+  /* Nothing needs saving if no indexed skins have been uploaded */
+  if (prog->program == 0)
+    return;
+
+  prog->saved = TRUE;
+  prog->saved_enabled = glIsEnabled (GL_FRAGMENT_PROGRAM_ARB);
+  prog->get_program_iv (GL_FRAGMENT_PROGRAM_ARB, GL_PROGRAM_BINDING_ARB,
+                        &prog->saved_program);
+  prog->active_texture (GL_TEXTURE1);
+  glGetIntegerv (GL_TEXTURE_BINDING_2D, &prog->saved_texture);
+  prog->active_texture (GL_TEXTURE0);
+
+  /* Cogl may have left its own program enabled */
+  glDisable (GL_FRAGMENT_PROGRAM_ARB);
+  prog->enabled = FALSE;
+}
+
+void
+_clutter_md2_data_bind_palette (const ClutterMD2DataSkin *skin)
+{
+  ClutterMD2SkinPaletteProgram *prog = &clutter_md2_skin_palette_program;
+  float width, height;
+
+  if (skin->palette_texture == 0)
+    {
+      if (prog->enabled)
+        {
+          glDisable (GL_FRAGMENT_PROGRAM_ARB);
+          prog->enabled = FALSE;
+        }
+
+      return;
+    }
+
+  g_return_if_fail (prog->saved);
+
+  if (!prog->enabled)
+    {
+      glEnable (GL_FRAGMENT_PROGRAM_ARB);
+      prog->bind_program (GL_FRAGMENT_PROGRAM_ARB, prog->program);
+      prog->enabled = TRUE;
+    }
+
+  prog->active_texture (GL_TEXTURE1);
+  glBindTexture (GL_TEXTURE_2D, skin->palette_texture);
+  prog->active_texture (GL_TEXTURE0);
+
+  width = skin->entry->texture_width;
+  height = skin->entry->texture_height;
+  prog->program_local_parameter_4f (GL_FRAGMENT_PROGRAM_ARB, 0,
+                                    width, height,
+                                    1.0f / width, 1.0f / height);
+}
+
+void
+_clutter_md2_data_end_palette (void)
+{
+  ClutterMD2SkinPaletteProgram *prog = &clutter_md2_skin_palette_program;
+
+  if (!prog->saved)
+    return;
+
+  prog->bind_program (GL_FRAGMENT_PROGRAM_ARB, prog->saved_program);
+  prog->active_texture (GL_TEXTURE1);
+  glBindTexture (GL_TEXTURE_2D, prog->saved_texture);
+  prog->active_texture (GL_TEXTURE0);
+
+  if (prog->saved_enabled)
+    glEnable (GL_FRAGMENT_PROGRAM_ARB);
+  else
+    glDisable (GL_FRAGMENT_PROGRAM_ARB);
+
+  prog->saved = FALSE;
+  prog->enabled = FALSE;
+}
+
+/* Gets the number of skin textures that are resident, the number of
+   times a skin was found in the cache instead of being loaded and the
+   bytes of texture memory that duplicate textures would use if the
+   skins weren't shared. Any of the pointers can be NULL */
+void
+clutter_md2_data_get_skin_cache_stats (guint *n_textures,
+                                       guint *n_hits,
+                                       gsize *bytes_saved)
+{
+  GHashTableIter iter;
+  gpointer value;
+  guint textures = 0;
+  gsize saved = 0;
+
+  if (clutter_md2_skin_cache)
+    {
+      g_hash_table_iter_init (&iter, clutter_md2_skin_cache);
+
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          ClutterMD2DataSkinEntry *entry = value;
+
+          if (entry->texture)
+            textures++;
+
+          if (entry->n_texture_users > 1)
+            saved += (entry->n_texture_users - 1) * entry->texture_bytes;
+        }
+    }
+
+  if (n_textures)
+    *n_textures = textures;
+  if (n_hits)
+    *n_hits = clutter_md2_skin_cache_hits;
+  if (bytes_saved)
+    *bytes_saved = saved;
+}
+
+/* Sets a limit on the texture memory used by the skins of every
+   model. Skins are uploaded when they are first drawn and when a new
+   one would go over the limit the skins that were drawn least
+   recently are deleted. They are decoded and uploaded again if they
+   are drawn later, which is quick if a skin cache directory is set. A
+   skin that is being drawn is never deleted so the limit may be
+   exceeded by one skin. The default is 0 which means no limit */
+void
+clutter_md2_data_set_skin_texture_budget (gsize bytes)
+{
+  clutter_md2_skin_texture_budget = bytes;
+
+  if (bytes > 0)
+    clutter_md2_skin_evict_to (bytes);
+}
+
+gsize
+clutter_md2_data_get_skin_texture_budget (void)
+{
+  return clutter_md2_skin_texture_budget;
+}
+
+/* Gets the bytes of texture memory used by the skins that are
+   uploaded, the number of uploads and the number of textures that
+   were deleted to stay within the budget. Any of the pointers can be
+   NULL */
+void
+clutter_md2_data_get_skin_residency_stats (gsize *resident_bytes,
+                                           guint *n_uploads,
+                                           guint *n_evictions)
+{
+  if (resident_bytes)
+    *resident_bytes = clutter_md2_skin_resident_bytes;
+  if (n_uploads)
+    *n_uploads = clutter_md2_skin_n_uploads;
+  if (n_evictions)
+    *n_evictions = clutter_md2_skin_n_evictions;
+}
+
+/* Sets a directory where skins are stored after they are decoded so
+   that later runs can map them straight into GL without decoding the
+   images again. The directory is created when the first skin is
+   written. By default skins aren't stored */
+void
+clutter_md2_data_set_skin_cache_dir (const gchar *dir)
+{
+  g_free (clutter_md2_skin_cache_dir);
+  clutter_md2_skin_cache_dir = g_strdup (dir);
+}
+
+const gchar *
+clutter_md2_data_get_skin_cache_dir (void)
+{
+  return clutter_md2_skin_cache_dir;
+}
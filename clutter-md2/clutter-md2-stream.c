@@ -0,0 +1,340 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib-object.h>
+#include <clutter/clutter.h>
+#include <string.h>
+
+#include "clutter-md2-data.h"
+#include "clutter-md2-data-private.h"
+#include "clutter-md2-norms.h"
+
+/* When a frame budget is set only the headers of the frames are kept
+   after loading. The file stays mapped and the vertices of a frame
+   are copied out of the mapping the first time they are needed. The
+   frames that are paged in are kept in a queue with the most recently
+   used at the head and the least recently used frames are freed
+   whenever the total would go over the budget.
+
+   Whenever a frame is used the next few frames of the same animation
+   sequence are copied in a background thread so that an animation
+   playing forwards will usually find its frames already paged in. The
+   copy is handed back to the main thread from an idle handler */
+
+/* Number of frames to read ahead within a sequence */
+#define CLUTTER_MD2_STREAM_PREFETCH_FRAMES 4
+
+typedef struct _ClutterMD2StreamJob ClutterMD2StreamJob;
+
+struct _ClutterMD2StreamJob
+{
+  ClutterMD2Data *data;
+  GMappedFile *file;
+  guint generation;
+  int frame_num;
+  gsize offset, size;
+
+  guchar *vertices;
+};
+
+static GThreadPool *clutter_md2_stream_pool = NULL;
+
+static void
+clutter_md2_stream_install (ClutterMD2Data *data,
+                            gint frame_num,
+                            guchar *vertices)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  ClutterMD2DataFrame *frame = priv->frames[frame_num];
+  gsize size = priv->num_vertices * 4;
+
+  /* Free the least recently used frames to make room. The most recent
+     few are always kept because the caller may still be holding
+     pointers to them */
+  while (priv->resident_bytes + size > priv->frame_budget
+         && g_queue_get_length (&priv->resident_frames)
+         >= CLUTTER_MD2_DATA_FRAME_SLOTS)
+    {
+      GList *link = g_queue_pop_tail_link (&priv->resident_frames);
+      ClutterMD2DataFrame *old_frame
+        = priv->frames[GPOINTER_TO_INT (link->data)];
+
+      g_free (old_frame->vertices);
+      old_frame->vertices = NULL;
+      old_frame->lru_link = NULL;
+      g_list_free_1 (link);
+
+      priv->resident_bytes -= size;
+    }
+
+  frame->vertices = vertices;
+  g_queue_push_head (&priv->resident_frames, GINT_TO_POINTER (frame_num));
+  frame->lru_link = priv->resident_frames.head;
+
+  priv->resident_bytes += size;
+}
+
+/* Copies the vertices of a frame out of the mapping. The normal
+   indices were checked when the file was loaded but the file may have
+   been changed underneath the mapping since then so any that are out
+   of range are clamped */
+static guchar *
+clutter_md2_stream_copy_vertices (GMappedFile *file,
+                                  gsize        offset,
+                                  gsize        size)
+{
+  guchar *vertices = g_malloc (size);
+  guchar *p;
+
+  memcpy (vertices, g_mapped_file_get_contents (file) + offset, size);
+
+  for (p = vertices + size; p > vertices;)
+    {
+      p -= 4;
+
+      if (p[3] >= CLUTTER_MD2_NORMS_COUNT)
+        p[3] = 0;
+    }
+
+  return vertices;
+}
+
+static gboolean
+clutter_md2_stream_idle_cb (gpointer user_data)
+{
+  ClutterMD2StreamJob *job = user_data;
+  ClutterMD2DataPrivate *priv = job->data->priv;
+
+  /* The model may have been reloaded while the job was running */
+  if (job->generation == priv->stream_generation)
+    {
+      ClutterMD2DataFrame *frame = priv->frames[job->frame_num];
+
+      frame->prefetching = FALSE;
+
+      /* If the frame was needed before the copy finished it will
+         already have been paged in */
+      if (frame->vertices == NULL)
+        {
+          clutter_md2_stream_install (job->data, job->frame_num,
+                                      job->vertices);
+          job->vertices = NULL;
+          priv->n_prefetched++;
+        }
+    }
+
+  g_free (job->vertices);
+  g_mapped_file_unref (job->file);
+  g_object_unref (job->data);
+  g_slice_free (ClutterMD2StreamJob, job);
+
+  return FALSE;
+}
+
+static void
+clutter_md2_stream_thread_cb (gpointer job_data, gpointer user_data)
+{
+  ClutterMD2StreamJob *job = job_data;
+
+  /* Copying touches the pages of the mapping so any disk access
+     happens here instead of in the main thread */
+  job->vertices = clutter_md2_stream_copy_vertices (job->file,
+                                                    job->offset,
+                                                    job->size);
+
+  clutter_threads_add_idle (clutter_md2_stream_idle_cb, job);
+}
+
+static void
+clutter_md2_stream_prefetch (ClutterMD2Data *data, gint frame_num)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  gint frame_start, frame_end;
+  int i;
+
+  if (!g_thread_supported ())
+    return;
+
+  /* Frames that aren't part of a sequence aren't read ahead */
+  if (!_clutter_md2_data_get_frame_sequence (data, frame_num,
+                                             &frame_start, &frame_end))
+    return;
+
+  for (i = 1; i <= CLUTTER_MD2_STREAM_PREFETCH_FRAMES; i++)
+    {
+      ClutterMD2StreamJob *job;
+      ClutterMD2DataFrame *frame;
+      int next = frame_num + i;
+
+      /* Sequences usually loop so wrap around to the start */
+      if (next > frame_end)
+        next = frame_start + (next - frame_end - 1) % (frame_end
+                                                      - frame_start + 1);
+      if (next == frame_num)
+        break;
+
+      frame = priv->frames[next];
+
+      if (frame->vertices || frame->prefetching)
+        continue;
+
+      job = g_slice_new (ClutterMD2StreamJob);
+      job->data = g_object_ref (data);
+      job->file = g_mapped_file_ref (priv->frame_file);
+      job->generation = priv->stream_generation;
+      job->frame_num = next;
+      job->offset = frame->offset;
+      job->size = priv->num_vertices * 4;
+      job->vertices = NULL;
+
+      frame->prefetching = TRUE;
+
+      if (clutter_md2_stream_pool == NULL)
+        clutter_md2_stream_pool
+          = g_thread_pool_new (clutter_md2_stream_thread_cb, NULL,
+                               1, FALSE, NULL);
+
+      g_thread_pool_push (clutter_md2_stream_pool, job, NULL);
+    }
+}
+
+gboolean
+_clutter_md2_data_open_stream (ClutterMD2Data *data,
+                               const gchar    *filename,
+                               const gchar    *display_name,
+                               GError        **error)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  GMappedFile *file;
+  gsize length;
+  int i;
+
+  if ((file = g_mapped_file_new (filename, FALSE, error)) == NULL)
+    return FALSE;
+
+  /* Make sure the file hasn't been truncated since it was read */
+  length = g_mapped_file_get_length (file);
+
+  for (i = 0; i < priv->num_frames; i++)
+    if (priv->frames[i]->offset + priv->num_vertices * 4 > length)
+      {
+        g_set_error (error,
+                     CLUTTER_MD2_DATA_ERROR,
+                     CLUTTER_MD2_DATA_ERROR_INVALID_FILE,
+                     "'%s' changed while it was being loaded",
+                     display_name);
+        g_mapped_file_unref (file);
+
+        return FALSE;
+      }
+
+  priv->frame_file = file;
+
+  return TRUE;
+}
+
+void
+_clutter_md2_data_close_stream (ClutterMD2Data *data)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  GList *l;
+
+  /* Any jobs still running will be ignored when they finish */
+  priv->stream_generation++;
+
+  for (l = priv->resident_frames.head; l; l = l->next)
+    {
+      ClutterMD2DataFrame *frame = priv->frames[GPOINTER_TO_INT (l->data)];
+
+      g_free (frame->vertices);
+      frame->vertices = NULL;
+      frame->lru_link = NULL;
+    }
+
+  g_queue_clear (&priv->resident_frames);
+  priv->resident_bytes = 0;
+
+  if (priv->frame_file)
+    {
+      g_mapped_file_unref (priv->frame_file);
+      priv->frame_file = NULL;
+    }
+}
+
+const guchar *
+_clutter_md2_data_stream_frame (ClutterMD2Data *data,
+                                gint            frame_num)
+{
+  ClutterMD2DataPrivate *priv = data->priv;
+  ClutterMD2DataFrame *frame = priv->frames[frame_num];
+
+  if (frame->vertices == NULL)
+    {
+      guchar *vertices
+        = clutter_md2_stream_copy_vertices (priv->frame_file,
+                                            frame->offset,
+                                            priv->num_vertices * 4);
+
+      clutter_md2_stream_install (data, frame_num, vertices);
+
+      priv->n_page_ins++;
+    }
+  else if (frame->lru_link != priv->resident_frames.head)
+    {
+      g_queue_unlink (&priv->resident_frames, frame->lru_link);
+      g_queue_push_head_link (&priv->resident_frames, frame->lru_link);
+    }
+
+  clutter_md2_stream_prefetch (data, frame_num);
+
+  return frame->vertices;
+}
+
+/* Gets the bytes of frame vertices that are paged in, the number of
+   times a frame had to be read while it was needed and the number of
+   frames that were read ahead in the background when the model was
+   loaded with a frame budget. The counts are reset when a model is
+   loaded. Any of the pointers can be NULL */
+void
+clutter_md2_data_get_stream_stats (ClutterMD2Data *data,
+                                   gsize          *resident_bytes,
+                                   guint          *n_page_ins,
+                                   guint          *n_prefetched)
+{
+  ClutterMD2DataPrivate *priv;
+
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+
+  priv = data->priv;
+
+  if (resident_bytes)
+    *resident_bytes = priv->resident_bytes;
+  if (n_page_ins)
+    *n_page_ins = priv->n_page_ins;
+  if (n_prefetched)
+    *n_prefetched = priv->n_prefetched;
+}
@@ -31,18 +31,27 @@
 #include <glib-object.h>
 #include <clutter/clutter.h>
 #include <string.h>
+#include <math.h>
 
 #include "clutter-md2.h"
 #include "clutter-md2-data.h"
+#include "clutter-md2-data-private.h"
+#include "clutter-md2-private.h"
 
 #define CLUTTER_MD2_GET_PRIVATE(obj) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((obj), CLUTTER_TYPE_MD2, ClutterMD2Private))
 
 #define CLUTTER_MD2_PREFERRED_SIZE 100
 
+/* The offscreen cache won't be used if the texture would be bigger
+   than this */
+#define CLUTTER_MD2_MAX_CACHE_SIZE 2048
+
 G_DEFINE_TYPE (ClutterMD2, clutter_md2, CLUTTER_TYPE_ACTOR);
 
 static void clutter_md2_paint (ClutterActor *self);
+static void clutter_md2_pick (ClutterActor       *self,
+                              const ClutterColor *color);
 static void clutter_md2_dispose (GObject *self);
 static void clutter_md2_get_preferred_width (ClutterActor *self,
                                              gfloat        for_height,
@@ -67,9 +76,63 @@ struct _ClutterMD2Private
   float current_frame_interval;
   int current_skin;
 
+  /* The full model is replaced with an impostor when its on-screen
+     size is smaller than this */
+  float impostor_threshold;
+
+  /* Below lod_full_size pixels the interpolation between frames is
+     quantized into fewer steps and below lod_snap_size the nearest
+     whole frame is drawn. The size is taken from the last paint */
+  float lod_full_size, lod_snap_size;
+  float screen_size;
+  guint lod_skipped_updates, lod_static_paints;
+
+  /* When the sub-frame jumps to a pose that doesn't follow on from
+     the current one, the old pose is blended into the new one over
+     transition_duration milliseconds */
+  guint transition_duration;
+  gboolean in_transition;
+  int transition_frame_a, transition_frame_b;
+  float transition_interval;
+  GTimer *transition_timer;
+  guint transition_redraw_id;
+
+  /* If cache_result is set then the model is rendered into
+     cache_texture and only redrawn when one of the values it was
+     rendered with changes */
+  guint cache_result : 1;
+  guint cache_valid  : 1;
+  CoglHandle cache_texture;
+  CoglHandle cache_offscreen;
+  CoglHandle cache_material;
+  int cache_frame_a, cache_frame_b;
+  float cache_interval;
+  int cache_skin;
+  guint cache_width, cache_height;
+  float cache_x_angle, cache_y_angle;
+  guint cache_hits, cache_misses;
+
+  /* The value of clutter_md2_frame_counter when a redraw was last
+     queued because the frame changed. Animating the actor several
+     times in the same frame then only queues one redraw */
+  guint redraw_frame;
+
+  /* Set when an animation driver skipped the actor while it wasn't
+     going to be painted */
+  ClutterMD2CatchUpFunc catch_up_func;
+  gpointer catch_up_data;
+  /* Set while the catch up function runs from the paint. The actor is
+     already being painted so the new frame doesn't need a redraw */
+  gboolean in_catch_up;
+
   guint data_changed_handler;
+  guint skin_changed_handler;
 
   ClutterMD2Data *data;
+
+  /* Extra models such as a weapon that are drawn with the same frames
+     and placement as the main model */
+  GSList *attachments;
 };
 
 enum
@@ -80,9 +143,44 @@ enum
 
     PROP_CURRENT_SKIN,
     PROP_CURRENT_FRAME,
-    PROP_SUB_FRAME
+    PROP_SUB_FRAME,
+
+    PROP_IMPOSTOR_THRESHOLD,
+
+    PROP_LOD_FULL_SIZE,
+    PROP_LOD_SNAP_SIZE,
+    PROP_LOD_SKIPPED_UPDATES,
+    PROP_LOD_STATIC_PAINTS,
+
+    PROP_TRANSITION_DURATION,
+
+    PROP_CACHE_RESULT,
+    PROP_CACHE_HITS,
+    PROP_CACHE_MISSES,
+
+    PROP_LAST
   };
 
+/* The param specs are kept so that notifications don't have to look
+   up the property by name */
+static GParamSpec *clutter_md2_properties[PROP_LAST];
+
+/* Number of steps that the interval is quantized to just below the
+   full size */
+#define CLUTTER_MD2_LOD_MAX_STEPS 8
+
+/* Incremented by a repaint function before each frame is drawn */
+static guint clutter_md2_frame_counter = 1;
+
+static gboolean
+clutter_md2_count_frame (gpointer user_data)
+{
+  clutter_md2_frame_counter++;
+
+  /* Keep the repaint function installed */
+  return TRUE;
+}
+
 static void
 clutter_md2_class_init (ClutterMD2Class *klass)
 {
@@ -91,6 +189,7 @@ clutter_md2_class_init (ClutterMD2Class *klass)
   GParamSpec *pspec;
 
   actor_class->paint = clutter_md2_paint;
+  actor_class->pick = clutter_md2_pick;
   actor_class->get_preferred_width = clutter_md2_get_preferred_width;
   actor_class->get_preferred_height = clutter_md2_get_preferred_height;
 
@@ -105,12 +204,14 @@ clutter_md2_class_init (ClutterMD2Class *klass)
                                "will be renderered",
                                CLUTTER_TYPE_MD2_DATA,
                                G_PARAM_READWRITE);
+  clutter_md2_properties[PROP_DATA] = pspec;
   g_object_class_install_property (object_class, PROP_DATA, pspec);
 
   pspec = g_param_spec_int ("current_frame", "Current frame",
                             "The frame number that will be rendered",
                             0, G_MAXINT, 0,
                             G_PARAM_READWRITE);
+  clutter_md2_properties[PROP_CURRENT_FRAME] = pspec;
   g_object_class_install_property (object_class, PROP_CURRENT_FRAME, pspec);
 
   pspec = g_param_spec_float ("sub_frame", "Interpolated frame number",
@@ -119,13 +220,96 @@ clutter_md2_class_init (ClutterMD2Class *klass)
                               "that will be rendered",
                               0.0f, G_MAXFLOAT, 0.0f,
                               G_PARAM_READWRITE);
+  clutter_md2_properties[PROP_SUB_FRAME] = pspec;
   g_object_class_install_property (object_class, PROP_SUB_FRAME, pspec);
 
   pspec = g_param_spec_int ("current_skin", "Current skin",
                             "The skin number that will be rendered",
                             0, G_MAXINT, 0,
                             G_PARAM_READWRITE);
+  clutter_md2_properties[PROP_CURRENT_SKIN] = pspec;
   g_object_class_install_property (object_class, PROP_CURRENT_SKIN, pspec);
+
+  pspec = g_param_spec_float ("impostor_threshold", "Impostor threshold",
+                              "The on-screen size in pixels below which "
+                              "the model is drawn from the data's impostor "
+                              "atlas instead, or 0 to always draw the "
+                              "full model",
+                              0.0f, G_MAXFLOAT, 0.0f,
+                              G_PARAM_READWRITE);
+  clutter_md2_properties[PROP_IMPOSTOR_THRESHOLD] = pspec;
+  g_object_class_install_property (object_class, PROP_IMPOSTOR_THRESHOLD,
+                                   pspec);
+
+  pspec = g_param_spec_float ("lod_full_size", "LOD full size",
+                              "The on-screen size in pixels below which "
+                              "the interpolation between frames is "
+                              "updated less often, or 0 to always "
+                              "interpolate fully",
+                              0.0f, G_MAXFLOAT, 0.0f,
+                              G_PARAM_READWRITE);
+  clutter_md2_properties[PROP_LOD_FULL_SIZE] = pspec;
+  g_object_class_install_property (object_class, PROP_LOD_FULL_SIZE, pspec);
+
+  pspec = g_param_spec_float ("lod_snap_size", "LOD snap size",
+                              "The on-screen size in pixels below which "
+                              "the nearest whole frame is drawn instead "
+                              "of interpolating",
+                              0.0f, G_MAXFLOAT, 0.0f,
+                              G_PARAM_READWRITE);
+  clutter_md2_properties[PROP_LOD_SNAP_SIZE] = pspec;
+  g_object_class_install_property (object_class, PROP_LOD_SNAP_SIZE, pspec);
+
+  pspec = g_param_spec_uint ("lod_skipped_updates", "LOD skipped updates",
+                             "The number of frame changes that didn't "
+                             "need a redraw because the actor is small",
+                             0, G_MAXUINT, 0, G_PARAM_READABLE);
+  clutter_md2_properties[PROP_LOD_SKIPPED_UPDATES] = pspec;
+  g_object_class_install_property (object_class, PROP_LOD_SKIPPED_UPDATES,
+                                   pspec);
+
+  pspec = g_param_spec_uint ("lod_static_paints", "LOD static paints",
+                             "The number of paints that drew a whole "
+                             "frame instead of interpolating because the "
+                             "actor is small",
+                             0, G_MAXUINT, 0, G_PARAM_READABLE);
+  clutter_md2_properties[PROP_LOD_STATIC_PAINTS] = pspec;
+  g_object_class_install_property (object_class, PROP_LOD_STATIC_PAINTS,
+                                   pspec);
+
+  pspec = g_param_spec_uint ("transition_duration", "Transition duration",
+                             "The time in milliseconds to blend from the "
+                             "old pose when the frame jumps to an "
+                             "unrelated pose, or 0 to switch immediately",
+                             0, G_MAXUINT, 0, G_PARAM_READWRITE);
+  clutter_md2_properties[PROP_TRANSITION_DURATION] = pspec;
+  g_object_class_install_property (object_class, PROP_TRANSITION_DURATION,
+                                   pspec);
+
+  pspec = g_param_spec_boolean ("cache_result", "Cache result",
+                                "Whether to render the model into an "
+                                "offscreen texture and reuse it until the "
+                                "frame, skin, rotation or allocation "
+                                "changes",
+                                FALSE, G_PARAM_READWRITE);
+  clutter_md2_properties[PROP_CACHE_RESULT] = pspec;
+  g_object_class_install_property (object_class, PROP_CACHE_RESULT, pspec);
+
+  pspec = g_param_spec_uint ("cache_hits", "Cache hits",
+                             "The number of paints that reused the "
+                             "offscreen texture",
+                             0, G_MAXUINT, 0, G_PARAM_READABLE);
+  clutter_md2_properties[PROP_CACHE_HITS] = pspec;
+  g_object_class_install_property (object_class, PROP_CACHE_HITS, pspec);
+
+  pspec = g_param_spec_uint ("cache_misses", "Cache misses",
+                             "The number of paints that had to render "
+                             "the model into the offscreen texture",
+                             0, G_MAXUINT, 0, G_PARAM_READABLE);
+  clutter_md2_properties[PROP_CACHE_MISSES] = pspec;
+  g_object_class_install_property (object_class, PROP_CACHE_MISSES, pspec);
+
+  clutter_threads_add_repaint_func (clutter_md2_count_frame, NULL, NULL);
 }
 
 static void
@@ -138,7 +322,29 @@ clutter_md2_init (ClutterMD2 *self)
   priv->current_frame_a = 0;
   priv->current_frame_b = 0;
   priv->current_skin = 0;
+  priv->impostor_threshold = 0.0f;
+  priv->lod_full_size = 0.0f;
+  priv->lod_snap_size = 0.0f;
+  priv->screen_size = G_MAXFLOAT;
+  priv->lod_skipped_updates = 0;
+  priv->lod_static_paints = 0;
+  priv->transition_duration = 0;
+  priv->in_transition = FALSE;
+  priv->transition_timer = NULL;
+  priv->transition_redraw_id = 0;
+  priv->cache_result = FALSE;
+  priv->cache_valid = FALSE;
+  priv->cache_texture = COGL_INVALID_HANDLE;
+  priv->cache_offscreen = COGL_INVALID_HANDLE;
+  priv->cache_material = COGL_INVALID_HANDLE;
+  priv->cache_hits = 0;
+  priv->cache_misses = 0;
+  priv->redraw_frame = 0;
+  priv->catch_up_func = NULL;
+  priv->catch_up_data = NULL;
+  priv->in_catch_up = FALSE;
   priv->data = NULL;
+  priv->attachments = NULL;
 }
 
 static void
@@ -176,6 +382,30 @@ clutter_md2_set_property (GObject      *self,
       }
       break;
 
+    case PROP_IMPOSTOR_THRESHOLD:
+      clutter_md2_set_impostor_threshold (md2, g_value_get_float (value));
+      break;
+
+    case PROP_LOD_FULL_SIZE:
+      clutter_md2_set_lod_sizes (md2,
+                                 g_value_get_float (value),
+                                 md2->priv->lod_snap_size);
+      break;
+
+    case PROP_LOD_SNAP_SIZE:
+      clutter_md2_set_lod_sizes (md2,
+                                 md2->priv->lod_full_size,
+                                 g_value_get_float (value));
+      break;
+
+    case PROP_TRANSITION_DURATION:
+      clutter_md2_set_transition_duration (md2, g_value_get_uint (value));
+      break;
+
+    case PROP_CACHE_RESULT:
+      clutter_md2_set_cache_result (md2, g_value_get_boolean (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (self, property_id, pspec);
       break;
@@ -218,6 +448,42 @@ clutter_md2_get_property (GObject    *self,
       }
       break;
 
+    case PROP_IMPOSTOR_THRESHOLD:
+      g_value_set_float (value, clutter_md2_get_impostor_threshold (md2));
+      break;
+
+    case PROP_LOD_FULL_SIZE:
+      g_value_set_float (value, md2->priv->lod_full_size);
+      break;
+
+    case PROP_LOD_SNAP_SIZE:
+      g_value_set_float (value, md2->priv->lod_snap_size);
+      break;
+
+    case PROP_LOD_SKIPPED_UPDATES:
+      g_value_set_uint (value, md2->priv->lod_skipped_updates);
+      break;
+
+    case PROP_LOD_STATIC_PAINTS:
+      g_value_set_uint (value, md2->priv->lod_static_paints);
+      break;
+
+    case PROP_TRANSITION_DURATION:
+      g_value_set_uint (value, clutter_md2_get_transition_duration (md2));
+      break;
+
+    case PROP_CACHE_RESULT:
+      g_value_set_boolean (value, clutter_md2_get_cache_result (md2));
+      break;
+
+    case PROP_CACHE_HITS:
+      g_value_set_uint (value, md2->priv->cache_hits);
+      break;
+
+    case PROP_CACHE_MISSES:
+      g_value_set_uint (value, md2->priv->cache_misses);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (self, property_id, pspec);
       break;
@@ -230,24 +496,454 @@ clutter_md2_new (void)
   return g_object_new (CLUTTER_TYPE_MD2, NULL);
 }
 
+static void
+clutter_md2_free_cache (ClutterMD2 *md2)
+{
+  ClutterMD2Private *priv = md2->priv;
+
+  if (priv->cache_material)
+    {
+      cogl_handle_unref (priv->cache_material);
+      priv->cache_material = COGL_INVALID_HANDLE;
+    }
+  if (priv->cache_offscreen)
+    {
+      cogl_handle_unref (priv->cache_offscreen);
+      priv->cache_offscreen = COGL_INVALID_HANDLE;
+    }
+  if (priv->cache_texture)
+    {
+      cogl_handle_unref (priv->cache_texture);
+      priv->cache_texture = COGL_INVALID_HANDLE;
+    }
+
+  priv->cache_valid = FALSE;
+}
+
+/* Draws the model and all of its attachments with the same frames in
+   a single batch so that the GL state is only set up once */
+static void
+clutter_md2_render (ClutterMD2            *md2,
+                    gint                   n_frames,
+                    const gint            *frame_nums,
+                    const gfloat          *weights,
+                    const ClutterGeometry *geom,
+                    const ClutterColor    *pick_color)
+{
+  ClutterMD2Private *priv = md2->priv;
+  GSList *l;
+
+  _clutter_md2_data_begin_batch (pick_color);
+
+  _clutter_md2_data_draw_batched (priv->data, n_frames, frame_nums, weights,
+                                  priv->current_skin, priv->data,
+                                  NULL, geom);
+
+  for (l = priv->attachments; l; l = l->next)
+    {
+      ClutterMD2Data *data = l->data;
+      gint skin_num = priv->current_skin;
+
+      /* Attachments usually only have one skin */
+      if (skin_num >= clutter_md2_data_get_n_skins (data))
+        skin_num = 0;
+
+      _clutter_md2_data_draw_batched (data, n_frames, frame_nums, weights,
+                                      skin_num, priv->data, NULL, geom);
+    }
+
+  _clutter_md2_data_end_batch ();
+}
+
+static void
+clutter_md2_render_sub_frame (ClutterMD2            *md2,
+                              gint                   frame_a,
+                              gint                   frame_b,
+                              gfloat                 interval,
+                              const ClutterGeometry *geom,
+                              const ClutterColor    *pick_color)
+{
+  gint frame_nums[2] = { frame_a, frame_b };
+  gfloat weights[2] = { 1.0f - interval, interval };
+
+  if (frame_a == frame_b)
+    weights[0] = 1.0f;
+
+  clutter_md2_render (md2, frame_a == frame_b ? 1 : 2, frame_nums, weights,
+                      geom, pick_color);
+}
+
+static gboolean
+clutter_md2_update_cache (ClutterMD2 *md2,
+                          const ClutterGeometry *geom,
+                          float x_angle, float y_angle,
+                          float *size)
+{
+  ClutterMD2Private *priv = md2->priv;
+  ClutterMD2DataExtents extents;
+  float scale, center[3], width, height, depth;
+  CoglColor transparent;
+  guint tex_size;
+
+  /* The texture needs to contain the model at any rotation so it is
+     sized to fit the bounding sphere of the model as it would be
+     drawn */
+  clutter_md2_data_get_extents (priv->data, &extents);
+  _clutter_md2_data_get_fit_transform (priv->data, geom, &scale, center);
+  width = (extents.right - extents.left) * scale;
+  height = (extents.bottom - extents.top) * scale;
+  depth = (extents.front - extents.back) * scale;
+  *size = sqrt (width * width + height * height + depth * depth);
+  tex_size = (guint) ceil (*size);
+
+  if (tex_size < 1 || tex_size > CLUTTER_MD2_MAX_CACHE_SIZE)
+    return FALSE;
+
+  if (priv->cache_valid
+      && priv->cache_frame_a == priv->current_frame_a
+      && priv->cache_frame_b == priv->current_frame_b
+      && priv->cache_interval == priv->current_frame_interval
+      && priv->cache_skin == priv->current_skin
+      && priv->cache_width == geom->width
+      && priv->cache_height == geom->height
+      && priv->cache_x_angle == x_angle
+      && priv->cache_y_angle == y_angle)
+    {
+      priv->cache_hits++;
+      return TRUE;
+    }
+
+  if (priv->cache_texture == COGL_INVALID_HANDLE
+      || cogl_texture_get_width (priv->cache_texture) != tex_size)
+    {
+      clutter_md2_free_cache (md2);
+
+      priv->cache_texture
+        = cogl_texture_new_with_size (tex_size, tex_size,
+                                      COGL_TEXTURE_NO_AUTO_MIPMAP,
+                                      COGL_PIXEL_FORMAT_RGBA_8888_PRE);
+      if (priv->cache_texture == COGL_INVALID_HANDLE)
+        return FALSE;
+
+      priv->cache_offscreen
+        = cogl_offscreen_new_to_texture (priv->cache_texture);
+      if (priv->cache_offscreen == COGL_INVALID_HANDLE)
+        {
+          clutter_md2_free_cache (md2);
+          return FALSE;
+        }
+
+      priv->cache_material = cogl_material_new ();
+      cogl_material_set_layer (priv->cache_material, 0, priv->cache_texture);
+    }
+
+  priv->cache_misses++;
+
+  /* Render the model with an orthographic projection, rotated in the
+     same way as the actor about the center of the model. The texture
+     is later drawn with the rotation undone */
+  cogl_push_framebuffer (priv->cache_offscreen);
+
+  cogl_ortho (0, tex_size, tex_size, 0, -(float) tex_size, tex_size);
+
+  cogl_color_set_from_4ub (&transparent, 0, 0, 0, 0);
+  cogl_clear (&transparent, COGL_BUFFER_BIT_COLOR | COGL_BUFFER_BIT_DEPTH);
+
+  cogl_push_matrix ();
+  cogl_translate (tex_size / 2.0f, tex_size / 2.0f, 0);
+  cogl_rotate (y_angle, 0, 1, 0);
+  cogl_rotate (x_angle, 1, 0, 0);
+  cogl_translate (-(geom->width / 2.0f), -(geom->height / 2.0f), 0);
+
+  clutter_md2_render_sub_frame (md2,
+                                priv->current_frame_a,
+                                priv->current_frame_b,
+                                priv->current_frame_interval,
+                                geom, NULL);
+
+  cogl_pop_matrix ();
+
+  cogl_pop_framebuffer ();
+
+  priv->cache_valid = TRUE;
+  priv->cache_frame_a = priv->current_frame_a;
+  priv->cache_frame_b = priv->current_frame_b;
+  priv->cache_interval = priv->current_frame_interval;
+  priv->cache_skin = priv->current_skin;
+  priv->cache_width = geom->width;
+  priv->cache_height = geom->height;
+  priv->cache_x_angle = x_angle;
+  priv->cache_y_angle = y_angle;
+
+  return TRUE;
+}
+
+static gboolean
+clutter_md2_paint_cached (ClutterMD2 *md2, const ClutterGeometry *geom)
+{
+  ClutterMD2Private *priv = md2->priv;
+  ClutterActor *actor = CLUTTER_ACTOR (md2);
+  float x_angle, y_angle, size;
+  guint8 opacity;
+
+  if (!cogl_features_available (COGL_FEATURE_OFFSCREEN))
+    return FALSE;
+
+  x_angle = clutter_actor_get_rotation (actor, CLUTTER_X_AXIS,
+                                        NULL, NULL, NULL);
+  y_angle = clutter_actor_get_rotation (actor, CLUTTER_Y_AXIS,
+                                        NULL, NULL, NULL);
+
+  if (!clutter_md2_update_cache (md2, geom, x_angle, y_angle, &size))
+    return FALSE;
+
+  /* Undo the actor's rotation about the center of the model in the
+     reverse order that Clutter applies it so that the texture faces
+     the viewer. Rotation about the z axis doesn't change the image so
+     it is left in */
+  cogl_push_matrix ();
+  cogl_translate (geom->width / 2.0f, geom->height / 2.0f, 0);
+  cogl_rotate (-x_angle, 1, 0, 0);
+  cogl_rotate (-y_angle, 0, 1, 0);
+
+  opacity = clutter_actor_get_paint_opacity (actor);
+  cogl_material_set_color4ub (priv->cache_material,
+                              opacity, opacity, opacity, opacity);
+  cogl_set_source (priv->cache_material);
+  cogl_rectangle (-size / 2.0f, -size / 2.0f, size / 2.0f, size / 2.0f);
+
+  cogl_pop_matrix ();
+
+  return TRUE;
+}
+
+/* Reduces the sub-frame to the precision that is worth drawing at
+   the last known on-screen size */
+static void
+clutter_md2_apply_lod (ClutterMD2Private *priv,
+                       gint              *frame_a,
+                       gint              *frame_b,
+                       gfloat            *interval)
+{
+  float steps, snap_size;
+
+  if (priv->lod_full_size <= 0.0f
+      || priv->screen_size >= priv->lod_full_size
+      || *frame_a == *frame_b)
+    return;
+
+  /* The sizes can be set in either order so the snap size is only
+     limited to the full size here */
+  snap_size = MIN (priv->lod_snap_size, priv->lod_full_size);
+
+  if (priv->screen_size < snap_size)
+    {
+      if (*interval >= 0.5f)
+        *frame_a = *frame_b;
+      *interval = 0.0f;
+    }
+  else
+    {
+      steps = ceil (CLUTTER_MD2_LOD_MAX_STEPS
+                    * (priv->screen_size - snap_size)
+                    / (priv->lod_full_size - snap_size));
+      /* At exactly the snap size there would be no steps at all */
+      steps = MAX (steps, 1.0f);
+      *interval = floor (*interval * steps) / steps;
+    }
+
+  /* Use the cheaper static frame path when there's nothing to blend */
+  if (*interval == 0.0f)
+    *frame_b = *frame_a;
+}
+
+static void
+clutter_md2_stop_transition (ClutterMD2 *md2)
+{
+  ClutterMD2Private *priv = md2->priv;
+
+  priv->in_transition = FALSE;
+
+  if (priv->transition_redraw_id)
+    {
+      g_source_remove (priv->transition_redraw_id);
+      priv->transition_redraw_id = 0;
+    }
+}
+
+static gboolean
+clutter_md2_transition_redraw_cb (gpointer user_data)
+{
+  ClutterMD2 *md2 = CLUTTER_MD2 (user_data);
+
+  md2->priv->transition_redraw_id = 0;
+
+  clutter_actor_queue_redraw (CLUTTER_ACTOR (md2));
+
+  return FALSE;
+}
+
+/* Gets the four weighted frames of the blend between the pose at the
+   start of the transition and the current pose. Returns how far
+   through the transition it is */
+static gfloat
+clutter_md2_get_transition_pose (ClutterMD2Private *priv,
+                                 gint              *frame_nums,
+                                 gfloat            *weights)
+{
+  gfloat t;
+
+  t = (g_timer_elapsed (priv->transition_timer, NULL) * 1000.0
+       / priv->transition_duration);
+  t = MIN (t, 1.0f);
+
+  frame_nums[0] = priv->transition_frame_a;
+  frame_nums[1] = priv->transition_frame_b;
+  frame_nums[2] = priv->current_frame_a;
+  frame_nums[3] = priv->current_frame_b;
+  weights[0] = (1.0f - priv->transition_interval) * (1.0f - t);
+  weights[1] = priv->transition_interval * (1.0f - t);
+  weights[2] = (1.0f - priv->current_frame_interval) * t;
+  weights[3] = priv->current_frame_interval * t;
+
+  return t;
+}
+
+/* Paints the blend between the pose at the start of the transition
+   and the current pose. Returns FALSE once the transition is over */
+static gboolean
+clutter_md2_paint_transition (ClutterMD2 *md2, const ClutterGeometry *geom)
+{
+  ClutterMD2Private *priv = md2->priv;
+  gint frame_nums[4];
+  gfloat weights[4];
+
+  if (clutter_md2_get_transition_pose (priv, frame_nums, weights) >= 1.0f)
+    {
+      clutter_md2_stop_transition (md2);
+      return FALSE;
+    }
+
+  clutter_md2_render (md2, 4, frame_nums, weights, geom, NULL);
+
+  /* Keep redrawing until the transition is over even if nothing else
+     changes. The redraw can't be queued during the paint */
+  if (priv->transition_redraw_id == 0)
+    priv->transition_redraw_id
+      = clutter_threads_add_idle (clutter_md2_transition_redraw_cb, md2);
+
+  return TRUE;
+}
+
+static void
+clutter_md2_catch_up (ClutterMD2 *md2)
+{
+  ClutterMD2Private *priv = md2->priv;
+  ClutterMD2CatchUpFunc func = priv->catch_up_func;
+
+  if (func == NULL)
+    return;
+
+  priv->catch_up_func = NULL;
+
+  /* redraw_frame is left alone because the timelines for the next
+     frame run before the frame counter is incremented */
+  priv->in_catch_up = TRUE;
+  func (md2, priv->catch_up_data);
+  priv->in_catch_up = FALSE;
+}
+
 static void
 clutter_md2_paint (ClutterActor *self)
 {
   ClutterMD2 *md2 = CLUTTER_MD2 (self);
   ClutterMD2Private *priv = md2->priv;
   ClutterGeometry geom;
+  gint frame_a, frame_b;
+  gfloat interval;
 
   clutter_actor_get_allocation_geometry (self, &geom);
 
   if (priv->data == NULL)
     return;
 
-  clutter_md2_data_render (priv->data,
-                           priv->current_frame_a,
-                           priv->current_frame_b,
-                           priv->current_frame_interval,
-                           priv->current_skin,
-                           &geom);
+  clutter_md2_catch_up (md2);
+
+  if (priv->impostor_threshold > 0.0f || priv->lod_full_size > 0.0f)
+    {
+      gfloat width, height;
+
+      clutter_actor_get_transformed_size (self, &width, &height);
+
+      priv->screen_size = MAX (width, height);
+    }
+
+  /* The impostors only contain the main model so they can't be used
+     with attachments */
+  if (priv->impostor_threshold > 0.0f && priv->attachments == NULL)
+    {
+      if (priv->screen_size < priv->impostor_threshold)
+        {
+          /* The impostors only contain whole frames so use whichever
+             is closest */
+          int frame_num = (priv->current_frame_interval < 0.5f
+                           ? priv->current_frame_a
+                           : priv->current_frame_b);
+          gfloat angle = clutter_actor_get_rotation (self, CLUTTER_Y_AXIS,
+                                                     NULL, NULL, NULL);
+
+          if (_clutter_md2_data_paint_impostor (priv->data,
+                                                self,
+                                                frame_num,
+                                                priv->current_skin,
+                                                angle,
+                                                &geom))
+            return;
+        }
+    }
+
+  if (priv->in_transition && clutter_md2_paint_transition (md2, &geom))
+    return;
+
+  if (priv->cache_result && clutter_md2_paint_cached (md2, &geom))
+    return;
+
+  frame_a = priv->current_frame_a;
+  frame_b = priv->current_frame_b;
+  interval = priv->current_frame_interval;
+
+  clutter_md2_apply_lod (priv, &frame_a, &frame_b, &interval);
+
+  if (frame_a == frame_b && priv->current_frame_a != priv->current_frame_b)
+    priv->lod_static_paints++;
+
+  clutter_md2_render_sub_frame (md2, frame_a, frame_b, interval,
+                                &geom, NULL);
+}
+
+static void
+clutter_md2_pick (ClutterActor *self, const ClutterColor *color)
+{
+  ClutterMD2 *md2 = CLUTTER_MD2 (self);
+  ClutterMD2Private *priv = md2->priv;
+  ClutterGeometry geom;
+
+  if (priv->data == NULL || !clutter_actor_should_pick_paint (self))
+    return;
+
+  clutter_md2_catch_up (md2);
+
+  clutter_actor_get_allocation_geometry (self, &geom);
+
+  /* Draw the silhouette of the current sub-frame instead of the
+     allocation box so that only the pixels covered by the model are
+     reactive */
+  clutter_md2_render_sub_frame (md2,
+                                priv->current_frame_a,
+                                priv->current_frame_b,
+                                priv->current_frame_interval,
+                                &geom,
+                                color);
 }
 
 static void
@@ -341,7 +1037,8 @@ clutter_md2_set_current_skin (ClutterMD2 *md2, gint skin_num)
 
   clutter_actor_queue_redraw (CLUTTER_ACTOR (md2));
 
-  g_object_notify (G_OBJECT (md2), "current_skin");
+  g_object_notify_by_pspec (G_OBJECT (md2),
+                            clutter_md2_properties[PROP_CURRENT_SKIN]);
 }
 
 gint
@@ -363,6 +1060,169 @@ clutter_md2_get_current_frame (ClutterMD2 *md2)
   return md2->priv->current_frame_a;
 }
 
+/* Checks whether a new pose follows on from the current one. Any
+   frame of the same animation sequence does, so that skipped frames
+   and looping back to the start don't start a transition */
+static gboolean
+clutter_md2_is_continuation (ClutterMD2Private *priv,
+                             gint               frame_a,
+                             gint               frame_b)
+{
+  gint frame_start, frame_end;
+
+  if (_clutter_md2_data_get_frame_sequence (priv->data,
+                                            priv->current_frame_a,
+                                            &frame_start, &frame_end))
+    return frame_a >= frame_start && frame_a <= frame_end;
+
+  return (frame_a == priv->current_frame_a
+          || frame_a == priv->current_frame_a + 1
+          || frame_a == priv->current_frame_b
+          || frame_b == priv->current_frame_a);
+}
+
+/* Starts a transition from the pose that is currently drawn. If a
+   transition is already running then its blend of four frames can't
+   be kept as the start pose so the two frames with the most weight
+   are used instead */
+static void
+clutter_md2_start_transition (ClutterMD2 *md2)
+{
+  ClutterMD2Private *priv = md2->priv;
+  gint frame_nums[4];
+  gfloat weights[4];
+
+  if (priv->in_transition)
+    {
+      int i, first = 0, second = 1;
+
+      clutter_md2_get_transition_pose (priv, frame_nums, weights);
+
+      /* Merge the weights of frames that appear twice */
+      for (i = 1; i < 4; i++)
+        {
+          int j;
+
+          for (j = 0; j < i; j++)
+            if (frame_nums[j] == frame_nums[i])
+              {
+                weights[j] += weights[i];
+                weights[i] = 0.0f;
+                break;
+              }
+        }
+
+      if (weights[second] > weights[first])
+        {
+          first = 1;
+          second = 0;
+        }
+      for (i = 2; i < 4; i++)
+        if (weights[i] > weights[first])
+          {
+            second = first;
+            first = i;
+          }
+        else if (weights[i] > weights[second])
+          second = i;
+
+      priv->transition_frame_a = frame_nums[first];
+      priv->transition_frame_b = frame_nums[second];
+      priv->transition_interval = (weights[first] + weights[second] > 0.0f
+                                   ? weights[second]
+                                   / (weights[first] + weights[second])
+                                   : 0.0f);
+    }
+  else
+    {
+      priv->transition_frame_a = priv->current_frame_a;
+      priv->transition_frame_b = priv->current_frame_b;
+      priv->transition_interval = priv->current_frame_interval;
+    }
+
+  if (priv->transition_timer == NULL)
+    priv->transition_timer = g_timer_new ();
+  else
+    g_timer_start (priv->transition_timer);
+
+  priv->in_transition = TRUE;
+}
+
+static void
+clutter_md2_update_sub_frame (ClutterMD2 *md2, gint frame_a, gint frame_b,
+                              gfloat interval)
+{
+  ClutterMD2Private *priv = md2->priv;
+  gboolean frame_changed, sub_frame_changed;
+  gint old_a, old_b, new_a, new_b;
+  gfloat old_interval, new_interval;
+
+  /* Whoever set the frame is keeping the actor up to date */
+  priv->catch_up_func = NULL;
+
+  /* The interval is ignored when both frames are the same */
+  if (frame_a == frame_b)
+    interval = 0.0f;
+
+  frame_changed = priv->current_frame_a != frame_a;
+  sub_frame_changed = (frame_changed
+                       || priv->current_frame_b != frame_b
+                       || priv->current_frame_interval != interval);
+
+  /* Animations often set the same frame for several ticks in a row
+     so there is nothing to do unless something changed */
+  if (!sub_frame_changed)
+    return;
+
+  /* Small actors don't need redrawing if the change is too small to
+     be drawn at their size */
+  old_a = priv->current_frame_a;
+  old_b = priv->current_frame_b;
+  old_interval = priv->current_frame_interval;
+  clutter_md2_apply_lod (priv, &old_a, &old_b, &old_interval);
+  new_a = frame_a;
+  new_b = frame_b;
+  new_interval = interval;
+  clutter_md2_apply_lod (priv, &new_a, &new_b, &new_interval);
+
+  /* Jumping to a pose that isn't a continuation of the current one
+     starts a transition from the current pose */
+  if (priv->transition_duration > 0
+      && priv->data
+      && !clutter_md2_is_continuation (priv, frame_a, frame_b))
+    {
+      clutter_md2_start_transition (md2);
+      /* Make sure the redraw isn't skipped */
+      old_a = -1;
+    }
+
+  priv->current_frame_a = frame_a;
+  priv->current_frame_b = frame_b;
+  priv->current_frame_interval = interval;
+
+  if (old_a == new_a && old_b == new_b && old_interval == new_interval)
+    priv->lod_skipped_updates++;
+  else if (!priv->in_catch_up
+           && priv->redraw_frame != clutter_md2_frame_counter)
+    {
+      priv->redraw_frame = clutter_md2_frame_counter;
+      clutter_actor_queue_redraw (CLUTTER_ACTOR (md2));
+    }
+
+  if (frame_changed)
+    {
+      g_object_freeze_notify (G_OBJECT (md2));
+      g_object_notify_by_pspec (G_OBJECT (md2),
+                                clutter_md2_properties[PROP_CURRENT_FRAME]);
+      g_object_notify_by_pspec (G_OBJECT (md2),
+                                clutter_md2_properties[PROP_SUB_FRAME]);
+      g_object_thaw_notify (G_OBJECT (md2));
+    }
+  else
+    g_object_notify_by_pspec (G_OBJECT (md2),
+                              clutter_md2_properties[PROP_SUB_FRAME]);
+}
+
 void
 clutter_md2_set_current_frame (ClutterMD2 *md2, gint frame_num)
 {
@@ -370,22 +1230,14 @@ clutter_md2_set_current_frame (ClutterMD2 *md2, gint frame_num)
   g_return_if_fail (frame_num >= 0
                     && frame_num < clutter_md2_get_n_frames (md2));
 
-  md2->priv->current_frame_a = frame_num;
-  md2->priv->current_frame_b = frame_num;
-
-  clutter_actor_queue_redraw (CLUTTER_ACTOR (md2));
-
-  g_object_freeze_notify (G_OBJECT (md2));
-  g_object_notify (G_OBJECT (md2), "current_frame");
-  g_object_notify (G_OBJECT (md2), "sub_frame");
-  g_object_thaw_notify (G_OBJECT (md2));
+  clutter_md2_update_sub_frame (md2, frame_num, frame_num, 0.0f);
 }
 
 void
 clutter_md2_set_current_frame_by_name (ClutterMD2 *md2, const gchar *frame_name)
 {
   ClutterMD2Private *priv;
-  int i, num_frames;
+  int frame_num;
 
   g_return_if_fail (CLUTTER_IS_MD2 (md2));
   g_return_if_fail (frame_name != NULL);
@@ -395,14 +1247,10 @@ clutter_md2_set_current_frame_by_name (ClutterMD2 *md2, const gchar *frame_name)
   if (priv->data == NULL)
     return;
 
-  num_frames = clutter_md2_data_get_n_frames (priv->data);
+  frame_num = clutter_md2_data_get_frame_by_name (priv->data, frame_name);
 
-  for (i = 0; i <num_frames; i++)
-    if (!strcmp (clutter_md2_data_get_frame_name (priv->data, i), frame_name))
-      {
-        clutter_md2_set_current_frame (md2, i);
-        break;
-      }
+  if (frame_num >= 0)
+    clutter_md2_set_current_frame (md2, frame_num);
 }
 
 void
@@ -433,18 +1281,157 @@ clutter_md2_set_sub_frame (ClutterMD2 *md2, gint frame_a, gint frame_b,
   g_return_if_fail (frame_a >= 0 && frame_a < num_frames);
   g_return_if_fail (frame_b >= 0 && frame_b < num_frames);
 
-  md2->priv->current_frame_a = frame_a;
-  md2->priv->current_frame_b = frame_b;
-  md2->priv->current_frame_interval = interval;
+  clutter_md2_update_sub_frame (md2, frame_a, frame_b, interval);
+}
 
-  clutter_actor_queue_redraw (CLUTTER_ACTOR (md2));
+/* The data needs to have impostors enabled with
+   clutter_md2_data_set_impostor_size for this to have any effect */
+void
+clutter_md2_set_impostor_threshold (ClutterMD2 *md2,
+                                    gfloat      threshold)
+{
+  g_return_if_fail (CLUTTER_IS_MD2 (md2));
+
+  if (md2->priv->impostor_threshold != threshold)
+    {
+      md2->priv->impostor_threshold = threshold;
+
+      clutter_actor_queue_redraw (CLUTTER_ACTOR (md2));
+
+      g_object_notify_by_pspec
+        (G_OBJECT (md2), clutter_md2_properties[PROP_IMPOSTOR_THRESHOLD]);
+    }
+}
+
+gfloat
+clutter_md2_get_impostor_threshold (ClutterMD2 *md2)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2 (md2), 0.0f);
+
+  return md2->priv->impostor_threshold;
+}
+
+void
+clutter_md2_set_transition_duration (ClutterMD2 *md2,
+                                     guint       duration)
+{
+  g_return_if_fail (CLUTTER_IS_MD2 (md2));
+
+  if (md2->priv->transition_duration != duration)
+    {
+      md2->priv->transition_duration = duration;
+
+      if (duration == 0 && md2->priv->in_transition)
+        {
+          clutter_md2_stop_transition (md2);
+          clutter_actor_queue_redraw (CLUTTER_ACTOR (md2));
+        }
+
+      g_object_notify_by_pspec
+        (G_OBJECT (md2), clutter_md2_properties[PROP_TRANSITION_DURATION]);
+    }
+}
+
+guint
+clutter_md2_get_transition_duration (ClutterMD2 *md2)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2 (md2), 0);
+
+  return md2->priv->transition_duration;
+}
+
+/* Returns TRUE if the actor is blending from an earlier pose. The
+   transition only finishes when the actor is painted */
+gboolean
+clutter_md2_is_in_transition (ClutterMD2 *md2)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2 (md2), FALSE);
+
+  return md2->priv->in_transition;
+}
+
+/* A snap size bigger than the full size is treated as the full size
+   when drawing. Setting the full size to 0 disables the level of
+   detail */
+void
+clutter_md2_set_lod_sizes (ClutterMD2 *md2,
+                           gfloat      full_size,
+                           gfloat      snap_size)
+{
+  ClutterMD2Private *priv;
+
+  g_return_if_fail (CLUTTER_IS_MD2 (md2));
+  g_return_if_fail (full_size >= 0.0f && snap_size >= 0.0f);
+
+  priv = md2->priv;
+
+  if (priv->lod_full_size == full_size && priv->lod_snap_size == snap_size)
+    return;
 
   g_object_freeze_notify (G_OBJECT (md2));
-  g_object_notify (G_OBJECT (md2), "current_frame");
-  g_object_notify (G_OBJECT (md2), "sub_frame");
+
+  if (priv->lod_full_size != full_size)
+    {
+      priv->lod_full_size = full_size;
+      g_object_notify_by_pspec (G_OBJECT (md2),
+                                clutter_md2_properties[PROP_LOD_FULL_SIZE]);
+    }
+
+  if (priv->lod_snap_size != snap_size)
+    {
+      priv->lod_snap_size = snap_size;
+      g_object_notify_by_pspec (G_OBJECT (md2),
+                                clutter_md2_properties[PROP_LOD_SNAP_SIZE]);
+    }
+
+  clutter_actor_queue_redraw (CLUTTER_ACTOR (md2));
+
   g_object_thaw_notify (G_OBJECT (md2));
 }
 
+void
+clutter_md2_get_lod_sizes (ClutterMD2 *md2,
+                           gfloat     *full_size,
+                           gfloat     *snap_size)
+{
+  g_return_if_fail (CLUTTER_IS_MD2 (md2));
+
+  if (full_size)
+    *full_size = md2->priv->lod_full_size;
+  if (snap_size)
+    *snap_size = md2->priv->lod_snap_size;
+}
+
+/* The cached texture is drawn with an orthographic projection so
+   this is best suited to models that are paused on one frame */
+void
+clutter_md2_set_cache_result (ClutterMD2 *md2,
+                              gboolean    cache_result)
+{
+  g_return_if_fail (CLUTTER_IS_MD2 (md2));
+
+  if (md2->priv->cache_result != !!cache_result)
+    {
+      md2->priv->cache_result = !!cache_result;
+
+      if (!cache_result)
+        clutter_md2_free_cache (md2);
+
+      clutter_actor_queue_redraw (CLUTTER_ACTOR (md2));
+
+      g_object_notify_by_pspec (G_OBJECT (md2),
+                                clutter_md2_properties[PROP_CACHE_RESULT]);
+    }
+}
+
+gboolean
+clutter_md2_get_cache_result (ClutterMD2 *md2)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2 (md2), FALSE);
+
+  return md2->priv->cache_result;
+}
+
 const gchar *
 clutter_md2_get_frame_name (ClutterMD2 *md2, gint frame_num)
 {
@@ -463,11 +1450,42 @@ clutter_md2_forget_data (ClutterMD2 *md2)
     {
       g_signal_handler_disconnect (md2->priv->data,
                                    md2->priv->data_changed_handler);
+      g_signal_handler_disconnect (md2->priv->data,
+                                   md2->priv->skin_changed_handler);
       g_object_unref (md2->priv->data);
       md2->priv->data = NULL;
     }
 }
 
+static void
+clutter_md2_on_skin_changed (ClutterMD2 *md2, gint skin_num)
+{
+  /* The cached image may have the old palette */
+  if (skin_num == md2->priv->current_skin)
+    {
+      md2->priv->cache_valid = FALSE;
+
+      clutter_actor_queue_redraw (CLUTTER_ACTOR (md2));
+    }
+}
+
+static void
+clutter_md2_on_attachment_changed (ClutterMD2 *md2)
+{
+  md2->priv->cache_valid = FALSE;
+
+  clutter_actor_queue_redraw (CLUTTER_ACTOR (md2));
+}
+
+static void
+clutter_md2_forget_attachment (ClutterMD2 *md2, ClutterMD2Data *data)
+{
+  g_signal_handlers_disconnect_by_func (data,
+                                        clutter_md2_on_attachment_changed,
+                                        md2);
+  g_object_unref (data);
+}
+
 static void
 clutter_md2_dispose (GObject *self)
 {
@@ -475,6 +1493,23 @@ clutter_md2_dispose (GObject *self)
 
   clutter_md2_forget_data (md2);
 
+  while (md2->priv->attachments)
+    {
+      clutter_md2_forget_attachment (md2, md2->priv->attachments->data);
+      md2->priv->attachments
+        = g_slist_delete_link (md2->priv->attachments,
+                               md2->priv->attachments);
+    }
+  clutter_md2_free_cache (md2);
+  clutter_md2_stop_transition (md2);
+  md2->priv->catch_up_func = NULL;
+
+  if (md2->priv->transition_timer)
+    {
+      g_timer_destroy (md2->priv->transition_timer);
+      md2->priv->transition_timer = NULL;
+    }
+
   md2->priv->current_frame_a = 0;
   md2->priv->current_frame_b = 0;
   md2->priv->current_frame_interval = 0;
@@ -498,6 +1533,13 @@ clutter_md2_on_data_changed (ClutterMD2 *md2)
   int num_frames = clutter_md2_get_n_frames (md2);
   int num_skins = clutter_md2_get_n_skins (md2);
 
+  /* The model may look different even if the frame numbers are the
+     same */
+  priv->cache_valid = FALSE;
+
+  /* The old pose may not exist in the new data */
+  clutter_md2_stop_transition (md2);
+
   g_object_freeze_notify (G_OBJECT (md2));
 
   if (priv->current_frame_a >= num_frames
@@ -505,14 +1547,17 @@ clutter_md2_on_data_changed (ClutterMD2 *md2)
     {
       priv->current_frame_b = priv->current_frame_a = 0;
 
-      g_object_notify (G_OBJECT (md2), "current_frame");
-      g_object_notify (G_OBJECT (md2), "sub_frame");
+      g_object_notify_by_pspec (G_OBJECT (md2),
+                                clutter_md2_properties[PROP_CURRENT_FRAME]);
+      g_object_notify_by_pspec (G_OBJECT (md2),
+                                clutter_md2_properties[PROP_SUB_FRAME]);
     }
   if (priv->current_skin >= num_skins)
     {
       priv->current_skin = 0;
 
-      g_object_notify (G_OBJECT (md2), "current_skin");
+      g_object_notify_by_pspec (G_OBJECT (md2),
+                                clutter_md2_properties[PROP_CURRENT_SKIN]);
     }
 
   clutter_actor_queue_relayout (CLUTTER_ACTOR (md2));
@@ -534,16 +1579,202 @@ clutter_md2_set_data (ClutterMD2 *md2, ClutterMD2Data *data)
   md2->priv->data = data;
 
   if (data)
-    md2->priv->data_changed_handler
-      = g_signal_connect_swapped (data, "data-changed",
-                                  G_CALLBACK (clutter_md2_on_data_changed),
-                                  md2);
+    {
+      md2->priv->data_changed_handler
+        = g_signal_connect_swapped (data, "data-changed",
+                                    G_CALLBACK (clutter_md2_on_data_changed),
+                                    md2);
+      md2->priv->skin_changed_handler
+        = g_signal_connect_swapped (data, "skin-changed",
+                                    G_CALLBACK (clutter_md2_on_skin_changed),
+                                    md2);
+    }
 
   g_object_freeze_notify (G_OBJECT (md2));
 
   clutter_md2_on_data_changed (md2);
 
-  g_object_notify (G_OBJECT (md2), "data");
+  g_object_notify_by_pspec (G_OBJECT (md2),
+                            clutter_md2_properties[PROP_DATA]);
 
   g_object_thaw_notify (G_OBJECT (md2));
 }
+
+/* The attachment is drawn with the same frames as the main model and
+   is placed using the main model's extents. Quake 2 weapon models
+   have the same frame layout as the player model so they line up */
+void
+clutter_md2_add_attachment (ClutterMD2     *md2,
+                            ClutterMD2Data *data)
+{
+  ClutterMD2Private *priv;
+
+  g_return_if_fail (CLUTTER_IS_MD2 (md2));
+  g_return_if_fail (CLUTTER_IS_MD2_DATA (data));
+
+  priv = md2->priv;
+
+  g_return_if_fail (g_slist_find (priv->attachments, data) == NULL);
+
+  g_object_ref_sink (data);
+
+  priv->attachments = g_slist_append (priv->attachments, data);
+
+  g_signal_connect_swapped (data, "data-changed",
+                            G_CALLBACK (clutter_md2_on_attachment_changed),
+                            md2);
+  g_signal_connect_swapped (data, "skin-changed",
+                            G_CALLBACK (clutter_md2_on_attachment_changed),
+                            md2);
+
+  clutter_md2_on_attachment_changed (md2);
+}
+
+void
+clutter_md2_remove_attachment (ClutterMD2     *md2,
+                               ClutterMD2Data *data)
+{
+  ClutterMD2Private *priv;
+  GSList *link;
+
+  g_return_if_fail (CLUTTER_IS_MD2 (md2));
+
+  priv = md2->priv;
+
+  if ((link = g_slist_find (priv->attachments, data)) == NULL)
+    return;
+
+  priv->attachments = g_slist_delete_link (priv->attachments, link);
+
+  clutter_md2_on_attachment_changed (md2);
+
+  clutter_md2_forget_attachment (md2, data);
+}
+
+/* Returns a newly allocated list of the attached models. The list
+   should be freed with g_slist_free but the models are still owned by
+   the actor */
+GSList *
+clutter_md2_get_attachments (ClutterMD2 *md2)
+{
+  g_return_val_if_fail (CLUTTER_IS_MD2 (md2), NULL);
+
+  return g_slist_copy (md2->priv->attachments);
+}
+
+void
+_clutter_md2_set_catch_up (ClutterMD2            *md2,
+                           ClutterMD2CatchUpFunc  func,
+                           gpointer               user_data)
+{
+  md2->priv->catch_up_func = func;
+  md2->priv->catch_up_data = user_data;
+}
+
+void
+_clutter_md2_cancel_catch_up (ClutterMD2 *md2,
+                              gpointer    user_data)
+{
+  if (md2->priv->catch_up_data == user_data)
+    md2->priv->catch_up_func = NULL;
+}
+
+gboolean
+_clutter_md2_get_screen_size (ClutterMD2 *md2,
+                              gfloat     *size)
+{
+  ClutterActor *actor = CLUTTER_ACTOR (md2);
+  ClutterActor *stage;
+  ClutterVertex verts[4];
+  gfloat stage_width, stage_height;
+  gfloat min_x, max_x, min_y, max_y;
+  int i;
+
+  if (!CLUTTER_ACTOR_IS_MAPPED (actor)
+      || clutter_actor_get_paint_opacity (actor) == 0
+      || (stage = clutter_actor_get_stage (actor)) == NULL)
+    return FALSE;
+
+  clutter_actor_get_abs_allocation_vertices (actor, verts);
+
+  min_x = max_x = verts[0].x;
+  min_y = max_y = verts[0].y;
+
+  for (i = 1; i < 4; i++)
+    {
+      if (verts[i].x < min_x)
+        min_x = verts[i].x;
+      if (verts[i].x > max_x)
+        max_x = verts[i].x;
+      if (verts[i].y < min_y)
+        min_y = verts[i].y;
+      if (verts[i].y > max_y)
+        max_y = verts[i].y;
+    }
+
+  clutter_actor_get_size (stage, &stage_width, &stage_height);
+
+  if (max_x < 0.0f || max_y < 0.0f
+      || min_x > stage_width || min_y > stage_height)
+    return FALSE;
+
+  if (size)
+    *size = MAX (max_x - min_x, max_y - min_y);
+
+  return TRUE;
+}
+
+gboolean
+clutter_md2_ray_intersect (ClutterMD2              *md2,
+                           const ClutterMD2DataRay *ray,
+                           ClutterMD2DataHit       *hit)
+{
+  ClutterMD2Private *priv;
+  ClutterMD2DataRay model_ray;
+  ClutterGeometry geom;
+  float scale, center[3], offset[3];
+  int i;
+
+  g_return_val_if_fail (CLUTTER_IS_MD2 (md2), FALSE);
+  g_return_val_if_fail (ray != NULL, FALSE);
+
+  priv = md2->priv;
+
+  if (priv->data == NULL || clutter_md2_get_n_frames (md2) < 1)
+    return FALSE;
+
+  clutter_actor_get_allocation_geometry (CLUTTER_ACTOR (md2), &geom);
+
+  if (geom.width == 0 || geom.height == 0)
+    return FALSE;
+
+  /* Convert the ray into model space using the same transformation
+     that is used to paint the model */
+  _clutter_md2_data_get_fit_transform (priv->data, &geom, &scale, center);
+
+  offset[0] = geom.width / 2.0f;
+  offset[1] = geom.height / 2.0f;
+  offset[2] = 0.0f;
+
+  for (i = 0; i < 3; i++)
+    {
+      model_ray.origin[i] = (ray->origin[i] - offset[i]) / scale + center[i];
+      model_ray.direction[i] = ray->direction[i] / scale;
+    }
+
+  if (!clutter_md2_data_ray_intersect (priv->data,
+                                       priv->current_frame_a,
+                                       priv->current_frame_b,
+                                       priv->current_frame_interval,
+                                       &model_ray,
+                                       hit))
+    return FALSE;
+
+  /* The distance is the same in both spaces because the direction
+     was scaled too but the position needs converting back */
+  if (hit)
+    for (i = 0; i < 3; i++)
+      hit->position[i] = (hit->position[i] - center[i]) * scale + offset[i];
+
+  return TRUE;
+}
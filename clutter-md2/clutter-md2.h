@@ -85,6 +85,36 @@ void clutter_md2_set_sub_frame (ClutterMD2 *md2,
                                 gfloat interval);
 const gchar *clutter_md2_get_frame_name (ClutterMD2 *md2, gint frame_num);
 
+void clutter_md2_set_impostor_threshold (ClutterMD2 *md2,
+                                         gfloat      threshold);
+gfloat clutter_md2_get_impostor_threshold (ClutterMD2 *md2);
+
+void clutter_md2_set_lod_sizes (ClutterMD2 *md2,
+                                gfloat      full_size,
+                                gfloat      snap_size);
+void clutter_md2_get_lod_sizes (ClutterMD2 *md2,
+                                gfloat     *full_size,
+                                gfloat     *snap_size);
+
+void clutter_md2_set_transition_duration (ClutterMD2 *md2,
+                                          guint       duration);
+guint clutter_md2_get_transition_duration (ClutterMD2 *md2);
+gboolean clutter_md2_is_in_transition (ClutterMD2 *md2);
+
+void clutter_md2_set_cache_result (ClutterMD2 *md2,
+                                   gboolean    cache_result);
+gboolean clutter_md2_get_cache_result (ClutterMD2 *md2);
+
+void clutter_md2_add_attachment (ClutterMD2     *md2,
+                                 ClutterMD2Data *data);
+void clutter_md2_remove_attachment (ClutterMD2     *md2,
+                                    ClutterMD2Data *data);
+GSList *clutter_md2_get_attachments (ClutterMD2 *md2);
+
+gboolean clutter_md2_ray_intersect (ClutterMD2              *md2,
+                                    const ClutterMD2DataRay *ray,
+                                    ClutterMD2DataHit       *hit);
+
 G_END_DECLS
 
 
@@ -0,0 +1,111 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <clutter-md2/clutter-behaviour-md2-animate.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define N_TICKS          1000
+#define DEFAULT_N_ACTORS 500
+
+static void
+notify_cb (GObject *object, GParamSpec *pspec, gpointer user_data)
+{
+  guint *n_notifies = user_data;
+
+  (*n_notifies)++;
+}
+
+int
+main (int argc, char **argv)
+{
+  ClutterBehaviourClass *behaviour_class;
+  ClutterBehaviour *behaviour;
+  ClutterMD2Data *data;
+  ClutterActor *stage;
+  GError *error = NULL;
+  GTimer *timer;
+  guint n_notifies = 0, n_updated, n_skipped;
+  int i, n_actors = DEFAULT_N_ACTORS, n_frames;
+
+  clutter_init (&argc, &argv);
+
+  if (argc < 2 || argc > 3)
+    {
+      fprintf (stderr, "usage: %s <md2file> [n_actors]\n", argv[0]);
+      exit (1);
+    }
+
+  if (argc > 2)
+    n_actors = MAX (atoi (argv[2]), 1);
+
+  data = clutter_md2_data_new ();
+  g_object_ref_sink (data);
+
+  if (!clutter_md2_data_load (data, argv[1], &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  n_frames = clutter_md2_data_get_n_frames (data);
+
+  stage = clutter_stage_get_default ();
+
+  behaviour = clutter_behaviour_md2_animate_new (NULL, 0, n_frames - 1);
+
+  for (i = 0; i < n_actors; i++)
+    {
+      ClutterActor *md2 = clutter_md2_new ();
+
+      clutter_md2_set_data (CLUTTER_MD2 (md2), data);
+      clutter_actor_set_size (md2, 32, 32);
+      clutter_actor_set_position (md2, (i % 20) * 32, (i / 20) * 32);
+      clutter_container_add_actor (CLUTTER_CONTAINER (stage), md2);
+
+      g_signal_connect (md2, "notify", G_CALLBACK (notify_cb), &n_notifies);
+
+      clutter_behaviour_apply (behaviour, md2);
+    }
+
+  clutter_actor_show (stage);
+
+  /* The behaviour is driven directly instead of through a timeline so
+     that each tick can be timed on its own. The main loop is run
+     between ticks so that the stage gets a chance to redraw as it
+     would with a real timeline */
+  behaviour_class = CLUTTER_BEHAVIOUR_GET_CLASS (behaviour);
+
+  timer = g_timer_new ();
+  g_timer_stop (timer);
+
+  for (i = 0; i < N_TICKS; i++)
+    {
+      /* Advance slowly enough that consecutive ticks often land on
+         the same frame, as they would at 60 ticks per second */
+      gdouble alpha = (i % 240) / 240.0;
+
+      g_timer_continue (timer);
+      behaviour_class->alpha_notify (behaviour, alpha);
+      g_timer_stop (timer);
+
+      while (g_main_context_pending (NULL))
+        g_main_context_iteration (NULL, FALSE);
+    }
+
+  printf ("%i actors: %10.0f ticks/s, %.1f notifications per tick\n",
+          n_actors,
+          N_TICKS / g_timer_elapsed (timer, NULL),
+          n_notifies / (double) N_TICKS);
+
+  /* Actors that fall off the bottom of the stage are skipped */
+  clutter_behaviour_md2_animate_get_tick_stats
+    (CLUTTER_BEHAVIOUR_MD2_ANIMATE (behaviour), &n_updated, &n_skipped);
+  printf ("last tick: %u actors updated, %u skipped\n",
+          n_updated, n_skipped);
+
+  g_timer_destroy (timer);
+  g_object_unref (behaviour);
+  g_object_unref (data);
+
+  return 0;
+}
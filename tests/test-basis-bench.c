@@ -0,0 +1,140 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define N_PAINTS  200
+#define N_ACTORS  100
+
+/* Compares painting a crowd of models with the frames stored directly
+   against the same model stored as a principal component basis */
+
+static void
+run_bench (ClutterActor *stage, const char *filename, float tolerance)
+{
+  ClutterActor *actors[N_ACTORS];
+  ClutterMD2Data *data;
+  GError *error = NULL;
+  GTimer *timer;
+  gint n_frames, n_keyframes;
+  gsize bytes_saved;
+  gfloat max_error;
+  double load_time, paint_time;
+  int i, paint;
+
+  data = clutter_md2_data_new ();
+  g_object_ref_sink (data);
+
+  clutter_md2_data_set_basis_tolerance (data, tolerance);
+
+  timer = g_timer_new ();
+
+  if (!clutter_md2_data_load (data, filename, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  load_time = g_timer_elapsed (timer, NULL);
+
+  n_frames = clutter_md2_data_get_n_frames (data);
+
+  /* The basis replaces the frames so make sure they can still be
+     found by name */
+  for (i = 0; i < n_frames; i++)
+    if (clutter_md2_data_get_frame_by_name
+        (data, clutter_md2_data_get_frame_name (data, i)) < 0)
+      {
+        fprintf (stderr, "Frame %i can't be found by name\n", i);
+        exit (1);
+      }
+
+  clutter_md2_data_get_frame_stats (data, &n_keyframes,
+                                    &bytes_saved, &max_error);
+
+  for (i = 0; i < N_ACTORS; i++)
+    {
+      actors[i] = clutter_md2_new ();
+      clutter_md2_set_data (CLUTTER_MD2 (actors[i]), data);
+      clutter_actor_set_size (actors[i], 64, 64);
+      clutter_actor_set_position (actors[i], (i % 10) * 64, (i / 10) * 48);
+      clutter_container_add_actor (CLUTTER_CONTAINER (stage), actors[i]);
+    }
+
+  /* Paint once so that the skins are uploaded before timing */
+  clutter_redraw (CLUTTER_STAGE (stage));
+
+  g_timer_start (timer);
+
+  for (paint = 0; paint < N_PAINTS; paint++)
+    {
+      /* Each actor is at a different point in the animation and
+         always between two frames so that every paint blends */
+      for (i = 0; i < N_ACTORS; i++)
+        {
+          int frame = (paint / 4 + i) % n_frames;
+
+          clutter_md2_set_sub_frame (CLUTTER_MD2 (actors[i]),
+                                     frame, (frame + 1) % n_frames,
+                                     (paint % 4 + 0.5f) / 4.0f);
+        }
+
+      clutter_redraw (CLUTTER_STAGE (stage));
+    }
+
+  paint_time = g_timer_elapsed (timer, NULL);
+
+  if (tolerance < 0.0f)
+    printf ("%-6s %9s %5s %10s %10s %8.1f %10.3f\n",
+            "raw", "-", "-", "-", "-",
+            load_time * 1000.0, paint_time * 1000.0 / N_PAINTS);
+  else
+    printf ("%-6s %9.3f %5i %10lu %10.4f %8.1f %10.3f\n",
+            clutter_md2_data_get_basis_size (data) > 0 ? "basis" : "raw",
+            tolerance,
+            clutter_md2_data_get_basis_size (data),
+            (unsigned long) bytes_saved, max_error,
+            load_time * 1000.0, paint_time * 1000.0 / N_PAINTS);
+
+  for (i = 0; i < N_ACTORS; i++)
+    clutter_actor_destroy (actors[i]);
+
+  g_timer_destroy (timer);
+  g_object_unref (data);
+}
+
+int
+main (int argc, char **argv)
+{
+  ClutterActor *stage;
+  int i;
+
+  clutter_init (&argc, &argv);
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s <md2file> [tolerance]...\n", argv[0]);
+      exit (1);
+    }
+
+  stage = clutter_stage_get_default ();
+  clutter_actor_set_size (stage, 640, 480);
+  clutter_actor_show (stage);
+
+  printf ("%-6s %9s %5s %10s %10s %8s %10s\n",
+          "mode", "tolerance", "size", "saved", "max error",
+          "load ms", "ms/paint");
+
+  run_bench (stage, argv[1], -1.0f);
+
+  if (argc > 2)
+    for (i = 2; i < argc; i++)
+      run_bench (stage, argv[1], g_ascii_strtod (argv[i], NULL));
+  else
+    {
+      run_bench (stage, argv[1], 0.1f);
+      run_bench (stage, argv[1], 0.5f);
+    }
+
+  return 0;
+}
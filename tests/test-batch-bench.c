@@ -0,0 +1,180 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define N_PAINTS     100
+#define N_INSTANCES  1000
+#define COLUMNS      40
+#define CELL_SIZE    16
+
+/* Compares drawing a crowd of models from a paint handler with one
+   clutter_md2_data_render call each against a single batch. The
+   batch is tried both in the order that the instances were created,
+   where the skins alternate, and sorted by skin */
+
+typedef enum
+{
+  MODE_SINGLE,
+  MODE_BATCH,
+  MODE_BATCH_SORTED
+} BenchMode;
+
+typedef struct _BenchState BenchState;
+
+struct _BenchState
+{
+  ClutterMD2Data *data;
+  BenchMode mode;
+  int paint;
+  int n_frames, n_skins;
+};
+
+static void
+get_instance (BenchState *state, int i,
+              int *frame, int *skin, float *x, float *y)
+{
+  *frame = (state->paint / 4 + i) % state->n_frames;
+  *skin = i % state->n_skins;
+  *x = (i % COLUMNS) * CELL_SIZE;
+  *y = (i / COLUMNS) * CELL_SIZE;
+}
+
+static void
+on_paint (ClutterActor *stage, BenchState *state)
+{
+  ClutterGeometry geom = { 0, 0, CELL_SIZE, CELL_SIZE };
+  float interval = (state->paint % 4 + 0.5f) / 4.0f;
+  int frame, skin, i, pass;
+  float x, y;
+
+  if (state->mode == MODE_SINGLE)
+    {
+      for (i = 0; i < N_INSTANCES; i++)
+        {
+          get_instance (state, i, &frame, &skin, &x, &y);
+
+          cogl_push_matrix ();
+          cogl_translate (x, y, 0);
+          clutter_md2_data_render (state->data,
+                                   frame, (frame + 1) % state->n_frames,
+                                   interval, skin, &geom);
+          cogl_pop_matrix ();
+        }
+
+      return;
+    }
+
+  clutter_md2_data_render_begin ();
+
+  /* The sorted mode makes one pass over the instances for each skin */
+  for (pass = 0;
+       pass < (state->mode == MODE_BATCH_SORTED ? state->n_skins : 1);
+       pass++)
+    for (i = 0; i < N_INSTANCES; i++)
+      {
+        CoglMatrix transform;
+
+        get_instance (state, i, &frame, &skin, &x, &y);
+
+        if (state->mode == MODE_BATCH_SORTED && skin != pass)
+          continue;
+
+        cogl_matrix_init_identity (&transform);
+        cogl_matrix_translate (&transform, x, y, 0);
+
+        clutter_md2_data_render_draw (state->data,
+                                      frame, (frame + 1) % state->n_frames,
+                                      interval, skin, &transform, &geom);
+      }
+
+  clutter_md2_data_render_end ();
+}
+
+static void
+run_bench (ClutterActor *stage, BenchState *state, BenchMode mode,
+           const char *name)
+{
+  GTimer *timer;
+  double paint_time;
+
+  state->mode = mode;
+  state->paint = 0;
+
+  /* Paint once so that the skins are uploaded before timing */
+  clutter_redraw (CLUTTER_STAGE (stage));
+
+  timer = g_timer_new ();
+
+  for (state->paint = 0; state->paint < N_PAINTS; state->paint++)
+    clutter_redraw (CLUTTER_STAGE (stage));
+
+  paint_time = g_timer_elapsed (timer, NULL);
+
+  printf ("%-14s %10.3f %12.0f\n",
+          name,
+          paint_time * 1000.0 / N_PAINTS,
+          N_INSTANCES * N_PAINTS / paint_time);
+
+  g_timer_destroy (timer);
+}
+
+int
+main (int argc, char **argv)
+{
+  ClutterActor *stage;
+  BenchState state;
+  GError *error = NULL;
+  int i;
+
+  clutter_init (&argc, &argv);
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s <md2file> [skin]...\n", argv[0]);
+      exit (1);
+    }
+
+  state.data = clutter_md2_data_new ();
+  g_object_ref_sink (state.data);
+
+  if (!clutter_md2_data_load (state.data, argv[1], &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  for (i = 2; i < argc; i++)
+    if (!clutter_md2_data_add_skin (state.data, argv[i], &error))
+      {
+        fprintf (stderr, "%s\n", error->message);
+        exit (1);
+      }
+
+  state.n_frames = clutter_md2_data_get_n_frames (state.data);
+  state.n_skins = clutter_md2_data_get_n_skins (state.data);
+
+  if (state.n_frames < 1 || state.n_skins < 1)
+    {
+      fprintf (stderr, "%s has no frames or no skins\n", argv[1]);
+      exit (1);
+    }
+
+  stage = clutter_stage_get_default ();
+  clutter_actor_set_size (stage, COLUMNS * CELL_SIZE,
+                          (N_INSTANCES + COLUMNS - 1) / COLUMNS * CELL_SIZE);
+  clutter_actor_show (stage);
+
+  g_signal_connect_after (stage, "paint", G_CALLBACK (on_paint), &state);
+
+  printf ("%i instances, %i skins\n", N_INSTANCES, state.n_skins);
+  printf ("%-14s %10s %12s\n", "mode", "ms/paint", "draws/s");
+
+  run_bench (stage, &state, MODE_SINGLE, "single");
+  run_bench (stage, &state, MODE_BATCH, "batch");
+  run_bench (stage, &state, MODE_BATCH_SORTED, "batch sorted");
+
+  g_object_unref (state.data);
+
+  return 0;
+}
@@ -335,6 +335,7 @@ main (int argc, char **argv)
   ClutterActor *stage, *md2, *grabber, *angle_buttons;
   ClutterMD2Data *data;
   GError *error = NULL;
+  const gchar *weapon_file;
   ClutterAlpha *alpha;
   ClutterTimeline *tl;
   DisplayState state;
@@ -382,6 +383,24 @@ main (int argc, char **argv)
 
   clutter_md2_set_data (CLUTTER_MD2 (md2), data);
 
+  /* A model with the same frame layout such as a Quake 2 weapon can
+     be drawn along with the main model */
+  if ((weapon_file = getenv ("WEAPON")))
+    {
+      ClutterMD2Data *weapon = clutter_md2_data_new ();
+
+      if (clutter_md2_data_load (weapon, weapon_file, &error))
+        clutter_md2_add_attachment (CLUTTER_MD2 (md2), weapon);
+      else
+        {
+          fprintf (stderr, "%s\n", error->message);
+          g_error_free (error);
+          error = NULL;
+          g_object_ref_sink (weapon);
+          g_object_unref (weapon);
+        }
+    }
+
   tl = clutter_timeline_new (6000);
   clutter_timeline_start (tl);
   clutter_timeline_set_loop (tl, TRUE);
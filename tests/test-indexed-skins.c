@@ -0,0 +1,122 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Loads a model with its skins expanded to RGB and again with indexed
+   skins and reports the texture memory used by each. The palette of
+   the indexed skins is then swapped repeatedly to show how cheap it
+   is to recolour them */
+
+#define N_SWAPS 1000
+
+static ClutterMD2Data *
+load_model (int argc, char **argv, gboolean indexed)
+{
+  ClutterMD2Data *data;
+  GError *error = NULL;
+  int i;
+
+  data = clutter_md2_data_new ();
+  g_object_ref_sink (data);
+  clutter_md2_data_set_indexed_skins (data, indexed);
+
+  if (!clutter_md2_data_load (data, argv[1], &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  for (i = 2; i < argc; i++)
+    if (!clutter_md2_data_add_skin (data, argv[i], &error))
+      {
+        fprintf (stderr, "%s\n", error->message);
+        exit (1);
+      }
+
+  return data;
+}
+
+static int
+count_indexed_skins (ClutterMD2Data *data)
+{
+  int i, n_indexed = 0;
+
+  for (i = 0; i < clutter_md2_data_get_n_skins (data); i++)
+    if (clutter_md2_data_get_skin_palette (data, i))
+      n_indexed++;
+
+  return n_indexed;
+}
+
+int
+main (int argc, char **argv)
+{
+  ClutterActor *stage;
+  ClutterMD2Data *data;
+  gsize rgb_bytes, indexed_bytes;
+  guchar palette[256 * 3];
+  GTimer *timer;
+  int n_indexed, i, j;
+
+  clutter_init (&argc, &argv);
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s <md2file> [skin]...\n", argv[0]);
+      exit (1);
+    }
+
+  /* The skins are uploaded so there needs to be a GL context */
+  stage = clutter_stage_get_default ();
+  clutter_actor_show (stage);
+
+  data = load_model (argc, argv, FALSE);
+  rgb_bytes = clutter_md2_data_get_skin_texture_bytes (data);
+  g_object_unref (data);
+
+  data = load_model (argc, argv, TRUE);
+  indexed_bytes = clutter_md2_data_get_skin_texture_bytes (data);
+  n_indexed = count_indexed_skins (data);
+
+  printf ("%-8s %12s\n", "skins", "texture bytes");
+  printf ("%-8s %12lu\n", "rgb", (unsigned long) rgb_bytes);
+  printf ("%-8s %12lu\n", "indexed", (unsigned long) indexed_bytes);
+  printf ("%i of %i skins are indexed\n",
+          n_indexed, clutter_md2_data_get_n_skins (data));
+
+  if (n_indexed > 0)
+    {
+      guchar original[256 * 3];
+
+      /* Use the first indexed skin */
+      for (i = 0; clutter_md2_data_get_skin_palette (data, i) == NULL; i++);
+
+      /* The returned palette is overwritten by the swaps */
+      memcpy (original, clutter_md2_data_get_skin_palette (data, i),
+              sizeof (original));
+
+      timer = g_timer_new ();
+
+      /* Alternate between the original colours and a tinted copy */
+      for (j = 0; j < N_SWAPS; j++)
+        {
+          int k;
+
+          for (k = 0; k < 256 * 3; k++)
+            palette[k] = (j & 1) && k % 3 == 0 ? 255 : original[k];
+
+          clutter_md2_data_set_skin_palette (data, i, palette);
+        }
+
+      printf ("palette swap: %.3f us\n",
+              g_timer_elapsed (timer, NULL) * 1000000.0 / N_SWAPS);
+
+      g_timer_destroy (timer);
+    }
+
+  g_object_unref (data);
+
+  return 0;
+}
@@ -0,0 +1,98 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Tolerances to try if none are given on the command line, in model
+   units */
+static const float default_tolerances[] = { 0.0f, 0.05f, 0.1f, 0.25f, 0.5f };
+
+static void
+check_frame_names (ClutterMD2Data *data)
+{
+  int i;
+
+  for (i = 0; i < clutter_md2_data_get_n_frames (data); i++)
+    {
+      const gchar *name = clutter_md2_data_get_frame_name (data, i);
+      gint frame_num = clutter_md2_data_get_frame_by_name (data, name);
+
+      /* Duplicate names map to the first frame with the name */
+      if (frame_num < 0
+          || strcmp (clutter_md2_data_get_frame_name (data, frame_num),
+                     name))
+        {
+          fprintf (stderr, "Looking up frame '%s' failed\n", name);
+          exit (1);
+        }
+    }
+}
+
+static void
+run_test (const char *filename, float tolerance)
+{
+  ClutterMD2Data *data;
+  GError *error = NULL;
+  GTimer *timer;
+  gint n_keyframes, n_frames;
+  gsize bytes_saved;
+  gfloat max_error;
+  double elapsed;
+
+  data = clutter_md2_data_new ();
+  g_object_ref_sink (data);
+
+  clutter_md2_data_set_frame_tolerance (data, tolerance);
+
+  timer = g_timer_new ();
+
+  if (!clutter_md2_data_load (data, filename, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  n_frames = clutter_md2_data_get_n_frames (data);
+
+  /* Dropping frames mustn't break looking them up by name */
+  check_frame_names (data);
+
+  clutter_md2_data_get_frame_stats (data, &n_keyframes,
+                                    &bytes_saved, &max_error);
+
+  printf ("%9.3f %5i/%-5i %10lu %10.4f %8.1f\n",
+          tolerance, n_keyframes, n_frames,
+          (unsigned long) bytes_saved, max_error, elapsed * 1000.0);
+
+  g_object_unref (data);
+}
+
+int
+main (int argc, char **argv)
+{
+  int i;
+
+  clutter_init (&argc, &argv);
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s <md2file> [tolerance]...\n", argv[0]);
+      exit (1);
+    }
+
+  printf ("%9s %11s %10s %10s %8s\n",
+          "tolerance", "keyframes", "saved", "max error", "load ms");
+
+  if (argc > 2)
+    for (i = 2; i < argc; i++)
+      run_test (argv[1], g_ascii_strtod (argv[i], NULL));
+  else
+    for (i = 0; i < G_N_ELEMENTS (default_tolerances); i++)
+      run_test (argv[1], default_tolerances[i]);
+
+  return 0;
+}
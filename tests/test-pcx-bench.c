@@ -0,0 +1,133 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Compares decoding each PCX file given on the command line with the
+   gdk-pixbuf loader against the decoder built into the library and
+   checks that both give the same pixels */
+
+#define N_DECODES 50
+
+typedef GdkPixbuf *(* DecodeFunc) (const gchar *filename, GError **error);
+
+static GdkPixbuf *
+decode_with_gdk_pixbuf (const gchar *filename, GError **error)
+{
+  return gdk_pixbuf_new_from_file (filename, error);
+}
+
+static GdkPixbuf *
+decode_file (DecodeFunc func, const gchar *filename)
+{
+  GError *error = NULL;
+  GdkPixbuf *pixbuf;
+
+  if ((pixbuf = func (filename, &error)) == NULL)
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  return pixbuf;
+}
+
+static double
+time_decodes (DecodeFunc func, const gchar *filename)
+{
+  GTimer *timer = g_timer_new ();
+  double elapsed;
+  int i;
+
+  for (i = 0; i < N_DECODES; i++)
+    g_object_unref (decode_file (func, filename));
+
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  g_timer_destroy (timer);
+
+  return elapsed / N_DECODES;
+}
+
+static gboolean
+compare_pixbufs (GdkPixbuf *a, GdkPixbuf *b)
+{
+  int width = gdk_pixbuf_get_width (a);
+  int height = gdk_pixbuf_get_height (a);
+  int n_channels = gdk_pixbuf_get_n_channels (a);
+  int y;
+
+  if (width != gdk_pixbuf_get_width (b)
+      || height != gdk_pixbuf_get_height (b)
+      || n_channels != gdk_pixbuf_get_n_channels (b))
+    return FALSE;
+
+  for (y = 0; y < height; y++)
+    if (memcmp (gdk_pixbuf_get_pixels (a)
+                + y * gdk_pixbuf_get_rowstride (a),
+                gdk_pixbuf_get_pixels (b)
+                + y * gdk_pixbuf_get_rowstride (b),
+                width * n_channels))
+      return FALSE;
+
+  return TRUE;
+}
+
+static void
+print_result (const char *name, const char *decoder, double decode_time,
+              GdkPixbuf *pixbuf)
+{
+  double n_bytes = (gdk_pixbuf_get_width (pixbuf)
+                    * gdk_pixbuf_get_height (pixbuf)
+                    * gdk_pixbuf_get_n_channels (pixbuf));
+
+  printf ("%-24s %-10s %10.3f %10.1f\n",
+          name, decoder, decode_time * 1000.0,
+          n_bytes / decode_time / (1024.0 * 1024.0));
+}
+
+int
+main (int argc, char **argv)
+{
+  int i;
+
+  clutter_init (&argc, &argv);
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s <pcxfile>...\n", argv[0]);
+      exit (1);
+    }
+
+  printf ("%-24s %-10s %10s %10s\n", "file", "decoder", "ms", "MB/s");
+
+  for (i = 1; i < argc; i++)
+    {
+      GdkPixbuf *gdk_pixbuf, *native_pixbuf;
+      gchar *name = g_path_get_basename (argv[i]);
+
+      gdk_pixbuf = decode_file (decode_with_gdk_pixbuf, argv[i]);
+      native_pixbuf = decode_file (clutter_md2_data_load_pcx, argv[i]);
+
+      print_result (name, "gdk-pixbuf",
+                    time_decodes (decode_with_gdk_pixbuf, argv[i]),
+                    gdk_pixbuf);
+      print_result (name, "native",
+                    time_decodes (clutter_md2_data_load_pcx, argv[i]),
+                    native_pixbuf);
+
+      if (!compare_pixbufs (gdk_pixbuf, native_pixbuf))
+        {
+          fprintf (stderr, "%s: the decoders give different pixels\n",
+                   argv[i]);
+          exit (1);
+        }
+
+      g_object_unref (gdk_pixbuf);
+      g_object_unref (native_pixbuf);
+      g_free (name);
+    }
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define N_RAYS 100000
+
+static float
+random_in_range (float min, float max)
+{
+  return min + g_random_double () * (max - min);
+}
+
+static void
+run_bench (ClutterMD2Data *data,
+           const char *label,
+           int frame_a, int frame_b, float interval)
+{
+  ClutterMD2DataExtents extents;
+  ClutterMD2DataRay *rays;
+  ClutterMD2DataHit hit;
+  GTimer *timer;
+  int i, hits = 0;
+  double elapsed;
+
+  clutter_md2_data_get_extents (data, &extents);
+
+  /* Generate the rays up front so that only the intersection is
+     timed. Each ray starts in front of the model and points at a
+     random point within its extents */
+  rays = g_new (ClutterMD2DataRay, N_RAYS);
+
+  for (i = 0; i < N_RAYS; i++)
+    {
+      ClutterMD2DataRay *ray = rays + i;
+
+      ray->origin[0] = random_in_range (extents.left, extents.right);
+      ray->origin[1] = random_in_range (extents.top, extents.bottom);
+      ray->origin[2] = extents.front + (extents.front - extents.back);
+      ray->direction[0] = (random_in_range (extents.left, extents.right)
+                           - ray->origin[0]);
+      ray->direction[1] = (random_in_range (extents.top, extents.bottom)
+                           - ray->origin[1]);
+      ray->direction[2] = extents.back - ray->origin[2];
+    }
+
+  /* Cast one ray first so that the tree building isn't counted */
+  clutter_md2_data_ray_intersect (data, frame_a, frame_b, interval,
+                                  rays, &hit);
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < N_RAYS; i++)
+    if (clutter_md2_data_ray_intersect (data, frame_a, frame_b, interval,
+                                        rays + i, &hit))
+      hits++;
+
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  printf ("%-10s %10.0f rays/s (%i%% hit)\n",
+          label, N_RAYS / elapsed, hits * 100 / N_RAYS);
+
+  g_timer_destroy (timer);
+  g_free (rays);
+}
+
+int
+main (int argc, char **argv)
+{
+  ClutterMD2Data *data;
+  GError *error = NULL;
+  int n_frames;
+
+  clutter_init (&argc, &argv);
+
+  if (argc != 2)
+    {
+      fprintf (stderr, "usage: %s <md2file>\n", argv[0]);
+      exit (1);
+    }
+
+  data = clutter_md2_data_new ();
+  g_object_ref_sink (data);
+
+  if (!clutter_md2_data_load (data, argv[1], &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  n_frames = clutter_md2_data_get_n_frames (data);
+
+  run_bench (data, "Frame", 0, 0, 0.0f);
+  if (n_frames > 1)
+    run_bench (data, "Sub-frame", 0, 1, 0.5f);
+
+  g_object_unref (data);
+
+  return 0;
+}
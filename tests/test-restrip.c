@@ -0,0 +1,160 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* Runs a model through clutter-md2-restrip and checks that the output
+   still loads and that a grid of rays fired at every frame hits the
+   same surface as in the original model */
+
+#ifndef RESTRIP_TOOL
+#define RESTRIP_TOOL "../tools/clutter-md2-restrip"
+#endif
+
+#define GRID_SIZE 32
+
+static ClutterMD2Data *
+load_model (const gchar *filename)
+{
+  ClutterMD2Data *data = clutter_md2_data_new ();
+  GError *error = NULL;
+
+  g_object_ref_sink (data);
+  clutter_md2_data_set_upload_skins (data, FALSE);
+
+  if (!clutter_md2_data_load (data, filename, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  return data;
+}
+
+/* Returns the number of rays that hit differently */
+static int
+compare_frame (ClutterMD2Data *before, ClutterMD2Data *after,
+               gint frame_num, int *n_hits)
+{
+  ClutterMD2DataExtents extents;
+  int x, y, n_differences = 0;
+
+  clutter_md2_data_get_frame_extents (before, frame_num, &extents);
+
+  for (y = 0; y < GRID_SIZE; y++)
+    for (x = 0; x < GRID_SIZE; x++)
+      {
+        ClutterMD2DataRay ray;
+        ClutterMD2DataHit hit_before, hit_after;
+        gboolean hit_a, hit_b;
+
+        ray.origin[0] = (extents.left + (x + 0.5f)
+                         * (extents.right - extents.left) / GRID_SIZE);
+        ray.origin[1] = (extents.top + (y + 0.5f)
+                         * (extents.bottom - extents.top) / GRID_SIZE);
+        ray.origin[2] = extents.front + 1.0f;
+        ray.direction[0] = 0.0f;
+        ray.direction[1] = 0.0f;
+        ray.direction[2] = -1.0f;
+
+        hit_a = clutter_md2_data_ray_intersect (before, frame_num, frame_num,
+                                                0.0f, &ray, &hit_before);
+        hit_b = clutter_md2_data_ray_intersect (after, frame_num, frame_num,
+                                                0.0f, &ray, &hit_after);
+
+        if (hit_a != hit_b
+            || (hit_a && fabsf (hit_before.distance
+                                - hit_after.distance) > 0.001f))
+          n_differences++;
+
+        if (hit_a)
+          (*n_hits)++;
+      }
+
+  return n_differences;
+}
+
+int
+main (int argc, char **argv)
+{
+  ClutterMD2Data *before, *after;
+  GError *error = NULL;
+  gchar *output, *stdout_text;
+  gchar *tool_argv[4];
+  gint status, fd, frame_num;
+  int n_hits = 0, n_differences = 0, ret = 0;
+
+  clutter_init (&argc, &argv);
+
+  if (argc != 2)
+    {
+      fprintf (stderr, "usage: %s <md2file>\n", argv[0]);
+      exit (1);
+    }
+
+  if ((fd = g_file_open_tmp ("restrip-XXXXXX.md2", &output, &error)) == -1)
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+  close (fd);
+
+  tool_argv[0] = RESTRIP_TOOL;
+  tool_argv[1] = argv[1];
+  tool_argv[2] = output;
+  tool_argv[3] = NULL;
+
+  if (!g_spawn_sync (NULL, tool_argv, NULL, 0, NULL, NULL,
+                     &stdout_text, NULL, &status, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    {
+      fprintf (stderr, "%s failed\n", RESTRIP_TOOL);
+      exit (1);
+    }
+
+  fputs (stdout_text, stdout);
+  g_free (stdout_text);
+
+  before = load_model (argv[1]);
+  after = load_model (output);
+
+  if (clutter_md2_data_get_n_frames (before)
+      != clutter_md2_data_get_n_frames (after)
+      || clutter_md2_data_get_n_skins (before)
+      != clutter_md2_data_get_n_skins (after))
+    {
+      fprintf (stderr, "The frames or skins changed\n");
+      ret = 1;
+    }
+  else
+    {
+      for (frame_num = 0;
+           frame_num < clutter_md2_data_get_n_frames (before);
+           frame_num++)
+        n_differences += compare_frame (before, after, frame_num, &n_hits);
+
+      printf ("%i rays hit, %i differences\n", n_hits, n_differences);
+
+      if (n_differences > 0)
+        {
+          fprintf (stderr, "The restripped model has a different surface\n");
+          ret = 1;
+        }
+    }
+
+  g_object_unref (after);
+  g_object_unref (before);
+  g_unlink (output);
+  g_free (output);
+
+  return ret;
+}
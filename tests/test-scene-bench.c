@@ -0,0 +1,181 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <clutter-md2/clutter-md2-scene.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define N_PAINTS   100
+#define CELL_SIZE  16
+#define COLUMNS    50
+
+/* Compares animating a crowd with one ClutterMD2 actor per model
+   against a single ClutterMD2Scene. The grid is taller than the stage
+   so that some of the instances are culled */
+
+static void
+get_cell (int i, int paint, int n_frames,
+          float *x, float *y, int *frame_a, int *frame_b, float *interval)
+{
+  *x = (i % COLUMNS) * CELL_SIZE;
+  *y = (i / COLUMNS) * CELL_SIZE;
+  *frame_a = (paint / 4 + i) % n_frames;
+  *frame_b = (*frame_a + 1) % n_frames;
+  *interval = (paint % 4 + 0.5f) / 4.0f;
+}
+
+static void
+run_actors (ClutterActor *stage, ClutterMD2Data *data, int n_instances)
+{
+  ClutterActor **actors = g_new (ClutterActor *, n_instances);
+  int n_frames = clutter_md2_data_get_n_frames (data);
+  int frame_a, frame_b;
+  float x, y, interval;
+  GTimer *timer;
+  double paint_time;
+  int i, paint;
+
+  for (i = 0; i < n_instances; i++)
+    {
+      actors[i] = clutter_md2_new ();
+      clutter_md2_set_data (CLUTTER_MD2 (actors[i]), data);
+      get_cell (i, 0, n_frames, &x, &y, &frame_a, &frame_b, &interval);
+      clutter_actor_set_position (actors[i], x, y);
+      clutter_actor_set_size (actors[i], CELL_SIZE, CELL_SIZE);
+      clutter_container_add_actor (CLUTTER_CONTAINER (stage), actors[i]);
+    }
+
+  clutter_redraw (CLUTTER_STAGE (stage));
+
+  timer = g_timer_new ();
+
+  for (paint = 0; paint < N_PAINTS; paint++)
+    {
+      for (i = 0; i < n_instances; i++)
+        {
+          get_cell (i, paint, n_frames,
+                    &x, &y, &frame_a, &frame_b, &interval);
+          clutter_md2_set_sub_frame (CLUTTER_MD2 (actors[i]),
+                                     frame_a, frame_b, interval);
+        }
+
+      clutter_redraw (CLUTTER_STAGE (stage));
+    }
+
+  paint_time = g_timer_elapsed (timer, NULL);
+
+  printf ("%-7s %9i %10.3f %8s %8s\n", "actors", n_instances,
+          paint_time * 1000.0 / N_PAINTS, "-", "-");
+
+  for (i = 0; i < n_instances; i++)
+    clutter_actor_destroy (actors[i]);
+
+  g_free (actors);
+  g_timer_destroy (timer);
+}
+
+static void
+run_scene (ClutterActor *stage, ClutterMD2Data *data, int n_instances)
+{
+  ClutterActor *scene = clutter_md2_scene_new ();
+  ClutterMD2SceneInstance *instances
+    = g_new0 (ClutterMD2SceneInstance, n_instances);
+  int n_frames = clutter_md2_data_get_n_frames (data);
+  int model;
+  GTimer *timer;
+  double paint_time;
+  guint n_drawn, n_culled;
+  int i, paint;
+
+  model = clutter_md2_scene_add_model (CLUTTER_MD2_SCENE (scene), data);
+  clutter_md2_scene_set_n_instances (CLUTTER_MD2_SCENE (scene),
+                                     n_instances);
+  clutter_actor_set_size (scene,
+                          clutter_actor_get_width (stage),
+                          clutter_actor_get_height (stage));
+  clutter_container_add_actor (CLUTTER_CONTAINER (stage), scene);
+
+  for (i = 0; i < n_instances; i++)
+    {
+      instances[i].model = model;
+      instances[i].size = CELL_SIZE;
+    }
+
+  clutter_redraw (CLUTTER_STAGE (stage));
+
+  timer = g_timer_new ();
+
+  for (paint = 0; paint < N_PAINTS; paint++)
+    {
+      for (i = 0; i < n_instances; i++)
+        get_cell (i, paint, n_frames,
+                  &instances[i].x, &instances[i].y,
+                  &instances[i].frame_num_a, &instances[i].frame_num_b,
+                  &instances[i].interval);
+
+      clutter_md2_scene_set_instances (CLUTTER_MD2_SCENE (scene),
+                                       0, n_instances, instances);
+
+      clutter_redraw (CLUTTER_STAGE (stage));
+    }
+
+  paint_time = g_timer_elapsed (timer, NULL);
+
+  clutter_md2_scene_get_paint_stats (CLUTTER_MD2_SCENE (scene),
+                                     &n_drawn, &n_culled);
+
+  printf ("%-7s %9i %10.3f %8u %8u\n", "scene", n_instances,
+          paint_time * 1000.0 / N_PAINTS, n_drawn, n_culled);
+
+  clutter_actor_destroy (scene);
+
+  g_free (instances);
+  g_timer_destroy (timer);
+}
+
+int
+main (int argc, char **argv)
+{
+  ClutterActor *stage;
+  ClutterMD2Data *data;
+  GError *error = NULL;
+  int n_instances;
+
+  clutter_init (&argc, &argv);
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s <md2file> [instances]\n", argv[0]);
+      exit (1);
+    }
+
+  n_instances = argc > 2 ? atoi (argv[2]) : 2000;
+
+  data = clutter_md2_data_new ();
+  g_object_ref_sink (data);
+
+  if (!clutter_md2_data_load (data, argv[1], &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  if (clutter_md2_data_get_n_frames (data) < 1)
+    {
+      fprintf (stderr, "%s has no frames\n", argv[1]);
+      exit (1);
+    }
+
+  stage = clutter_stage_get_default ();
+  clutter_actor_set_size (stage, COLUMNS * CELL_SIZE, 480);
+  clutter_actor_show (stage);
+
+  printf ("%-7s %9s %10s %8s %8s\n",
+          "mode", "instances", "ms/paint", "drawn", "culled");
+
+  run_actors (stage, data, n_instances);
+  run_scene (stage, data, n_instances);
+
+  g_object_unref (data);
+
+  return 0;
+}
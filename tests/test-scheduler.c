@@ -0,0 +1,256 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <clutter-md2/clutter-md2-scheduler.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Plays the first sequence of a model once on one actor and in a loop
+   on another. The record for the first actor should be removed once it
+   reaches the last frame and the scheduler's timeline should keep
+   going for the second one until it is stopped.
+
+   Then a third actor is played while it is transparent so that the
+   scheduler skips it. When it is made visible it catches up in its
+   paint and the next frame change after that should still queue a
+   redraw */
+
+#define TIMEOUT 10000
+
+static gboolean failed = FALSE;
+
+static void
+fail (const char *message)
+{
+  fprintf (stderr, "%s\n", message);
+  failed = TRUE;
+}
+
+typedef struct
+{
+  ClutterMD2Scheduler *scheduler;
+  ClutterActor *actor;
+  gboolean painted;
+  guint n_redraws;
+} CatchUpTest;
+
+static gboolean
+timeout_cb (gpointer user_data)
+{
+  fail (user_data);
+  clutter_main_quit ();
+
+  return FALSE;
+}
+
+static gboolean
+check_cb (gpointer user_data)
+{
+  ClutterMD2Scheduler *scheduler = user_data;
+
+  if (clutter_md2_scheduler_get_n_records (scheduler) > 1)
+    return TRUE;
+
+  clutter_main_quit ();
+
+  return FALSE;
+}
+
+static void
+catch_up_queue_redraw_cb (ClutterActor *actor,
+                          ClutterActor *origin,
+                          CatchUpTest  *test)
+{
+  test->n_redraws++;
+}
+
+static gboolean
+catch_up_check_cb (gpointer user_data)
+{
+  CatchUpTest *test = user_data;
+
+  if (test->n_redraws == 0)
+    fail ("No redraw was queued for the frame after catching up");
+
+  clutter_main_quit ();
+
+  return FALSE;
+}
+
+static gboolean
+catch_up_next_tick_cb (gpointer user_data)
+{
+  CatchUpTest *test = user_data;
+  ClutterMD2 *md2 = CLUTTER_MD2 (test->actor);
+  gint frame_a, frame_b, other;
+
+  /* This runs before the repaint functions of the next frame in the
+     same way as a timeline */
+  clutter_md2_get_sub_frame (md2, &frame_a, &frame_b, NULL);
+  other = frame_a == 0 ? 1 : 0;
+
+  test->n_redraws = 0;
+  clutter_md2_set_sub_frame (md2, other, other, 0.0f);
+
+  g_timeout_add (100, catch_up_check_cb, test);
+
+  return FALSE;
+}
+
+static void
+catch_up_paint_cb (ClutterActor *actor,
+                   CatchUpTest  *test)
+{
+  if (test->painted)
+    return;
+
+  test->painted = TRUE;
+
+  /* Stop the scheduler so that the only frame change is the one made
+     by the test */
+  clutter_md2_scheduler_stop (test->scheduler, CLUTTER_MD2 (actor));
+
+  g_idle_add (catch_up_next_tick_cb, test);
+}
+
+static gboolean
+catch_up_show_cb (gpointer user_data)
+{
+  CatchUpTest *test = user_data;
+
+  clutter_actor_set_opacity (test->actor, 255);
+
+  return FALSE;
+}
+
+int
+main (int argc, char **argv)
+{
+  ClutterMD2Scheduler *scheduler;
+  ClutterMD2Data *data;
+  ClutterActor *stage, *once, *loop;
+  CatchUpTest catch_up_test;
+  GEnumClass *enum_class;
+  GEnumValue *value;
+  GError *error = NULL;
+  gint frame_start, frame_end, frame_a, frame_b;
+  guint timeout_id;
+
+  clutter_init (&argc, &argv);
+
+  if (argc != 2)
+    {
+      fprintf (stderr, "usage: %s <md2file>\n", argv[0]);
+      exit (1);
+    }
+
+  enum_class = g_type_class_ref (CLUTTER_TYPE_MD2_SCHEDULER_LOOP);
+  value = g_enum_get_value (enum_class, CLUTTER_MD2_SCHEDULER_PING_PONG);
+  if (value == NULL || strcmp (value->value_nick, "ping-pong"))
+    fail ("ClutterMD2SchedulerLoop is not registered properly");
+  g_type_class_unref (enum_class);
+
+  data = clutter_md2_data_new ();
+  g_object_ref_sink (data);
+
+  if (!clutter_md2_data_load (data, argv[1], &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  if (clutter_md2_data_get_n_sequences (data) < 1
+      || !clutter_md2_data_get_sequence
+      (data, clutter_md2_data_get_sequence_name (data, 0),
+       &frame_start, &frame_end, NULL))
+    {
+      fprintf (stderr, "%s has no sequences\n", argv[1]);
+      exit (1);
+    }
+
+  stage = clutter_stage_get_default ();
+  scheduler = clutter_md2_scheduler_get_for_stage (CLUTTER_STAGE (stage));
+
+  once = clutter_md2_new ();
+  clutter_md2_set_data (CLUTTER_MD2 (once), data);
+  clutter_actor_set_size (once, 100, 100);
+  clutter_container_add_actor (CLUTTER_CONTAINER (stage), once);
+
+  loop = clutter_md2_new ();
+  clutter_md2_set_data (CLUTTER_MD2 (loop), data);
+  clutter_actor_set_size (loop, 100, 100);
+  clutter_actor_set_x (loop, 100);
+  clutter_container_add_actor (CLUTTER_CONTAINER (stage), loop);
+
+  clutter_actor_show (stage);
+
+  clutter_md2_scheduler_play_frames (scheduler, CLUTTER_MD2 (once),
+                                     frame_start, frame_end,
+                                     60.0f, CLUTTER_MD2_SCHEDULER_ONCE);
+  clutter_md2_scheduler_play_frames (scheduler, CLUTTER_MD2 (loop),
+                                     frame_start, frame_end,
+                                     60.0f, CLUTTER_MD2_SCHEDULER_LOOP);
+
+  timeout_id = g_timeout_add (TIMEOUT, timeout_cb,
+                              "Timed out waiting for the sequence to finish");
+  g_timeout_add (10, check_cb, scheduler);
+
+  clutter_main ();
+
+  g_source_remove (timeout_id);
+
+  if (clutter_md2_scheduler_is_playing (scheduler, CLUTTER_MD2 (once)))
+    fail ("The finished record was not removed");
+  if (!clutter_md2_scheduler_is_playing (scheduler, CLUTTER_MD2 (loop)))
+    fail ("The looping record was removed");
+
+  clutter_md2_get_sub_frame (CLUTTER_MD2 (once), &frame_a, &frame_b, NULL);
+  if (frame_a != frame_end || frame_b != frame_end)
+    fail ("The finished actor is not on the last frame");
+
+  clutter_md2_scheduler_stop (scheduler, CLUTTER_MD2 (loop));
+
+  if (clutter_md2_scheduler_get_n_records (scheduler) != 0)
+    fail ("Records are left after stopping");
+
+  if (clutter_md2_data_get_n_frames (data) < 2)
+    printf ("Skipping the catch up test because there is only one frame\n");
+  else
+    {
+      catch_up_test.scheduler = scheduler;
+      catch_up_test.actor = clutter_md2_new ();
+      catch_up_test.painted = FALSE;
+      catch_up_test.n_redraws = 0;
+
+      clutter_md2_set_data (CLUTTER_MD2 (catch_up_test.actor), data);
+      clutter_actor_set_size (catch_up_test.actor, 100, 100);
+      clutter_actor_set_x (catch_up_test.actor, 200);
+      clutter_actor_set_opacity (catch_up_test.actor, 0);
+      clutter_container_add_actor (CLUTTER_CONTAINER (stage),
+                                   catch_up_test.actor);
+
+      g_signal_connect (catch_up_test.actor, "queue-redraw",
+                        G_CALLBACK (catch_up_queue_redraw_cb),
+                        &catch_up_test);
+      g_signal_connect_after (catch_up_test.actor, "paint",
+                              G_CALLBACK (catch_up_paint_cb),
+                              &catch_up_test);
+
+      clutter_md2_scheduler_play_frames (scheduler,
+                                         CLUTTER_MD2 (catch_up_test.actor),
+                                         frame_start, frame_end,
+                                         60.0f, CLUTTER_MD2_SCHEDULER_LOOP);
+
+      timeout_id = g_timeout_add (TIMEOUT, timeout_cb,
+                                  "Timed out waiting for the catch up");
+      g_timeout_add (100, catch_up_show_cb, &catch_up_test);
+
+      clutter_main ();
+
+      g_source_remove (timeout_id);
+    }
+
+  g_object_unref (data);
+
+  return failed ? 1 : 0;
+}
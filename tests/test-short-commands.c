@@ -0,0 +1,160 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Writes a model whose GL commands include fans and strips with fewer
+   than three vertices and checks that it loads and that rays still
+   hit the one real strip. Run it under valgrind to check that the
+   short commands don't shrink the triangle list */
+
+#define N_VERTICES 4
+#define N_SHORT_FANS 8
+#define N_SHORT_STRIPS 2
+
+static void
+add_word (GByteArray *buf, guint32 word)
+{
+  word = GUINT32_TO_LE (word);
+  g_byte_array_append (buf, (const guint8 *) &word, sizeof (word));
+}
+
+static void
+add_float (GByteArray *buf, float value)
+{
+  guint32 word;
+
+  memcpy (&word, &value, sizeof (word));
+  add_word (buf, word);
+}
+
+static void
+add_command (GByteArray *commands, gint32 len, const guint32 *vertices)
+{
+  int i;
+
+  add_word (commands, (guint32) len);
+
+  for (i = 0; i < ABS (len); i++)
+    {
+      add_float (commands, 0.0f);
+      add_float (commands, 0.0f);
+      add_word (commands, vertices[i]);
+    }
+}
+
+static gchar *
+write_model (void)
+{
+  static const guint32 strip[] = { 0, 1, 2, 3 };
+  static const guint8 positions[N_VERTICES][3] =
+    { { 0, 0, 0 }, { 10, 0, 0 }, { 0, 10, 0 }, { 10, 10, 0 } };
+  GByteArray *commands = g_byte_array_new ();
+  GByteArray *file = g_byte_array_new ();
+  GError *error = NULL;
+  gchar *filename;
+  guint32 header_size = 17 * sizeof (guint32);
+  guint32 frame_size = 6 * sizeof (float) + 16 + N_VERTICES * 4;
+  char name[16] = "stand01";
+  int fd, i;
+
+  for (i = 0; i < N_SHORT_FANS; i++)
+    add_command (commands, -1, strip + i % N_VERTICES);
+  for (i = 0; i < N_SHORT_STRIPS; i++)
+    add_command (commands, 2, strip);
+  add_command (commands, 4, strip);
+  add_word (commands, 0);
+
+  add_word (file, 0x32504449); /* IDP2 */
+  add_word (file, 8);
+  add_word (file, 8); /* skin width */
+  add_word (file, 8); /* skin height */
+  add_word (file, frame_size);
+  add_word (file, 0); /* skins */
+  add_word (file, N_VERTICES);
+  add_word (file, 0); /* texture coordinates */
+  add_word (file, 0); /* triangles */
+  add_word (file, commands->len / sizeof (guint32));
+  add_word (file, 1); /* frames */
+  add_word (file, header_size); /* skins */
+  add_word (file, header_size); /* texture coordinates */
+  add_word (file, header_size); /* triangles */
+  add_word (file, header_size); /* frames */
+  add_word (file, header_size + frame_size); /* GL commands */
+  add_word (file, header_size + frame_size + commands->len);
+
+  for (i = 0; i < 3; i++)
+    add_float (file, 1.0f);
+  for (i = 0; i < 3; i++)
+    add_float (file, 0.0f);
+  g_byte_array_append (file, (const guint8 *) name, sizeof (name));
+
+  for (i = 0; i < N_VERTICES; i++)
+    {
+      g_byte_array_append (file, positions[i], 3);
+      g_byte_array_append (file, (const guint8 *) "\0", 1);
+    }
+
+  g_byte_array_append (file, commands->data, commands->len);
+
+  if ((fd = g_file_open_tmp ("short-commands-XXXXXX.md2", &filename,
+                             &error)) == -1)
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  if (write (fd, file->data, file->len) != file->len)
+    {
+      fprintf (stderr, "Failed to write %s\n", filename);
+      exit (1);
+    }
+
+  close (fd);
+
+  g_byte_array_free (commands, TRUE);
+  g_byte_array_free (file, TRUE);
+
+  return filename;
+}
+
+int
+main (int argc, char **argv)
+{
+  ClutterMD2Data *data;
+  ClutterMD2DataRay ray = { { 7.0f, 7.0f, 10.0f }, { 0.0f, 0.0f, -1.0f } };
+  ClutterMD2DataHit hit;
+  GError *error = NULL;
+  gchar *filename;
+  int ret = 0;
+
+  clutter_init (&argc, &argv);
+
+  filename = write_model ();
+
+  data = clutter_md2_data_new ();
+  g_object_ref_sink (data);
+  clutter_md2_data_set_upload_skins (data, FALSE);
+
+  if (!clutter_md2_data_load (data, filename, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      ret = 1;
+    }
+  else if (!clutter_md2_data_ray_intersect (data, 0, 0, 0.0f, &ray, &hit))
+    {
+      fprintf (stderr, "The ray missed the strip\n");
+      ret = 1;
+    }
+  else
+    printf ("hit triangle %i at %.1f\n", hit.triangle, hit.distance);
+
+  g_object_unref (data);
+  g_unlink (filename);
+  g_free (filename);
+
+  return ret;
+}
@@ -0,0 +1,118 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* Draws the model with each of its skins in turn and reports how
+   much texture memory stays resident without a budget and with a
+   budget that only fits about half of the skins */
+
+#define N_PAINTS 100
+
+typedef struct _BudgetState BudgetState;
+
+struct _BudgetState
+{
+  ClutterMD2Data *data;
+  int paint;
+};
+
+static void
+on_paint (ClutterActor *stage, BudgetState *state)
+{
+  ClutterGeometry geom = { 0, 0, 256, 256 };
+  int n_skins = clutter_md2_data_get_n_skins (state->data);
+
+  clutter_md2_data_render (state->data, 0, 0, 0.0f,
+                           state->paint % n_skins, &geom);
+}
+
+static void
+run_budget (ClutterActor *stage, BudgetState *state, gsize budget)
+{
+  gsize resident_bytes;
+  guint n_uploads, n_evictions;
+  GTimer *timer;
+  double paint_time;
+
+  clutter_md2_data_set_skin_texture_budget (budget);
+
+  timer = g_timer_new ();
+
+  for (state->paint = 0; state->paint < N_PAINTS; state->paint++)
+    clutter_redraw (CLUTTER_STAGE (stage));
+
+  paint_time = g_timer_elapsed (timer, NULL);
+
+  clutter_md2_data_get_skin_residency_stats (&resident_bytes,
+                                             &n_uploads, &n_evictions);
+
+  printf ("%-10lu %10.3f %10lu %8u %10u\n",
+          (unsigned long) budget,
+          paint_time * 1000.0 / N_PAINTS,
+          (unsigned long) resident_bytes,
+          n_uploads, n_evictions);
+
+  g_timer_destroy (timer);
+}
+
+int
+main (int argc, char **argv)
+{
+  ClutterActor *stage;
+  BudgetState state;
+  GError *error = NULL;
+  gsize total_bytes;
+  int i;
+
+  clutter_init (&argc, &argv);
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s <md2file> [skin]...\n", argv[0]);
+      exit (1);
+    }
+
+  stage = clutter_stage_get_default ();
+  clutter_actor_show (stage);
+
+  state.data = clutter_md2_data_new ();
+  g_object_ref_sink (state.data);
+
+  if (!clutter_md2_data_load (state.data, argv[1], &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  for (i = 2; i < argc; i++)
+    if (!clutter_md2_data_add_skin (state.data, argv[i], &error))
+      {
+        fprintf (stderr, "%s\n", error->message);
+        exit (1);
+      }
+
+  if (clutter_md2_data_get_n_skins (state.data) < 1)
+    {
+      fprintf (stderr, "%s has no skins\n", argv[1]);
+      exit (1);
+    }
+
+  /* Nothing is uploaded until the skins are drawn */
+  total_bytes = clutter_md2_data_get_skin_texture_bytes (state.data);
+
+  g_signal_connect_after (stage, "paint", G_CALLBACK (on_paint), &state);
+
+  printf ("%i skins using %lu bytes\n",
+          clutter_md2_data_get_n_skins (state.data),
+          (unsigned long) total_bytes);
+  printf ("%-10s %10s %10s %8s %10s\n",
+          "budget", "ms/paint", "resident", "uploads", "evictions");
+
+  run_budget (stage, &state, 0);
+  run_budget (stage, &state, total_bytes / 2);
+
+  g_object_unref (state.data);
+
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* Loads each model given on the command line several times and
+   reports how many skin textures ended up being shared */
+
+#define N_COPIES 4
+
+int
+main (int argc, char **argv)
+{
+  GPtrArray *models;
+  GTimer *timer;
+  guint n_textures, n_hits;
+  gsize bytes_saved;
+  int i, copy;
+
+  clutter_init (&argc, &argv);
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s <md2file>...\n", argv[0]);
+      exit (1);
+    }
+
+  models = g_ptr_array_new ();
+
+  printf ("%-6s %8s %8s %6s %12s\n",
+          "copy", "load ms", "textures", "hits", "bytes saved");
+
+  timer = g_timer_new ();
+
+  for (copy = 0; copy < N_COPIES; copy++)
+    {
+      g_timer_start (timer);
+
+      for (i = 1; i < argc; i++)
+        {
+          ClutterMD2Data *data = clutter_md2_data_new ();
+          GError *error = NULL;
+
+          g_object_ref_sink (data);
+
+          if (!clutter_md2_data_load (data, argv[i], &error))
+            {
+              fprintf (stderr, "%s\n", error->message);
+              exit (1);
+            }
+
+          g_ptr_array_add (models, data);
+        }
+
+      clutter_md2_data_get_skin_cache_stats (&n_textures, &n_hits,
+                                             &bytes_saved);
+
+      printf ("%-6i %8.1f %8u %6u %12lu\n",
+              copy, g_timer_elapsed (timer, NULL) * 1000.0,
+              n_textures, n_hits, (unsigned long) bytes_saved);
+    }
+
+  for (i = 0; i < models->len; i++)
+    g_object_unref (g_ptr_array_index (models, i));
+  g_ptr_array_free (models, TRUE);
+
+  clutter_md2_data_get_skin_cache_stats (&n_textures, NULL, NULL);
+  printf ("%u textures left after unloading\n", n_textures);
+
+  g_timer_destroy (timer);
+
+  return 0;
+}
@@ -0,0 +1,135 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* Loads a model and draws it once with its skins decoded straight
+   away and again with progressive skins. For the progressive load it
+   also reports how long it takes until every skin has been swapped
+   in at full size */
+
+typedef struct _ProgressiveState ProgressiveState;
+
+struct _ProgressiveState
+{
+  ClutterMD2Data *data;
+  GTimer *timer;
+  double first_paint;
+  GMainLoop *loop;
+};
+
+static void
+on_paint (ClutterActor *stage, ProgressiveState *state)
+{
+  ClutterGeometry geom = { 0, 0, 256, 256 };
+
+  clutter_md2_data_render (state->data, 0, 0, 0.0f, 0, &geom);
+}
+
+static int
+count_loading_skins (ClutterMD2Data *data)
+{
+  int i, n_loading = 0;
+
+  for (i = 0; i < clutter_md2_data_get_n_skins (data); i++)
+    if (clutter_md2_data_is_skin_loading (data, i))
+      n_loading++;
+
+  return n_loading;
+}
+
+static void
+on_skin_changed (ClutterMD2Data *data, gint skin_num,
+                 ProgressiveState *state)
+{
+  if (count_loading_skins (data) == 0)
+    g_main_loop_quit (state->loop);
+}
+
+static void
+run_load (ClutterActor *stage, int argc, char **argv, gboolean progressive)
+{
+  ProgressiveState state;
+  GError *error = NULL;
+  gulong handler;
+  int i;
+
+  state.timer = g_timer_new ();
+
+  state.data = clutter_md2_data_new ();
+  g_object_ref_sink (state.data);
+  clutter_md2_data_set_progressive_skins (state.data, progressive);
+
+  if (!clutter_md2_data_load (state.data, argv[1], &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  for (i = 2; i < argc; i++)
+    if (!clutter_md2_data_add_skin (state.data, argv[i], &error))
+      {
+        fprintf (stderr, "%s\n", error->message);
+        exit (1);
+      }
+
+  if (clutter_md2_data_get_n_skins (state.data) < 1)
+    {
+      fprintf (stderr, "%s has no skins\n", argv[1]);
+      exit (1);
+    }
+
+  handler = g_signal_connect_after (stage, "paint",
+                                    G_CALLBACK (on_paint), &state);
+  clutter_redraw (CLUTTER_STAGE (stage));
+  state.first_paint = g_timer_elapsed (state.timer, NULL);
+
+  /* Wait for the background decoding to finish */
+  if (count_loading_skins (state.data) > 0)
+    {
+      state.loop = g_main_loop_new (NULL, FALSE);
+      g_signal_connect (state.data, "skin-changed",
+                        G_CALLBACK (on_skin_changed), &state);
+      g_main_loop_run (state.loop);
+      g_main_loop_unref (state.loop);
+
+      /* Draw the full size skin */
+      clutter_redraw (CLUTTER_STAGE (stage));
+    }
+
+  printf ("%-12s %14.3f %14.3f\n",
+          progressive ? "progressive" : "immediate",
+          state.first_paint * 1000.0,
+          g_timer_elapsed (state.timer, NULL) * 1000.0);
+
+  g_signal_handler_disconnect (stage, handler);
+  g_object_unref (state.data);
+  g_timer_destroy (state.timer);
+}
+
+int
+main (int argc, char **argv)
+{
+  ClutterActor *stage;
+
+  /* The skins are decoded in a thread pool */
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
+  clutter_init (&argc, &argv);
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s <md2file> [skin]...\n", argv[0]);
+      exit (1);
+    }
+
+  stage = clutter_stage_get_default ();
+  clutter_actor_show (stage);
+
+  printf ("%-12s %14s %14s\n", "skins", "first paint ms", "full size ms");
+
+  run_load (stage, argc, argv, FALSE);
+  run_load (stage, argc, argv, TRUE);
+
+  return 0;
+}
@@ -0,0 +1,121 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* Measures how long it takes to load a model and its skins without
+   the on-disk skin cache, with an empty cache and with a cache that
+   already contains the skins. Each is tried with and without
+   mipmaps, which are stored in the cache as well */
+
+#define N_LOADS 10
+
+static void
+empty_dir (const char *dir_name)
+{
+  GDir *dir;
+  const gchar *name;
+
+  if ((dir = g_dir_open (dir_name, 0, NULL)) == NULL)
+    return;
+
+  while ((name = g_dir_read_name (dir)))
+    {
+      gchar *path = g_build_filename (dir_name, name, NULL);
+      g_unlink (path);
+      g_free (path);
+    }
+
+  g_dir_close (dir);
+}
+
+static double
+load_model (int argc, char **argv, gboolean mipmap)
+{
+  ClutterMD2Data *data;
+  GError *error = NULL;
+  GTimer *timer;
+  double elapsed;
+  int i;
+
+  data = clutter_md2_data_new ();
+  g_object_ref_sink (data);
+  clutter_md2_data_set_mipmap_skins (data, mipmap);
+
+  timer = g_timer_new ();
+
+  if (!clutter_md2_data_load (data, argv[1], &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  for (i = 2; i < argc; i++)
+    if (!clutter_md2_data_add_skin (data, argv[i], &error))
+      {
+        fprintf (stderr, "%s\n", error->message);
+        exit (1);
+      }
+
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  g_timer_destroy (timer);
+
+  /* Dropping the model also drops the skins from the in-memory cache
+     so that the next load has to go to the disk again */
+  g_object_unref (data);
+
+  return elapsed;
+}
+
+int
+main (int argc, char **argv)
+{
+  double none_time[2] = { 0.0, 0.0 };
+  double cold_time[2] = { 0.0, 0.0 };
+  double warm_time[2] = { 0.0, 0.0 };
+  gchar *cache_dir, *dir_name;
+  int i, mipmap;
+
+  clutter_init (&argc, &argv);
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s <md2file> [skin]...\n", argv[0]);
+      exit (1);
+    }
+
+  dir_name = g_strdup_printf ("clutter-md2-skin-startup-%i", (int) getpid ());
+  cache_dir = g_build_filename (g_get_tmp_dir (), dir_name, NULL);
+  g_free (dir_name);
+
+  for (i = 0; i < N_LOADS; i++)
+    for (mipmap = 0; mipmap < 2; mipmap++)
+      {
+        clutter_md2_data_set_skin_cache_dir (NULL);
+        none_time[mipmap] += load_model (argc, argv, mipmap);
+
+        clutter_md2_data_set_skin_cache_dir (cache_dir);
+        empty_dir (cache_dir);
+        cold_time[mipmap] += load_model (argc, argv, mipmap);
+
+        /* The cold load has just filled the cache */
+        warm_time[mipmap] += load_model (argc, argv, mipmap);
+      }
+
+  printf ("%-8s %10s %10s\n", "cache", "load ms", "mipmap ms");
+  printf ("%-8s %10.3f %10.3f\n", "none",
+          none_time[0] * 1000.0 / N_LOADS, none_time[1] * 1000.0 / N_LOADS);
+  printf ("%-8s %10.3f %10.3f\n", "cold",
+          cold_time[0] * 1000.0 / N_LOADS, cold_time[1] * 1000.0 / N_LOADS);
+  printf ("%-8s %10.3f %10.3f\n", "warm",
+          warm_time[0] * 1000.0 / N_LOADS, warm_time[1] * 1000.0 / N_LOADS);
+
+  empty_dir (cache_dir);
+  g_rmdir (cache_dir);
+  g_free (cache_dir);
+
+  return 0;
+}
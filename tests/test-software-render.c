@@ -0,0 +1,119 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define N_FRAMES 100
+
+/* Renders a model into a PNG without using GL so that it can be run
+   on machines without a GPU. It also reports how many frames per
+   second the software renderer can draw */
+
+static void
+clear_buffer (ClutterMD2DataBuffer *buffer)
+{
+  int i;
+
+  memset (buffer->pixels, 0, buffer->rowstride * buffer->height);
+
+  for (i = buffer->width * buffer->height - 1; i >= 0; i--)
+    buffer->depth[i] = -G_MAXFLOAT;
+}
+
+int
+main (int argc, char **argv)
+{
+  ClutterMD2Data *data;
+  ClutterMD2DataBuffer buffer;
+  ClutterGeometry geom;
+  GdkPixbuf *pixbuf;
+  GError *error = NULL;
+  GTimer *timer;
+  int i, n_frames, size = 256;
+
+  g_type_init ();
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
+
+  if (argc < 3)
+    {
+      fprintf (stderr, "usage: %s <md2file> <output.png> [size]\n", argv[0]);
+      exit (1);
+    }
+
+  if (argc > 3)
+    size = MAX (1, atoi (argv[3]));
+
+  data = clutter_md2_data_new ();
+  g_object_ref_sink (data);
+
+  /* There is no GL context so the skins must only be kept in
+     memory */
+  g_object_set (data,
+                "upload_skins", FALSE,
+                "keep_skin_pixels", TRUE,
+                NULL);
+
+  if (!clutter_md2_data_load (data, argv[1], &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  n_frames = clutter_md2_data_get_n_frames (data);
+
+  buffer.width = size;
+  buffer.height = size;
+  buffer.rowstride = size * 4;
+  buffer.pixels = g_malloc (buffer.rowstride * buffer.height);
+  buffer.depth = g_new (gfloat, buffer.width * buffer.height);
+
+  geom.x = 0;
+  geom.y = 0;
+  geom.width = size;
+  geom.height = size;
+
+  clear_buffer (&buffer);
+
+  if (!clutter_md2_data_render_software (data, 0, 0, 0.0f, 0,
+                                         &geom, &buffer))
+    {
+      fprintf (stderr, "The model has no skins to render with\n");
+      exit (1);
+    }
+
+  pixbuf = gdk_pixbuf_new_from_data (buffer.pixels, GDK_COLORSPACE_RGB,
+                                     TRUE, 8,
+                                     buffer.width, buffer.height,
+                                     buffer.rowstride,
+                                     NULL, NULL);
+  if (!gdk_pixbuf_save (pixbuf, argv[2], "png", &error, NULL))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+  g_object_unref (pixbuf);
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < N_FRAMES; i++)
+    {
+      clear_buffer (&buffer);
+      clutter_md2_data_render_software (data,
+                                        i % n_frames, (i + 1) % n_frames,
+                                        0.5f, 0,
+                                        &geom, &buffer);
+    }
+
+  printf ("%ix%i: %.1f frames/s\n", size, size,
+          N_FRAMES / g_timer_elapsed (timer, NULL));
+
+  g_timer_destroy (timer);
+  g_free (buffer.pixels);
+  g_free (buffer.depth);
+  g_object_unref (data);
+
+  return 0;
+}
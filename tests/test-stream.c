@@ -0,0 +1,120 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define N_LOOPS 3
+#define SIZE    128
+
+/* Plays every sequence of a model through the software renderer with
+   the frames streamed from the file under a small budget and reports
+   how often frames had to be read while they were needed compared to
+   being read ahead in the background */
+
+static void
+clear_buffer (ClutterMD2DataBuffer *buffer)
+{
+  int i;
+
+  memset (buffer->pixels, 0, buffer->rowstride * buffer->height);
+
+  for (i = buffer->width * buffer->height - 1; i >= 0; i--)
+    buffer->depth[i] = -G_MAXFLOAT;
+}
+
+int
+main (int argc, char **argv)
+{
+  ClutterMD2Data *data;
+  ClutterMD2DataBuffer buffer;
+  ClutterGeometry geom;
+  GError *error = NULL;
+  GTimer *timer;
+  gsize resident_bytes;
+  guint budget = 64 * 1024, n_page_ins, n_prefetched;
+  int i, loop, frame, n_sequences, n_draws = 0;
+
+  g_type_init ();
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
+
+  if (argc < 2 || argc > 3)
+    {
+      fprintf (stderr, "usage: %s <md2file> [budget]\n", argv[0]);
+      exit (1);
+    }
+
+  if (argc > 2)
+    budget = MAX (atoi (argv[2]), 1);
+
+  data = clutter_md2_data_new ();
+  g_object_ref_sink (data);
+
+  g_object_set (data,
+                "upload_skins", FALSE,
+                "keep_skin_pixels", TRUE,
+                "frame_budget", budget,
+                NULL);
+
+  if (!clutter_md2_data_load (data, argv[1], &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  buffer.width = SIZE;
+  buffer.height = SIZE;
+  buffer.rowstride = SIZE * 4;
+  buffer.pixels = g_malloc (buffer.rowstride * buffer.height);
+  buffer.depth = g_new (gfloat, buffer.width * buffer.height);
+
+  geom.x = 0;
+  geom.y = 0;
+  geom.width = SIZE;
+  geom.height = SIZE;
+
+  n_sequences = clutter_md2_data_get_n_sequences (data);
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < n_sequences; i++)
+    {
+      const gchar *name = clutter_md2_data_get_sequence_name (data, i);
+      gint frame_start, frame_end;
+
+      clutter_md2_data_get_sequence (data, name,
+                                     &frame_start, &frame_end, NULL);
+
+      for (loop = 0; loop < N_LOOPS; loop++)
+        for (frame = frame_start; frame <= frame_end; frame++)
+          {
+            int next = frame < frame_end ? frame + 1 : frame_start;
+
+            clear_buffer (&buffer);
+            clutter_md2_data_render_software (data, frame, next, 0.5f, 0,
+                                              &geom, &buffer);
+            n_draws++;
+
+            /* Give the read-ahead a chance to finish as it would
+               between paints */
+            while (g_main_context_pending (NULL))
+              g_main_context_iteration (NULL, FALSE);
+          }
+    }
+
+  clutter_md2_data_get_stream_stats (data, &resident_bytes,
+                                     &n_page_ins, &n_prefetched);
+
+  printf ("budget %u bytes: %i draws, %.1f draws/s\n"
+          "%lu bytes resident, %u page-ins, %u frames read ahead\n",
+          budget, n_draws, n_draws / g_timer_elapsed (timer, NULL),
+          (unsigned long) resident_bytes, n_page_ins, n_prefetched);
+
+  g_timer_destroy (timer);
+  g_free (buffer.pixels);
+  g_free (buffer.depth);
+  g_object_unref (data);
+
+  return 0;
+}
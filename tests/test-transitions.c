@@ -0,0 +1,111 @@
+#include <clutter/clutter.h>
+#include <clutter-md2/clutter-md2.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* Checks which frame changes start a transition. Skipping frames and
+   looping back to the start of a sequence should carry on without
+   one but jumping to a different sequence should blend into it */
+
+static gboolean failed = FALSE;
+
+static void
+check (ClutterMD2 *md2, const char *what, gboolean expected)
+{
+  gboolean in_transition = clutter_md2_is_in_transition (md2);
+
+  printf ("%-28s %s\n", what, in_transition ? "transition" : "continuous");
+
+  if (in_transition != expected)
+    {
+      fprintf (stderr, "%s should%s start a transition\n",
+               what, expected ? "" : " not");
+      failed = TRUE;
+    }
+}
+
+/* Finds a sequence with at least min_frames frames that doesn't start
+   at not_start */
+static gboolean
+find_sequence (ClutterMD2Data *data, int min_frames, gint not_start,
+               gint *frame_start, gint *frame_end)
+{
+  int i;
+
+  for (i = 0; i < clutter_md2_data_get_n_sequences (data); i++)
+    if (clutter_md2_data_get_sequence
+        (data, clutter_md2_data_get_sequence_name (data, i),
+         frame_start, frame_end, NULL)
+        && *frame_end - *frame_start + 1 >= min_frames
+        && *frame_start != not_start)
+      return TRUE;
+
+  return FALSE;
+}
+
+int
+main (int argc, char **argv)
+{
+  ClutterMD2Data *data;
+  ClutterActor *md2;
+  GError *error = NULL;
+  gint start, end, other_start, other_end;
+
+  clutter_init (&argc, &argv);
+
+  if (argc != 2)
+    {
+      fprintf (stderr, "usage: %s <md2file>\n", argv[0]);
+      exit (1);
+    }
+
+  data = clutter_md2_data_new ();
+  g_object_ref_sink (data);
+
+  if (!clutter_md2_data_load (data, argv[1], &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      exit (1);
+    }
+
+  if (!find_sequence (data, 4, -1, &start, &end))
+    {
+      fprintf (stderr, "%s has no sequence with at least 4 frames\n",
+               argv[1]);
+      exit (1);
+    }
+
+  md2 = clutter_md2_new ();
+  g_object_ref_sink (md2);
+  clutter_md2_set_data (CLUTTER_MD2 (md2), data);
+  clutter_md2_set_current_frame (CLUTTER_MD2 (md2), start);
+  clutter_md2_set_transition_duration (CLUTTER_MD2 (md2), 1000);
+
+  clutter_md2_set_sub_frame (CLUTTER_MD2 (md2), start, start + 1, 0.5f);
+  check (CLUTTER_MD2 (md2), "next frame", FALSE);
+
+  /* A slow frame rate or a dropped tick */
+  clutter_md2_set_sub_frame (CLUTTER_MD2 (md2), start + 3, start + 4 > end
+                             ? start : start + 4, 0.25f);
+  check (CLUTTER_MD2 (md2), "skipped frames", FALSE);
+
+  /* The animate behaviour goes from the last frame to the start */
+  clutter_md2_set_sub_frame (CLUTTER_MD2 (md2), end, end, 0.0f);
+  clutter_md2_set_sub_frame (CLUTTER_MD2 (md2), start, start + 1, 0.1f);
+  check (CLUTTER_MD2 (md2), "loop wrap", FALSE);
+
+  if (find_sequence (data, 1, start, &other_start, &other_end))
+    {
+      clutter_md2_set_current_frame (CLUTTER_MD2 (md2), other_start);
+      check (CLUTTER_MD2 (md2), "other sequence", TRUE);
+
+      /* Jumping again part way through blends from the blended pose */
+      clutter_md2_set_current_frame (CLUTTER_MD2 (md2), start);
+      check (CLUTTER_MD2 (md2), "jump during transition", TRUE);
+    }
+
+  g_object_unref (md2);
+  g_object_unref (data);
+
+  return failed ? 1 : 0;
+}
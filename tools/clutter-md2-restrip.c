@@ -0,0 +1,941 @@
+/*
+ * Clutter-MD2.
+ *
+ * A Clutter actor to render MD2 models
+ *
+ * Copyright (C) 2010 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Offline tool to rewrite the GL command section of an MD2 file.
+
+   The existing strips and fans are broken back down into triangles,
+   the triangles are reordered for the post-transform vertex cache
+   using Tom Forsyth's linear-speed algorithm and then they are
+   greedily rebuilt into strips that follow that order. Unless
+   --no-join is given the strips are then stitched together with
+   degenerate triangles so that the whole model can be drawn with a
+   very small number of commands. Only the GL command section is
+   changed so the result can still be read by any MD2 loader. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MD2_FORMAT_MAGIC    0x32504449 /* IDP2 */
+#define MD2_FORMAT_VERSION  8
+
+#define MD2_SKIN_NAME_SIZE  64
+#define MD2_TEX_COORD_SIZE  (sizeof (gint16) * 2)
+#define MD2_TRIANGLE_SIZE   (sizeof (guint16) * 6)
+
+/* Forsyth's tuning constants */
+#define CACHE_DECAY_POWER   1.5f
+#define LAST_TRI_SCORE      0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+enum
+  {
+    HEADER_MAGIC,
+    HEADER_VERSION,
+    HEADER_SKIN_WIDTH,
+    HEADER_SKIN_HEIGHT,
+    HEADER_FRAME_SIZE,
+    HEADER_NUM_SKINS,
+    HEADER_NUM_VERTICES,
+    HEADER_NUM_TEX_COORDS,
+    HEADER_NUM_TRIANGLES,
+    HEADER_NUM_GL_COMMANDS,
+    HEADER_NUM_FRAMES,
+    HEADER_OFFSET_SKINS,
+    HEADER_OFFSET_TEX_COORDS,
+    HEADER_OFFSET_TRIANGLES,
+    HEADER_OFFSET_FRAMES,
+    HEADER_OFFSET_GL_COMMANDS,
+    HEADER_OFFSET_END,
+    HEADER_COUNT
+  };
+
+typedef struct _Corner Corner;
+typedef struct _Mesh Mesh;
+typedef struct _Stats Stats;
+
+/* A GL command vertex. Two commands refer to the same vertex only if
+   the texture coordinates and the vertex number all match */
+struct _Corner
+{
+  guint32 s, t;
+  guint32 vertex_num;
+};
+
+struct _Mesh
+{
+  /* Unique corners */
+  Corner *corners;
+  int num_corners;
+
+  /* Three corner indices per triangle in their original winding */
+  int *triangles;
+  int num_triangles;
+
+  /* For each corner, the list of triangles using it. This is stored
+     as an index into corner_tris for each corner */
+  int *corner_tri_start;
+  int *corner_tris;
+};
+
+struct _Stats
+{
+  int draw_calls;
+  int vertices;
+  int triangles;
+  float acmr;
+};
+
+static int cache_size = 16;
+static gboolean no_join = FALSE;
+
+static GOptionEntry options[] =
+  {
+    { "cache-size", 'c', 0, G_OPTION_ARG_INT, &cache_size,
+      "Size of the simulated vertex cache (default 16)", "N" },
+    { "no-join", 'n', 0, G_OPTION_ARG_NONE, &no_join,
+      "Don't join the strips with degenerate triangles", NULL },
+    { NULL }
+  };
+
+static guint
+corner_hash (gconstpointer key)
+{
+  const Corner *corner = key;
+
+  return (corner->s * 31 + corner->t) * 31 + corner->vertex_num;
+}
+
+static gboolean
+corner_equal (gconstpointer a, gconstpointer b)
+{
+  const Corner *ca = a, *cb = b;
+
+  return (ca->s == cb->s && ca->t == cb->t
+          && ca->vertex_num == cb->vertex_num);
+}
+
+static guint32
+read_uint32 (const guchar *p)
+{
+  guint32 v;
+
+  memcpy (&v, p, sizeof (v));
+
+  return GUINT32_FROM_LE (v);
+}
+
+static void
+write_uint32 (guchar *p, guint32 v)
+{
+  v = GUINT32_TO_LE (v);
+  memcpy (p, &v, sizeof (v));
+}
+
+/* Breaks the GL command block down into a list of unique corners
+   and a list of triangles. Returns FALSE if the commands are
+   invalid */
+static gboolean
+mesh_load (Mesh *mesh, const guchar *commands, gsize byte_len,
+           guint32 num_vertices, Stats *stats)
+{
+  const guchar *p, *end = commands + byte_len;
+  GHashTable *corner_table;
+  int total_corners = 0, max_triangles = 0;
+  int *command_corners = NULL;
+  int command_corners_size = 0;
+  int i;
+
+  memset (stats, 0, sizeof (Stats));
+
+  /* Do a first pass to validate the commands and count the corners
+     so that the corner array will never need to be reallocated */
+  for (p = commands; ; )
+    {
+      gint32 command_len;
+
+      if (p + sizeof (gint32) > end)
+        return FALSE;
+
+      command_len = (gint32) read_uint32 (p);
+      p += sizeof (gint32);
+
+      if (command_len == 0)
+        break;
+
+      command_len = ABS (command_len);
+
+      if ((end - p) / (sizeof (guint32) * 3) < command_len)
+        return FALSE;
+
+      /* Commands with fewer than three vertices don't draw anything.
+         The library accepts them so they are just dropped */
+      if (command_len < 3)
+        {
+          p += command_len * sizeof (guint32) * 3;
+          continue;
+        }
+
+      for (i = 0; i < command_len; i++)
+        if (read_uint32 (p + i * sizeof (guint32) * 3 + sizeof (guint32) * 2)
+            >= num_vertices)
+          return FALSE;
+
+      total_corners += command_len;
+      max_triangles += command_len - 2;
+      p += command_len * sizeof (guint32) * 3;
+    }
+
+  mesh->corners = g_new (Corner, MAX (total_corners, 1));
+  mesh->num_corners = 0;
+  mesh->triangles = g_new (int, MAX (max_triangles, 1) * 3);
+  mesh->num_triangles = 0;
+
+  corner_table = g_hash_table_new (corner_hash, corner_equal);
+
+  for (p = commands; ; )
+    {
+      gint32 command_len = (gint32) read_uint32 (p);
+      gboolean is_fan = command_len < 0;
+
+      p += sizeof (gint32);
+
+      if (command_len == 0)
+        break;
+
+      command_len = ABS (command_len);
+
+      if (command_len < 3)
+        {
+          p += command_len * sizeof (guint32) * 3;
+          continue;
+        }
+
+      if (command_len > command_corners_size)
+        command_corners = g_renew (int, command_corners,
+                                   (command_corners_size = command_len));
+
+      for (i = 0; i < command_len; i++)
+        {
+          Corner *corner = mesh->corners + mesh->num_corners;
+          gpointer value;
+
+          corner->s = read_uint32 (p);
+          corner->t = read_uint32 (p + sizeof (guint32));
+          corner->vertex_num = read_uint32 (p + sizeof (guint32) * 2);
+          p += sizeof (guint32) * 3;
+
+          if ((value = g_hash_table_lookup (corner_table, corner)))
+            command_corners[i] = GPOINTER_TO_INT (value) - 1;
+          else
+            {
+              command_corners[i] = mesh->num_corners++;
+              g_hash_table_insert (corner_table, corner,
+                                   GINT_TO_POINTER (mesh->num_corners));
+            }
+        }
+
+      for (i = 0; i + 2 < command_len; i++)
+        {
+          int *tri = mesh->triangles + mesh->num_triangles * 3;
+
+          if (is_fan)
+            {
+              tri[0] = command_corners[0];
+              tri[1] = command_corners[i + 1];
+              tri[2] = command_corners[i + 2];
+            }
+          else if ((i & 1))
+            {
+              tri[0] = command_corners[i + 1];
+              tri[1] = command_corners[i];
+              tri[2] = command_corners[i + 2];
+            }
+          else
+            {
+              tri[0] = command_corners[i];
+              tri[1] = command_corners[i + 1];
+              tri[2] = command_corners[i + 2];
+            }
+
+          /* Skip degenerate triangles. They will be regenerated if
+             the strips need to be joined again */
+          if (tri[0] != tri[1] && tri[1] != tri[2] && tri[2] != tri[0])
+            mesh->num_triangles++;
+        }
+
+      stats->draw_calls++;
+      stats->vertices += command_len;
+    }
+
+  g_hash_table_destroy (corner_table);
+  g_free (command_corners);
+
+  /* Build the corner to triangle adjacency lists */
+  mesh->corner_tri_start = g_new0 (int, mesh->num_corners + 1);
+  mesh->corner_tris = g_new (int, MAX (mesh->num_triangles * 3, 1));
+
+  for (i = 0; i < mesh->num_triangles * 3; i++)
+    mesh->corner_tri_start[mesh->triangles[i] + 1]++;
+  for (i = 0; i < mesh->num_corners; i++)
+    mesh->corner_tri_start[i + 1] += mesh->corner_tri_start[i];
+  {
+    int *fill = g_new (int, mesh->num_corners + 1);
+
+    memcpy (fill, mesh->corner_tri_start,
+            sizeof (int) * (mesh->num_corners + 1));
+
+    for (i = 0; i < mesh->num_triangles * 3; i++)
+      mesh->corner_tris[fill[mesh->triangles[i]]++] = i / 3;
+
+    g_free (fill);
+  }
+
+  stats->triangles = mesh->num_triangles;
+
+  return TRUE;
+}
+
+static void
+mesh_free (Mesh *mesh)
+{
+  g_free (mesh->corners);
+  g_free (mesh->triangles);
+  g_free (mesh->corner_tri_start);
+  g_free (mesh->corner_tris);
+}
+
+/* Simulates a FIFO post-transform cache over a stream of corner
+   indices and returns the number of misses */
+static int
+simulate_cache (const int *stream, int length, int num_corners)
+{
+  /* For each corner the number of the cache insert it was last
+     added with so that the lookup is constant time */
+  int *inserted_at = g_new (int, num_corners);
+  int inserts = 0, i;
+
+  for (i = 0; i < num_corners; i++)
+    inserted_at[i] = -cache_size - 1;
+
+  for (i = 0; i < length; i++)
+    if (inserts - inserted_at[stream[i]] > cache_size)
+      inserted_at[stream[i]] = inserts++;
+
+  g_free (inserted_at);
+
+  return inserts;
+}
+
+static float
+forsyth_vertex_score (int cache_pos, int remaining_tris)
+{
+  float score = 0.0f;
+
+  if (remaining_tris == 0)
+    return -1.0f;
+
+  if (cache_pos >= 0)
+    {
+      if (cache_pos < 3)
+        score = LAST_TRI_SCORE;
+      else
+        score = powf (1.0f - (cache_pos - 3) / (float) (cache_size - 3),
+                      CACHE_DECAY_POWER);
+    }
+
+  return score + VALENCE_BOOST_SCALE * powf (remaining_tris,
+                                             -VALENCE_BOOST_POWER);
+}
+
+/* Returns a new array with the triangle numbers in an order that
+   makes good use of the vertex cache */
+static int *
+forsyth_order (const Mesh *mesh)
+{
+  int lru_size = cache_size + 3;
+  int *order = g_new (int, MAX (mesh->num_triangles, 1));
+  int *remaining = g_new (int, mesh->num_corners);
+  int *cache_pos = g_new (int, mesh->num_corners);
+  float *vertex_score = g_new (float, mesh->num_corners);
+  float *tri_score = g_new (float, MAX (mesh->num_triangles, 1));
+  gboolean *added = g_new0 (gboolean, MAX (mesh->num_triangles, 1));
+  int *lru = g_new (int, lru_size + 3);
+  int lru_len = 0;
+  int best_tri = -1, next_scan = 0;
+  int n, i, j;
+
+  for (i = 0; i < mesh->num_corners; i++)
+    {
+      remaining[i] = (mesh->corner_tri_start[i + 1]
+                      - mesh->corner_tri_start[i]);
+      cache_pos[i] = -1;
+      vertex_score[i] = forsyth_vertex_score (-1, remaining[i]);
+    }
+
+  for (i = 0; i < mesh->num_triangles; i++)
+    {
+      const int *tri = mesh->triangles + i * 3;
+
+      tri_score[i] = (vertex_score[tri[0]] + vertex_score[tri[1]]
+                      + vertex_score[tri[2]]);
+    }
+
+  for (n = 0; n < mesh->num_triangles; n++)
+    {
+      const int *tri;
+      float best_score;
+
+      /* If none of the triangles touching the cache are available
+         then fall back to the best remaining triangle */
+      if (best_tri == -1)
+        {
+          best_score = -1.0f;
+
+          for (i = next_scan; i < mesh->num_triangles; i++)
+            if (!added[i] && tri_score[i] > best_score)
+              {
+                best_score = tri_score[i];
+                best_tri = i;
+              }
+
+          while (next_scan < mesh->num_triangles && added[next_scan])
+            next_scan++;
+        }
+
+      order[n] = best_tri;
+      added[best_tri] = TRUE;
+      tri = mesh->triangles + best_tri * 3;
+
+      /* Move the triangle's corners to the front of the LRU list */
+      for (i = 0; i < 3; i++)
+        {
+          int corner = tri[i];
+
+          remaining[corner]--;
+
+          for (j = 0; j < lru_len && lru[j] != corner; j++)
+            ;
+          if (j == lru_len)
+            lru_len++;
+          memmove (lru + 1, lru, sizeof (int) * j);
+          lru[0] = corner;
+        }
+
+      /* Rescore everything in the cache and the triangles that use
+         it. The corners that fell out of the cache are rescored too */
+      for (i = 0; i < lru_len; i++)
+        {
+          int corner = lru[i];
+          int k;
+
+          cache_pos[corner] = i < cache_size ? i : -1;
+          vertex_score[corner] = forsyth_vertex_score (cache_pos[corner],
+                                                       remaining[corner]);
+
+          for (k = mesh->corner_tri_start[corner];
+               k < mesh->corner_tri_start[corner + 1];
+               k++)
+            {
+              int t = mesh->corner_tris[k];
+              const int *other = mesh->triangles + t * 3;
+
+              if (!added[t])
+                tri_score[t] = (vertex_score[other[0]]
+                                + vertex_score[other[1]]
+                                + vertex_score[other[2]]);
+            }
+        }
+
+      if (lru_len > lru_size)
+        lru_len = lru_size;
+
+      /* Pick the best triangle touching the cache for the next
+         iteration */
+      best_tri = -1;
+      best_score = -1.0f;
+
+      for (i = 0; i < lru_len; i++)
+        {
+          int k, corner = lru[i];
+
+          for (k = mesh->corner_tri_start[corner];
+               k < mesh->corner_tri_start[corner + 1];
+               k++)
+            {
+              int t = mesh->corner_tris[k];
+
+              if (!added[t] && tri_score[t] > best_score)
+                {
+                  best_score = tri_score[t];
+                  best_tri = t;
+                }
+            }
+        }
+    }
+
+  g_free (lru);
+  g_free (added);
+  g_free (tri_score);
+  g_free (vertex_score);
+  g_free (cache_pos);
+  g_free (remaining);
+
+  return order;
+}
+
+/* Finds an unused triangle that has the directed edge a->b. Returns
+   the triangle number or -1 and stores the third corner in c */
+static int
+find_neighbour (const Mesh *mesh, const int *stamp, const int *rank,
+                int a, int b, int *c)
+{
+  int best = -1, k;
+
+  for (k = mesh->corner_tri_start[a]; k < mesh->corner_tri_start[a + 1]; k++)
+    {
+      int t = mesh->corner_tris[k];
+      const int *tri = mesh->triangles + t * 3;
+      int i;
+
+      if (stamp[t])
+        continue;
+
+      for (i = 0; i < 3; i++)
+        if (tri[i] == a && tri[(i + 1) % 3] == b)
+          {
+            /* Prefer the triangle that comes first in the cache
+               order */
+            if (best == -1 || rank[t] < rank[best])
+              {
+                best = t;
+                *c = tri[(i + 2) % 3];
+              }
+            break;
+          }
+    }
+
+  return best;
+}
+
+/* Grows a strip starting with the given rotation of the triangle.
+   The triangles used are stamped with the given value and their
+   numbers are stored in used. Returns the length of the strip */
+static int
+build_strip (const Mesh *mesh, int *stamp, const int *rank,
+             int start_tri, int rotation, int stamp_value, GArray *strip,
+             GArray *used)
+{
+  const int *tri = mesh->triangles + start_tri * 3;
+  int n_tris = 1;
+
+  g_array_set_size (strip, 0);
+  g_array_append_val (strip, tri[rotation]);
+  g_array_append_val (strip, tri[(rotation + 1) % 3]);
+  g_array_append_val (strip, tri[(rotation + 2) % 3]);
+  g_array_set_size (used, 0);
+  g_array_append_val (used, start_tri);
+  stamp[start_tri] = stamp_value;
+
+  for (;;)
+    {
+      int last = g_array_index (strip, int, strip->len - 1);
+      int second_last = g_array_index (strip, int, strip->len - 2);
+      int next_tri, c;
+
+      /* Odd triangles in a strip are wound the other way */
+      if ((n_tris & 1))
+        next_tri = find_neighbour (mesh, stamp, rank, last, second_last, &c);
+      else
+        next_tri = find_neighbour (mesh, stamp, rank, second_last, last, &c);
+
+      if (next_tri == -1)
+        break;
+
+      stamp[next_tri] = stamp_value;
+      g_array_append_val (used, next_tri);
+      g_array_append_val (strip, c);
+      n_tris++;
+    }
+
+  return strip->len;
+}
+
+static void
+append_command (GArray *commands, const Mesh *mesh,
+                const int *corners, int n_corners)
+{
+  guint32 word;
+  int i;
+
+  word = GUINT32_TO_LE ((guint32) n_corners);
+  g_array_append_val (commands, word);
+
+  for (i = 0; i < n_corners; i++)
+    {
+      const Corner *corner = mesh->corners + corners[i];
+
+      word = GUINT32_TO_LE (corner->s);
+      g_array_append_val (commands, word);
+      word = GUINT32_TO_LE (corner->t);
+      g_array_append_val (commands, word);
+      word = GUINT32_TO_LE (corner->vertex_num);
+      g_array_append_val (commands, word);
+    }
+}
+
+/* Builds the new GL commands as an array of little-endian words. The
+   corner stream that will be submitted is stored in stream */
+static GArray *
+restrip (const Mesh *mesh, GArray *stream, Stats *stats)
+{
+  GArray *commands = g_array_new (FALSE, FALSE, sizeof (guint32));
+  GArray *strip = g_array_new (FALSE, FALSE, sizeof (int));
+  GArray *best_strip = g_array_new (FALSE, FALSE, sizeof (int));
+  GArray *joined = g_array_new (FALSE, FALSE, sizeof (int));
+  GArray *used = g_array_new (FALSE, FALSE, sizeof (int));
+  int *order = forsyth_order (mesh);
+  int *rank = g_new (int, MAX (mesh->num_triangles, 1));
+  /* 0 for unused triangles, -1 for triangles used in an emitted
+     strip and 1 for the trial strip */
+  int *stamp = g_new0 (int, MAX (mesh->num_triangles, 1));
+  guint32 terminator = 0;
+  int i, rotation;
+
+  memset (stats, 0, sizeof (Stats));
+
+  for (i = 0; i < mesh->num_triangles; i++)
+    rank[order[i]] = i;
+
+  for (i = 0; i < mesh->num_triangles; i++)
+    {
+      int start_tri = order[i], best_rotation = 0, best_len = 0, k;
+
+      if (stamp[start_tri])
+        continue;
+
+      /* Try each rotation of the starting triangle and keep the
+         longest strip */
+      for (rotation = 0; rotation < 3; rotation++)
+        {
+          int len = build_strip (mesh, stamp, rank, start_tri, rotation,
+                                 1, strip, used);
+
+          if (len > best_len)
+            {
+              best_len = len;
+              best_rotation = rotation;
+            }
+
+          /* Undo the trial stamps. Only the triangles in the strip
+             were touched so this doesn't need to scan the mesh */
+          for (k = 0; k < used->len; k++)
+            stamp[g_array_index (used, int, k)] = 0;
+        }
+
+      build_strip (mesh, stamp, rank, start_tri, best_rotation,
+                   -1, best_strip, used);
+
+      stats->triangles += best_strip->len - 2;
+
+      if (no_join)
+        {
+          append_command (commands, mesh,
+                          (int *) best_strip->data, best_strip->len);
+          g_array_append_vals (stream, best_strip->data, best_strip->len);
+          stats->draw_calls++;
+        }
+      else
+        {
+          /* Stitch the strip onto the previous one with degenerate
+             triangles. The first triangle of the new strip has to
+             start on an even vertex so that it keeps its winding */
+          if (joined->len > 0)
+            {
+              int first = g_array_index (best_strip, int, 0);
+              int last = g_array_index (joined, int, joined->len - 1);
+
+              g_array_append_val (joined, last);
+              if ((joined->len & 1) == 0)
+                g_array_append_val (joined, first);
+              g_array_append_val (joined, first);
+            }
+
+          g_array_append_vals (joined, best_strip->data, best_strip->len);
+        }
+    }
+
+  if (!no_join && joined->len > 0)
+    {
+      append_command (commands, mesh, (int *) joined->data, joined->len);
+      g_array_append_vals (stream, joined->data, joined->len);
+      stats->draw_calls++;
+    }
+
+  g_array_append_val (commands, terminator);
+
+  stats->vertices = stream->len;
+
+  g_free (stamp);
+  g_free (rank);
+  g_free (order);
+  g_array_free (used, TRUE);
+  g_array_free (joined, TRUE);
+  g_array_free (best_strip, TRUE);
+  g_array_free (strip, TRUE);
+
+  return commands;
+}
+
+/* Reconstructs the corner stream for the original commands so that
+   the cache can be simulated */
+static void
+original_stream (const Mesh *mesh, const guchar *commands, GArray *stream)
+{
+  GHashTable *corner_table = g_hash_table_new (corner_hash, corner_equal);
+  const guchar *p = commands;
+  int i;
+
+  for (i = 0; i < mesh->num_corners; i++)
+    g_hash_table_insert (corner_table, mesh->corners + i,
+                         GINT_TO_POINTER (i));
+
+  for (;;)
+    {
+      gint32 command_len = (gint32) read_uint32 (p);
+
+      p += sizeof (gint32);
+
+      if (command_len == 0)
+        break;
+
+      /* The short commands were dropped when the mesh was loaded */
+      if (ABS (command_len) < 3)
+        {
+          p += ABS (command_len) * sizeof (guint32) * 3;
+          continue;
+        }
+
+      for (i = ABS (command_len); i > 0; i--)
+        {
+          Corner corner;
+          int index;
+
+          corner.s = read_uint32 (p);
+          corner.t = read_uint32 (p + sizeof (guint32));
+          corner.vertex_num = read_uint32 (p + sizeof (guint32) * 2);
+          p += sizeof (guint32) * 3;
+
+          index = GPOINTER_TO_INT (g_hash_table_lookup (corner_table,
+                                                        &corner));
+          g_array_append_val (stream, index);
+        }
+    }
+
+  g_hash_table_destroy (corner_table);
+}
+
+static gboolean
+check_section (gsize file_len, guint32 offset, gsize size)
+{
+  return offset <= file_len && size <= file_len - offset;
+}
+
+static void
+print_stats (const char *label, const Stats *stats)
+{
+  printf ("%-7s %6i draw calls, %7i vertices, %6i triangles, ACMR %.3f\n",
+          label, stats->draw_calls, stats->vertices, stats->triangles,
+          stats->acmr);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  gchar *contents = NULL;
+  gsize file_len;
+  guint32 header[HEADER_COUNT];
+  gsize section_sizes[4];
+  Mesh mesh;
+  Stats before, after;
+  GArray *stream = NULL, *commands = NULL;
+  GByteArray *output = NULL;
+  int ret = 1;
+  int i;
+
+  memset (&mesh, 0, sizeof (mesh));
+
+  context = g_option_context_new ("<input.md2> <output.md2> - "
+                                  "rebuild the GL commands of an MD2 file");
+  g_option_context_add_main_entries (context, options, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      g_option_context_free (context);
+      goto out;
+    }
+
+  g_option_context_free (context);
+
+  if (argc != 3)
+    {
+      fprintf (stderr, "usage: %s [options] <input.md2> <output.md2>\n",
+               argv[0]);
+      goto out;
+    }
+
+  if (cache_size < 4)
+    {
+      fprintf (stderr, "The cache size must be at least 4\n");
+      goto out;
+    }
+
+  if (!g_file_get_contents (argv[1], &contents, &file_len, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      goto out;
+    }
+
+  if (file_len < sizeof (header))
+    {
+      fprintf (stderr, "'%s' is too short\n", argv[1]);
+      goto out;
+    }
+  for (i = 0; i < HEADER_COUNT; i++)
+    header[i] = read_uint32 ((guchar *) contents + i * sizeof (guint32));
+
+  if (header[HEADER_MAGIC] != MD2_FORMAT_MAGIC
+      || header[HEADER_VERSION] != MD2_FORMAT_VERSION)
+    {
+      fprintf (stderr, "'%s' is not a version %i MD2 file\n",
+               argv[1], MD2_FORMAT_VERSION);
+      goto out;
+    }
+
+  /* Work out the size of every section so they can be copied
+     verbatim to the new file */
+  section_sizes[0] = (gsize) header[HEADER_NUM_SKINS] * MD2_SKIN_NAME_SIZE;
+  section_sizes[1] = ((gsize) header[HEADER_NUM_TEX_COORDS]
+                      * MD2_TEX_COORD_SIZE);
+  section_sizes[2] = ((gsize) header[HEADER_NUM_TRIANGLES]
+                      * MD2_TRIANGLE_SIZE);
+  section_sizes[3] = ((gsize) header[HEADER_NUM_FRAMES]
+                      * header[HEADER_FRAME_SIZE]);
+
+  for (i = 0; i < 4; i++)
+    if (!check_section (file_len, header[HEADER_OFFSET_SKINS + i],
+                        section_sizes[i]))
+      {
+        fprintf (stderr, "'%s' is invalid\n", argv[1]);
+        goto out;
+      }
+
+  if (!check_section (file_len, header[HEADER_OFFSET_GL_COMMANDS],
+                      (gsize) header[HEADER_NUM_GL_COMMANDS]
+                      * sizeof (guint32))
+      || !mesh_load (&mesh,
+                     (guchar *) contents + header[HEADER_OFFSET_GL_COMMANDS],
+                     (gsize) header[HEADER_NUM_GL_COMMANDS]
+                     * sizeof (guint32),
+                     header[HEADER_NUM_VERTICES],
+                     &before))
+    {
+      fprintf (stderr, "'%s' has invalid GL commands\n", argv[1]);
+      goto out;
+    }
+
+  stream = g_array_new (FALSE, FALSE, sizeof (int));
+  original_stream (&mesh,
+                   (guchar *) contents + header[HEADER_OFFSET_GL_COMMANDS],
+                   stream);
+  before.acmr = (simulate_cache ((int *) stream->data, stream->len,
+                                 mesh.num_corners)
+                 / (float) MAX (before.triangles, 1));
+
+  g_array_set_size (stream, 0);
+  commands = restrip (&mesh, stream, &after);
+  after.acmr = (simulate_cache ((int *) stream->data, stream->len,
+                                mesh.num_corners)
+                / (float) MAX (after.triangles, 1));
+
+  /* Write the sections back in the usual order with the new GL
+     commands */
+  output = g_byte_array_new ();
+  g_byte_array_set_size (output, sizeof (header));
+
+  for (i = 0; i < 4; i++)
+    {
+      header[HEADER_OFFSET_SKINS + i] = output->len;
+      g_byte_array_append (output, (guchar *) contents
+                           + read_uint32 ((guchar *) contents
+                                          + (HEADER_OFFSET_SKINS + i)
+                                          * sizeof (guint32)),
+                           section_sizes[i]);
+    }
+
+  header[HEADER_OFFSET_GL_COMMANDS] = output->len;
+  header[HEADER_NUM_GL_COMMANDS] = commands->len;
+  g_byte_array_append (output, (guchar *) commands->data,
+                       commands->len * sizeof (guint32));
+  header[HEADER_OFFSET_END] = output->len;
+
+  for (i = 0; i < HEADER_COUNT; i++)
+    write_uint32 (output->data + i * sizeof (guint32), header[i]);
+
+  if (!g_file_set_contents (argv[2], (gchar *) output->data, output->len,
+                            &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      goto out;
+    }
+
+  printf ("Simulated cache size: %i\n", cache_size);
+  print_stats ("Before:", &before);
+  print_stats ("After:", &after);
+
+  ret = 0;
+
+ out:
+  if (output)
+    g_byte_array_free (output, TRUE);
+  if (commands)
+    g_array_free (commands, TRUE);
+  if (stream)
+    g_array_free (stream, TRUE);
+  mesh_free (&mesh);
+  g_free (contents);
+  if (error)
+    g_error_free (error);
+
+  return ret;
+}